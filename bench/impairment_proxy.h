@@ -0,0 +1,248 @@
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// @brief Network impairments applied by ImpairmentProxy, 0 disables each.
+struct Impairments {
+    // Added one-way delay in both directions.
+    std::chrono::milliseconds delay{0};
+    // Bytes per second forwarded per direction and connection.
+    uint64_t bandwidth = 0;
+    // Every stall_every, the last stall_for of it forwards nothing.
+    std::chrono::milliseconds stall_every{0};
+    std::chrono::milliseconds stall_for{0};
+    // From this time on connections stay open but forward nothing, like
+    // a peer that vanished without closing (half-open connection).
+    std::chrono::milliseconds half_open_after{0};
+};
+
+// @class ImpairmentProxy
+// @brief Loopback TCP proxy that degrades the connections through it.
+//
+// Listens on an ephemeral 127.0.0.1 port and forwards every accepted
+// connection to the target. Each direction is read by one thread and
+// written by another. Reading stops while more than MaxBuffered bytes are
+// waiting, so a slow or stalled link pushes back on the sender as a real
+// network would. Stalls and half-open periods stop reading and writing
+// alike. Schedules are relative to start().
+class ImpairmentProxy {
+ public:
+    static constexpr size_t MaxBuffered = 256 * 1024;
+
+    ImpairmentProxy(std::string host, std::string port, Impairments impairments)
+        : _host(std::move(host)), _port(std::move(port)), _impairments(impairments) {}
+    ~ImpairmentProxy() { stop(); }
+    ImpairmentProxy(const ImpairmentProxy &) = delete;
+    ImpairmentProxy &operator=(const ImpairmentProxy &) = delete;
+
+    // @return Local port clients connect to, 0 on error.
+    uint16_t start() {
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (_listener == -1) return 0;
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(addr);
+        if (bind(_listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 || listen(_listener, SOMAXCONN) == -1 ||
+            getsockname(_listener, reinterpret_cast<sockaddr *>(&addr), &length) == -1) {
+            close(_listener);
+            _listener = -1;
+            return 0;
+        }
+        _started = std::chrono::steady_clock::now();
+        _acceptor = std::thread([this] { _accept_loop(); });
+        return ntohs(addr.sin_port);
+    }
+
+    // @brief Close all connections and join all threads.
+    void stop() {
+        if (_stopping.exchange(true)) return;
+        if (_listener != -1) shutdown(_listener, SHUT_RDWR);
+        if (_acceptor.joinable()) _acceptor.join();
+        if (_listener != -1) close(_listener);
+        _listener = -1;
+
+        std::lock_guard<std::mutex> lock(_links_mutex);
+        for (auto &link : _links) {
+            shutdown(link->client, SHUT_RDWR);
+            shutdown(link->server, SHUT_RDWR);
+            for (Pipe *pipe : {&link->upstream, &link->downstream}) {
+                std::lock_guard<std::mutex> pipe_lock(pipe->mutex);
+                pipe->changed.notify_all();
+            }
+        }
+        for (auto &link : _links) {
+            for (auto &t : link->threads) t.join();
+            close(link->client);
+            close(link->server);
+        }
+        _links.clear();
+    }
+
+    uint64_t forwarded_bytes() const { return _forwarded.load(); }
+    uint64_t connections() const { return _connections.load(); }
+
+ private:
+    struct Chunk {
+        std::string data;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    // One direction of a connection.
+    struct Pipe {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Chunk> chunks;
+        size_t buffered = 0;
+        bool eof = false;
+    };
+
+    struct Link {
+        int client = -1;
+        int server = -1;
+        Pipe upstream;    // client -> server
+        Pipe downstream;  // server -> client
+        std::thread threads[4];
+    };
+
+    std::string _host;
+    std::string _port;
+    Impairments _impairments;
+    std::chrono::steady_clock::time_point _started;
+    int _listener = -1;
+    std::thread _acceptor;
+    std::atomic<bool> _stopping{false};
+    std::atomic<uint64_t> _forwarded{0};
+    std::atomic<uint64_t> _connections{0};
+    std::mutex _links_mutex;
+    std::list<std::unique_ptr<Link>> _links;
+
+    int _connect_target() const {
+        addrinfo hints{}, *res{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(_host.c_str(), _port.c_str(), &hints, &res) != 0) return -1;
+        int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (sock != -1 && connect(sock, res->ai_addr, res->ai_addrlen) == -1) {
+            close(sock);
+            sock = -1;
+        }
+        freeaddrinfo(res);
+        return sock;
+    }
+
+    void _accept_loop() {
+        while (!_stopping.load()) {
+            int client = accept(_listener, nullptr, nullptr);
+            if (client == -1) break;
+            int server = _connect_target();
+            if (server == -1) {
+                close(client);
+                continue;
+            }
+            auto link = std::make_unique<Link>();
+            link->client = client;
+            link->server = server;
+            Link &l = *link;
+            l.threads[0] = std::thread([this, &l] { _read(l.client, l.upstream); });
+            l.threads[1] = std::thread([this, &l] { _write(l.upstream, l.server); });
+            l.threads[2] = std::thread([this, &l] { _read(l.server, l.downstream); });
+            l.threads[3] = std::thread([this, &l] { _write(l.downstream, l.client); });
+            ++_connections;
+            std::lock_guard<std::mutex> lock(_links_mutex);
+            _links.push_back(std::move(link));
+        }
+    }
+
+    bool _impaired(std::chrono::steady_clock::time_point now) const {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _started);
+        if (_impairments.half_open_after.count() > 0 && elapsed >= _impairments.half_open_after) return true;
+        if (_impairments.stall_every.count() > 0 && _impairments.stall_for.count() > 0) {
+            return elapsed % _impairments.stall_every >= _impairments.stall_every - _impairments.stall_for;
+        }
+        return false;
+    }
+
+    // @brief Sleep while the link is stalled or half-open.
+    void _wait_until_passable() const {
+        while (!_stopping.load() && _impaired(std::chrono::steady_clock::now())) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    void _read(int from, Pipe &pipe) {
+        std::string buffer(16 * 1024, '\0');
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(pipe.mutex);
+                pipe.changed.wait(lock, [&] { return pipe.buffered < MaxBuffered || _stopping.load(); });
+            }
+            _wait_until_passable();
+            if (_stopping.load()) break;
+            ssize_t n = recv(from, buffer.data(), buffer.size(), 0);
+            if (n <= 0) break;
+            std::lock_guard<std::mutex> lock(pipe.mutex);
+            pipe.chunks.push_back({buffer.substr(0, static_cast<size_t>(n)), std::chrono::steady_clock::now() + _impairments.delay});
+            pipe.buffered += static_cast<size_t>(n);
+            pipe.changed.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(pipe.mutex);
+        pipe.eof = true;
+        pipe.changed.notify_all();
+    }
+
+    void _write(Pipe &pipe, int to) {
+        // Bandwidth cap: earliest time the next byte may leave.
+        auto next_send = std::chrono::steady_clock::now();
+        for (;;) {
+            Chunk chunk;
+            {
+                std::unique_lock<std::mutex> lock(pipe.mutex);
+                pipe.changed.wait(lock, [&] { return !pipe.chunks.empty() || pipe.eof || _stopping.load(); });
+                if (_stopping.load() || pipe.chunks.empty()) break;
+                chunk = std::move(pipe.chunks.front());
+                pipe.chunks.pop_front();
+            }
+            std::this_thread::sleep_until(chunk.due);
+
+            size_t offset = 0;
+            while (offset < chunk.data.size()) {
+                _wait_until_passable();
+                if (_stopping.load()) return;
+                size_t slice = chunk.data.size() - offset;
+                if (_impairments.bandwidth > 0) {
+                    // Small slices keep the cap smooth instead of bursty.
+                    slice = std::min<size_t>(slice, std::max<uint64_t>(1, _impairments.bandwidth / 100));
+                    std::this_thread::sleep_until(next_send);
+                    next_send = std::max(next_send, std::chrono::steady_clock::now()) +
+                                std::chrono::nanoseconds(slice * 1000000000ull / _impairments.bandwidth);
+                }
+                ssize_t sent = send(to, chunk.data.data() + offset, slice, MSG_NOSIGNAL);
+                if (sent <= 0) return;
+                offset += static_cast<size_t>(sent);
+                _forwarded += static_cast<uint64_t>(sent);
+            }
+
+            std::lock_guard<std::mutex> lock(pipe.mutex);
+            pipe.buffered -= chunk.data.size();
+            pipe.changed.notify_all();
+        }
+        // Pass the end of stream on once everything before it was written.
+        if (!_stopping.load()) shutdown(to, SHUT_WR);
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// @class LatencyHistogram
+// @brief Log-linear latency histogram for the benchmark tools.
+//
+// Every power of two of nanoseconds is split into 16 sub-buckets, so any
+// percentile is reported with at most ~6% relative error, with fixed memory
+// and no allocation per recorded value. Not thread-safe, every thread keeps
+// its own histogram and they are merged at the end.
+class LatencyHistogram {
+ public:
+    static constexpr unsigned SubBucketBits = 4;
+    static constexpr size_t SubBuckets = size_t{1} << SubBucketBits;
+    static constexpr size_t BucketCount = (64 - SubBucketBits + 1) * SubBuckets;
+
+    void record(uint64_t ns) {
+        ++_counts[_bucket_of(ns)];
+        ++_count;
+        _sum += ns;
+        _max = std::max(_max, ns);
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < BucketCount; ++i) _counts[i] += other._counts[i];
+        _count += other._count;
+        _sum += other._sum;
+        _max = std::max(_max, other._max);
+    }
+
+    uint64_t count() const { return _count; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _count == 0 ? 0.0 : static_cast<double>(_sum) / static_cast<double>(_count); }
+
+    // @brief Value at quantile q in [0, 1], upper bound of its bucket (never above max).
+    uint64_t percentile(double q) const {
+        if (_count == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(_count));
+        if (rank >= _count) rank = _count - 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i) {
+            seen += _counts[i];
+            if (seen > rank) return std::min(_bucket_upper(i), _max);
+        }
+        return _max;
+    }
+
+ private:
+    std::array<uint64_t, BucketCount> _counts{};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+    uint64_t _max = 0;
+
+    static size_t _bucket_of(uint64_t ns) {
+        if (ns < SubBuckets) return static_cast<size_t>(ns);
+        unsigned magnitude = 63 - static_cast<unsigned>(std::countl_zero(ns));
+        unsigned shift = magnitude - SubBucketBits;
+        return static_cast<size_t>(shift + 1) * SubBuckets + static_cast<size_t>((ns >> shift) & (SubBuckets - 1));
+    }
+
+    static uint64_t _bucket_upper(size_t bucket) {
+        if (bucket < SubBuckets) return bucket;
+        unsigned shift = static_cast<unsigned>(bucket / SubBuckets) - 1;
+        uint64_t lower = (uint64_t{SubBuckets} + bucket % SubBuckets) << shift;
+        return lower + ((uint64_t{1} << shift) - 1);
+    }
+};
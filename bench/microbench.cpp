@@ -0,0 +1,325 @@
+// Microbenchmarks of protocol and broker hot paths.
+//
+// Runs in process, without a server: broker functions are linked from
+// server_core, work on a BrokerState of their own and talk to socketpairs
+// that a drain thread empties, so only
+// the framing, packing and fan-out code (and the send syscalls it makes)
+// is timed. Round trips go through an embedded Broker over its loopback
+// transport, without the TCP stack.
+//
+// Usage: mq_microbench [--filter <substring>] [--repetitions <n>]
+//                      [--min-time-ms <ms>] [--cpu <n>] [--json <file>] [--list]
+
+#include "microbench.h"
+
+#include "MessageQueueClient.h"
+
+#include "broker.h"
+#include "common.h"
+#include "logger.h"
+#include "message_operations.h"
+#include "protocol_handler.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// ------------------------------
+// FIXTURES
+// ------------------------------
+
+// Drained sockets of fan-out subscribers, larger fan-outs share them.
+constexpr size_t FANOUT_SOCKETS = 64;
+
+// Socketpairs whose far ends are read and discarded by a background thread,
+// so broker sends never block on a full socket buffer.
+class DrainedSockets {
+ public:
+    explicit DrainedSockets(size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                std::perror("socketpair");
+                std::exit(1);
+            }
+            int buffer = 1 << 20;
+            setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+            _near.push_back(std::make_shared<Connection>(fds[0]));
+            _far.push_back(fds[1]);
+        }
+        _drain = std::thread([this] { _run(); });
+    }
+
+    ~DrainedSockets() {
+        _stop = true;
+        _drain.join();
+        for (int fd : _far) close(fd);
+    }
+
+    DrainedSockets(const DrainedSockets &) = delete;
+    DrainedSockets &operator=(const DrainedSockets &) = delete;
+
+    const std::shared_ptr<Connection> &connection(size_t index) const { return _near[index]; }
+
+ private:
+    std::vector<std::shared_ptr<Connection>> _near;  // closed when the broker clients let go too
+    std::vector<int> _far;
+    std::atomic<bool> _stop{false};
+    std::thread _drain;
+
+    void _run() {
+        std::vector<pollfd> fds;
+        for (int fd : _far) fds.push_back({fd, POLLIN, 0});
+        std::vector<char> buffer(1 << 16);
+        while (!_stop) {
+            if (poll(fds.data(), fds.size(), 50) <= 0) continue;
+            for (const pollfd &p : fds) {
+                if (p.revents & POLLIN) {
+                    ssize_t ignored = recv(p.fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+                    (void)ignored;
+                }
+            }
+        }
+    }
+};
+
+// Client logged in over a socketpair, the benchmark writes server frames to the far end.
+class AttachedClient {
+ public:
+    MessageQueueClient client{"bench"};
+
+    AttachedClient() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            std::perror("socketpair");
+            std::exit(1);
+        }
+        _far = fds[1];
+        //login reply is waiting before the client asks, its LO is never read
+        write(prepare_message(message_type::LOGIN, "OK:LOGGED"));
+        if (!client.attach_socket(fds[0])) {
+            std::cerr << "Can not attach client\n";
+            std::exit(1);
+        }
+    }
+
+    ~AttachedClient() {
+        client.disconnect();
+        close(_far);
+    }
+
+    AttachedClient(const AttachedClient &) = delete;
+    AttachedClient &operator=(const AttachedClient &) = delete;
+
+    void write(const std::string &frame) {
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            ssize_t n = send(_far, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) std::exit(1);
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+ private:
+    int _far = -1;
+};
+
+// Registers a broker client that writes to the given connection.
+static Client add_client(BrokerState &state, const std::string &id, const std::shared_ptr<Connection> &connection) {
+    Client client;
+    client.id = id;
+    client.connection = connection;
+    MeteredLock lock(state.clients_mutex);
+    state.clients[id] = client;
+    return client;
+}
+
+// Creates a queue without notifying anyone, as create_queue does under the lock.
+static void add_queue(BrokerState &state, const std::string &name) {
+    Queue queue;
+    queue.name = name;
+    MeteredLock lock(state.queues_mutex);
+    Queue &stored = state.existing_queues[name] = queue;
+    assign_queue_handle(state, stored);
+}
+
+static void clear_queue_messages(BrokerState &state, const std::string &name) {
+    MeteredLock lock(state.queues_mutex);
+    Queue &queue = state.existing_queues[name];
+    queue.messages.clear();
+    queue.retained_bytes = 0;
+    queue.expiry = {};
+    queue.live_messages = 0;
+    queue.live_bytes = 0;
+    queue.oldest_live = 0;
+}
+
+// Legacy publish payload as the server receives it: [queue_name_size(4b)][ttl(4b)][queue_name][message]
+static std::string publish_payload(const std::string &queue_name, const std::string &message) {
+    std::string payload;
+    uint32_t name_size = htonl(static_cast<uint32_t>(queue_name.size()));
+    uint32_t ttl = htonl(3600);
+    payload.append(reinterpret_cast<const char *>(&name_size), 4);
+    payload.append(reinterpret_cast<const char *>(&ttl), 4);
+    payload += queue_name;
+    payload += message;
+    return payload;
+}
+
+// ------------------------------
+// BENCHMARKS
+// ------------------------------
+
+static void add_framing_benchmarks(Microbench &bench) {
+    for (size_t size : {size_t{64}, size_t{4096}}) {
+        for (bool compact : {false, true}) {
+            std::string payload(size, 'x');
+            bench.add("prepare_message/" + std::string(compact ? "compact/" : "legacy/") + std::to_string(size),
+                      [payload, compact](size_t iterations) {
+                          for (size_t i = 0; i < iterations; ++i) do_not_optimize(prepare_message(message_type::MESSAGE_MULTICAST, payload, compact));
+                      });
+        }
+    }
+
+    // Frames are written in batches and read back one per iteration, the
+    // batch write is a single send amortized over its frames.
+    for (bool compact : {false, true}) {
+        bench.add(std::string("recv_message/") + (compact ? "compact" : "legacy") + "/64", [compact](size_t iterations) {
+            constexpr size_t batch_frames = 256;
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) std::exit(1);
+            auto writer = std::make_shared<Connection>(fds[0]);
+            std::string batch;
+            for (size_t i = 0; i < batch_frames; ++i) batch += prepare_message(message_type::PUBLISH, std::string(64, 'x'), compact);
+            FrameReader reader;
+            reader.sock = fds[1];
+            reader.compact = compact;
+
+            size_t buffered = 0;
+            for (size_t i = 0; i < iterations; ++i) {
+                if (buffered == 0) {
+                    if (!send_message(writer, batch)) std::exit(1);
+                    buffered = batch_frames;
+                }
+                auto result = recv_message(reader);
+                do_not_optimize(result);
+                --buffered;
+            }
+            //drop frames of the last batch not read
+            for (; buffered > 0; --buffered) recv_message(reader);
+            close(fds[1]);
+        });
+    }
+}
+
+static void add_broker_benchmarks(Microbench &bench, BrokerState &state, DrainedSockets &sockets) {
+    constexpr size_t list_queues = 10000;
+    for (size_t i = 0; i < list_queues; ++i) add_queue(state, "list-queue-" + std::to_string(i));
+    for (bool compact : {false, true}) {
+        bench.add(std::string("construct_queue_list/") + (compact ? "compact" : "legacy") + "/10000", [&state, compact](size_t iterations) {
+            for (size_t i = 0; i < iterations; ++i) do_not_optimize(construct_queue_list(state, compact));
+        });
+    }
+
+    //backlog of a queue packed into MA frames for a new subscriber
+    constexpr size_t backlog_messages = 1000;
+    Client publisher = add_client(state, "bench-publisher", sockets.connection(0));
+    Client late_subscriber = add_client(state, "bench-late-subscriber", sockets.connection(1));
+    add_queue(state, "backlog-queue");
+    for (size_t i = 0; i < backlog_messages; ++i) publish_message_to_queue(state, publisher, publish_payload("backlog-queue", std::string(64, 'x')));
+    bench.add("send_messages_to_new_subscriber/1000x64", [&state, late_subscriber](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) send_messages_to_new_subscriber(state, late_subscriber, "backlog-queue");
+    });
+
+    //fan-out of one publish to every subscriber, queue backlog dropped before each batch
+    //timed until the fan-out workers sent everything (see fanout.h), inline without workers
+    size_t next_subscriber = 0;
+    for (size_t fanout : {size_t{16}, size_t{256}}) {
+        std::string queue_name = "fanout-queue-" + std::to_string(fanout);
+        add_queue(state, queue_name);
+        {
+            MeteredLock lock(state.queues_mutex);
+            Queue &queue = state.existing_queues[queue_name];
+            for (size_t i = 0; i < fanout; ++i, ++next_subscriber) {
+                std::string id = "bench-subscriber-" + std::to_string(next_subscriber);
+                add_client(state, id, sockets.connection(2 + next_subscriber % FANOUT_SOCKETS));
+                queue.subscribers.push_back(id);
+            }
+        }
+        std::string payload = publish_payload(queue_name, std::string(64, 'x'));
+        bench.add("publish_message_to_queue/fanout" + std::to_string(fanout) + "/64", [&state, publisher, payload](size_t iterations) {
+            for (size_t i = 0; i < iterations; ++i) publish_message_to_queue(state, publisher, payload);
+            state.fanout.wait_idle();
+        }, [&state, queue_name] { clear_queue_messages(state, queue_name); });
+    }
+}
+
+static void add_client_benchmarks(Microbench &bench) {
+    //legacy MA payload: [queue_name_size(4b)][queue_name][message_size(4b)][message]...
+    std::string queue_name = "backlog-queue";
+    std::string payload;
+    uint32_t name_size = htonl(static_cast<uint32_t>(queue_name.size()));
+    payload.append(reinterpret_cast<const char *>(&name_size), 4);
+    payload += queue_name;
+    for (size_t i = 0; i < 1000; ++i) {
+        uint32_t message_size = htonl(64);
+        payload.append(reinterpret_cast<const char *>(&message_size), 4);
+        payload.append(64, 'x');
+    }
+    //client attached to a socketpair whose far end plays the server, timed from
+    //writing the MA frame until poll_event returns its messages
+    auto fixture = std::make_shared<AttachedClient>();
+    std::string frame = prepare_message(message_type::MESSAGE_TO_NEW_SUBSCRIBER, payload);
+    bench.add("MessageQueueClient/receive_MA/1000x64", [fixture, frame](size_t iterations) {
+        Event ev;
+        for (size_t i = 0; i < iterations; ++i) {
+            fixture->write(frame);
+            while (!fixture->client.poll_event(ev) || ev.type() != Event::Type::BatchMessages) {}
+            do_not_optimize(ev);
+        }
+    });
+}
+
+// Publish acknowledged by an embedded broker, client attached over the loopback transport.
+static void add_loopback_benchmarks(Microbench &bench, Broker &broker, LoopbackTransport &loopback, MessageQueueClient &client) {
+    if (!client.attach_socket(loopback.connect()) || !client.create_queue_async("loopback-queue").wait().ok) {
+        std::cerr << "Can not reach embedded broker\n";
+        std::exit(1);
+    }
+    std::string content(64, 'x');
+    bench.add("broker_loopback/publish_ack/64", [&client, content](size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            if (!client.publish_async("loopback-queue", content, 3600).wait().ok) std::exit(1);
+        }
+    }, [&broker] { clear_queue_messages(broker.broker_state(), "loopback-queue"); });
+}
+
+int main(int argc, char **argv) {
+    //per message INFO lines would dominate the broker benchmarks
+    logger_start(log_level::WARN);
+
+    DrainedSockets sockets(2 + FANOUT_SOCKETS);
+    BrokerState state;  // broker functions run on it directly, no Broker threads
+    Microbench bench;
+    add_framing_benchmarks(bench);
+    add_broker_benchmarks(bench, state, sockets);
+    add_client_benchmarks(bench);
+
+    Broker broker;
+    LoopbackTransport loopback;
+    broker.add_transport(loopback);
+    broker.start();
+    MessageQueueClient loopback_client("bench-loopback");
+    add_loopback_benchmarks(bench, broker, loopback, loopback_client);
+
+    int status = bench.run(argc, argv);
+    loopback_client.disconnect();
+    broker.request_stop();
+    broker.wait();
+    logger_stop();
+    return status;
+}
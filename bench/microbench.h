@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+// @brief Keep the compiler from removing a computation whose result is unused.
+template <typename T>
+inline void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// @class Microbench
+// @brief Minimal in-house benchmark harness.
+//
+// Every benchmark body runs a given number of iterations of the measured
+// code. The harness first grows the iteration count until one batch takes
+// at least --min-time-ms, then times --repetitions batches and reports the
+// median time per iteration with its median absolute deviation. The median
+// of many batches ignores outliers from preemption, so runs on a quiet
+// machine (ideally pinned with --cpu) repeat within about one percent.
+//
+// The optional reset callback runs untimed before every batch, e.g. to
+// drop state a body accumulates.
+class Microbench {
+ public:
+    using Body = std::function<void(size_t iterations)>;
+
+    struct Result {
+        std::string name;
+        size_t iterations = 0;   // per batch
+        double median_ns = 0;    // per iteration
+        double min_ns = 0;
+        double mad_ns = 0;       // median absolute deviation of batch times, per iteration
+    };
+
+    void add(std::string name, Body body, std::function<void()> reset = {}) {
+        _benchmarks.push_back({std::move(name), std::move(body), std::move(reset)});
+    }
+
+    // @brief Parse options, run matching benchmarks, print a table (and JSON if asked).
+    //
+    // @return Process exit code.
+    int run(int argc, char **argv) {
+        std::string filter;
+        std::string json;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--filter" && has_value) filter = argv[++i];
+            else if (arg == "--repetitions" && has_value) _repetitions = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+            else if (arg == "--min-time-ms" && has_value) _min_batch_ns = std::strtoull(argv[++i], nullptr, 10) * 1000000ull;
+            else if (arg == "--json" && has_value) json = argv[++i];
+            else if (arg == "--cpu" && has_value) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(std::atoi(argv[++i]), &set);
+                if (sched_setaffinity(0, sizeof(set), &set) != 0) std::cerr << "Can not pin to cpu " << argv[i] << "\n";
+            }
+            else if (arg == "--list") {
+                for (const auto &b : _benchmarks) std::cout << b.name << "\n";
+                return 0;
+            }
+            else {
+                std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--repetitions <n>] [--min-time-ms <ms>] [--cpu <n>] [--json <file>] [--list]\n";
+                return 1;
+            }
+        }
+
+        std::printf("%-52s %12s %14s %14s %8s\n", "benchmark", "iterations", "median ns/op", "min ns/op", "mad %");
+        std::vector<Result> results;
+        for (const auto &b : _benchmarks) {
+            if (!filter.empty() && b.name.find(filter) == std::string::npos) continue;
+            Result r = _measure(b);
+            std::printf("%-52s %12zu %14.1f %14.1f %8.2f\n", r.name.c_str(), r.iterations, r.median_ns, r.min_ns,
+                        r.median_ns > 0 ? 100.0 * r.mad_ns / r.median_ns : 0.0);
+            std::fflush(stdout);
+            results.push_back(r);
+        }
+        if (!json.empty() && !_write_json(json, results)) {
+            std::cerr << "Can not write " << json << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+ private:
+    struct Benchmark {
+        std::string name;
+        Body body;
+        std::function<void()> reset;
+    };
+
+    std::vector<Benchmark> _benchmarks;
+    size_t _repetitions = 15;
+    uint64_t _min_batch_ns = 20000000;
+
+    static uint64_t _time_batch(const Benchmark &b, size_t iterations) {
+        if (b.reset) b.reset();
+        auto start = std::chrono::steady_clock::now();
+        b.body(iterations);
+        auto end = std::chrono::steady_clock::now();
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    Result _measure(const Benchmark &b) const {
+        // Calibration doubles as warm-up of caches and allocator.
+        size_t iterations = 1;
+        for (;;) {
+            uint64_t elapsed = _time_batch(b, iterations);
+            if (elapsed >= _min_batch_ns) break;
+            // Aim a bit above the target, at most 10x growth per step.
+            double scale = elapsed == 0 ? 10.0 : std::min(10.0, 1.2 * static_cast<double>(_min_batch_ns) / static_cast<double>(elapsed));
+            iterations = std::max(iterations + 1, static_cast<size_t>(static_cast<double>(iterations) * scale));
+        }
+
+        std::vector<double> per_op;
+        for (size_t i = 0; i < _repetitions; ++i)
+            per_op.push_back(static_cast<double>(_time_batch(b, iterations)) / static_cast<double>(iterations));
+        std::sort(per_op.begin(), per_op.end());
+        double median = per_op[per_op.size() / 2];
+        std::vector<double> deviations;
+        for (double v : per_op) deviations.push_back(v > median ? v - median : median - v);
+        std::sort(deviations.begin(), deviations.end());
+
+        return {b.name, iterations, median, per_op.front(), deviations[deviations.size() / 2]};
+    }
+
+    static bool _write_json(const std::string &path, const std::vector<Result> &results) {
+        std::ofstream out(path);
+        out << "[\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result &r = results[i];
+            char line[256];
+            std::snprintf(line, sizeof(line), "  {\"name\": \"%s\", \"iterations\": %zu, \"median_ns\": %.3f, \"min_ns\": %.3f, \"mad_ns\": %.3f}%s\n",
+                          r.name.c_str(), r.iterations, r.median_ns, r.min_ns, r.mad_ns, i + 1 < results.size() ? "," : "");
+            out << line;
+        }
+        out << "]\n";
+        return static_cast<bool>(out);
+    }
+};
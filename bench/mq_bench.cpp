@@ -0,0 +1,430 @@
+// mq_bench - load generator for the message queue broker.
+//
+// Spawns publishers, subscribers and queues against a running server and
+// reports throughput and publish-to-receive latency as JSON.
+//
+// - Every message starts with the steady clock time it was due to be sent,
+// so latency covers client send, broker fan-out and client receive. In
+// open-loop mode (--rate) that is the scheduled time, which keeps a stalled
+// broker from hiding its own queueing delay (coordinated omission).
+//
+// - Closed-loop mode (default) keeps --inflight unacknowledged publishes
+// per publisher and sends the next one as soon as an acknowledgment arrives.
+//
+// - Messages published during --warmup are delivered but not measured.
+//
+// Publishers and subscribers run in this process, so their clocks agree.
+//
+// - With --impaired N the first N subscribers reach the server through a
+// local proxy that adds delay, caps bandwidth, stalls or goes half-open
+// (see impairment_proxy.h). Their latency is reported apart from the
+// healthy subscribers, which shows whether one degraded subscriber slows
+// down delivery to everybody else.
+
+#include "MessageQueueClient.h"
+#include "impairment_proxy.h"
+#include "latency_histogram.h"
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+constexpr size_t TIMESTAMP_SIZE = 8;
+
+struct BenchConfig {
+    std::string host = "127.0.0.1";
+    std::string port = "7000";
+    size_t publishers = 1;
+    size_t subscribers = 1;
+    size_t queues = 1;
+    // Subscribers of every queue.
+    size_t fanout = 1;
+    size_t message_size = 64;
+    uint32_t ttl = 1;
+    // Messages per second and publisher, 0 for closed loop.
+    double rate = 0;
+    size_t inflight = 64;
+    double duration = 10;
+    double warmup = 1;
+    bool compact = false;
+    bool compression = false;
+    bool chunking = false;
+    std::string output;
+    // Subscribers connected through the impairment proxy.
+    size_t impaired = 0;
+    Impairments impairments;
+};
+
+// Counters of one publisher, read after its thread finished.
+struct PublisherResult {
+    uint64_t published = 0;
+    uint64_t measured = 0;
+    uint64_t errors = 0;
+};
+
+// Counters and latencies of one subscriber, read after its thread finished.
+struct SubscriberResult {
+    uint64_t received = 0;
+    uint64_t received_bytes = 0;
+    LatencyHistogram latency;
+};
+
+static uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count());
+}
+
+static void print_usage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --host <addr>         server address (127.0.0.1)\n"
+              << "  --port <port>         server port (7000)\n"
+              << "  --publishers <n>      publisher connections (1)\n"
+              << "  --subscribers <n>     subscriber connections (1)\n"
+              << "  --queues <n>          queues, publishers spread over them (1)\n"
+              << "  --fanout <n>          subscribers of every queue, at most --subscribers (1)\n"
+              << "  --size <bytes>        message size, at least 8 (64)\n"
+              << "  --ttl <seconds>       message TTL (1)\n"
+              << "  --rate <msg/s>        open loop rate per publisher, 0 for closed loop (0)\n"
+              << "  --inflight <n>        unacknowledged publishes per publisher in closed loop (64)\n"
+              << "  --duration <seconds>  measured time (10)\n"
+              << "  --warmup <seconds>    unmeasured time before it (1)\n"
+              << "  --compact             request compact framing\n"
+              << "  --compression         request payload compression\n"
+              << "  --chunking            request chunked streaming\n"
+              << "  --output <file>       write JSON report to file instead of stdout\n"
+              << "  --impaired <n>        subscribers connected through the impairment proxy (0)\n"
+              << "  --delay-ms <ms>       proxy one-way delay (0)\n"
+              << "  --bandwidth <bytes/s> proxy bandwidth per direction and connection, 0 for no cap (0)\n"
+              << "  --stall-every <s>     proxy stall period, 0 for no stalls (0)\n"
+              << "  --stall-for <s>       proxy stall length within each period (0)\n"
+              << "  --half-open-after <s> proxy stops forwarding without closing, 0 never (0)\n";
+}
+
+static std::chrono::milliseconds seconds_to_ms(const char *text) {
+    return std::chrono::milliseconds(static_cast<int64_t>(std::strtod(text, nullptr) * 1e3));
+}
+
+static bool parse_args(int argc, char **argv, BenchConfig &config) {
+    enum { Host = 1, Port, Publishers, Subscribers, Queues, Fanout, Size, Ttl, Rate, Inflight, Duration, Warmup, Compact, Compression, Chunking, Output, Impaired, DelayMs, Bandwidth, StallEvery, StallFor, HalfOpenAfter, Help };
+    static const option options[] = {
+        {"host", required_argument, nullptr, Host},
+        {"port", required_argument, nullptr, Port},
+        {"publishers", required_argument, nullptr, Publishers},
+        {"subscribers", required_argument, nullptr, Subscribers},
+        {"queues", required_argument, nullptr, Queues},
+        {"fanout", required_argument, nullptr, Fanout},
+        {"size", required_argument, nullptr, Size},
+        {"ttl", required_argument, nullptr, Ttl},
+        {"rate", required_argument, nullptr, Rate},
+        {"inflight", required_argument, nullptr, Inflight},
+        {"duration", required_argument, nullptr, Duration},
+        {"warmup", required_argument, nullptr, Warmup},
+        {"compact", no_argument, nullptr, Compact},
+        {"compression", no_argument, nullptr, Compression},
+        {"chunking", no_argument, nullptr, Chunking},
+        {"output", required_argument, nullptr, Output},
+        {"impaired", required_argument, nullptr, Impaired},
+        {"delay-ms", required_argument, nullptr, DelayMs},
+        {"bandwidth", required_argument, nullptr, Bandwidth},
+        {"stall-every", required_argument, nullptr, StallEvery},
+        {"stall-for", required_argument, nullptr, StallFor},
+        {"half-open-after", required_argument, nullptr, HalfOpenAfter},
+        {"help", no_argument, nullptr, Help},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+            case Host: config.host = optarg; break;
+            case Port: config.port = optarg; break;
+            case Publishers: config.publishers = std::strtoul(optarg, nullptr, 10); break;
+            case Subscribers: config.subscribers = std::strtoul(optarg, nullptr, 10); break;
+            case Queues: config.queues = std::strtoul(optarg, nullptr, 10); break;
+            case Fanout: config.fanout = std::strtoul(optarg, nullptr, 10); break;
+            case Size: config.message_size = std::strtoul(optarg, nullptr, 10); break;
+            case Ttl: config.ttl = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break;
+            case Rate: config.rate = std::strtod(optarg, nullptr); break;
+            case Inflight: config.inflight = std::strtoul(optarg, nullptr, 10); break;
+            case Duration: config.duration = std::strtod(optarg, nullptr); break;
+            case Warmup: config.warmup = std::strtod(optarg, nullptr); break;
+            case Compact: config.compact = true; break;
+            case Compression: config.compression = true; break;
+            case Chunking: config.chunking = true; break;
+            case Output: config.output = optarg; break;
+            case Impaired: config.impaired = std::strtoul(optarg, nullptr, 10); break;
+            case DelayMs: config.impairments.delay = std::chrono::milliseconds(std::strtoul(optarg, nullptr, 10)); break;
+            case Bandwidth: config.impairments.bandwidth = std::strtoull(optarg, nullptr, 10); break;
+            case StallEvery: config.impairments.stall_every = seconds_to_ms(optarg); break;
+            case StallFor: config.impairments.stall_for = seconds_to_ms(optarg); break;
+            case HalfOpenAfter: config.impairments.half_open_after = seconds_to_ms(optarg); break;
+            default: return false;
+        }
+    }
+    if (optind != argc || config.publishers == 0 || config.queues == 0 || config.message_size < TIMESTAMP_SIZE ||
+        config.inflight == 0 || config.duration <= 0 || config.warmup < 0 || config.rate < 0) {
+        return false;
+    }
+    config.fanout = std::min(config.fanout, config.subscribers);
+    config.impaired = std::min(config.impaired, config.subscribers);
+    return true;
+}
+
+static void configure(MessageQueueClient &client, const BenchConfig &config) {
+    client.set_compact_framing(config.compact);
+    client.set_compression(config.compression);
+    client.set_chunking(config.chunking);
+}
+
+// @brief Receive until stop is set, measuring messages sent after measure_from.
+static void run_subscriber(MessageQueueClient &client, const std::atomic<bool> &stop, uint64_t measure_from, SubscriberResult &result) {
+    Event ev;
+    while (!stop.load()) {
+        if (!client.poll_event(ev)) continue;
+        if (ev.type() != Event::Type::Message) continue;
+        uint64_t received_at = now_ns();
+        const std::string &content = ev.text();
+        if (content.size() < TIMESTAMP_SIZE) continue;
+        uint64_t sent_at;
+        std::memcpy(&sent_at, content.data(), TIMESTAMP_SIZE);
+        if (sent_at < measure_from) continue;
+        ++result.received;
+        result.received_bytes += content.size();
+        result.latency.record(received_at > sent_at ? received_at - sent_at : 0);
+    }
+}
+
+// @brief Publish until end, open loop if a rate is set, closed loop otherwise.
+static void run_publisher(MessageQueueClient &client, const BenchConfig &config, const std::vector<std::string> &queues, size_t index,
+                          uint64_t measure_from, uint64_t end, PublisherResult &result) {
+    std::string message(config.message_size, 'x');
+    std::deque<AsyncOperation> pending;
+    // Collect acknowledgments, waiting for up to limit of them if block is set.
+    auto reap = [&](bool block, size_t limit) {
+        while (!pending.empty() && ((block && limit > 0) || pending.front().await_ready())) {
+            if (!pending.front().wait().ok) ++result.errors;
+            pending.pop_front();
+            if (limit > 0) --limit;
+        }
+    };
+
+    uint64_t interval = config.rate > 0 ? static_cast<uint64_t>(1e9 / config.rate) : 0;
+    uint64_t due = now_ns();
+    size_t queue = index % queues.size();
+    for (;;) {
+        uint64_t now = now_ns();
+        if (interval != 0) {
+            if (due > now) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(due - now));
+                now = now_ns();
+            }
+        } else {
+            due = now;
+            if (pending.size() >= config.inflight) {
+                reap(true, 1);
+                due = now = now_ns();
+            }
+        }
+        if (now >= end) break;
+
+        // Open loop stamps the scheduled time, so late sends count as latency.
+        std::memcpy(message.data(), &due, TIMESTAMP_SIZE);
+        pending.push_back(client.publish_async(queues[queue], message, config.ttl));
+        ++result.published;
+        if (due >= measure_from) ++result.measured;
+        queue = (queue + 1) % queues.size();
+        due += interval;
+        reap(false, 0);
+    }
+    reap(true, pending.size());
+}
+
+static std::string json_number(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3f", value);
+    return buf;
+}
+
+static std::string latency_json(const LatencyHistogram &latency) {
+    auto us = [](uint64_t ns) { return json_number(static_cast<double>(ns) / 1e3); };
+    return "{\"count\": " + std::to_string(latency.count()) + ", \"mean\": " + json_number(latency.mean() / 1e3) +
+           ", \"p50\": " + us(latency.percentile(0.5)) + ", \"p90\": " + us(latency.percentile(0.9)) +
+           ", \"p99\": " + us(latency.percentile(0.99)) + ", \"p99.9\": " + us(latency.percentile(0.999)) +
+           ", \"max\": " + us(latency.max()) + "}";
+}
+
+// @brief Received count and latency of subscribers [from, to).
+static std::string group_json(const std::vector<SubscriberResult> &subscribers, size_t from, size_t to) {
+    LatencyHistogram latency;
+    uint64_t received = 0;
+    for (size_t i = from; i < to; ++i) {
+        latency.merge(subscribers[i].latency);
+        received += subscribers[i].received;
+    }
+    return "{\"subscribers\": " + std::to_string(to - from) + ", \"received\": " + std::to_string(received) +
+           ", \"latency_us\": " + latency_json(latency) + "}";
+}
+
+static std::string build_report(const BenchConfig &config, const std::vector<PublisherResult> &publishers,
+                                const std::vector<SubscriberResult> &subscribers, const ImpairmentProxy *proxy) {
+    PublisherResult published;
+    for (const auto &p : publishers) {
+        published.published += p.published;
+        published.measured += p.measured;
+        published.errors += p.errors;
+    }
+    LatencyHistogram latency;
+    uint64_t received = 0;
+    uint64_t received_bytes = 0;
+    for (const auto &s : subscribers) {
+        latency.merge(s.latency);
+        received += s.received;
+        received_bytes += s.received_bytes;
+    }
+    std::ostringstream out;
+    out << "{\n"
+        << "  \"config\": {\"publishers\": " << config.publishers << ", \"subscribers\": " << config.subscribers
+        << ", \"queues\": " << config.queues << ", \"fanout\": " << config.fanout << ", \"message_size\": " << config.message_size
+        << ", \"ttl\": " << config.ttl << ", \"mode\": \"" << (config.rate > 0 ? "open" : "closed") << "\""
+        << ", \"rate\": " << json_number(config.rate) << ", \"inflight\": " << config.inflight
+        << ", \"duration_s\": " << json_number(config.duration) << ", \"warmup_s\": " << json_number(config.warmup)
+        << ", \"compact\": " << (config.compact ? "true" : "false") << ", \"compression\": " << (config.compression ? "true" : "false")
+        << ", \"chunking\": " << (config.chunking ? "true" : "false") << ", \"impaired\": " << config.impaired
+        << ", \"delay_ms\": " << config.impairments.delay.count() << ", \"bandwidth\": " << config.impairments.bandwidth
+        << ", \"stall_every_ms\": " << config.impairments.stall_every.count() << ", \"stall_for_ms\": " << config.impairments.stall_for.count()
+        << ", \"half_open_after_ms\": " << config.impairments.half_open_after.count() << "},\n"
+        << "  \"published\": " << published.measured << ",\n"
+        << "  \"publish_errors\": " << published.errors << ",\n"
+        << "  \"expected\": " << published.measured * config.fanout << ",\n"
+        << "  \"received\": " << received << ",\n"
+        << "  \"publish_rate\": " << json_number(static_cast<double>(published.measured) / config.duration) << ",\n"
+        << "  \"receive_rate\": " << json_number(static_cast<double>(received) / config.duration) << ",\n"
+        << "  \"receive_mb_per_s\": " << json_number(static_cast<double>(received_bytes) / config.duration / 1e6) << ",\n"
+        << "  \"latency_us\": " << latency_json(latency);
+    if (proxy != nullptr) {
+        out << ",\n  \"impaired\": " << group_json(subscribers, 0, config.impaired)
+            << ",\n  \"healthy\": " << group_json(subscribers, config.impaired, subscribers.size())
+            << ",\n  \"proxy\": {\"connections\": " << proxy->connections() << ", \"forwarded_bytes\": " << proxy->forwarded_bytes() << "}";
+    }
+    out << "\n}\n";
+    return out.str();
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config;
+    if (!parse_args(argc, argv, config)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Names unique per run, so concurrent or aborted runs do not collide.
+    std::string prefix = "bench-" + std::to_string(getpid()) + "-";
+    std::vector<std::string> queues;
+    for (size_t i = 0; i < config.queues; ++i) queues.push_back(prefix + "q" + std::to_string(i));
+
+    MessageQueueClient admin(prefix + "admin");
+    configure(admin, config);
+    if (!admin.connect_to_server(config.host, config.port)) {
+        std::cerr << "Can not connect to " << config.host << ":" << config.port << "\n";
+        return 1;
+    }
+    for (const auto &queue : queues) {
+        if (!admin.create_queue_async(queue).wait().ok) {
+            std::cerr << "Can not create queue " << queue << "\n";
+            return 1;
+        }
+    }
+
+    // Impaired subscribers connect to the proxy, which forwards to the server.
+    std::unique_ptr<ImpairmentProxy> proxy;
+    std::string proxy_port;
+    if (config.impaired > 0) {
+        proxy = std::make_unique<ImpairmentProxy>(config.host, config.port, config.impairments);
+        uint16_t port = proxy->start();
+        if (port == 0) {
+            std::cerr << "Can not start impairment proxy\n";
+            return 1;
+        }
+        proxy_port = std::to_string(port);
+    }
+
+    std::vector<std::unique_ptr<MessageQueueClient>> publishers;
+    std::vector<std::unique_ptr<MessageQueueClient>> subscribers;
+    for (size_t i = 0; i < config.publishers; ++i) publishers.push_back(std::make_unique<MessageQueueClient>(prefix + "pub" + std::to_string(i)));
+    for (size_t i = 0; i < config.subscribers; ++i) subscribers.push_back(std::make_unique<MessageQueueClient>(prefix + "sub" + std::to_string(i)));
+    for (auto *group : {&publishers, &subscribers}) {
+        for (size_t i = 0; i < group->size(); ++i) {
+            MessageQueueClient &client = *(*group)[i];
+            bool impaired = group == &subscribers && i < config.impaired;
+            std::string host = impaired ? "127.0.0.1" : config.host;
+            std::string port = impaired ? proxy_port : config.port;
+            configure(client, config);
+            if (!client.connect_to_server(host, port)) {
+                std::cerr << "Can not connect to " << host << ":" << port << "\n";
+                return 1;
+            }
+        }
+    }
+
+    // Queue q is subscribed by subscribers q, q+1, ... q+fanout-1 (mod subscribers).
+    for (size_t q = 0; q < queues.size(); ++q) {
+        for (size_t k = 0; k < config.fanout; ++k) {
+            if (!subscribers[(q + k) % config.subscribers]->subscribe_async(queues[q]).wait().ok) {
+                std::cerr << "Can not subscribe to " << queues[q] << "\n";
+                return 1;
+            }
+        }
+    }
+
+    uint64_t start = now_ns();
+    uint64_t measure_from = start + static_cast<uint64_t>(config.warmup * 1e9);
+    uint64_t end = measure_from + static_cast<uint64_t>(config.duration * 1e9);
+
+    std::atomic<bool> stop_subscribers{false};
+    std::vector<PublisherResult> publisher_results(config.publishers);
+    std::vector<SubscriberResult> subscriber_results(config.subscribers);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.subscribers; ++i)
+        threads.emplace_back(run_subscriber, std::ref(*subscribers[i]), std::cref(stop_subscribers), measure_from, std::ref(subscriber_results[i]));
+    std::vector<std::thread> publisher_threads;
+    for (size_t i = 0; i < config.publishers; ++i)
+        publisher_threads.emplace_back(run_publisher, std::ref(*publishers[i]), std::cref(config), std::cref(queues), i, measure_from, end, std::ref(publisher_results[i]));
+    for (auto &t : publisher_threads) t.join();
+
+    // Deliveries still in flight arrive shortly after the last acknowledgment.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    stop_subscribers.store(true);
+    for (auto &t : threads) t.join();
+    // Releases broker sends blocked on a stalled or half-open subscriber.
+    if (proxy) proxy->stop();
+
+    for (const auto &queue : queues) admin.delete_queue_async(queue).wait();
+    for (auto &client : publishers) client->disconnect();
+    for (auto &client : subscribers) client->disconnect();
+    admin.disconnect();
+
+    std::string report = build_report(config, publisher_results, subscriber_results, proxy.get());
+    if (config.output.empty()) {
+        std::cout << report;
+    } else {
+        std::ofstream file(config.output);
+        if (!(file << report)) {
+            std::cerr << "Can not write " << config.output << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
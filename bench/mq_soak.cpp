@@ -0,0 +1,393 @@
+// mq_soak - long-running churn test that tracks broker memory growth.
+//
+// Runs an embedded broker (see broker.h) and drives it through the
+// loopback transport for --duration seconds:
+//
+// - sessions connect, subscribe, receive for a while and disconnect, half
+// of them coming back under a login used before (session restore), half
+// under a new one (expires after SECONDS_TO_CLEAR_CLIENT),
+//
+// - a queue worker creates queues, publishes to them and deletes them,
+//
+// - publishers publish with a short TTL to long-lived queues, so messages
+// pile up between cleanup sweeps,
+//
+// - a subscriber keeps subscribing and unsubscribing those queues.
+//
+// Every --sample-interval seconds it records RSS, allocator statistics
+// (mallinfo2) and the sizes of the broker containers, written as JSON lines
+// to --output. Samples after --settle seconds are split into two halves;
+// the run fails if the peak of the later half exceeds the peak of the
+// earlier one by more than --max-growth (plus a small absolute slack),
+// i.e. if memory does not plateau. Clients run in the same process, so
+// RSS and heap cover them too; container sizes are broker only.
+
+#include "MessageQueueClient.h"
+
+#include "broker.h"
+#include "common.h"
+
+#include <getopt.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using soak_clock = std::chrono::steady_clock;
+
+struct SoakConfig {
+    double duration = 3600;
+    double settle = 120;
+    double sample_interval = 10;
+    size_t sessions = 4;
+    size_t publishers = 2;
+    size_t queues = 8;
+    double rate = 200;  // messages per second and publisher
+    uint32_t ttl = 2;
+    size_t message_size = 256;
+    double max_growth = 0.05;
+    std::string output;
+};
+
+// One observation of process and broker memory.
+struct Sample {
+    double elapsed = 0;
+    uint64_t rss_bytes = 0;
+    uint64_t heap_in_use = 0;      // mallinfo2 uordblks
+    uint64_t heap_reserved = 0;    // mallinfo2 arena + hblkhd
+    uint64_t clients = 0;
+    uint64_t connected_clients = 0;
+    uint64_t connections = 0;
+    uint64_t queues = 0;
+    uint64_t retained_messages = 0;
+    uint64_t retained_bytes = 0;
+};
+
+// Churn counters, reported at the end.
+struct SoakCounters {
+    std::atomic<uint64_t> sessions{0};
+    std::atomic<uint64_t> session_failures{0};
+    std::atomic<uint64_t> queues_created{0};
+    std::atomic<uint64_t> published{0};
+    std::atomic<uint64_t> publish_errors{0};
+    std::atomic<uint64_t> received{0};
+};
+
+static void print_usage(const char *program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --duration <seconds>         total run time (3600)\n"
+              << "  --settle <seconds>           time before samples are judged (120)\n"
+              << "  --sample-interval <seconds>  time between samples (10)\n"
+              << "  --sessions <n>               threads connecting and disconnecting (4)\n"
+              << "  --publishers <n>             long-lived publishers (2)\n"
+              << "  --queues <n>                 long-lived queues (8)\n"
+              << "  --rate <msg/s>               messages per second and publisher (200)\n"
+              << "  --ttl <seconds>              message TTL (2)\n"
+              << "  --size <bytes>               message size (256)\n"
+              << "  --max-growth <fraction>      allowed growth of later peaks over earlier ones (0.05)\n"
+              << "  --output <file>              write samples as JSON lines to file\n";
+}
+
+static bool parse_args(int argc, char **argv, SoakConfig &config) {
+    enum { Duration = 1, Settle, SampleInterval, Sessions, Publishers, Queues, Rate, Ttl, Size, MaxGrowth, Output, Help };
+    static const option options[] = {
+        {"duration", required_argument, nullptr, Duration},
+        {"settle", required_argument, nullptr, Settle},
+        {"sample-interval", required_argument, nullptr, SampleInterval},
+        {"sessions", required_argument, nullptr, Sessions},
+        {"publishers", required_argument, nullptr, Publishers},
+        {"queues", required_argument, nullptr, Queues},
+        {"rate", required_argument, nullptr, Rate},
+        {"ttl", required_argument, nullptr, Ttl},
+        {"size", required_argument, nullptr, Size},
+        {"max-growth", required_argument, nullptr, MaxGrowth},
+        {"output", required_argument, nullptr, Output},
+        {"help", no_argument, nullptr, Help},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, nullptr)) != -1) {
+        switch (opt) {
+            case Duration: config.duration = std::strtod(optarg, nullptr); break;
+            case Settle: config.settle = std::strtod(optarg, nullptr); break;
+            case SampleInterval: config.sample_interval = std::strtod(optarg, nullptr); break;
+            case Sessions: config.sessions = std::strtoul(optarg, nullptr, 10); break;
+            case Publishers: config.publishers = std::strtoul(optarg, nullptr, 10); break;
+            case Queues: config.queues = std::strtoul(optarg, nullptr, 10); break;
+            case Rate: config.rate = std::strtod(optarg, nullptr); break;
+            case Ttl: config.ttl = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 10)); break;
+            case Size: config.message_size = std::strtoul(optarg, nullptr, 10); break;
+            case MaxGrowth: config.max_growth = std::strtod(optarg, nullptr); break;
+            case Output: config.output = optarg; break;
+            default: return false;
+        }
+    }
+    if (optind != argc) return false;
+    if (config.queues == 0 || config.rate <= 0 || config.sample_interval <= 0 || config.message_size == 0) return false;
+    if (config.settle >= config.duration) {
+        std::cerr << "--settle must be shorter than --duration\n";
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------
+// SAMPLING
+// ------------------------------
+
+static uint64_t resident_bytes() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+static Sample take_sample(BrokerState &state, double elapsed) {
+    Sample s;
+    s.elapsed = elapsed;
+    s.rss_bytes = resident_bytes();
+    struct mallinfo2 heap = mallinfo2();
+    s.heap_in_use = heap.uordblks;
+    s.heap_reserved = heap.arena + heap.hblkhd;
+    {
+        MeteredLock lock(state.queues_mutex);
+        s.queues = state.existing_queues.size();
+        for (const auto &[name, queue] : state.existing_queues) {
+            s.retained_messages += queue.messages.size();
+            s.retained_bytes += queue.retained_bytes;
+        }
+    }
+    {
+        MeteredLock lock(state.clients_mutex);
+        s.clients = state.clients.size();
+        for (const auto &[id, client] : state.clients) {
+            if (client.connection) ++s.connected_clients;
+        }
+    }
+    s.connections = Connection::alive();
+    return s;
+}
+
+static std::string sample_json(const Sample &s) {
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "{\"elapsed_s\": %.1f, \"rss_bytes\": %llu, \"heap_in_use\": %llu, \"heap_reserved\": %llu, \"clients\": %llu, "
+                  "\"connected_clients\": %llu, \"connections\": %llu, \"queues\": %llu, \"retained_messages\": %llu, \"retained_bytes\": %llu}",
+                  s.elapsed, static_cast<unsigned long long>(s.rss_bytes), static_cast<unsigned long long>(s.heap_in_use),
+                  static_cast<unsigned long long>(s.heap_reserved), static_cast<unsigned long long>(s.clients),
+                  static_cast<unsigned long long>(s.connected_clients), static_cast<unsigned long long>(s.connections),
+                  static_cast<unsigned long long>(s.queues), static_cast<unsigned long long>(s.retained_messages),
+                  static_cast<unsigned long long>(s.retained_bytes));
+    return line;
+}
+
+// Compares the peak of the later half of judged samples with the earlier half.
+struct GrowthCheck {
+    const char *name;
+    uint64_t Sample::*field;
+    uint64_t slack;  // absolute growth always allowed
+};
+
+static const GrowthCheck GROWTH_CHECKS[] = {
+    {"rss_bytes", &Sample::rss_bytes, 4u << 20},
+    {"heap_in_use", &Sample::heap_in_use, 4u << 20},
+    {"clients", &Sample::clients, 16},
+    {"connections", &Sample::connections, 16},
+    {"queues", &Sample::queues, 4},
+    {"retained_messages", &Sample::retained_messages, 1000},
+};
+
+// @return true if every checked value plateaued.
+static bool judge(const std::vector<Sample> &samples, const SoakConfig &config) {
+    std::vector<const Sample *> judged;
+    for (const Sample &s : samples) {
+        if (s.elapsed >= config.settle) judged.push_back(&s);
+    }
+    if (judged.size() < 4) {
+        std::cerr << "Too few samples after --settle to judge growth, run longer or sample more often\n";
+        return false;
+    }
+    size_t half = judged.size() / 2;
+    bool ok = true;
+    for (const GrowthCheck &check : GROWTH_CHECKS) {
+        uint64_t early = 0, late = 0;
+        for (size_t i = 0; i < judged.size(); ++i) {
+            uint64_t value = judged[i]->*check.field;
+            uint64_t &peak = i < half ? early : late;
+            peak = std::max(peak, value);
+        }
+        double limit = static_cast<double>(early) * (1.0 + config.max_growth) + static_cast<double>(check.slack);
+        bool grew = static_cast<double>(late) > limit;
+        std::printf("%-18s early peak %12llu  late peak %12llu  %s\n", check.name, static_cast<unsigned long long>(early),
+                    static_cast<unsigned long long>(late), grew ? "GROWING" : "ok");
+        ok = ok && !grew;
+    }
+    return ok;
+}
+
+// ------------------------------
+// CHURN
+// ------------------------------
+
+// Takes and drops events, so client side queues stay short.
+static void drain_events(MessageQueueClient &client, SoakCounters &counters) {
+    Event ev;
+    while (client.poll_event(ev)) {
+        if (ev.type() == Event::Type::Message) ++counters.received;
+    }
+}
+
+static bool attach(MessageQueueClient &client, LoopbackTransport &loopback) {
+    int sock = loopback.connect();
+    return sock != -1 && client.attach_socket(sock);
+}
+
+static void run_sessions(size_t index, LoopbackTransport &loopback, const std::vector<std::string> &queues, const std::atomic<bool> &stop,
+                         SoakCounters &counters) {
+    std::minstd_rand rng(static_cast<unsigned>(index * 7919 + 1));
+    for (uint64_t cycle = 0; !stop.load(); ++cycle) {
+        //odd cycles restore one of few sessions, even ones leave a new session behind to expire
+        std::string login = cycle % 2 == 1 ? "soak-session-" + std::to_string(index) + "-" + std::to_string(rng() % 4)
+                                           : "soak-once-" + std::to_string(index) + "-" + std::to_string(cycle);
+        MessageQueueClient client(login);
+        if (!attach(client, loopback)) {
+            ++counters.session_failures;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        ++counters.sessions;
+        client.subscribe_async(queues[rng() % queues.size()]).wait();
+        auto until = soak_clock::now() + std::chrono::milliseconds(200 + rng() % 800);
+        while (soak_clock::now() < until && !stop.load()) drain_events(client, counters);
+        client.disconnect();
+    }
+}
+
+static void run_queue_churn(LoopbackTransport &loopback, const SoakConfig &config, const std::atomic<bool> &stop, SoakCounters &counters) {
+    MessageQueueClient client("soak-queue-churn");
+    if (!attach(client, loopback)) return;
+    std::string message(config.message_size, 'q');
+    for (uint64_t n = 0; !stop.load(); ++n) {
+        std::string name = "soak-temp-" + std::to_string(n);
+        if (client.create_queue_async(name).wait().ok) ++counters.queues_created;
+        client.subscribe_async(name).wait();
+        for (int i = 0; i < 10; ++i) client.publish_async(name, message, config.ttl).wait();
+        client.delete_queue_async(name).wait();
+        drain_events(client, counters);
+    }
+    client.disconnect();
+}
+
+static void run_publisher(size_t index, LoopbackTransport &loopback, const SoakConfig &config, const std::vector<std::string> &queues,
+                          const std::atomic<bool> &stop, SoakCounters &counters) {
+    MessageQueueClient client("soak-publisher-" + std::to_string(index));
+    if (!attach(client, loopback)) return;
+    std::string message(config.message_size, 'p');
+    auto interval = std::chrono::duration_cast<soak_clock::duration>(std::chrono::duration<double>(1.0 / config.rate));
+    auto due = soak_clock::now();
+    for (size_t n = index; !stop.load(); ++n) {
+        std::this_thread::sleep_until(due);
+        due += interval;
+        if (client.publish_async(queues[n % queues.size()], message, config.ttl).wait().ok) ++counters.published;
+        else ++counters.publish_errors;
+        //queue lists of the churn worker arrive as events
+        if (n % 64 == 0) {
+            Event ev;
+            while (client.poll_event(ev)) {}
+        }
+    }
+    client.disconnect();
+}
+
+static void run_toggling_subscriber(LoopbackTransport &loopback, const std::vector<std::string> &queues, const std::atomic<bool> &stop,
+                                    SoakCounters &counters) {
+    MessageQueueClient client("soak-subscriber");
+    if (!attach(client, loopback)) return;
+    for (size_t n = 0; !stop.load(); ++n) {
+        const std::string &queue = queues[n % queues.size()];
+        client.subscribe_async(queue).wait();
+        drain_events(client, counters);
+        client.unsubscribe_async(queue).wait();
+    }
+    client.disconnect();
+}
+
+int main(int argc, char **argv) {
+    SoakConfig config;
+    if (!parse_args(argc, argv, config)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::ofstream output;
+    if (!config.output.empty()) {
+        output.open(config.output);
+        if (!output) {
+            std::cerr << "Can not write " << config.output << "\n";
+            return 1;
+        }
+    }
+
+    //per connection INFO lines would be most of the run's output
+    logger_start(log_level::WARN);
+    Broker broker;
+    LoopbackTransport loopback;
+    broker.add_transport(loopback);
+    if (!broker.start()) return 1;
+
+    std::vector<std::string> queues;
+    {
+        MessageQueueClient admin("soak-admin");
+        if (!attach(admin, loopback)) return 1;
+        for (size_t i = 0; i < config.queues; ++i) {
+            queues.push_back("soak-queue-" + std::to_string(i));
+            admin.create_queue_async(queues.back()).wait();
+        }
+        admin.disconnect();
+    }
+
+    std::atomic<bool> stop{false};
+    SoakCounters counters;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.sessions; ++i) threads.emplace_back(run_sessions, i, std::ref(loopback), std::cref(queues), std::cref(stop), std::ref(counters));
+    for (size_t i = 0; i < config.publishers; ++i)
+        threads.emplace_back(run_publisher, i, std::ref(loopback), std::cref(config), std::cref(queues), std::cref(stop), std::ref(counters));
+    threads.emplace_back(run_queue_churn, std::ref(loopback), std::cref(config), std::cref(stop), std::ref(counters));
+    threads.emplace_back(run_toggling_subscriber, std::ref(loopback), std::cref(queues), std::cref(stop), std::ref(counters));
+
+    std::vector<Sample> samples;
+    auto start = soak_clock::now();
+    auto interval = std::chrono::duration_cast<soak_clock::duration>(std::chrono::duration<double>(config.sample_interval));
+    for (auto next = start + interval; ; next += interval) {
+        std::this_thread::sleep_until(next);
+        double elapsed = std::chrono::duration<double>(soak_clock::now() - start).count();
+        samples.push_back(take_sample(broker.broker_state(), elapsed));
+        std::string line = sample_json(samples.back());
+        if (output.is_open()) output << line << "\n" << std::flush;
+        else std::cout << line << "\n" << std::flush;
+        if (elapsed >= config.duration) break;
+    }
+
+    stop = true;
+    for (auto &t : threads) t.join();
+    broker.request_stop();
+    broker.wait();
+
+    std::printf("sessions %llu (failed %llu), queues created %llu, published %llu (errors %llu), received %llu\n",
+                static_cast<unsigned long long>(counters.sessions.load()), static_cast<unsigned long long>(counters.session_failures.load()),
+                static_cast<unsigned long long>(counters.queues_created.load()), static_cast<unsigned long long>(counters.published.load()),
+                static_cast<unsigned long long>(counters.publish_errors.load()), static_cast<unsigned long long>(counters.received.load()));
+    bool ok = judge(samples, config);
+    std::printf("%s\n", ok ? "PLATEAU" : "MEMORY GROWTH");
+    logger_stop();
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <optional>
+#include <exception>
+#include <utility>
+
+// @brief Outcome of a request acknowledged by the server.
+//
+// @param ok true if the server answered the request with OK.
+// @param status Raw status payload sent by the server ("OK", "ER:NO_QUEUE", ...)
+// or a local reason ("ER:DISCONNECTED", "ER:INVALID_ARGUMENT") when the
+// request never got an answer.
+// @param data Data carried by replies to queries (server_stats_async), empty otherwise.
+struct AsyncResult {
+    bool ok = false;
+    std::string status;
+    std::string data;
+
+    AsyncResult() = default;
+    AsyncResult(bool ok, std::string status, std::string data = {})
+        : ok(ok), status(std::move(status)), data(std::move(data)) {}
+};
+
+template <typename T>
+class AsyncTask;
+
+// @class AsyncExecutor
+// @brief Small fixed-size thread pool used to resume awaiting coroutines.
+//
+// MessageQueueClient never resumes a coroutine on its receiver thread.
+// When an acknowledgment arrives, the awaiting coroutine is posted to the
+// executor configured with MessageQueueClient::set_executor() (or to
+// default_executor()), so any number of operations can be in flight
+// without a thread per outstanding request.
+class AsyncExecutor {
+ public:
+    explicit AsyncExecutor(size_t threads = 1);
+    ~AsyncExecutor();
+
+    AsyncExecutor(const AsyncExecutor &) = delete;
+    AsyncExecutor &operator=(const AsyncExecutor &) = delete;
+
+    // @brief Queue a callable for execution on one of the worker threads.
+    void post(std::function<void()> fn);
+    void post(std::coroutine_handle<> handle) {
+        post([handle] { handle.resume(); });
+    }
+
+    // @brief Start a task detached on this executor.
+    //
+    // The coroutine frame is destroyed when the task finishes. Exceptions
+    // escaping a detached task are swallowed.
+    template <typename T>
+    void spawn(AsyncTask<T> task);
+
+    // @brief Process-wide executor with one worker thread.
+    static AsyncExecutor &default_executor();
+
+ private:
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _jobs;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stopping = false;
+
+    void _worker_loop();
+};
+
+// @brief Shared state between a pending request and its awaiter.
+//
+// Completed exactly once, either by the receiver thread when the matching
+// acknowledgment arrives or locally when the connection is lost.
+class AsyncOperationState {
+ public:
+    explicit AsyncOperationState(AsyncExecutor *executor) : _executor(executor) {}
+
+    void complete(AsyncResult result);
+
+ private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _done = false;
+    AsyncResult _result;
+    std::coroutine_handle<> _waiter;
+    AsyncExecutor *_executor;
+
+    friend class AsyncOperation;
+};
+
+// @class AsyncOperation
+// @brief Awaitable handle returned by the *_async methods of MessageQueueClient.
+//
+// `co_await op` suspends until the server acknowledges the request and
+// yields an AsyncResult. Code outside a coroutine can call wait() instead.
+class AsyncOperation {
+ public:
+    explicit AsyncOperation(std::shared_ptr<AsyncOperationState> state) : _state(std::move(state)) {}
+
+    // @brief Create an operation that is already completed with the given result.
+    static AsyncOperation ready(AsyncResult result);
+
+    bool await_ready() const noexcept;
+    bool await_suspend(std::coroutine_handle<> handle);
+    AsyncResult await_resume();
+
+    // @brief Block the calling thread until the operation completes.
+    AsyncResult wait();
+
+    // @brief Block the calling thread until the operation completes or timeout passes.
+    //
+    // @return The result, or a failed result with status "ER:TIMEOUT". A late
+    // reply still completes the operation.
+    AsyncResult wait_for(std::chrono::milliseconds timeout);
+
+ private:
+    std::shared_ptr<AsyncOperationState> _state;
+};
+
+namespace async_detail {
+
+    struct PromiseBase {
+        std::coroutine_handle<> continuation;
+        bool detached = false;
+        std::exception_ptr exception;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                auto &promise = handle.promise();
+                if (promise.continuation) return promise.continuation;
+                if (promise.detached) handle.destroy();
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct PromiseValue {
+        std::optional<T> value;
+        void return_value(T v) { value = std::move(v); }
+        T take() { return std::move(*value); }
+    };
+
+    template <>
+    struct PromiseValue<void> {
+        void return_void() noexcept {}
+        void take() {}
+    };
+}
+
+// @class AsyncTask
+// @brief Lazily started coroutine returning T.
+//
+// A task starts when it is awaited by another coroutine or handed to
+// AsyncExecutor::spawn().
+template <typename T = void>
+class AsyncTask {
+ public:
+    struct promise_type : async_detail::PromiseBase, async_detail::PromiseValue<T> {
+        AsyncTask get_return_object() {
+            return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    AsyncTask(AsyncTask &&other) noexcept : _handle(std::exchange(other._handle, {})) {}
+    AsyncTask &operator=(AsyncTask &&other) noexcept {
+        if (this != &other) {
+            if (_handle) _handle.destroy();
+            _handle = std::exchange(other._handle, {});
+        }
+        return *this;
+    }
+    AsyncTask(const AsyncTask &) = delete;
+    AsyncTask &operator=(const AsyncTask &) = delete;
+    ~AsyncTask() {
+        if (_handle) _handle.destroy();
+    }
+
+    bool await_ready() const noexcept { return !_handle || _handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        _handle.promise().continuation = awaiting;
+        return _handle;
+    }
+    T await_resume() {
+        auto &promise = _handle.promise();
+        if (promise.exception) std::rethrow_exception(promise.exception);
+        return promise.take();
+    }
+
+ private:
+    explicit AsyncTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+    std::coroutine_handle<promise_type> _handle;
+
+    friend class AsyncExecutor;
+};
+
+template <typename T>
+void AsyncExecutor::spawn(AsyncTask<T> task) {
+    auto handle = std::exchange(task._handle, {});
+    if (!handle) return;
+    handle.promise().detached = true;
+    post(std::coroutine_handle<>(handle));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+class MessageQueueClient;
+
+// @class ClientReactor
+// @brief Shared epoll event loop for many MessageQueueClient instances.
+//
+// @param io_threads Number of I/O threads serving all attached clients.
+//
+// By default every MessageQueueClient runs its own receiver thread blocked
+// in recv(). A client constructed with a reactor instead registers its
+// socket here after the login handshake, and incoming frames are read and
+// dispatched by one of the reactor's I/O threads. Any number of clients
+// can share a handful of threads while keeping the same public API.
+//
+// - A socket is armed with EPOLLONESHOT, so at most one I/O thread reads
+// from a given client at any time and frames are dispatched in order.
+//
+// - The reactor must outlive every client attached to it.
+class ClientReactor {
+ public:
+    explicit ClientReactor(size_t io_threads = 1);
+    ~ClientReactor();
+
+    ClientReactor(const ClientReactor &) = delete;
+    ClientReactor &operator=(const ClientReactor &) = delete;
+
+ private:
+    struct Registration {
+        MessageQueueClient *client = nullptr;
+        int fd = -1;
+        bool busy = false;
+        bool removed = false;
+        std::thread::id busy_thread;
+    };
+
+    int _epoll_fd = -1;
+    int _wake_fd = -1;
+    std::atomic<bool> _running{true};
+    std::vector<std::thread> _threads;
+
+    // Registrations by id, the id is stored in epoll_event::data.
+    std::unordered_map<uint64_t, std::shared_ptr<Registration>> _registrations;
+    uint64_t _next_id = 1;
+    std::mutex _mutex;
+    std::condition_variable _idle_cv;
+
+    void _io_loop();
+
+    // @brief Start watching a connected client socket.
+    // @return Registration id, 0 on failure.
+    uint64_t _add(MessageQueueClient *client, int fd);
+
+    // @brief Stop watching a client.
+    //
+    // Blocks until no I/O thread is dispatching for this client, unless
+    // called from within that dispatch.
+    void _remove(uint64_t id);
+
+    friend class MessageQueueClient;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -40,6 +41,8 @@ class Event {
     Type _type = Type::Unknown;
     std::string _source;
     std::vector<std::string> _result;
+    // Trace id of a traced message, 0 otherwise.
+    uint64_t _trace_id = 0;
 
 
     // Helper event dispatch methods
@@ -48,10 +51,13 @@ class Event {
     bool is_heartbeat(char &role, char &cmd) { return role == 'H' && cmd == 'B'; }
     bool is_initial_queue_list(char &role, char &cmd) { return role == 'I' && cmd == 'N'; }
     bool is_update_queue_list(char &role, char &cmd) { return role == 'Q' && cmd == 'L'; }
+    bool is_queue_list_snapshot(char &role, char &cmd) { return role == 'Q' && cmd == 'V'; }
+    bool is_queue_list_delta(char &role, char &cmd) { return role == 'Q' && cmd == 'D'; }
     bool is_new_message(char &role, char &cmd) { return role == 'M' && cmd == 'S'; }
+    bool is_new_traced_message(char &role, char &cmd) { return role == 'M' && cmd == 'T'; }
     bool is_new_batch_messages(char &role, char &cmd) { return role == 'M' && cmd == 'A'; }
     bool is_queue_deleted(char &role, char &cmd) { return role == 'N' && cmd == 'D'; }
-    bool is_new_status_update(char &role, char &cmd) { return (role == 'S' && (cmd == 'S' || cmd == 'U')) || (role == 'P' && (cmd == 'C' || cmd == 'D' || cmd == 'B')); }
+    bool is_new_status_update(char &role, char &cmd) { return (role == 'S' && (cmd == 'S' || cmd == 'U' || cmd == 'T')) || (role == 'Q' && cmd == 'S') || (role == 'P' && (cmd == 'C' || cmd == 'D' || cmd == 'B')); }
     bool is_new_error(char &role, char &cmd) { return role == 'L' && cmd == 'O'; }
 
     friend class MessageQueueClient;
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Event.h"
+
+#include <queue>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// @brief Thread-safe FIFO of events waiting for poll_event().
+//
+// Each MessageQueueClient owns one, the members of a MessageQueuePool
+// share a single queue so the pool can be polled like one client.
+class EventQueue {
+ public:
+    void push(Event &&ev) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _events.push(std::move(ev));
+        }
+        _cv.notify_one();
+    }
+
+    // @brief Pop the oldest event, waiting at most timeout for one to arrive.
+    bool pop(Event &ev, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait_for(lock, timeout, [this] { return !_events.empty(); });
+        if (_events.empty()) return false;
+
+        ev = std::move(_events.front());
+        _events.pop();
+        return true;
+    }
+
+ private:
+    std::queue<Event> _events;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+};
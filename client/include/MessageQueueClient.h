@@ -1,20 +1,85 @@
 #pragma once
 
 #include "Event.h"
+#include "EventQueue.h"
 #include "Helpers.h"
+#include "Async.h"
+#include "ClientReactor.h"
+#include "compression.h"
+#include "chunking.h"
+#include "tracing.h"
 
 #include <string>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <chrono>
 #include <thread>
 #include <queue>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <span>
+#include <string_view>
 #include <cstring>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
 constexpr size_t SOCKET_TIMEOUT_VALUE = 35;
 
+// @brief Capabilities requested in the login hello and accepted by the server.
+namespace Feature {
+    inline constexpr uint32_t CompactFraming = wire::CAP_COMPACT_FRAMING;
+    inline constexpr uint32_t CompressionZlib = wire::CAP_COMPRESSION_ZLIB;
+    inline constexpr uint32_t CompressionZstd = wire::CAP_COMPRESSION_ZSTD;
+    inline constexpr uint32_t Chunking = wire::CAP_CHUNKING;
+    inline constexpr uint32_t Tracing = wire::CAP_TRACING;
+    inline constexpr uint32_t QueueListDelta = wire::CAP_QUEUE_LIST_DELTA;
+    inline constexpr uint32_t QueueListFilter = wire::CAP_QUEUE_LIST_FILTER;
+    // Requested with every hello, tells whether queue_stats() gets an answer.
+    inline constexpr uint32_t QueueStats = wire::CAP_QUEUE_STATS;
+}
+
+// @brief Automatic reconnect behaviour after an unexpected connection loss.
+//
+// - Reconnect attempts are spaced with exponential backoff (with jitter,
+// so many clients of a restarted broker do not reconnect in lockstep).
+//
+// - The client logs in again with the same id and re-subscribes the
+// queues it was subscribed to, unless the server still kept the session.
+//
+// - Publishes issued during the outage are buffered and sent in order
+// after the connection is restored, up to the given limits.
+struct ReconnectPolicy {
+    bool enabled = false;
+    std::chrono::milliseconds initial_backoff{100};
+    std::chrono::milliseconds max_backoff{10000};
+    double backoff_multiplier = 2.0;
+    // 0 means retry until disconnect() is called.
+    uint32_t max_attempts = 0;
+    size_t max_buffered_publishes = 1000;
+    size_t max_buffered_bytes = 8 * 1024 * 1024;
+};
+
+// @brief Statistics of one queue, as reported by the server.
+//
+// Rates are messages per second, averaged with exponential decay over
+// about a minute. Subscribers include disconnected sessions the server
+// still keeps for reconnect.
+struct QueueStats {
+    std::string name;
+    uint64_t depth = 0;            // messages retained and not expired
+    uint64_t retained_bytes = 0;   // bytes of those messages, as stored
+    uint32_t subscribers = 0;
+    uint64_t published = 0;        // messages published since queue creation
+    uint64_t delivered = 0;        // messages sent to subscribers since queue creation
+    double publish_rate = 0;
+    double deliver_rate = 0;
+    uint64_t oldest_age_ms = 0;    // age of the oldest retained message, 0 if empty
+};
+
 // @class MessageQueueClient
 // @brief Client for interacting with a message queue server.
 //
@@ -34,18 +99,31 @@ constexpr size_t SOCKET_TIMEOUT_VALUE = 35;
 //
 // - Server-side failures, protocol errors, and connection issues are
 // reported asynchronously as Event::Type::Error or
-// Event::Type::Disconnected events.
+// Event::Type::Disconnected events. With a ReconnectPolicy enabled, a
+// lost connection is reported as an Error, followed by a StatusUpdate
+// once it is restored, and Disconnected only when the policy gives up.
 //
 // - Methods return false only for local failures such as invalid
 // arguments, disconnected state, or socket send errors.
 //
+// - Every *_async method returns an AsyncOperation that can be awaited
+// from a coroutine (`co_await client.publish_async(...)`) and resumes
+// once the server acknowledges the request. Acknowledgments of async
+// requests are not reported as events.
+//
 // - The client starts one internal receiver thread upon successful
-// connection.
+// connection, unless it was constructed with a ClientReactor, in which
+// case incoming data is handled by the reactor's shared I/O threads.
 // - All public methods are thread-safe and may be called concurrently.
 class MessageQueueClient {
  public:
     MessageQueueClient();
     MessageQueueClient(const std::string &client_login);
+
+    // @brief Create a client served by a shared reactor instead of its own receiver thread.
+    //
+    // @param reactor Event loop that must outlive this client.
+    MessageQueueClient(const std::string &client_login, ClientReactor &reactor);
     ~MessageQueueClient();
 
     // @brief Connect to the server.
@@ -53,7 +131,8 @@ class MessageQueueClient {
     // Establishes a TCP connection and performs a protocol handshake using
     // the client login provided at construction time.
     //
-    // On success, a dedicated receiver thread is started.
+    // On success, a dedicated receiver thread is started, or the socket
+    // is registered with the reactor given at construction.
     //
     // @param host Server hostname or IPv4 address.
     // @param port Server port number (string representation).
@@ -65,10 +144,22 @@ class MessageQueueClient {
     //       operations.
     bool connect_to_server(const std::string &host, const std::string &port);
 
+    // @brief Log in over an already connected socket.
+    //
+    // Used with transports other than TCP, e.g. one end of a socketpair
+    // served by an in-process Broker. The client takes ownership of the
+    // socket and closes it on disconnect. Lost connections are never
+    // re-established, whatever the reconnect policy.
+    //
+    // @param sock Connected stream socket.
+    //
+    // @return true if the handshake succeeded, false otherwise.
+    bool attach_socket(int sock);
+
     // @brief Disconnect from the server.
     //
-    // Stops the receiver thread, shuts down the socket, and releases
-    // all associated resources.
+    // Stops the receiver thread (or detaches from the reactor), shuts down
+    // the socket, and releases all associated resources.
     void disconnect();
 
     // @brief Request creation of a new queue.
@@ -96,13 +187,68 @@ class MessageQueueClient {
     //
     // @return true if the request was sent successfully,
     // false if the client is disconnected or arguments are invalid.
-    bool publish(const std::string &queue_name, const std::string &content, uint32_t ttl);
+    bool publish(const std::string &queue_name, std::string_view content, uint32_t ttl);
+
+    // @brief Publish a message assembled from several buffers.
+    //
+    // The parts are concatenated on the wire only: the frame header is
+    // built on the stack and sent together with the queue name and the
+    // parts in one sendmsg() call, without copying the payload.
+    //
+    // @param parts Buffers forming the message body, in order.
+    bool publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl);
 
     // @brief Subscribe to active queue.
     bool subscribe(const std::string &queue_name);
     // @brief Unubscribe active (and subscribed) queue.
     bool unsubscribe(const std::string &queue_name);
 
+    // @brief Awaitable variants of the action methods.
+    //
+    // The returned operation completes when the server acknowledges the
+    // request, with AsyncResult::ok telling whether it was accepted.
+    // Local failures (invalid arguments, disconnected state, send errors)
+    // complete the operation immediately with ok == false.
+    //
+    // Awaiting coroutines are resumed on the executor set with
+    // set_executor(), or on AsyncExecutor::default_executor().
+    AsyncOperation create_queue_async(const std::string &queue_name);
+    AsyncOperation delete_queue_async(const std::string &queue_name);
+    AsyncOperation publish_async(const std::string &queue_name, std::string_view content, uint32_t ttl);
+    AsyncOperation publish_async(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl);
+    AsyncOperation subscribe_async(const std::string &queue_name);
+    AsyncOperation unsubscribe_async(const std::string &queue_name);
+
+    // @brief Request broker metrics.
+    //
+    // On success AsyncResult::data holds counters, gauges and latency
+    // histograms in Prometheus text exposition format.
+    AsyncOperation server_stats_async();
+
+    // @brief Request statistics of one queue, or of all queues if queue_name is empty.
+    //
+    // On success AsyncResult::data holds one line per queue, decode it
+    // with parse_queue_stats(). Fails at once with "ER:NOT_SUPPORTED" if
+    // the server negotiated without Feature::QueueStats.
+    AsyncOperation queue_stats_async(const std::string &queue_name = "");
+
+    // @brief Blocking variant of queue_stats_async().
+    //
+    // Waits at most SOCKET_TIMEOUT_VALUE seconds, servers that did not
+    // negotiate (no hello sent) may not know the request.
+    //
+    // @param stats Receives statistics of the requested queues.
+    // @return true if the server answered, false on error (e.g. unknown queue) or timeout.
+    bool queue_stats(const std::string &queue_name, std::vector<QueueStats> &stats);
+
+    // @brief Decode AsyncResult::data of a queue_stats_async() reply.
+    static std::vector<QueueStats> parse_queue_stats(const std::string &data);
+
+    // @brief Set the executor used to resume coroutines awaiting this client.
+    //
+    // The executor must outlive the client.
+    void set_executor(AsyncExecutor &executor) { _executor.store(&executor); }
+
     // @brief Retrieve the next pending event.
     //
     // Blocks until an event is available, the client disconnects or timeout.
@@ -121,27 +267,348 @@ class MessageQueueClient {
     // @brief Check connection.
     bool is_connected() const { return _connected.load(); };
 
+    // @brief Set the reconnect policy used after unexpected connection loss.
+    //
+    // Must be called before connect_to_server().
+    void set_reconnect_policy(const ReconnectPolicy &policy) { _reconnect_policy = policy; }
+
+    // @brief Check whether the client is currently trying to restore its connection.
+    bool is_reconnecting() const { return _reconnecting.load(); }
+
+    // @brief Send publishes of at least this many payload bytes with MSG_ZEROCOPY.
+    //
+    // The kernel then reads the payload straight from the caller's buffers.
+    // publish() waits for the kernel's completion notification before it
+    // returns, so the buffers may be reused afterwards. Zero-copy only pays
+    // off for large payloads (tens of KB and more). 0 disables it (default).
+    void set_zerocopy_threshold(size_t bytes) { _zerocopy_threshold.store(bytes); }
+
+    // @brief Request compact framing at login.
+    //
+    // Frames then carry varint lengths instead of 4-byte ones, and
+    // publishes and deliveries address queues by the numeric handle the
+    // server returns on create, subscribe and publish, instead of by name.
+    // Falls back to the standard framing if the server does not accept it.
+    // Requires a server that understands the login hello.
+    //
+    // Must be called before connect_to_server().
+    void set_compact_framing(bool enabled) {
+        if (enabled) _requested_capabilities |= Feature::CompactFraming;
+        else _requested_capabilities &= ~Feature::CompactFraming;
+    }
+
+    // @brief Request payload compression at login.
+    //
+    // Publishes of at least threshold bytes are compressed with the best
+    // codec both sides were built with (zstd, then zlib), and the server
+    // may send compressed deliveries and history batches. Codecs depend on
+    // the libraries found at build time, without any this has no effect.
+    //
+    // Must be called before connect_to_server().
+    void set_compression(bool enabled, size_t threshold = wire::DEFAULT_COMPRESSION_THRESHOLD);
+
+    // @brief Request chunked streaming of large frames at login.
+    //
+    // Frames over wire::CHUNK_SIZE are then sent in chunks in both
+    // directions, so messages up to wire::MAX_CHUNKED_MESSAGE_SIZE can be
+    // published and received, and small frames on the connection are not
+    // held back behind a large one.
+    //
+    // Must be called before connect_to_server().
+    void set_chunking(bool enabled) {
+        if (enabled) _requested_capabilities |= Feature::Chunking;
+        else _requested_capabilities &= ~Feature::Chunking;
+    }
+
+    // @brief Request queue list changes instead of full lists at login.
+    //
+    // The server then sends the full list once per connection and after
+    // that only the queues created and deleted since, batched when many
+    // change at once. QueueList events still carry the full list. If the
+    // client notices it missed changes it asks the server for the list again.
+    //
+    // Must be called before connect_to_server().
+    void set_queue_list_deltas(bool enabled) {
+        if (enabled) _requested_capabilities |= Feature::QueueListDelta;
+        else _requested_capabilities &= ~Feature::QueueListDelta;
+    }
+
+    // @brief Receive queue lists with only the queues whose name starts with one of prefixes.
+    //
+    // An empty prefix matches every queue, an empty vector opts out of queue
+    // lists, which suits clients that only publish. The server then neither
+    // builds nor sends lists this client does not want. Servers without the
+    // feature keep sending the whole list.
+    //
+    // Must be called before connect_to_server().
+    void set_queue_list_filter(std::vector<std::string> prefixes) {
+        _queue_list_prefixes = std::move(prefixes);
+        _requested_capabilities |= Feature::QueueListFilter;
+    }
+
+    // @brief Trace one in sample_one_in publishes end to end, 0 disables tracing.
+    //
+    // A traced message records spans (see tracing.h) at client publish,
+    // server receive, queue lock, enqueue and every subscriber send, and in
+    // subscribing clients with tracing at receive and at poll_event(). All
+    // times are wall clock, so spans of several processes on one host can
+    // be joined by trace id. Publishes sent in chunks are not traced.
+    //
+    // @param export_path File the spans of this client are appended to as
+    // JSON lines. Without one only the latest spans are kept, see trace_spans().
+    //
+    // @return false if export_path can not be opened.
+    //
+    // Must be called before connect_to_server().
+    bool set_tracing(uint32_t sample_one_in, const std::string &export_path = "");
+
+    // @brief Spans recorded by this client and not exported yet, oldest first.
+    std::vector<trace::span> trace_spans() const;
+
+    // @brief Capabilities accepted by the server for the current connection (Feature bits).
+    uint32_t capabilities() const { return _capabilities.load(); }
+
+    // @brief Protocol version negotiated at login, 0 if the hello was not exchanged.
+    uint8_t protocol_version() const { return _protocol_version.load(); }
+
+    // @brief Largest payload the server accepts, 0 if it did not announce a limit.
+    uint32_t server_max_frame() const { return _server_max_frame.load(); }
+
 private:
     std::atomic<int> _socket{-1};
     std::string _client_login;
     std::thread _receiver_thread;
     std::atomic<bool> _connected{false};
     
-    std::queue<Event> _event_queue;
-    std::mutex _event_mutex;
-    std::condition_variable _event_cv;
+    // Shared with the other members when the client is part of a MessageQueuePool.
+    std::shared_ptr<EventQueue> _events = std::make_shared<EventQueue>();
+    bool _forward_queue_lists = true;
 
     std::vector<std::string> _available_queues;
+    // Version of _available_queues with queue list deltas, valid once a
+    // snapshot arrived on the current connection.
+    uint32_t _queue_list_version = 0;
+    bool _queue_list_synced = false;
     std::mutex _queues_cache_mutex;
+    // Sent as QF after every login, see set_queue_list_filter().
+    std::vector<std::string> _queue_list_prefixes;
+
+    std::atomic<AsyncExecutor *> _executor{nullptr};
+
+    // Request waiting for acknowledgment.
+    // Synchronous requests are tracked with a null state so acknowledgments
+    // of mixed sync/async traffic are matched to the right request.
+    struct PendingRequest {
+        std::shared_ptr<AsyncOperationState> op;
+        std::string queue_name;
+    };
+
+    // Pending requests in send order, per command.
+    std::map<uint16_t, std::deque<PendingRequest>> _pending_acks;
+    std::mutex _pending_mutex;
+
+    // Publish issued while the connection is being restored.
+    struct BufferedPublish {
+        std::string queue_name;
+        std::string content;
+        uint32_t ttl;
+        std::shared_ptr<AsyncOperationState> op;
+    };
+
+    std::string _host;
+    std::string _port;
+    ReconnectPolicy _reconnect_policy;
+    std::atomic<bool> _reconnecting{false};
+    // Incremented on every connection loss, lets a stale restore stop early.
+    std::atomic<uint64_t> _connection_epoch{0};
+    bool _stopping = false;
+    std::thread _reconnect_thread;
+    std::mutex _reconnect_mutex;
+    std::condition_variable _reconnect_cv;
+
+    // Login reply of the last handshake ("OK:LOGGED" or "OK:RECONNECTED").
+    std::string _login_status;
+
+    // Capabilities requested in the login hello, no hello is sent when empty.
+    uint32_t _requested_capabilities = 0;
+    // Result of the login hello for the current connection.
+    std::atomic<uint32_t> _capabilities{0};
+    std::atomic<uint8_t> _protocol_version{0};
+    std::atomic<uint32_t> _server_max_frame{0};
+    // Compact framing accepted by the server for the current connection.
+    std::atomic<bool> _compact{false};
+    // Compression accepted by the server, and the codec used for publishing.
+    std::atomic<bool> _compression{false};
+    std::atomic<wire::encoding> _publish_encoding{wire::encoding::NONE};
+    std::atomic<size_t> _compression_threshold{wire::DEFAULT_COMPRESSION_THRESHOLD};
+    // Chunked streaming accepted by the server, and id of the next outgoing stream.
+    std::atomic<bool> _chunking{false};
+    std::atomic<uint32_t> _next_stream_id{1};
+    // Tracing accepted by the server, sampling rate and spans (shared by members of a pool).
+    std::atomic<bool> _tracing{false};
+    uint32_t _trace_sample = 0;
+    std::atomic<uint64_t> _trace_sequence{0};
+    uint64_t _trace_id_base = 0;
+    std::shared_ptr<trace::span_ring> _spans;
+
+    // Queue handles returned by the server, valid for the current connection.
+    std::unordered_map<std::string, uint32_t> _queue_handles;
+    std::unordered_map<uint32_t, std::string> _handle_names;
+    std::mutex _handles_mutex;
+
+    // Queues confirmed as subscribed, restored after reconnect.
+    std::set<std::string> _subscriptions;
+    std::mutex _subscriptions_mutex;
+
+    std::deque<BufferedPublish> _outage_buffer;
+    size_t _outage_buffer_bytes = 0;
+    std::mutex _outage_mutex;
+
+    // Serializes writes to the socket so frames of concurrent callers never interleave.
+    std::mutex _send_mutex;
+
+    std::atomic<size_t> _zerocopy_threshold{0};
+    // Socket for which SO_ZEROCOPY was enabled, and zero-copy sends issued on it (guarded by _send_mutex).
+    int _zerocopy_socket = -1;
+    uint32_t _zerocopy_sent = 0;
+    uint32_t _zerocopy_completed = 0;
+
+    ClientReactor *_reactor = nullptr;
+    uint64_t _reactor_id = 0;
+
+    // Bytes received but not yet parsed into complete frames.
+    std::string _rx_buffer;
+    // Remaining bytes of an oversized frame that are being skipped.
+    size_t _rx_discard = 0;
+    // Frames received in chunks that are not complete yet.
+    wire::chunk_assembler _rx_chunks;
 
     void _receiver_loop();
     static bool _send_message(int socket, const std::string &data);
 
+    // @brief Open a socket to _host:_port and perform the login handshake.
+    bool _open_connection();
+
+    // @brief Perform the login handshake on _socket and reset per-connection state.
+    bool _prepare_connection();
+
+    // @brief Start reading from the connected socket (receiver thread or reactor).
+    void _start_receiving();
+
+    // @brief Begin restoring a lost connection in the background.
+    //
+    // @return false if reconnecting is disabled or the client is stopping.
+    bool _start_reconnect(const std::string &reason);
+
+    // @brief Backoff loop of the reconnect thread.
+    void _reconnect_loop();
+
+    // @brief Re-subscribe remembered queues and flush buffered publishes.
+    void _restore_session();
+
+    // @brief Buffer a publish if the client is reconnecting.
+    //
+    // @param accepted Set to false when the outage buffer limits are reached.
+    // @return true if the publish was handled by the buffer, false if it
+    // should be sent directly.
+    bool _try_buffer_publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl, const std::shared_ptr<AsyncOperationState> &op, bool &accepted);
+
+    // @brief Check the publish against the frame limit announced by the server.
+    bool _fits_server_frame(const std::string &queue_name, std::span<const std::string_view> parts) const;
+
+    // @brief Send a publish request built from scatter-gather parts.
+    bool _send_publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl, const std::shared_ptr<AsyncOperationState> &op);
+
+    // @brief Write all buffers, resuming after partial writes.
+    //
+    // @param zerocopy Send with MSG_ZEROCOPY and wait until the kernel
+    // released the buffers.
+    bool _send_iov(int sock, std::vector<iovec> &iov, bool zerocopy);
+
+    // @brief Enable SO_ZEROCOPY on the current socket once.
+    bool _enable_zerocopy(int sock);
+
+    // @brief Read zero-copy completions from the error queue until all sends are released.
+    bool _wait_zerocopy_completion(int sock);
+
+    // @brief Remember the handle carried by an OK reply ("OK" + varint).
+    void _cache_queue_handle(const std::string &queue_name, const std::string &payload);
+    void _forget_queue_handle(const std::string &queue_name);
+    // @return Cached handle of a queue, 0 if unknown.
+    uint32_t _queue_handle(const std::string &queue_name);
+    // @brief Name of the queue behind a handle received in MS/MA frames.
+    std::string _queue_name_for_handle(uint32_t handle);
+
+    // @brief Track subscription changes confirmed by the server.
+    void _track_subscription(char cmd, const std::string &queue_name, bool ok);
+
+    // @brief Parse received bytes and dispatch every complete frame.
+    //
+    // Shared by the receiver thread and the reactor, so both paths handle
+    // partial frames and oversized payloads identically.
+    //
+    // @return false if the stream is out of sync, the connection was dropped.
+    bool _consume_input(const char *data, size_t size);
+
+    // @brief Drain the socket without blocking (reactor mode).
+    //
+    // @return false if the connection was lost and must be unregistered.
+    bool _on_readable();
+
+    // @brief Send a request that the server answers with a status frame.
+    //
+    // The request is registered as pending before it is written, under the
+    // send lock, so acknowledgment order always matches registration order.
+    //
+    // @param op Operation to complete on acknowledgment, nullptr for
+    // synchronous requests reported through events.
+    bool _send_request(char role, char cmd, const std::string &message, const std::shared_ptr<AsyncOperationState> &op, const std::string &queue_name);
+    bool _send_request(char role, char cmd, std::vector<iovec> &iov, const std::shared_ptr<AsyncOperationState> &op, const std::string &queue_name, bool zerocopy);
+
+    // @return Trace id for the next publish, 0 if it is not sampled.
+    uint64_t _next_trace_id();
+
+    // @brief Record delivery of a traced message returned by poll_event.
+    void _trace_delivery(const Event &ev);
+
+    // @brief Send a request payload as a stream of chunks.
+    //
+    // The send lock is released between chunks. The request is registered
+    // as pending together with the last chunk, which is when the server
+    // processes it, so acknowledgment order still matches registration order.
+    //
+    // @param payload Request payload without frame header.
+    bool _send_chunked_request(char role, char cmd, std::vector<iovec> &payload, const std::shared_ptr<AsyncOperationState> &op, const std::string &queue_name, bool zerocopy);
+
+    // @brief Send a request and wrap it in an awaitable operation.
+    AsyncOperation _send_async_request(char role, char cmd, const std::string &message, const std::string &queue_name);
+
+    // @brief Match a status frame with the oldest pending request of the same command.
+    //
+    // @return true if the acknowledgment completed an async operation and
+    // must not be reported as an event.
+    bool _complete_pending(char role, char cmd, const std::string &payload);
+
+    // @brief Complete all pending operations with a local failure.
+    void _fail_pending(const std::string &reason);
+
+    static uint16_t _ack_key(char role, char cmd) {
+        return static_cast<uint16_t>((static_cast<unsigned char>(role) << 8) | static_cast<unsigned char>(cmd));
+    }
+
     // @brief Read exactly N bytes from a socket.
     bool _read_exactly(int sock, char *buffer, size_t size);
     
-    std::tuple<std::string, std::string> _handle_message_payload(const std::string &payload);
-    std::vector<std::string> _handle_queue_list_payload(const std::string &payload);
+    // @return false if the message content can not be decompressed.
+    bool _handle_message_payload(const std::string &payload, std::string &queue_name, std::string &content);
+    // @brief Decode [encoding(1b)][data] starting at offset (plain rest of payload without compression).
+    bool _decode_body(const std::string &payload, size_t offset, std::string &out);
+    std::vector<std::string> _handle_queue_list_payload(const std::string &payload, size_t offset = 0);
+    // @brief Apply QD payload to _available_queues.
+    //
+    // Asks the server for a snapshot if changes before the delta were missed.
+    // @return true if the list moved to a new version, copied to queues.
+    bool _apply_queue_list_delta(const std::string &payload, std::vector<std::string> &queues);
     std::vector<std::string> _handle_new_sub_messages(const std::string &payload);
 
     // @brief Verify server connection via handshake.
@@ -162,4 +629,9 @@ private:
     void _handle_error_event(const std::string &reason, bool is_fatal);
 
     void _dispatch_event(char &role, char &cmd, std::string &payload, Event &ev);
+
+    void _post_event(Event &&ev);
+
+    friend class ClientReactor;
+    friend class MessageQueuePool;
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "MessageQueueClient.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+
+// @class MessageQueuePool
+// @brief Client that spreads its traffic over several connections.
+//
+// @param client_login Base login, connection i logs in as "<login>#<i>".
+// @param connections Number of connections to open (at least 1).
+//
+// Every queue is routed by hash of its name to one fixed connection, so
+// all requests for a queue travel over the same socket and keep their
+// order, while different queues are served by different server threads.
+//
+// - The API mirrors MessageQueueClient. Action methods apply to the
+// connection owning the queue.
+//
+// - Events of all connections are merged into one stream returned by
+// poll_event(). Queue lists are reported by the first connection only.
+//
+// - All public methods are thread-safe and may be called concurrently.
+class MessageQueuePool {
+ public:
+    MessageQueuePool(const std::string &client_login, size_t connections);
+
+    // @brief Create a pool whose connections are served by a shared reactor.
+    MessageQueuePool(const std::string &client_login, size_t connections, ClientReactor &reactor);
+    ~MessageQueuePool();
+
+    // @brief Connect all pool connections.
+    //
+    // @return true if every connection succeeded. On failure the
+    // connections opened so far are closed again.
+    bool connect_to_server(const std::string &host, const std::string &port);
+    void disconnect();
+
+    bool create_queue(const std::string &queue_name);
+    bool delete_queue(const std::string &queue_name);
+    bool publish(const std::string &queue_name, std::string_view content, uint32_t ttl);
+    bool publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl);
+    bool subscribe(const std::string &queue_name);
+    bool unsubscribe(const std::string &queue_name);
+
+    AsyncOperation create_queue_async(const std::string &queue_name);
+    AsyncOperation delete_queue_async(const std::string &queue_name);
+    AsyncOperation publish_async(const std::string &queue_name, std::string_view content, uint32_t ttl);
+    AsyncOperation publish_async(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl);
+    AsyncOperation subscribe_async(const std::string &queue_name);
+    AsyncOperation unsubscribe_async(const std::string &queue_name);
+
+    // @brief Statistics of a queue, asked on the connection serving it
+    // (all queues through the first connection if queue_name is empty).
+    AsyncOperation queue_stats_async(const std::string &queue_name = "");
+    bool queue_stats(const std::string &queue_name, std::vector<QueueStats> &stats);
+
+    // @brief Retrieve the next pending event of any connection.
+    bool poll_event(Event &ev);
+
+    std::vector<std::string> get_available_queues() { return _clients.front()->get_available_queues(); }
+
+    // @brief Check that every connection of the pool is up.
+    bool is_connected() const;
+
+    void set_executor(AsyncExecutor &executor);
+    void set_reconnect_policy(const ReconnectPolicy &policy);
+    void set_zerocopy_threshold(size_t bytes);
+    void set_compact_framing(bool enabled);
+    void set_compression(bool enabled, size_t threshold = wire::DEFAULT_COMPRESSION_THRESHOLD);
+    void set_chunking(bool enabled);
+    // @brief Queue lists of the first connection only hold queues matching prefixes, the others receive none.
+    void set_queue_list_filter(std::vector<std::string> prefixes);
+    // @brief Trace one in sample_one_in publishes of every connection, spans of all connections are collected together.
+    bool set_tracing(uint32_t sample_one_in, const std::string &export_path = "");
+    std::vector<trace::span> trace_spans() const { return _clients.front()->trace_spans(); }
+
+    // @brief Index of the connection serving a queue.
+    size_t connection_for(const std::string &queue_name) const;
+    size_t size() const { return _clients.size(); }
+
+ private:
+    std::vector<std::unique_ptr<MessageQueueClient>> _clients;
+    std::shared_ptr<EventQueue> _events = std::make_shared<EventQueue>();
+
+    void _attach_members();
+    MessageQueueClient &_route(const std::string &queue_name) { return *_clients[connection_for(queue_name)]; }
+};
@@ -1,16 +1,23 @@
 #pragma once
 
 #include "MessageQueueClient.h"
+#include "wire_codec.h"
 
 #include <string>
+#include <vector>
 
-constexpr size_t HEADER_PACKET_SIZE = 6;
+constexpr size_t HEADER_PACKET_SIZE = wire::FIXED_HEADER_SIZE;
 constexpr uint32_t MAX_PAYLOAD = 1 * 1024 * 1024;
+constexpr size_t RECV_CHUNK_SIZE = 64 * 1024;
+constexpr size_t PUBLISH_HEADER_SIZE = HEADER_PACKET_SIZE + 8;
+// Type, payload length, queue handle (or 0 and queue name length) and TTL.
+constexpr size_t COMPACT_PUBLISH_HEADER_MAX_SIZE = wire::MAX_HEADER_SIZE + 3 * wire::MAX_VARINT_SIZE;
 
 // @brief Message sender role.
 namespace Role {
     inline constexpr char Publisher = 'P';
     inline constexpr char Subscriber = 'S';
+    inline constexpr char Query = 'Q';
 }
 
 // @brief Message action / command type.
@@ -20,6 +27,9 @@ namespace Action {
     inline constexpr char Publish = 'B';
     inline constexpr char Subscribe = 'S';
     inline constexpr char Unsubscribe = 'U';
+    inline constexpr char Stats = 'T';
+    inline constexpr char QueueStats = 'S';
+    inline constexpr char PublishTraced = 'T';
 }
 
 // All protocol messages consist of a fixed-size header followed
@@ -35,6 +45,32 @@ namespace Action {
 // The header is immediately followed by a payload of exactly
 // `payload_length` bytes.
 
+// Compact framing (negotiated with Feature::CompactFraming):
+// The payload length is a varint (LEB128, 1-5 bytes) instead of 4 bytes,
+// and queues are addressed by the numeric handle the server returns in
+// the OK reply of create, subscribe and publish ("OK" + varint handle).
+// The login exchange itself always uses the fixed-size header.
+//
+// Login hello (sent only when a capability is requested, see wire_codec.h):
+// Login payload: [client_id]['\0'][version(1)][capabilities(4)][max frame(4)]
+// Login reply:   [OK:LOGGED]['\0'][version(1)][accepted capabilities(4)][max frame(4)]
+// Both sides then keep every payload they send within the peer's max frame.
+//
+// Chunked streaming (negotiated with Feature::Chunking, see chunking.h):
+// A payload over CHUNK_SIZE may be sent as CK frames, each carrying
+// [stream id(varint)][flags(1)] and, in the first one only,
+// [type(2)][total size(varint)], followed by up to CHUNK_SIZE bytes of it.
+// The frame is handled when its last chunk arrives.
+//
+// Tracing (negotiated with Feature::Tracing, see tracing.h):
+// A sampled publish is sent as PT, the publish payload followed by
+// [trace id(8)][publish time ns(8)], and acknowledged like PB. Its
+// deliveries arrive as MT, the MS payload followed by [trace id(8)].
+//
+// Queue list filter (negotiated with Feature::QueueListFilter):
+// No queue list is sent at login. QF with [count(4)] and per prefix
+// [prefix length(4)][prefix] asks for lists of the matching queues only.
+
 // Publish payload format:
 // Offset | Size | Description
 // -------|------|----------------------------------------------
@@ -43,6 +79,13 @@ namespace Action {
 // 8      | N    | Queue name (N bytes)
 // 8 + N  | M    | Message content (remaining bytes)
 //
+// Compact publish payload:
+// [queue handle(varint)][ttl(varint)][content], or with handle 0:
+// [0][ttl(varint)][queue name length(varint)][queue name][content]
+//
+// Frame headers are encoded and decoded by the codec in wire_codec.h,
+// shared with the server.
+//
 // This class  is used internally by MessageQueueClient to construct
 // and parse protocol-compliant messages.
 class Protocol {
@@ -53,9 +96,10 @@ private:
     // @param role Message sender role.
     // @param cmd Action / command code.
     // @param payload Payload data.
+    // @param compact Encode payload length as varint.
     //
     // @return Message ready to be sent over the socket.
-    static std::string _prepare_message(char role, char cmd, const std::string &payload);
+    static std::string _prepare_message(char role, char cmd, const std::string &payload, bool compact = false);
 
     // @brief Pack publish-specific payload data.
     //
@@ -66,12 +110,33 @@ private:
     // @return Serialized publish payload.
     static std::string _pack_publish_data(const std::string &queue_name, const std::string &content, const uint32_t ttl);
 
-    // @brief Decode a protocol header.
+    // @brief Pack the frame header and publish header of a publish request.
+    //
+    // Used for scatter-gather publishing, where the queue name and the
+    // content are sent from their own buffers right after this header.
+    //
+    // @param out Buffer of at least PUBLISH_HEADER_SIZE bytes.
+    // @param queue_name_size Length of the queue name.
+    // @param content_size Total length of the message content.
+    // @param ttl Message time-to-live in seconds.
+    static void _pack_publish_header(char *out, size_t queue_name_size, size_t content_size, uint32_t ttl);
+
+    // @brief Pack the compact frame header and publish header.
+    //
+    // @param out Buffer of at least COMPACT_PUBLISH_HEADER_MAX_SIZE bytes.
+    // @param queue_handle Handle of the queue, 0 to address it by name.
+    // @param queue_name_size Length of the queue name sent after the
+    // header, ignored when a handle is given.
+    //
+    // @return Number of bytes written.
+    static size_t _pack_compact_publish_header(char *out, uint32_t queue_handle, size_t queue_name_size, size_t content_size, uint32_t ttl);
+
+    // @brief Pack QF payload.
     //
-    // @param message A buffer containing at least HEADER_PACKET_SIZE bytes.
+    // @param prefixes Queue name prefixes, empty to receive no queue lists.
     //
-    // @return Tuple containing: role (char), action/command (char), payload length (uint32, host byte order).
-    static std::tuple<char, char, uint32_t> _decode_packet(const std::string &message);
+    // @return Serialized queue list filter payload.
+    static std::string _pack_queue_list_filter(const std::vector<std::string> &prefixes);
 
     friend class MessageQueueClient;
 };
\ No newline at end of file
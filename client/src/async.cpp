@@ -0,0 +1,108 @@
+#include "Async.h"
+
+// ------------------------------
+// EXECUTOR
+// ------------------------------
+
+AsyncExecutor::AsyncExecutor(size_t threads) {
+    if (threads == 0) threads = 1;
+    _workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        _workers.emplace_back(&AsyncExecutor::_worker_loop, this);
+}
+
+AsyncExecutor::~AsyncExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+    for (auto &worker : _workers) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+void AsyncExecutor::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(fn));
+    }
+    _cv.notify_one();
+}
+
+AsyncExecutor &AsyncExecutor::default_executor() {
+    static AsyncExecutor executor(1);
+    return executor;
+}
+
+void AsyncExecutor::_worker_loop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+            // Pending jobs are drained before stopping so no coroutine is left suspended forever.
+            if (_jobs.empty()) return;
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+        job();
+    }
+}
+
+// ------------------------------
+// OPERATIONS
+// ------------------------------
+
+void AsyncOperationState::complete(AsyncResult result) {
+    std::coroutine_handle<> waiter;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_done) return;
+        _done = true;
+        _result = std::move(result);
+        waiter = std::exchange(_waiter, {});
+    }
+    _cv.notify_all();
+
+    if (waiter) {
+        AsyncExecutor *executor = _executor ? _executor : &AsyncExecutor::default_executor();
+        executor->post(waiter);
+    }
+}
+
+AsyncOperation AsyncOperation::ready(AsyncResult result) {
+    auto state = std::make_shared<AsyncOperationState>(nullptr);
+    state->complete(std::move(result));
+    return AsyncOperation(std::move(state));
+}
+
+bool AsyncOperation::await_ready() const noexcept {
+    std::lock_guard<std::mutex> lock(_state->_mutex);
+    return _state->_done;
+}
+
+bool AsyncOperation::await_suspend(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lock(_state->_mutex);
+    // Completed between await_ready() and now - continue without suspending.
+    if (_state->_done) return false;
+    _state->_waiter = handle;
+    return true;
+}
+
+AsyncResult AsyncOperation::await_resume() {
+    std::lock_guard<std::mutex> lock(_state->_mutex);
+    return _state->_result;
+}
+
+AsyncResult AsyncOperation::wait() {
+    std::unique_lock<std::mutex> lock(_state->_mutex);
+    _state->_cv.wait(lock, [this] { return _state->_done; });
+    return _state->_result;
+}
+
+AsyncResult AsyncOperation::wait_for(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(_state->_mutex);
+    if (!_state->_cv.wait_for(lock, timeout, [this] { return _state->_done; })) return {false, "ER:TIMEOUT"};
+    return _state->_result;
+}
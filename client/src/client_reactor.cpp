@@ -0,0 +1,117 @@
+#include "ClientReactor.h"
+#include "MessageQueueClient.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+constexpr int REACTOR_MAX_EVENTS = 64;
+
+ClientReactor::ClientReactor(size_t io_threads) {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    // Wake descriptor is level-triggered so every I/O thread sees the stop request.
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wake_fd, &ev);
+
+    if (io_threads == 0) io_threads = 1;
+    for (size_t i = 0; i < io_threads; ++i)
+        _threads.emplace_back(&ClientReactor::_io_loop, this);
+}
+
+ClientReactor::~ClientReactor() {
+    _running.store(false);
+    uint64_t one = 1;
+    ssize_t written = write(_wake_fd, &one, sizeof(one));
+    (void)written;
+
+    for (auto &t : _threads) {
+        if (t.joinable()) t.join();
+    }
+    close(_wake_fd);
+    close(_epoll_fd);
+}
+
+uint64_t ClientReactor::_add(MessageQueueClient *client, int fd) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint64_t id = _next_id++;
+    auto reg = std::make_shared<Registration>();
+    reg->client = client;
+    reg->fd = fd;
+    _registrations[id] = reg;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.u64 = id;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        _registrations.erase(id);
+        return 0;
+    }
+    return id;
+}
+
+void ClientReactor::_remove(uint64_t id) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _registrations.find(id);
+    if (it == _registrations.end()) return;
+
+    auto reg = it->second;
+    _registrations.erase(it);
+    reg->removed = true;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, reg->fd, nullptr);
+
+    // Removing from inside our own dispatch, the I/O thread drops it when the callback returns.
+    if (reg->busy && reg->busy_thread == std::this_thread::get_id()) return;
+    _idle_cv.wait(lock, [&reg] { return !reg->busy; });
+}
+
+void ClientReactor::_io_loop() {
+    epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (_running.load()) {
+        int n = epoll_wait(_epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            uint64_t id = events[i].data.u64;
+            if (id == 0) continue; // wake descriptor
+
+            std::shared_ptr<Registration> reg;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto it = _registrations.find(id);
+                if (it == _registrations.end()) continue;
+                reg = it->second;
+                reg->busy = true;
+                reg->busy_thread = std::this_thread::get_id();
+            }
+
+            bool keep = reg->client->_on_readable();
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                reg->busy = false;
+                if (!reg->removed) {
+                    if (keep) {
+                        epoll_event ev{};
+                        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                        ev.data.u64 = id;
+                        epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, reg->fd, &ev);
+                    } else {
+                        // Connection lost - the socket itself is closed by disconnect().
+                        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, reg->fd, nullptr);
+                        _registrations.erase(id);
+                        reg->removed = true;
+                    }
+                }
+            }
+            _idle_cv.notify_all();
+        }
+    }
+}
@@ -1,4 +1,5 @@
 #include "Helpers.h"
+#include "wire_codec.h"
 
 #include <string>
 #include <cctype>
@@ -26,4 +27,4 @@ bool _is_valid_ttl(uint32_t ttl) {
 void extract_convert_net_to_host(const std::string &data, size_t offset, uint32_t &output) {
     std::memcpy(&output, data.data() + offset, sizeof(uint32_t));
     output = ntohl(output);
-}
\ No newline at end of file
+}
@@ -1,10 +1,15 @@
 #include "MessageQueueClient.h"
 #include "Protocol.h"
 #include "Helpers.h"
+#include "compression.h"
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+#include <climits>
 
 #include <string>
 #include <unistd.h>
@@ -12,6 +17,8 @@
 #include <thread>
 #include <vector>
 #include <cctype>
+#include <random>
+#include <sstream>
 
 std::mutex cout_mutex;
 
@@ -34,6 +41,12 @@ MessageQueueClient::MessageQueueClient(const std::string &client_login)
       _connected(false)
 {}
 
+MessageQueueClient::MessageQueueClient(const std::string &client_login, ClientReactor &reactor)
+    : MessageQueueClient(client_login)
+{
+    _reactor = &reactor;
+}
+
 MessageQueueClient::~MessageQueueClient() {
     disconnect();
 }
@@ -43,75 +56,418 @@ MessageQueueClient::~MessageQueueClient() {
 // ------------------------------
 
 bool MessageQueueClient::connect_to_server(const std::string &host, const std::string &port) {
+    {
+        std::lock_guard<std::mutex> lock(_reconnect_mutex);
+        _stopping = false;
+    }
+    _host = host;
+    _port = port;
+
+    if (!_open_connection()) return false;
+    _connected.store(true);
+    _start_receiving();
+    return true;
+}
+
+bool MessageQueueClient::attach_socket(int sock) {
+    {
+        std::lock_guard<std::mutex> lock(_reconnect_mutex);
+        _stopping = false;
+    }
+    // Nothing to reconnect to, the caller owns the transport.
+    _host.clear();
+    _port.clear();
+
+    _socket = sock;
+    if (!_prepare_connection()) return false;
+    _connected.store(true);
+    _start_receiving();
+    return true;
+}
+
+bool MessageQueueClient::_open_connection() {
     addrinfo hints{}, *res{};
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
-    if (int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &res)) {
+    if (int err = getaddrinfo(_host.c_str(), _port.c_str(), &hints, &res)) {
         thread_safe_print(gai_strerror(err));
         return false;
     }
     _socket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
     const int reuse{1};
     setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    struct timeval tv{};
-    tv.tv_sec = SOCKET_TIMEOUT_VALUE;
-    tv.tv_usec = 0;
-    setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 
     if (connect(_socket, res->ai_addr, res->ai_addrlen) == -1) {
         thread_safe_print("DEBUG: Error with connect");
         freeaddrinfo(res);
-        close(_socket);
+        close(_socket.exchange(-1));
         return false;
     }
     freeaddrinfo(res);
+    return _prepare_connection();
+}
+
+bool MessageQueueClient::_prepare_connection() {
+    struct timeval tv{};
+    tv.tv_sec = SOCKET_TIMEOUT_VALUE;
+    tv.tv_usec = 0;
+    setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
     if (!_verify_connection()) {
-        close(_socket);
-        _socket = -1;
+        close(_socket.exchange(-1));
         return false;
     }
-    _connected.store(true);
+    _rx_buffer.clear();
+    _rx_discard = 0;
+    _rx_chunks.clear();
+    if (_login_status.find("OK:RECONNECTED") != 0) {
+        // Handles belong to the broker that returned them. A session the
+        // server kept keeps its subscriptions without subscribing again, so
+        // their handles stay learned: the broker numbers each queue for its
+        // whole life, and a queue deleted meanwhile answers ER:NO_QUEUE.
+        std::lock_guard<std::mutex> lock(_handles_mutex);
+        _queue_handles.clear();
+        _handle_names.clear();
+    }
+    {
+        // Deltas apply only on top of a snapshot from this connection.
+        std::lock_guard<std::mutex> lock(_queues_cache_mutex);
+        _queue_list_synced = false;
+    }
+    {
+        // A new socket may reuse the descriptor number, zero-copy must be enabled again.
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        _zerocopy_socket = -1;
+    }
+    if ((_capabilities.load() & Feature::QueueListFilter) && !_queue_list_prefixes.empty()) {
+        // The server sends no list until it knows which queues we want.
+        std::string filter = Protocol::_prepare_message('Q', 'F', Protocol::_pack_queue_list_filter(_queue_list_prefixes), _compact.load());
+        std::lock_guard<std::mutex> lock(_send_mutex);
+        if (!_send_message(_socket, filter)) {
+            close(_socket.exchange(-1));
+            return false;
+        }
+    }
+    return true;
+}
+
+void MessageQueueClient::_start_receiving() {
+    if (_reactor) {
+        _reactor_id = _reactor->_add(this, _socket);
+        if (_reactor_id == 0) _handle_error_event("Reactor registration failed.", true);
+        return;
+    }
     _receiver_thread = std::thread(&MessageQueueClient::_receiver_loop, this);
+}
+
+void MessageQueueClient::set_compression(bool enabled, size_t threshold) {
+    if (enabled) _requested_capabilities |= wire::available_compression();
+    else _requested_capabilities &= ~wire::CAP_COMPRESSION_ANY;
+    _compression_threshold.store(threshold);
+}
+
+bool MessageQueueClient::set_tracing(uint32_t sample_one_in, const std::string &export_path) {
+    if (sample_one_in == 0) {
+        _requested_capabilities &= ~Feature::Tracing;
+        _trace_sample = 0;
+        return true;
+    }
+    auto spans = std::make_shared<trace::span_ring>(_client_login);
+    if (!export_path.empty() && !spans->set_export_file(export_path)) return false;
+    _requested_capabilities |= Feature::Tracing;
+    _trace_sample = sample_one_in;
+    _spans = std::move(spans);
+    // Random base keeps trace ids of different clients apart.
+    std::random_device random;
+    _trace_id_base = (static_cast<uint64_t>(random()) << 32) | random();
     return true;
 }
 
+std::vector<trace::span> MessageQueueClient::trace_spans() const {
+    if (!_spans) return {};
+    return _spans->snapshot();
+}
+
+uint64_t MessageQueueClient::_next_trace_id() {
+    if (_trace_sample == 0 || !_tracing.load()) return 0;
+    uint64_t sequence = _trace_sequence.fetch_add(1, std::memory_order_relaxed);
+    if (sequence % _trace_sample != 0) return 0;
+    uint64_t id = _trace_id_base + sequence;
+    return id != 0 ? id : 1;
+}
+
+void MessageQueueClient::_trace_delivery(const Event &ev) {
+    if (ev._trace_id != 0 && _spans) _spans->record(ev._trace_id, trace::hop::CLIENT_DELIVER);
+}
+
 void MessageQueueClient::disconnect() {
-    bool was_connected = _connected.exchange(false);
-    
-    if (was_connected) {
-        int sock = _socket.exchange(-1);
-        if (sock != -1) {
-            shutdown(sock, SHUT_RDWR);
-            close(sock);
-        }
+    // Stop a reconnect in progress first, it owns the connection while running.
+    std::thread reconnect_thread;
+    {
+        std::lock_guard<std::mutex> lock(_reconnect_mutex);
+        _stopping = true;
+        reconnect_thread = std::move(_reconnect_thread);
+    }
+    _reconnect_cv.notify_all();
+    // Releases a restore waiting for resubscribe acknowledgments.
+    _fail_pending("ER:DISCONNECTED");
+    if (reconnect_thread.joinable()) reconnect_thread.join();
+
+    _connected.store(false);
+    _reconnecting.store(false);
+
+    // Reactor dispatch must be finished before the descriptor can be closed and reused.
+    if (_reactor && _reactor_id != 0) {
+        _reactor->_remove(_reactor_id);
+        _reactor_id = 0;
     }
-    
+
+    int sock = _socket.exchange(-1);
+    if (sock != -1) shutdown(sock, SHUT_RDWR);
+
     if (_receiver_thread.joinable()) _receiver_thread.join();
+    if (sock != -1) close(sock);
+    _fail_pending("ER:DISCONNECTED");
+
+    std::deque<BufferedPublish> buffered;
+    {
+        std::lock_guard<std::mutex> lock(_outage_mutex);
+        buffered.swap(_outage_buffer);
+        _outage_buffer_bytes = 0;
+    }
+    for (auto &pub : buffered) {
+        if (pub.op) pub.op->complete({false, "ER:DISCONNECTED"});
+    }
 }
 
 void MessageQueueClient::_handle_error_event(const std::string &reason, bool is_fatal) {
     if(!_connected.load()) return; // We don't bother with handling event when we are disconnecting
 
+    if (is_fatal && _start_reconnect(reason)) return;
+
     Event ev;
     if (is_fatal) {
         ev._type = Event::Type::Disconnected;
         _connected.store(false);
+        _fail_pending("ER:DISCONNECTED");
     }
     else {
         ev._type = Event::Type::Error;
     }
     ev._result.push_back(reason);
 
+    _post_event(std::move(ev));
+}
+
+// ------------------------------
+// RECONNECT
+// ------------------------------
+
+bool MessageQueueClient::_start_reconnect(const std::string &reason) {
+    // Attached sockets can not be reopened.
+    if (!_reconnect_policy.enabled || _host.empty()) return false;
     {
-        std::lock_guard<std::mutex> lock(_event_mutex);
-        _event_queue.push(std::move(ev));
+        std::lock_guard<std::mutex> lock(_reconnect_mutex);
+        if (_stopping) return false;
+
+        // Publishes are buffered from now on, before the connection is marked down.
+        _reconnecting.store(true);
+        _connected.store(false);
+        _connection_epoch.fetch_add(1);
+
+        // Requests in flight may or may not have reached the server, their outcome is unknown.
+        // Failing them also releases a previous reconnect thread still waiting for acknowledgments.
+        _fail_pending("ER:DISCONNECTED");
+
+        // A previous reconnect thread has already handed the connection over and is
+        // finishing. The new one waits for it, this may run on the I/O thread it needs.
+        std::thread previous = std::move(_reconnect_thread);
+        _reconnect_thread = std::thread([this, previous = std::move(previous)]() mutable {
+            if (previous.joinable()) previous.join();
+            _reconnect_loop();
+        });
     }
-    _event_cv.notify_one();
+
+    Event ev;
+    ev._type = Event::Type::Error;
+    ev._result.push_back(reason + " Reconnecting.");
+    _post_event(std::move(ev));
+    return true;
+}
+
+void MessageQueueClient::_reconnect_loop() {
+    // Let the failed reader finish before its socket is closed and the descriptor reused.
+    if (_reactor && _reactor_id != 0) {
+        _reactor->_remove(_reactor_id);
+        _reactor_id = 0;
+    }
+    if (_receiver_thread.joinable()) _receiver_thread.join();
+    int old_sock = _socket.exchange(-1);
+    if (old_sock != -1) close(old_sock);
+
+    std::minstd_rand rng(std::random_device{}());
+    std::uniform_real_distribution<double> jitter(0.8, 1.2);
+    auto backoff = _reconnect_policy.initial_backoff;
+
+    for (uint32_t attempt = 1; ; ++attempt) {
+        {
+            std::unique_lock<std::mutex> lock(_reconnect_mutex);
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(backoff * jitter(rng));
+            if (_reconnect_cv.wait_for(lock, delay, [this] { return _stopping; })) return;
+        }
+
+        if (_open_connection()) break;
+
+        if (_reconnect_policy.max_attempts != 0 && attempt >= _reconnect_policy.max_attempts) {
+            _reconnecting.store(false);
+            std::deque<BufferedPublish> buffered;
+            {
+                std::lock_guard<std::mutex> lock(_outage_mutex);
+                buffered.swap(_outage_buffer);
+                _outage_buffer_bytes = 0;
+            }
+            for (auto &pub : buffered) {
+                if (pub.op) pub.op->complete({false, "ER:DISCONNECTED"});
+            }
+
+            Event ev;
+            ev._type = Event::Type::Disconnected;
+            ev._result.push_back("Reconnect failed after " + std::to_string(attempt) + " attempts.");
+            _post_event(std::move(ev));
+            return;
+        }
+        auto next = std::chrono::duration_cast<std::chrono::milliseconds>(backoff * _reconnect_policy.backoff_multiplier);
+        backoff = std::min(next, _reconnect_policy.max_backoff);
+    }
+
+    _connected.store(true);
+    _start_receiving();
+    _restore_session();
+}
+
+void MessageQueueClient::_restore_session() {
+    uint64_t epoch = _connection_epoch.load();
+    std::vector<std::pair<std::string, AsyncOperation>> resubscribed;
+
+    // A session the server kept still has its subscriptions.
+    if (_login_status.find("OK:RECONNECTED") != 0) {
+        std::vector<std::string> queues;
+        {
+            std::lock_guard<std::mutex> lock(_subscriptions_mutex);
+            queues.assign(_subscriptions.begin(), _subscriptions.end());
+        }
+        for (const auto &queue_name : queues) {
+            resubscribed.emplace_back(queue_name, subscribe_async(queue_name));
+        }
+    }
+
+    // Flush publishes in order. Publishing goes direct only once the buffer is
+    // seen empty under its lock, so no new publish overtakes a buffered one.
+    while (true) {
+        BufferedPublish pub;
+        {
+            std::lock_guard<std::mutex> lock(_outage_mutex);
+            // Lost again meanwhile, the next reconnect flushes what is left.
+            if (_connection_epoch.load() != epoch) break;
+            if (_outage_buffer.empty()) {
+                _reconnecting.store(false);
+                break;
+            }
+            pub = std::move(_outage_buffer.front());
+            _outage_buffer.pop_front();
+            _outage_buffer_bytes -= pub.content.size();
+        }
+        std::string_view content = pub.content;
+        if (!_send_publish(pub.queue_name, std::span<const std::string_view>(&content, 1), pub.ttl, pub.op) && pub.op) {
+            pub.op->complete({false, "ER:SEND_FAILED"});
+        }
+    }
+
+    Event ev;
+    ev._type = Event::Type::StatusUpdate;
+    ev._result.push_back("Reconnected");
+    _post_event(std::move(ev));
+
+    // Queues that vanished while we were away are forgotten.
+    for (auto &[queue_name, op] : resubscribed) {
+        AsyncResult result = op.wait_for(std::chrono::seconds(SOCKET_TIMEOUT_VALUE));
+        if (!result.ok && result.status.find("ER:NO_QUEUE") == 0) {
+            std::lock_guard<std::mutex> lock(_subscriptions_mutex);
+            _subscriptions.erase(queue_name);
+        }
+    }
+}
+
+bool MessageQueueClient::_try_buffer_publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl, const std::shared_ptr<AsyncOperationState> &op, bool &accepted) {
+    if (!_reconnecting.load()) return false;
+
+    // Checked again under the lock, the flush may have just finished.
+    std::lock_guard<std::mutex> lock(_outage_mutex);
+    if (!_reconnecting.load()) return false;
+
+    size_t content_size = 0;
+    for (auto part : parts) content_size += part.size();
+
+    accepted = _outage_buffer.size() < _reconnect_policy.max_buffered_publishes &&
+               _outage_buffer_bytes + content_size <= _reconnect_policy.max_buffered_bytes;
+    if (accepted) {
+        std::string content;
+        content.reserve(content_size);
+        for (auto part : parts) content.append(part);
+        _outage_buffer.push_back({queue_name, std::move(content), ttl, op});
+        _outage_buffer_bytes += content_size;
+    }
+    return true;
+}
+
+void MessageQueueClient::_track_subscription(char cmd, const std::string &queue_name, bool ok) {
+    if (queue_name.empty()) return;
+    std::lock_guard<std::mutex> lock(_subscriptions_mutex);
+    if (cmd == Action::Subscribe && ok) _subscriptions.insert(queue_name);
+    else if (cmd == Action::Unsubscribe && ok) _subscriptions.erase(queue_name);
+}
+
+void MessageQueueClient::_cache_queue_handle(const std::string &queue_name, const std::string &payload) {
+    size_t offset = 2;
+    uint32_t handle = 0;
+    if (queue_name.empty() || wire::read_varint(payload, offset, handle) != wire::decode_status::COMPLETE || handle == 0) return;
+
+    std::lock_guard<std::mutex> lock(_handles_mutex);
+    _queue_handles[queue_name] = handle;
+    _handle_names[handle] = queue_name;
+}
+
+void MessageQueueClient::_forget_queue_handle(const std::string &queue_name) {
+    std::lock_guard<std::mutex> lock(_handles_mutex);
+    auto it = _queue_handles.find(queue_name);
+    if (it == _queue_handles.end()) return;
+    _handle_names.erase(it->second);
+    _queue_handles.erase(it);
+}
+
+uint32_t MessageQueueClient::_queue_handle(const std::string &queue_name) {
+    std::lock_guard<std::mutex> lock(_handles_mutex);
+    auto it = _queue_handles.find(queue_name);
+    return it == _queue_handles.end() ? 0 : it->second;
+}
+
+std::string MessageQueueClient::_queue_name_for_handle(uint32_t handle) {
+    std::lock_guard<std::mutex> lock(_handles_mutex);
+    auto it = _handle_names.find(handle);
+    return it == _handle_names.end() ? "#" + std::to_string(handle) : it->second;
 }
 
 bool MessageQueueClient::_verify_connection() {
-    std::string login_msg = Protocol::_prepare_message('L', 'O', _client_login);
+    std::string login_payload = _client_login;
+    // Queue statistics need no setup, only a hello learns whether the server answers them.
+    uint32_t requested = _requested_capabilities != 0 ? _requested_capabilities | Feature::QueueStats : 0;
+    if (requested != 0) {
+        char hello[wire::HELLO_SIZE];
+        login_payload += '\0';
+        login_payload.append(hello, wire::encode_hello(hello, {wire::PROTOCOL_VERSION, requested, MAX_PAYLOAD}));
+    }
+    std::string login_msg = Protocol::_prepare_message('L', 'O', login_payload);
     if (!_send_message(_socket, login_msg))
         return false;
 
@@ -120,7 +476,11 @@ bool MessageQueueClient::_verify_connection() {
     if (!_read_exactly(_socket, header, HEADER_PACKET_SIZE))
         return false;
 
-    auto [role, cmd, len] = Protocol::_decode_packet(std::string(header, HEADER_PACKET_SIZE));
+    wire::frame_header frame;
+    wire::decode_header(header, HEADER_PACKET_SIZE, false, frame);
+    char role = frame.code[0];
+    char cmd = frame.code[1];
+    uint32_t len = frame.payload_size;
 
     if (len > MAX_PAYLOAD) {
         thread_safe_print("DEBUG: Server sent too much data.");
@@ -135,6 +495,21 @@ bool MessageQueueClient::_verify_connection() {
     // Server accept new client by sending LO message.
     if (role == 'L' && cmd == 'O') {
         if (payload.find("OK") == 0) {
+            // The server answers a hello with its own, old servers only send the status.
+            wire::hello hello;
+            size_t separator = payload.find('\0');
+            if (separator != std::string::npos)
+                wire::decode_hello(payload.data() + separator + 1, payload.size() - separator - 1, hello);
+            uint32_t accepted = hello.capabilities & requested;
+            _capabilities.store(accepted);
+            _protocol_version.store(std::min(hello.version, wire::PROTOCOL_VERSION));
+            _server_max_frame.store(hello.max_frame);
+            _compact.store((accepted & Feature::CompactFraming) != 0);
+            _compression.store((accepted & wire::CAP_COMPRESSION_ANY) != 0);
+            _chunking.store((accepted & Feature::Chunking) != 0);
+            _tracing.store((accepted & Feature::Tracing) != 0);
+            _publish_encoding.store(wire::preferred_encoding(accepted));
+            _login_status = payload.substr(0, separator);
             return true;
         }
     }
@@ -149,33 +524,130 @@ bool MessageQueueClient::_verify_connection() {
 
 bool MessageQueueClient::create_queue(const std::string &queue_name) {
     if (!_connected.load() || !_is_valid_queue_name(queue_name)) return false;
-    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Create, queue_name);
-    return MessageQueueClient::_send_message(_socket, message);
+    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Create, queue_name, _compact.load());
+    return _send_request(Role::Publisher, Action::Create, message, nullptr, queue_name);
 }
 
 bool MessageQueueClient::delete_queue(const std::string &queue_name) {
     if (!_connected.load()) return false;
-    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Delete, queue_name);
-    return MessageQueueClient::_send_message(_socket, message);
+    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Delete, queue_name, _compact.load());
+    return _send_request(Role::Publisher, Action::Delete, message, nullptr, queue_name);
 }
 
-bool MessageQueueClient::publish(const std::string &queue_name, const std::string &content, uint32_t ttl) {
-    if (!_is_valid_ttl(ttl) || !_connected.load()) return false;
-    std::string internal_payload = Protocol::_pack_publish_data(queue_name, content, ttl);
-    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Publish, internal_payload);
-    return MessageQueueClient::_send_message(_socket, message);
+bool MessageQueueClient::publish(const std::string &queue_name, std::string_view content, uint32_t ttl) {
+    return publish(queue_name, std::span<const std::string_view>(&content, 1), ttl);
+}
+
+bool MessageQueueClient::publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl) {
+    if (!_is_valid_ttl(ttl) || !_fits_server_frame(queue_name, parts)) return false;
+    bool accepted = false;
+    if (_try_buffer_publish(queue_name, parts, ttl, nullptr, accepted)) return accepted;
+    if (!_connected.load()) return false;
+    return _send_publish(queue_name, parts, ttl, nullptr);
 }
 
 bool MessageQueueClient::subscribe(const std::string &queue_name) {
     if (!_connected.load()) return false;
-    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Subscribe, queue_name);
-    return MessageQueueClient::_send_message(_socket, message);
+    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Subscribe, queue_name, _compact.load());
+    return _send_request(Role::Subscriber, Action::Subscribe, message, nullptr, queue_name);
 }
 
 bool MessageQueueClient::unsubscribe(const std::string &queue_name) {
     if (!_connected.load()) return false;
-    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Unsubscribe, queue_name);
-    return MessageQueueClient::_send_message(_socket, message);
+    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Unsubscribe, queue_name, _compact.load());
+    return _send_request(Role::Subscriber, Action::Unsubscribe, message, nullptr, queue_name);
+}
+
+// ------------------------------
+// ASYNC ACTIONS
+// ------------------------------
+
+AsyncOperation MessageQueueClient::create_queue_async(const std::string &queue_name) {
+    if (!_is_valid_queue_name(queue_name)) return AsyncOperation::ready({false, "ER:INVALID_ARGUMENT"});
+    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Create, queue_name, _compact.load());
+    return _send_async_request(Role::Publisher, Action::Create, message, queue_name);
+}
+
+AsyncOperation MessageQueueClient::delete_queue_async(const std::string &queue_name) {
+    std::string message = Protocol::_prepare_message(Role::Publisher, Action::Delete, queue_name, _compact.load());
+    return _send_async_request(Role::Publisher, Action::Delete, message, queue_name);
+}
+
+AsyncOperation MessageQueueClient::publish_async(const std::string &queue_name, std::string_view content, uint32_t ttl) {
+    return publish_async(queue_name, std::span<const std::string_view>(&content, 1), ttl);
+}
+
+AsyncOperation MessageQueueClient::publish_async(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl) {
+    if (!_is_valid_ttl(ttl)) return AsyncOperation::ready({false, "ER:INVALID_ARGUMENT"});
+    if (!_fits_server_frame(queue_name, parts)) return AsyncOperation::ready({false, "ER:MSG_TOO_BIG"});
+
+    auto state = std::make_shared<AsyncOperationState>(_executor.load());
+    bool accepted = false;
+    if (_try_buffer_publish(queue_name, parts, ttl, state, accepted)) {
+        if (!accepted) state->complete({false, "ER:BUFFER_FULL"});
+        return AsyncOperation(state);
+    }
+    if (!_connected.load()) return AsyncOperation::ready({false, "ER:DISCONNECTED"});
+
+    if (!_send_publish(queue_name, parts, ttl, state)) {
+        state->complete({false, "ER:SEND_FAILED"});
+    }
+    return AsyncOperation(state);
+}
+
+AsyncOperation MessageQueueClient::subscribe_async(const std::string &queue_name) {
+    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Subscribe, queue_name, _compact.load());
+    return _send_async_request(Role::Subscriber, Action::Subscribe, message, queue_name);
+}
+
+AsyncOperation MessageQueueClient::unsubscribe_async(const std::string &queue_name) {
+    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Unsubscribe, queue_name, _compact.load());
+    return _send_async_request(Role::Subscriber, Action::Unsubscribe, message, queue_name);
+}
+
+AsyncOperation MessageQueueClient::server_stats_async() {
+    std::string message = Protocol::_prepare_message(Role::Subscriber, Action::Stats, "", _compact.load());
+    return _send_async_request(Role::Subscriber, Action::Stats, message, "");
+}
+
+AsyncOperation MessageQueueClient::queue_stats_async(const std::string &queue_name) {
+    if (!queue_name.empty() && !_is_valid_queue_name(queue_name)) return AsyncOperation::ready({false, "ER:INVALID_ARGUMENT"});
+    // A server that negotiated without QS would never answer it.
+    if (_protocol_version.load() != 0 && !(_capabilities.load() & Feature::QueueStats)) return AsyncOperation::ready({false, "ER:NOT_SUPPORTED"});
+    std::string message = Protocol::_prepare_message(Role::Query, Action::QueueStats, queue_name, _compact.load());
+    return _send_async_request(Role::Query, Action::QueueStats, message, queue_name);
+}
+
+bool MessageQueueClient::queue_stats(const std::string &queue_name, std::vector<QueueStats> &stats) {
+    AsyncResult result = queue_stats_async(queue_name).wait_for(std::chrono::seconds(SOCKET_TIMEOUT_VALUE));
+    if (!result.ok) return false;
+    stats = parse_queue_stats(result.data);
+    return true;
+}
+
+std::vector<QueueStats> MessageQueueClient::parse_queue_stats(const std::string &data) {
+    // name depth retained_bytes subscribers published delivered publish_rate deliver_rate oldest_age_ms
+    std::vector<QueueStats> stats;
+    std::istringstream lines(data);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        QueueStats s;
+        if (fields >> s.name >> s.depth >> s.retained_bytes >> s.subscribers >> s.published >> s.delivered >>
+            s.publish_rate >> s.deliver_rate >> s.oldest_age_ms)
+            stats.push_back(std::move(s));
+    }
+    return stats;
+}
+
+AsyncOperation MessageQueueClient::_send_async_request(char role, char cmd, const std::string &message, const std::string &queue_name) {
+    if (!_connected.load()) return AsyncOperation::ready({false, "ER:DISCONNECTED"});
+
+    auto state = std::make_shared<AsyncOperationState>(_executor.load());
+    if (!_send_request(role, cmd, message, state, queue_name)) {
+        state->complete({false, "ER:SEND_FAILED"});
+    }
+    return AsyncOperation(state);
 }
 
 // ------------------------------
@@ -195,6 +667,322 @@ bool MessageQueueClient::_send_message(int sock, const std::string &data) {
     return true;
 }
 
+bool MessageQueueClient::_send_request(char role, char cmd, const std::string &message, const std::shared_ptr<AsyncOperationState> &op, const std::string &queue_name) {
+    std::vector<iovec> iov{{const_cast<char *>(message.data()), message.size()}};
+    return _send_request(role, cmd, iov, op, queue_name, false);
+}
+
+bool MessageQueueClient::_send_request(char role, char cmd, std::vector<iovec> &iov, const std::shared_ptr<AsyncOperationState> &op, const std::string &queue_name, bool zerocopy) {
+    std::lock_guard<std::mutex> send_lock(_send_mutex);
+    {
+        std::lock_guard<std::mutex> lock(_pending_mutex);
+        _pending_acks[_ack_key(role, cmd)].push_back({op, queue_name});
+    }
+    int sock = _socket.load();
+    if (zerocopy && !_enable_zerocopy(sock)) zerocopy = false;
+    if (_send_iov(sock, iov, zerocopy)) return true;
+
+    // Nothing will acknowledge a request that was not sent. It is the newest
+    // entry of its command since the send lock is still held.
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    auto &pending = _pending_acks[_ack_key(role, cmd)];
+    if (!pending.empty()) pending.pop_back();
+    return false;
+}
+
+bool MessageQueueClient::_fits_server_frame(const std::string &queue_name, std::span<const std::string_view> parts) const {
+    // Chunked frames are limited by the reassembly limit, not by the frame size.
+    uint32_t limit = _chunking.load() ? wire::MAX_CHUNKED_MESSAGE_SIZE : _server_max_frame.load();
+    if (limit == 0) return true;
+    // Standard publish payload, the compact one is never larger.
+    size_t payload_size = 8 + queue_name.size();
+    for (auto part : parts) payload_size += part.size();
+    return payload_size <= limit;
+}
+
+bool MessageQueueClient::_send_publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl, const std::shared_ptr<AsyncOperationState> &op) {
+    size_t content_size = 0;
+    for (auto part : parts) content_size += part.size();
+
+    // With compression negotiated the content is [encoding(1b)][data].
+    char encoding_byte = static_cast<char>(wire::encoding::NONE);
+    std::string compressed;
+    bool compression = _compression.load();
+    if (compression && content_size >= _compression_threshold.load()) {
+        wire::encoding enc = _publish_encoding.load();
+        std::string joined;
+        joined.reserve(content_size);
+        for (auto part : parts) joined.append(part);
+        // Incompressible content is sent as it is.
+        if (wire::compress(enc, joined, compressed) && compressed.size() < content_size)
+            encoding_byte = static_cast<char>(enc);
+        else
+            compressed.clear();
+    }
+    size_t body_size = compression ? 1 + (compressed.empty() ? content_size : compressed.size()) : content_size;
+
+    // A sampled publish goes out as PT with the trace context after the content.
+    // Chunked publishes, and ones the trace context would push over the frame limit, are not traced.
+    bool chunked = _chunking.load() && body_size > wire::CHUNK_SIZE;
+    uint32_t max_frame = _server_max_frame.load();
+    bool traceable = !chunked && (max_frame == 0 || 8 + queue_name.size() + body_size + trace::TRACE_CONTEXT_SIZE <= max_frame);
+    uint64_t trace_id = traceable ? _next_trace_id() : 0;
+    char trace_context[trace::TRACE_CONTEXT_SIZE];
+    size_t frame_body_size = body_size;
+    if (trace_id != 0) {
+        uint64_t publish_ns = trace::wall_ns();
+        trace::write_u64(trace_context, trace_id);
+        trace::write_u64(trace_context + trace::TRACE_ID_SIZE, publish_ns);
+        _spans->record_at(trace_id, trace::hop::CLIENT_PUBLISH, publish_ns);
+        frame_body_size += trace::TRACE_CONTEXT_SIZE;
+    }
+
+    char header[std::max(PUBLISH_HEADER_SIZE, COMPACT_PUBLISH_HEADER_MAX_SIZE)];
+    size_t header_size = PUBLISH_HEADER_SIZE;
+    uint32_t handle = 0;
+    if (_compact.load()) {
+        handle = _queue_handle(queue_name);
+        header_size = Protocol::_pack_compact_publish_header(header, handle, queue_name.size(), frame_body_size, ttl);
+    } else {
+        Protocol::_pack_publish_header(header, queue_name.size(), frame_body_size, ttl);
+    }
+    // Both framings start with the type, PT is acknowledged like PB.
+    if (trace_id != 0) header[1] = Action::PublishTraced;
+
+    std::vector<iovec> iov;
+    iov.reserve(parts.size() + 4);
+    iov.push_back({header, header_size});
+    // A known handle replaces the queue name on the wire.
+    if (handle == 0) iov.push_back({const_cast<char *>(queue_name.data()), queue_name.size()});
+    if (compression) iov.push_back({&encoding_byte, 1});
+    if (!compressed.empty()) {
+        iov.push_back({compressed.data(), compressed.size()});
+    } else {
+        for (auto part : parts) {
+            if (!part.empty()) iov.push_back({const_cast<char *>(part.data()), part.size()});
+        }
+    }
+    if (trace_id != 0) iov.push_back({trace_context, sizeof(trace_context)});
+
+    size_t threshold = _zerocopy_threshold.load();
+    bool zerocopy = threshold != 0 && compressed.empty() && content_size >= threshold;
+    if (chunked) {
+        // Chunks carry the publish payload, the frame header is replaced by chunk headers.
+        wire::frame_header frame;
+        wire::decode_header(header, header_size, _compact.load(), frame);
+        iov[0] = {header + frame.size, header_size - frame.size};
+        return _send_chunked_request(Role::Publisher, Action::Publish, iov, op, queue_name, zerocopy);
+    }
+    return _send_request(Role::Publisher, Action::Publish, iov, op, queue_name, zerocopy);
+}
+
+bool MessageQueueClient::_send_chunked_request(char role, char cmd, std::vector<iovec> &payload, const std::shared_ptr<AsyncOperationState> &op, const std::string &queue_name, bool zerocopy) {
+    size_t total = 0;
+    for (const iovec &part : payload) total += part.iov_len;
+    if (total > wire::MAX_CHUNKED_MESSAGE_SIZE) return false;
+
+    bool compact = _compact.load();
+    int sock = _socket.load();
+    wire::chunk_header chunk;
+    chunk.stream_id = _next_stream_id.fetch_add(1);
+    chunk.code[0] = role;
+    chunk.code[1] = cmd;
+    chunk.total_size = static_cast<uint32_t>(total);
+
+    size_t part = 0;
+    size_t sent = 0;
+    do {
+        size_t data_size = std::min(wire::CHUNK_SIZE, total - sent);
+        chunk.flags = (sent == 0 ? wire::CHUNK_FIRST : 0) | (sent + data_size == total ? wire::CHUNK_LAST : 0);
+        bool last = (chunk.flags & wire::CHUNK_LAST) != 0;
+
+        char chunk_header[wire::MAX_CHUNK_HEADER_SIZE];
+        size_t chunk_header_size = wire::encode_chunk_header(chunk_header, chunk);
+        char header[wire::MAX_HEADER_SIZE + wire::MAX_CHUNK_HEADER_SIZE];
+        size_t header_size = wire::encode_header(header, wire::frame_type::CHUNK, static_cast<uint32_t>(chunk_header_size + data_size), compact);
+        std::memcpy(header + header_size, chunk_header, chunk_header_size);
+        header_size += chunk_header_size;
+
+        // Slices of the payload buffers that make up this chunk.
+        std::vector<iovec> iov{{header, header_size}};
+        for (size_t needed = data_size; needed > 0;) {
+            iovec &source = payload[part];
+            size_t take = std::min(needed, source.iov_len);
+            if (take > 0) iov.push_back({source.iov_base, take});
+            source.iov_base = static_cast<char *>(source.iov_base) + take;
+            source.iov_len -= take;
+            needed -= take;
+            if (source.iov_len == 0) ++part;
+        }
+
+        std::lock_guard<std::mutex> send_lock(_send_mutex);
+        // The rest of a stream is useless on a new connection.
+        if (_socket.load() != sock) return false;
+        if (last) {
+            std::lock_guard<std::mutex> lock(_pending_mutex);
+            _pending_acks[_ack_key(role, cmd)].push_back({op, queue_name});
+        }
+        bool chunk_zerocopy = zerocopy && _enable_zerocopy(sock);
+        if (!_send_iov(sock, iov, chunk_zerocopy)) {
+            if (last) {
+                std::lock_guard<std::mutex> lock(_pending_mutex);
+                auto &pending = _pending_acks[_ack_key(role, cmd)];
+                if (!pending.empty()) pending.pop_back();
+            }
+            return false;
+        }
+        sent += data_size;
+    } while (sent < total);
+    return true;
+}
+
+bool MessageQueueClient::_send_iov(int sock, std::vector<iovec> &iov, bool zerocopy) {
+    if (sock < 0) return false;
+
+    int flags = MSG_NOSIGNAL;
+#ifdef MSG_ZEROCOPY
+    if (zerocopy) flags |= MSG_ZEROCOPY;
+#endif
+    bool zerocopy_used = false;
+
+    size_t first = 0;
+    while (first < iov.size()) {
+        msghdr msg{};
+        msg.msg_iov = iov.data() + first;
+        msg.msg_iovlen = std::min<size_t>(iov.size() - first, IOV_MAX);
+
+        ssize_t sent = sendmsg(sock, &msg, flags);
+        if (sent < 0 && errno == EINTR) continue;
+#ifdef MSG_ZEROCOPY
+        // Out of option memory for pinned pages - fall back to a regular copy.
+        if (sent < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+            flags &= ~MSG_ZEROCOPY;
+            continue;
+        }
+        if (sent > 0 && (flags & MSG_ZEROCOPY)) {
+            ++_zerocopy_sent;
+            zerocopy_used = true;
+        }
+#endif
+        if (sent <= 0) return false;
+
+        // Skip fully written buffers and trim a partially written one.
+        size_t remaining = static_cast<size_t>(sent);
+        while (first < iov.size() && remaining >= iov[first].iov_len) {
+            remaining -= iov[first].iov_len;
+            ++first;
+        }
+        if (remaining > 0) {
+            iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + remaining;
+            iov[first].iov_len -= remaining;
+        }
+    }
+    return !zerocopy_used || _wait_zerocopy_completion(sock);
+}
+
+bool MessageQueueClient::_enable_zerocopy(int sock) {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    if (sock < 0) return false;
+    if (_zerocopy_socket == sock) return true;
+
+    const int one{1};
+    if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1) return false;
+    _zerocopy_socket = sock;
+    _zerocopy_sent = 0;
+    _zerocopy_completed = 0;
+    return true;
+#else
+    (void)sock;
+    return false;
+#endif
+}
+
+bool MessageQueueClient::_wait_zerocopy_completion(int sock) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(SOCKET_TIMEOUT_VALUE);
+
+    // The kernel numbers zero-copy sends from 0 per socket and reports released ranges.
+    while (_zerocopy_completed < _zerocopy_sent) {
+        char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+
+            // Pending error queue entries are always reported as POLLERR.
+            pollfd pfd{sock, 0, 0};
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            bool is_recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!is_recverr) continue;
+
+            sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+            if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            _zerocopy_completed = std::max(_zerocopy_completed, err.ee_data + 1);
+        }
+    }
+    return true;
+}
+
+bool MessageQueueClient::_complete_pending(char role, char cmd, const std::string &payload) {
+    PendingRequest request;
+    {
+        std::lock_guard<std::mutex> lock(_pending_mutex);
+        auto it = _pending_acks.find(_ack_key(role, cmd));
+        if (it == _pending_acks.end() || it->second.empty()) return false;
+        request = std::move(it->second.front());
+        it->second.pop_front();
+    }
+    bool ok = payload.find("OK") == 0;
+    if (role == Role::Subscriber) _track_subscription(cmd, request.queue_name, ok);
+
+    std::string status = payload;
+    std::string data;
+    if ((role == Role::Subscriber && cmd == Action::Stats) || (role == Role::Query && cmd == Action::QueueStats)) {
+        // Query replies are "OK\n" followed by the data.
+        size_t separator = payload.find('\n');
+        if (ok && separator != std::string::npos) {
+            status = payload.substr(0, separator);
+            data = payload.substr(separator + 1);
+        }
+    }
+    else if (_compact.load()) {
+        if (ok && payload.size() > 2) {
+            _cache_queue_handle(request.queue_name, payload);
+            status = "OK";
+        }
+        // Only a queue that is gone invalidates the cached handle, other
+        // errors (e.g. ER:ALREADY_SUBSCRIBED) leave it valid.
+        bool queue_gone = ok ? (role == Role::Publisher && cmd == Action::Delete) : payload.find("ER:NO_QUEUE") == 0;
+        if (queue_gone) _forget_queue_handle(request.queue_name);
+    }
+    if (!request.op) return false;
+
+    request.op->complete({ok, status, std::move(data)});
+    return true;
+}
+
+void MessageQueueClient::_fail_pending(const std::string &reason) {
+    std::map<uint16_t, std::deque<PendingRequest>> pending;
+    {
+        std::lock_guard<std::mutex> lock(_pending_mutex);
+        pending.swap(_pending_acks);
+    }
+    for (auto &[key, requests] : pending) {
+        for (auto &request : requests) {
+            if (request.op) request.op->complete({false, reason});
+        }
+    }
+}
+
 bool MessageQueueClient::_read_exactly(int sock, char *buffer, size_t size) {
     if (sock < 0) return false;
 
@@ -209,44 +997,111 @@ bool MessageQueueClient::_read_exactly(int sock, char *buffer, size_t size) {
 }
 
 void MessageQueueClient::_receiver_loop() {
-    char header_buffer[HEADER_PACKET_SIZE];
+    std::vector<char> buffer(RECV_CHUNK_SIZE);
+    int sock = _socket.load();
 
     while (_connected.load()) {
-        if (_socket.load() == -1) break;
-        if (!_read_exactly(_socket, header_buffer, HEADER_PACKET_SIZE)) {
+        ssize_t received = recv(sock, buffer.data(), buffer.size(), 0);
+        if (received <= 0) {
             _handle_error_event("Reading packet failed.", true);
             break;
         }
-        auto [role, cmd, payload_len] = Protocol::_decode_packet(std::string(header_buffer, HEADER_PACKET_SIZE));
+        if (!_consume_input(buffer.data(), static_cast<size_t>(received))) break;
+    }
+}
+
+bool MessageQueueClient::_on_readable() {
+    char buffer[RECV_CHUNK_SIZE];
+    int sock = _socket.load();
+    if (sock == -1) return false;
+
+    while (_connected.load()) {
+        ssize_t received = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received > 0) {
+            if (!_consume_input(buffer, static_cast<size_t>(received))) return false;
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (received < 0 && errno == EINTR) continue;
+
+        _handle_error_event("Reading packet failed.", true);
+        return false;
+    }
+    return false;
+}
+
+bool MessageQueueClient::_consume_input(const char *data, size_t size) {
+    // Skip the rest of an oversized frame without buffering it.
+    if (_rx_discard > 0) {
+        size_t skipped = std::min(_rx_discard, size);
+        _rx_discard -= skipped;
+        data += skipped;
+        size -= skipped;
+    }
+    _rx_buffer.append(data, size);
+
+    bool compact = _compact.load();
+    size_t offset = 0;
+    while (offset < _rx_buffer.size()) {
+        wire::frame_header frame;
+        auto decoded = wire::decode_header(_rx_buffer.data() + offset, _rx_buffer.size() - offset, compact, frame);
+        if (decoded == wire::decode_status::NEED_MORE) break;
+        if (decoded == wire::decode_status::MALFORMED) {
+            // Stream can not be resynchronized after a malformed length,
+            // the connection is dropped and the reconnect policy takes over.
+            _rx_buffer.clear();
+            _handle_error_event("Malformed frame from server.", true);
+            return false;
+        }
+        char role = frame.code[0];
+        char cmd = frame.code[1];
+        uint32_t payload_len = frame.payload_size;
+        size_t header_size = frame.size;
 
         if (payload_len > MAX_PAYLOAD) {
             _handle_error_event("Message from server is too big.", false);
-            std::string discard;
-            discard.resize(payload_len);
-            if (!_read_exactly(_socket, discard.data(), payload_len)) {
-                _handle_error_event("Failed to read oversized payload.", true);
-                break;
-            }
+            offset += header_size;
+            size_t available = std::min<size_t>(payload_len, _rx_buffer.size() - offset);
+            offset += available;
+            _rx_discard = payload_len - available;
             continue;
         }
+        if (_rx_buffer.size() - offset - header_size < payload_len) break;
 
-        std::string payload;
-        if (payload_len > 0) {
-            payload.resize(payload_len);
-            if (!_read_exactly(_socket, payload.data(), payload_len)) {
-                _handle_error_event("Read exactly failed.", true);
-                break;
+        std::string payload = _rx_buffer.substr(offset + header_size, payload_len);
+        offset += header_size + payload_len;
+
+        // A chunked frame is dispatched once its last chunk arrives.
+        if (role == 'C' && cmd == 'K') {
+            char code[wire::TYPE_SIZE];
+            std::string assembled;
+            auto result = _rx_chunks.feed(payload, code, assembled);
+            if (result == wire::chunk_assembler::result::INCOMPLETE) continue;
+            if (result == wire::chunk_assembler::result::ERROR) {
+                _handle_error_event("Invalid chunk from server.", false);
+                continue;
             }
+            role = code[0];
+            cmd = code[1];
+            payload = std::move(assembled);
         }
 
         Event ev{};
         _dispatch_event(role, cmd, payload, ev);
     }
+    _rx_buffer.erase(0, offset);
+    return true;
 }
 
 void MessageQueueClient::_dispatch_event(char &role, char &cmd, std::string &payload, Event &ev) {
+    // MT is an MS followed by the trace id.
+    if (ev.is_new_traced_message(role, cmd)) {
+        if (trace::strip_trace_id(payload, ev._trace_id) && _spans) _spans->record(ev._trace_id, trace::hop::CLIENT_RECEIVE);
+        cmd = 'S';
+    }
     if (ev.is_heartbeat(role, cmd)) {
-        std::string heartbeat = Protocol::_prepare_message('H', 'B', "");
+        std::string heartbeat = Protocol::_prepare_message('H', 'B', "", _compact.load());
+        std::lock_guard<std::mutex> lock(_send_mutex);
         _send_message(_socket, heartbeat);
         return;
     }
@@ -255,10 +1110,15 @@ void MessageQueueClient::_dispatch_event(char &role, char &cmd, std::string &pay
         ev._result = _handle_queue_list_payload(payload);
     }
     else if (ev.is_new_message(role, cmd)) {
-        ev._type = Event::Type::Message;
-        auto [q, msg] = _handle_message_payload(payload);
-        ev._source = q;
-        ev._result.push_back(msg);
+        std::string queue_name, content;
+        if (_handle_message_payload(payload, queue_name, content)) {
+            ev._type = Event::Type::Message;
+            ev._source = queue_name;
+            ev._result.push_back(content);
+        } else {
+            ev._type = Event::Type::Error;
+            ev._result.push_back("Malformed compressed message from queue " + queue_name);
+        }
     }
     else if (ev.is_new_batch_messages(role, cmd)) {
         ev._type = Event::Type::BatchMessages;
@@ -281,7 +1141,31 @@ void MessageQueueClient::_dispatch_event(char &role, char &cmd, std::string &pay
         ev._type = Event::Type::QueueList;
         ev._result = list;
     }
+    else if (ev.is_queue_list_snapshot(role, cmd)) {
+        // [VERSION(4b)] followed by a QL payload.
+        if (payload.size() < 4) return;
+        uint32_t version;
+        extract_convert_net_to_host(payload, 0, version);
+        auto list = _handle_queue_list_payload(payload, 4);
+        {
+            std::lock_guard<std::mutex> lock(_queues_cache_mutex);
+            _available_queues = list;
+            _queue_list_version = version;
+            _queue_list_synced = true;
+        }
+        ev._type = Event::Type::QueueList;
+        ev._result = std::move(list);
+    }
+    else if (ev.is_queue_list_delta(role, cmd)) {
+        std::vector<std::string> list;
+        if (!_apply_queue_list_delta(payload, list)) return;
+        ev._type = Event::Type::QueueList;
+        ev._result = std::move(list);
+    }
     else if (ev.is_new_status_update(role, cmd)) {
+        // Acknowledgments of async requests go to their awaiters only.
+        if (_complete_pending(role, cmd, payload)) return;
+
         if (payload.find("ER:") == 0) {
             ev._type = Event::Type::Error;
             ev._result.push_back("Cmd " + std::string(1, role) + std::string(1, cmd) + " Failed: " + payload);
@@ -292,6 +1176,13 @@ void MessageQueueClient::_dispatch_event(char &role, char &cmd, std::string &pay
         }
     }
     else if (ev.is_queue_deleted(role, cmd)) {
+        // Server unsubscribed us, nothing to restore after reconnect.
+        std::string queue_name = payload.substr(0, payload.find(' '));
+        {
+            std::lock_guard<std::mutex> lock(_subscriptions_mutex);
+            _subscriptions.erase(queue_name);
+        }
+        _forget_queue_handle(queue_name);
         ev._type = Event::Type::Error;
         ev._result.push_back("Queue Deleted: " + payload);
     }
@@ -301,9 +1192,9 @@ void MessageQueueClient::_dispatch_event(char &role, char &cmd, std::string &pay
     }
 
     if (ev.is_valid()) {
-        std::lock_guard<std::mutex> lock(_event_mutex);
-        _event_queue.push(std::move(ev));
-        _event_cv.notify_one();
+        // Pool members other than the primary leave queue lists to it.
+        if (ev._type == Event::Type::QueueList && !_forward_queue_lists) return;
+        _post_event(std::move(ev));
     }
 }
 
@@ -312,21 +1203,45 @@ void MessageQueueClient::_dispatch_event(char &role, char &cmd, std::string &pay
 // HANDLING MESSAGES
 // ------------------------------
 
-std::tuple<std::string, std::string> MessageQueueClient::_handle_message_payload(const std::string &payload) {
-    uint32_t q_name_size;
-    extract_convert_net_to_host(payload, 0, q_name_size);
-    std::string queue_name = payload.substr(4, q_name_size);
-    std::string message_content = payload.substr(4 + q_name_size);
+bool MessageQueueClient::_handle_message_payload(const std::string &payload, std::string &queue_name, std::string &content) {
+    size_t offset = 0;
+    if (_compact.load()) {
+        uint32_t handle = 0;
+        if (wire::read_varint(payload, offset, handle) != wire::decode_status::COMPLETE) return false;
+        queue_name = _queue_name_for_handle(handle);
+    } else {
+        uint32_t q_name_size;
+        extract_convert_net_to_host(payload, 0, q_name_size);
+        queue_name = payload.substr(4, q_name_size);
+        offset = 4 + q_name_size;
+    }
+    return _decode_body(payload, offset, content);
+}
 
-    return {queue_name, message_content};
+bool MessageQueueClient::_decode_body(const std::string &payload, size_t offset, std::string &out) {
+    if (offset > payload.size()) return false;
+    if (!_compression.load()) {
+        out = payload.substr(offset);
+        return true;
+    }
+    // [encoding(1b)][data], see compression.h
+    if (offset == payload.size()) return false;
+    auto enc = static_cast<wire::encoding>(payload[offset]);
+    std::string_view data(payload.data() + offset + 1, payload.size() - offset - 1);
+    if (enc == wire::encoding::NONE) {
+        out.assign(data);
+        return true;
+    }
+    return wire::decompress(enc, data, _chunking.load() ? wire::MAX_CHUNKED_MESSAGE_SIZE : MAX_PAYLOAD, out);
 }
 
-std::vector<std::string> MessageQueueClient::_handle_queue_list_payload(const std::string &payload) {
+std::vector<std::string> MessageQueueClient::_handle_queue_list_payload(const std::string &payload, size_t offset) {
     std::vector<std::string> queues;
+    if (offset + 4 > payload.size()) return queues;
     uint32_t count_net;
-    extract_convert_net_to_host(payload, 0, count_net);
+    extract_convert_net_to_host(payload, offset, count_net);
 
-    size_t offset = 4;
+    offset += 4;
 
     // Get all available queues and save it to list.
     for (uint32_t i = 0; i < count_net; ++i) {
@@ -346,28 +1261,85 @@ std::vector<std::string> MessageQueueClient::_handle_queue_list_payload(const st
     return queues;
 }
 
+bool MessageQueueClient::_apply_queue_list_delta(const std::string &payload, std::vector<std::string> &queues) {
+    // [FROM(4b)][TO(4b)][COUNT(4b)] then [OP(1b)][NAME_SIZE(4b)][NAME] per change, see wire_codec.h
+    if (payload.size() < 12) return false;
+    uint32_t from, to, count;
+    extract_convert_net_to_host(payload, 0, from);
+    extract_convert_net_to_host(payload, 4, to);
+    extract_convert_net_to_host(payload, 8, count);
+    {
+        std::lock_guard<std::mutex> lock(_queues_cache_mutex);
+        // Before the snapshot arrived, or changes already in the list.
+        if (!_queue_list_synced || to <= _queue_list_version) return false;
+
+        if (from <= _queue_list_version) {
+            size_t offset = 12;
+            for (uint32_t i = 0; i < count && offset + 5 <= payload.size(); ++i) {
+                char op = payload[offset];
+                uint32_t name_size;
+                extract_convert_net_to_host(payload, offset + 1, name_size);
+                offset += 5;
+                if (offset + name_size > payload.size()) break;
+                std::string name = payload.substr(offset, name_size);
+                offset += name_size;
+
+                auto it = std::find(_available_queues.begin(), _available_queues.end(), name);
+                if (op == wire::QUEUE_ADDED && it == _available_queues.end()) _available_queues.push_back(std::move(name));
+                else if (op == wire::QUEUE_REMOVED && it != _available_queues.end()) _available_queues.erase(it);
+            }
+            _queue_list_version = to;
+            queues = _available_queues;
+            return true;
+        }
+        // Changes between our version and the delta were missed.
+        _queue_list_synced = false;
+    }
+    // The server answers an empty QL with a snapshot.
+    std::string request = Protocol::_prepare_message('Q', 'L', "", _compact.load());
+    std::lock_guard<std::mutex> lock(_send_mutex);
+    _send_message(_socket, request);
+    return false;
+}
+
 std::vector<std::string> MessageQueueClient::_handle_new_sub_messages(const std::string &payload) {
     size_t offset = 0;
-    uint32_t  q_name_len;
-    extract_convert_net_to_host(payload, offset, q_name_len);
-    offset += 4;
+    std::vector<std::string> messages;
+    bool compact = _compact.load();
 
-    std::string queue_name = payload.substr(offset, q_name_len);
-    offset += q_name_len;
+    if (compact) {
+        uint32_t handle = 0;
+        if (wire::read_varint(payload, offset, handle) != wire::decode_status::COMPLETE) return messages;
+    } else {
+        if (payload.size() < 4) return messages;
+        uint32_t  q_name_len;
+        extract_convert_net_to_host(payload, offset, q_name_len);
+        offset += 4 + q_name_len;
+    }
 
-    std::vector<std::string> messages;
+    // The message list is compressed as a whole when compression is on.
+    std::string entries;
+    if (!_decode_body(payload, offset, entries)) {
+        _handle_error_event("Malformed compressed message batch from server.", false);
+        return messages;
+    }
 
     // Get all available messages for subscriber and save it to list.
-    while (offset + 4 <= payload.size()){
+    offset = 0;
+    while (offset < entries.size()) {
         uint32_t msg_len;
-        extract_convert_net_to_host(payload, offset, msg_len);
-        offset += 4;
+        if (compact) {
+            if (wire::read_varint(entries, offset, msg_len) != wire::decode_status::COMPLETE) break;
+        } else {
+            if (offset + 4 > entries.size()) break;
+            extract_convert_net_to_host(entries, offset, msg_len);
+            offset += 4;
+        }
 
-        if (offset + msg_len > payload.size())
+        if (offset + msg_len > entries.size())
             break;
 
-        std::string message_text = payload.substr(offset, msg_len);
-        messages.push_back(message_text);
+        messages.push_back(entries.substr(offset, msg_len));
         offset += msg_len;
     }
 
@@ -375,13 +1347,11 @@ std::vector<std::string> MessageQueueClient::_handle_new_sub_messages(const std:
 }
 
 bool MessageQueueClient::poll_event(Event &ev) {
-    std::unique_lock<std::mutex> lock(_event_mutex);
-    _event_cv.wait_for(lock, std::chrono::milliseconds(100), 
-        [this] { return !_event_queue.empty() || !_connected; });
-
-    if (_event_queue.empty()) return false;
-
-    ev = std::move(_event_queue.front());
-    _event_queue.pop();
+    if (!_events->pop(ev, std::chrono::milliseconds(100))) return false;
+    _trace_delivery(ev);
     return true;
+}
+
+void MessageQueueClient::_post_event(Event &&ev) {
+    _events->push(std::move(ev));
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "MessageQueuePool.h"
+
+#include <cstdint>
+
+// ------------------------------
+// CONSTRUCTOR
+// ------------------------------
+
+MessageQueuePool::MessageQueuePool(const std::string &client_login, size_t connections) {
+    if (connections == 0) connections = 1;
+    for (size_t i = 0; i < connections; ++i)
+        _clients.push_back(std::make_unique<MessageQueueClient>(client_login + "#" + std::to_string(i)));
+    _attach_members();
+}
+
+MessageQueuePool::MessageQueuePool(const std::string &client_login, size_t connections, ClientReactor &reactor) {
+    if (connections == 0) connections = 1;
+    for (size_t i = 0; i < connections; ++i)
+        _clients.push_back(std::make_unique<MessageQueueClient>(client_login + "#" + std::to_string(i), reactor));
+    _attach_members();
+}
+
+MessageQueuePool::~MessageQueuePool() {
+    disconnect();
+}
+
+void MessageQueuePool::_attach_members() {
+    for (size_t i = 0; i < _clients.size(); ++i) {
+        _clients[i]->_events = _events;
+        // Every connection receives the same queue lists, report them once.
+        _clients[i]->_forward_queue_lists = (i == 0);
+        if (i != 0) _clients[i]->set_queue_list_filter({});
+    }
+}
+
+// ------------------------------
+// CONNECTION
+// ------------------------------
+
+bool MessageQueuePool::connect_to_server(const std::string &host, const std::string &port) {
+    for (auto &client : _clients) {
+        if (!client->connect_to_server(host, port)) {
+            disconnect();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MessageQueuePool::disconnect() {
+    for (auto &client : _clients) client->disconnect();
+}
+
+bool MessageQueuePool::is_connected() const {
+    for (const auto &client : _clients) {
+        if (!client->is_connected()) return false;
+    }
+    return true;
+}
+
+void MessageQueuePool::set_executor(AsyncExecutor &executor) {
+    for (auto &client : _clients) client->set_executor(executor);
+}
+
+void MessageQueuePool::set_reconnect_policy(const ReconnectPolicy &policy) {
+    for (auto &client : _clients) client->set_reconnect_policy(policy);
+}
+
+void MessageQueuePool::set_zerocopy_threshold(size_t bytes) {
+    for (auto &client : _clients) client->set_zerocopy_threshold(bytes);
+}
+
+void MessageQueuePool::set_compact_framing(bool enabled) {
+    for (auto &client : _clients) client->set_compact_framing(enabled);
+}
+
+void MessageQueuePool::set_compression(bool enabled, size_t threshold) {
+    for (auto &client : _clients) client->set_compression(enabled, threshold);
+}
+
+void MessageQueuePool::set_chunking(bool enabled) {
+    for (auto &client : _clients) client->set_chunking(enabled);
+}
+
+void MessageQueuePool::set_queue_list_filter(std::vector<std::string> prefixes) {
+    _clients.front()->set_queue_list_filter(std::move(prefixes));
+}
+
+bool MessageQueuePool::set_tracing(uint32_t sample_one_in, const std::string &export_path) {
+    if (!_clients.front()->set_tracing(sample_one_in, export_path)) return false;
+    // Every connection samples on its own, spans go to one shared ring.
+    for (size_t i = 1; i < _clients.size(); ++i) {
+        _clients[i]->set_tracing(sample_one_in);
+        _clients[i]->_spans = _clients.front()->_spans;
+    }
+    return true;
+}
+
+size_t MessageQueuePool::connection_for(const std::string &queue_name) const {
+    // FNV-1a, stable across processes and builds unlike std::hash.
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : queue_name) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash % _clients.size();
+}
+
+// ------------------------------
+// ACTIONS
+// ------------------------------
+
+bool MessageQueuePool::create_queue(const std::string &queue_name) {
+    return _route(queue_name).create_queue(queue_name);
+}
+
+bool MessageQueuePool::delete_queue(const std::string &queue_name) {
+    return _route(queue_name).delete_queue(queue_name);
+}
+
+bool MessageQueuePool::publish(const std::string &queue_name, std::string_view content, uint32_t ttl) {
+    return _route(queue_name).publish(queue_name, content, ttl);
+}
+
+bool MessageQueuePool::publish(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl) {
+    return _route(queue_name).publish(queue_name, parts, ttl);
+}
+
+bool MessageQueuePool::subscribe(const std::string &queue_name) {
+    return _route(queue_name).subscribe(queue_name);
+}
+
+bool MessageQueuePool::unsubscribe(const std::string &queue_name) {
+    return _route(queue_name).unsubscribe(queue_name);
+}
+
+AsyncOperation MessageQueuePool::create_queue_async(const std::string &queue_name) {
+    return _route(queue_name).create_queue_async(queue_name);
+}
+
+AsyncOperation MessageQueuePool::delete_queue_async(const std::string &queue_name) {
+    return _route(queue_name).delete_queue_async(queue_name);
+}
+
+AsyncOperation MessageQueuePool::publish_async(const std::string &queue_name, std::string_view content, uint32_t ttl) {
+    return _route(queue_name).publish_async(queue_name, content, ttl);
+}
+
+AsyncOperation MessageQueuePool::publish_async(const std::string &queue_name, std::span<const std::string_view> parts, uint32_t ttl) {
+    return _route(queue_name).publish_async(queue_name, parts, ttl);
+}
+
+AsyncOperation MessageQueuePool::subscribe_async(const std::string &queue_name) {
+    return _route(queue_name).subscribe_async(queue_name);
+}
+
+AsyncOperation MessageQueuePool::unsubscribe_async(const std::string &queue_name) {
+    return _route(queue_name).unsubscribe_async(queue_name);
+}
+
+AsyncOperation MessageQueuePool::queue_stats_async(const std::string &queue_name) {
+    // Stats come from the broker, any connection can ask for all queues.
+    if (queue_name.empty()) return _clients.front()->queue_stats_async();
+    return _route(queue_name).queue_stats_async(queue_name);
+}
+
+bool MessageQueuePool::queue_stats(const std::string &queue_name, std::vector<QueueStats> &stats) {
+    if (queue_name.empty()) return _clients.front()->queue_stats("", stats);
+    return _route(queue_name).queue_stats(queue_name, stats);
+}
+
+// ------------------------------
+// EVENTS
+// ------------------------------
+
+bool MessageQueuePool::poll_event(Event &ev) {
+    if (!_events->pop(ev, std::chrono::milliseconds(100))) return false;
+    _clients.front()->_trace_delivery(ev);
+    return true;
+}
@@ -1,12 +1,11 @@
 #include "Protocol.h"
 
-std::string Protocol::_prepare_message(char role, char cmd, const std::string &payload) {
+std::string Protocol::_prepare_message(char role, char cmd, const std::string &payload, bool compact) {
+    char header[wire::MAX_HEADER_SIZE];
+    size_t header_size = wire::encode_header(header, role, cmd, static_cast<uint32_t>(payload.size()), compact);
     std::string buf;
-    buf.reserve(HEADER_PACKET_SIZE + payload.size());
-    buf += role;
-    buf += cmd;
-    uint32_t len = htonl(static_cast<uint32_t>(payload.size()));
-    buf.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    buf.reserve(header_size + payload.size());
+    buf.append(header, header_size);
     buf.append(payload);
     return buf;
 }
@@ -26,17 +25,41 @@ std::string Protocol::_pack_publish_data(const std::string &queue_name, const st
     return internal_payload;
 }
 
-std::tuple<char, char, uint32_t> Protocol::_decode_packet(const std::string &full_message) {
-        if (full_message.size() < HEADER_PACKET_SIZE) {
-            return {0, 0, 0};
-        }
+void Protocol::_pack_publish_header(char *out, size_t queue_name_size, size_t content_size, uint32_t ttl) {
+    size_t offset = wire::encode_header(out, Role::Publisher, Action::Publish, static_cast<uint32_t>(8 + queue_name_size + content_size), false);
+    wire::write_u32(out + offset, static_cast<uint32_t>(queue_name_size));
+    wire::write_u32(out + offset + 4, ttl);
+}
+
+size_t Protocol::_pack_compact_publish_header(char *out, uint32_t queue_handle, size_t queue_name_size, size_t content_size, uint32_t ttl) {
+    // Publish header goes first into a scratch buffer, its size is part of the frame length.
+    char body[3 * wire::MAX_VARINT_SIZE];
+    size_t body_size = wire::write_varint(body, queue_handle);
+    body_size += wire::write_varint(body + body_size, ttl);
+    size_t name_size = 0;
+    if (queue_handle == 0) {
+        name_size = queue_name_size;
+        body_size += wire::write_varint(body + body_size, static_cast<uint32_t>(queue_name_size));
+    }
 
-        char role = full_message[0];
-        char cmd = full_message[1];
+    size_t offset = wire::encode_header(out, Role::Publisher, Action::Publish, static_cast<uint32_t>(body_size + name_size + content_size), true);
+    std::memcpy(out + offset, body, body_size);
+    return offset + body_size;
+}
 
-        uint32_t payload_len_net;
-        std::memcpy(&payload_len_net, full_message.data() + 2, sizeof(uint32_t));
-        uint32_t payload_len = ntohl(payload_len_net);
+std::string Protocol::_pack_queue_list_filter(const std::vector<std::string> &prefixes) {
+    std::string payload;
+    size_t size = 4;
+    for (const auto &prefix : prefixes) size += 4 + prefix.size();
+    payload.reserve(size);
 
-        return {role, cmd, payload_len};
-}
\ No newline at end of file
+    char len[4];
+    wire::write_u32(len, static_cast<uint32_t>(prefixes.size()));
+    payload.append(len, sizeof(len));
+    for (const auto &prefix : prefixes) {
+        wire::write_u32(len, static_cast<uint32_t>(prefix.size()));
+        payload.append(len, sizeof(len));
+        payload += prefix;
+    }
+    return payload;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file chunking.h
+ * @brief Chunked transfer of frames larger than CHUNK_SIZE.
+ *
+ * With CAP_CHUNKING negotiated a large frame may be sent as a stream of CK
+ * frames, each carrying at most CHUNK_SIZE bytes of the original payload:
+ * [CK][SIZE][STREAM_ID(varint)][FLAGS(1b)][TYPE(2b)][TOTAL_SIZE(varint)][DATA]
+ * TYPE and TOTAL_SIZE are present only in the chunk with CHUNK_FIRST set.
+ *
+ * The writer releases the connection between chunks, so small frames on the
+ * same connection are not stuck behind a large one. Stream ids only need to
+ * be unique among the streams in flight on one connection. A frame is
+ * processed when its last chunk arrives, in order of last chunks.
+ */
+
+#ifndef MQ_CHUNKING_H
+#define MQ_CHUNKING_H
+
+#include "wire_codec.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace wire {
+
+constexpr size_t CHUNK_SIZE = 64 * 1024;                        //payload bytes per CK frame
+constexpr uint32_t MAX_CHUNKED_MESSAGE_SIZE = 64 * 1024 * 1024; //largest frame accepted in chunks
+constexpr size_t MAX_STREAMS_PER_CONNECTION = 8;                //partially received frames per connection
+
+constexpr uint8_t CHUNK_FIRST = 1u << 0;
+constexpr uint8_t CHUNK_LAST = 1u << 1;
+
+constexpr size_t MAX_CHUNK_HEADER_SIZE = MAX_VARINT_SIZE + 1 + TYPE_SIZE + MAX_VARINT_SIZE;
+
+// Chunk header that precedes chunk data in CK payload
+struct chunk_header {
+    uint32_t stream_id = 0;
+    uint8_t flags = 0;
+    char code[TYPE_SIZE] = {0, 0}; //type of the chunked frame, first chunk only
+    uint32_t total_size = 0;       //payload size of the chunked frame, first chunk only
+    size_t size = 0;               //chunk header size in bytes
+};
+
+/**
+ * @brief Writes chunk header.
+ * @param out Buffer of at least MAX_CHUNK_HEADER_SIZE bytes.
+ * @return Number of bytes written.
+ */
+constexpr size_t encode_chunk_header(char *out, const chunk_header &header) {
+    size_t offset = write_varint(out, header.stream_id);
+    out[offset++] = static_cast<char>(header.flags);
+    if (header.flags & CHUNK_FIRST) {
+        out[offset++] = header.code[0];
+        out[offset++] = header.code[1];
+        offset += write_varint(out + offset, header.total_size);
+    }
+    return offset;
+}
+
+/**
+ * @brief Reads chunk header from the start of CK payload.
+ * @return false if payload is too short or malformed.
+ */
+constexpr bool decode_chunk_header(const char *data, size_t size, chunk_header &header) {
+    size_t offset = 0;
+    if (read_varint(data, size, offset, header.stream_id) != decode_status::COMPLETE || offset >= size) {
+        return false;
+    }
+    header.flags = static_cast<uint8_t>(data[offset++]);
+    if (header.flags & CHUNK_FIRST) {
+        if (offset + TYPE_SIZE > size) {
+            return false;
+        }
+        header.code[0] = data[offset++];
+        header.code[1] = data[offset++];
+        if (read_varint(data, size, offset, header.total_size) != decode_status::COMPLETE) {
+            return false;
+        }
+    }
+    header.size = offset;
+    return true;
+}
+
+/**
+ * @brief Splits a frame payload into complete CK frames.
+ * @param stream_id Stream id, unique among streams in flight on the connection.
+ * @param compact Encode CK frame headers with varint length.
+ * @return CK frames in send order.
+ */
+inline std::vector<std::string> chunk_frames(uint32_t stream_id, char first, char second, const std::string &payload, bool compact) {
+    std::vector<std::string> frames;
+    frames.reserve(payload.size() / CHUNK_SIZE + 1);
+    size_t offset = 0;
+    do {
+        size_t data_size = std::min(CHUNK_SIZE, payload.size() - offset);
+        chunk_header header;
+        header.stream_id = stream_id;
+        header.flags = (offset == 0 ? CHUNK_FIRST : 0) | (offset + data_size == payload.size() ? CHUNK_LAST : 0);
+        header.code[0] = first;
+        header.code[1] = second;
+        header.total_size = static_cast<uint32_t>(payload.size());
+
+        char chunk[MAX_CHUNK_HEADER_SIZE];
+        size_t chunk_size = encode_chunk_header(chunk, header);
+        char frame[MAX_HEADER_SIZE];
+        size_t frame_size = encode_header(frame, frame_type::CHUNK, static_cast<uint32_t>(chunk_size + data_size), compact);
+
+        std::string &out = frames.emplace_back();
+        out.reserve(frame_size + chunk_size + data_size);
+        out.append(frame, frame_size);
+        out.append(chunk, chunk_size);
+        out.append(payload, offset, data_size);
+        offset += data_size;
+    } while (offset < payload.size());
+    return frames;
+}
+
+// Reassembles chunked frames of one connection
+class chunk_assembler {
+public:
+    enum class result {
+        INCOMPLETE, //chunk stored, frame not complete yet
+        COMPLETE,   //frame complete, returned in code and payload
+        ERROR       //malformed chunk or limits exceeded, stream dropped
+    };
+
+    /**
+     * @brief Adds one CK payload.
+     * @param code Type of the completed frame.
+     * @param payload Payload of the completed frame.
+     */
+    result feed(const std::string &chunk, char (&code)[TYPE_SIZE], std::string &payload) {
+        chunk_header header;
+        if (!decode_chunk_header(chunk.data(), chunk.size(), header)) {
+            return result::ERROR;
+        }
+        size_t data_size = chunk.size() - header.size;
+
+        auto it = streams.find(header.stream_id);
+        if (header.flags & CHUNK_FIRST) {
+            if (it != streams.end() || streams.size() >= MAX_STREAMS_PER_CONNECTION || header.total_size > MAX_CHUNKED_MESSAGE_SIZE) {
+                streams.erase(header.stream_id);
+                return result::ERROR;
+            }
+            it = streams.emplace(header.stream_id, stream{}).first;
+            it->second.code[0] = header.code[0];
+            it->second.code[1] = header.code[1];
+            it->second.total_size = header.total_size;
+            //memory grows with received data, not with announced size
+            it->second.data.reserve(std::min<size_t>(header.total_size, 4 * CHUNK_SIZE));
+        }
+        if (it == streams.end()) {
+            return result::ERROR;
+        }
+
+        stream &s = it->second;
+        if (s.data.size() + data_size > s.total_size) {
+            streams.erase(it);
+            return result::ERROR;
+        }
+        s.data.append(chunk, header.size, data_size);
+
+        if (!(header.flags & CHUNK_LAST)) {
+            return result::INCOMPLETE;
+        }
+        if (s.data.size() != s.total_size) {
+            streams.erase(it);
+            return result::ERROR;
+        }
+        code[0] = s.code[0];
+        code[1] = s.code[1];
+        payload = std::move(s.data);
+        streams.erase(it);
+        return result::COMPLETE;
+    }
+
+    void clear() { streams.clear(); }
+
+private:
+    struct stream {
+        char code[TYPE_SIZE] = {0, 0};
+        uint32_t total_size = 0;
+        std::string data;
+    };
+    std::unordered_map<uint32_t, stream> streams;
+};
+
+} // namespace wire
+
+#endif
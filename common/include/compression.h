@@ -0,0 +1,178 @@
+/**
+ * @file compression.h
+ * @brief Optional payload compression of PB, MS and MA frames.
+ *
+ * Once a compression capability was negotiated, the message part of PB and MS
+ * and the whole message list of MA start with one encoding byte:
+ * [ENCODING(1b)][DATA]
+ * ENCODING NONE: DATA is the plain content.
+ * Other encodings: DATA is [RAW_SIZE(varint)][COMPRESSED(n)].
+ *
+ * Codecs are compiled in when the build finds their library (MQ_HAVE_ZSTD,
+ * MQ_HAVE_ZLIB), available_compression() tells which ones are present.
+ */
+
+#ifndef MQ_COMPRESSION_H
+#define MQ_COMPRESSION_H
+
+#include "wire_codec.h"
+
+#include <string>
+#include <string_view>
+
+#ifdef MQ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MQ_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace wire {
+
+// Encoding byte of a compressed payload
+enum class encoding : uint8_t {
+    NONE = 0,
+    ZLIB = 1,
+    ZSTD = 2
+};
+
+constexpr size_t ENCODING_COUNT = 3;
+
+/**
+ * @brief Capability bit of an encoding, 0 for NONE.
+ */
+constexpr uint32_t encoding_capability(encoding enc) {
+    switch (enc) {
+        case encoding::ZLIB: return CAP_COMPRESSION_ZLIB;
+        case encoding::ZSTD: return CAP_COMPRESSION_ZSTD;
+        default: return 0;
+    }
+}
+
+/**
+ * @brief Compression capabilities compiled into this build.
+ */
+constexpr uint32_t available_compression() {
+    uint32_t caps = 0;
+#ifdef MQ_HAVE_ZLIB
+    caps |= CAP_COMPRESSION_ZLIB;
+#endif
+#ifdef MQ_HAVE_ZSTD
+    caps |= CAP_COMPRESSION_ZSTD;
+#endif
+    return caps;
+}
+
+/**
+ * @brief Best encoding allowed by capabilities, zstd is preferred for its speed.
+ */
+constexpr encoding preferred_encoding(uint32_t capabilities) {
+    if (capabilities & CAP_COMPRESSION_ZSTD) return encoding::ZSTD;
+    if (capabilities & CAP_COMPRESSION_ZLIB) return encoding::ZLIB;
+    return encoding::NONE;
+}
+
+/**
+ * @brief Appends [RAW_SIZE(varint)][COMPRESSED(n)] of input to out.
+ * @return false if encoding is not compiled in or compression failed.
+ */
+inline bool compress(encoding enc, std::string_view input, std::string &out) {
+    char raw_size[MAX_VARINT_SIZE];
+    size_t start = out.size();
+    out.append(raw_size, write_varint(raw_size, static_cast<uint32_t>(input.size())));
+    size_t offset = out.size();
+
+    switch (enc) {
+#ifdef MQ_HAVE_ZLIB
+        case encoding::ZLIB: {
+            uLongf compressed_size = compressBound(static_cast<uLong>(input.size()));
+            out.resize(offset + compressed_size);
+            //level 1, the goal is bandwidth at line rate, not the best ratio
+            if (compress2(reinterpret_cast<Bytef *>(out.data() + offset), &compressed_size,
+                          reinterpret_cast<const Bytef *>(input.data()), static_cast<uLong>(input.size()), 1) != Z_OK) {
+                break;
+            }
+            out.resize(offset + compressed_size);
+            return true;
+        }
+#endif
+#ifdef MQ_HAVE_ZSTD
+        case encoding::ZSTD: {
+            size_t bound = ZSTD_compressBound(input.size());
+            out.resize(offset + bound);
+            size_t compressed_size = ZSTD_compress(out.data() + offset, bound, input.data(), input.size(), 1);
+            if (ZSTD_isError(compressed_size)) {
+                break;
+            }
+            out.resize(offset + compressed_size);
+            return true;
+        }
+#endif
+        default:
+            break;
+    }
+    out.resize(start);
+    return false;
+}
+
+/**
+ * @brief Largest content compressed_size bytes of enc can decompress to.
+ *
+ * deflate expands at most 1032:1; a zstd RLE block is 4 bytes for up to 128KB,
+ * so RAW_SIZE above this bound can only come from a corrupt or hostile sender.
+ */
+constexpr uint64_t max_decompressed_size(encoding enc, size_t compressed_size) {
+    switch (enc) {
+        case encoding::ZLIB: return static_cast<uint64_t>(compressed_size) * 1032;
+        case encoding::ZSTD: return static_cast<uint64_t>(compressed_size) * 32768;
+        default: return compressed_size;
+    }
+}
+
+/**
+ * @brief Reads RAW_SIZE of compressed data without decompressing it.
+ * @return false if data does not start with a valid varint.
+ */
+inline bool compressed_raw_size(std::string_view data, uint32_t &raw_size) {
+    size_t offset = 0;
+    return read_varint(data.data(), data.size(), offset, raw_size) == decode_status::COMPLETE;
+}
+
+/**
+ * @brief Decompresses [RAW_SIZE(varint)][COMPRESSED(n)] into out.
+ * @param max_size Largest accepted RAW_SIZE, protects against decompression bombs.
+ * @return false if data is malformed, too large or encoding is not compiled in.
+ */
+inline bool decompress(encoding enc, std::string_view data, uint32_t max_size, std::string &out) {
+    size_t offset = 0;
+    uint32_t raw_size = 0;
+    if (read_varint(data.data(), data.size(), offset, raw_size) != decode_status::COMPLETE || raw_size > max_size) {
+        return false;
+    }
+    out.resize(raw_size);
+    const char *compressed = data.data() + offset;
+    size_t compressed_size = data.size() - offset;
+
+    switch (enc) {
+#ifdef MQ_HAVE_ZLIB
+        case encoding::ZLIB: {
+            uLongf written = raw_size;
+            return uncompress(reinterpret_cast<Bytef *>(out.data()), &written,
+                              reinterpret_cast<const Bytef *>(compressed), static_cast<uLong>(compressed_size)) == Z_OK &&
+                   written == raw_size;
+        }
+#endif
+#ifdef MQ_HAVE_ZSTD
+        case encoding::ZSTD: {
+            size_t written = ZSTD_decompress(out.data(), raw_size, compressed, compressed_size);
+            return !ZSTD_isError(written) && written == raw_size;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+} // namespace wire
+
+#endif
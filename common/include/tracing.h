@@ -0,0 +1,198 @@
+/**
+ * @file tracing.h
+ * @brief Sampled end-to-end tracing of single messages.
+ *
+ * With CAP_TRACING negotiated a client sends a sampled publish as PT instead
+ * of PB, the PB payload followed by trace context:
+ * [PB PAYLOAD][TRACE_ID(8b)][PUBLISH_TIME_NS(8b)]
+ * The server answers it like PB and delivers it to subscribers with
+ * CAP_TRACING as MT, the MS payload followed by the trace id:
+ * [MS PAYLOAD][TRACE_ID(8b)]
+ * Other subscribers get a plain MS. Chunked publishes are never traced.
+ *
+ * Every hop of a traced message records a span with a wall clock time, so
+ * spans of client and server on one host can be merged by trace id into a
+ * timeline. Untraced messages never touch the span ring.
+ */
+
+#ifndef MQ_TRACING_H
+#define MQ_TRACING_H
+
+#include "wire_codec.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace trace {
+
+constexpr size_t TRACE_ID_SIZE = 8;
+constexpr size_t TRACE_CONTEXT_SIZE = TRACE_ID_SIZE + 8; //PT trailer, trace id and client publish time
+constexpr size_t DEFAULT_SPAN_CAPACITY = 4096;           //spans buffered before export or overwrite
+
+// Point on the path of a message where a span is recorded
+enum class hop : uint8_t {
+    CLIENT_PUBLISH, //client is about to write PT
+    SERVER_RECEIVE, //server parsed PT
+    SERVER_LOCKED,  //server acquired queues lock
+    SERVER_ENQUEUE, //message appended to Queue::messages
+    SERVER_SEND,    //delivery written to one subscriber socket, detail is the socket
+    CLIENT_RECEIVE, //client parsed MT
+    CLIENT_DELIVER  //poll_event returned the message
+};
+
+constexpr const char *hop_name(hop where) {
+    switch (where) {
+        case hop::CLIENT_PUBLISH: return "client_publish";
+        case hop::SERVER_RECEIVE: return "server_receive";
+        case hop::SERVER_LOCKED: return "server_locked";
+        case hop::SERVER_ENQUEUE: return "server_enqueue";
+        case hop::SERVER_SEND: return "server_send";
+        case hop::CLIENT_RECEIVE: return "client_receive";
+        case hop::CLIENT_DELIVER: return "client_deliver";
+    }
+    return "";
+}
+
+// One recorded hop of a traced message
+struct span {
+    uint64_t trace_id = 0;
+    uint64_t time_ns = 0; //CLOCK_REALTIME
+    hop where = hop::CLIENT_PUBLISH;
+    uint32_t detail = 0;
+};
+
+/**
+ * @brief Wall clock in nanoseconds, comparable between processes on one host.
+ */
+inline uint64_t wall_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+constexpr void write_u64(char *out, uint64_t value) {
+    wire::write_u32(out, static_cast<uint32_t>(value >> 32));
+    wire::write_u32(out + 4, static_cast<uint32_t>(value));
+}
+
+constexpr uint64_t read_u64(const char *in) {
+    return (static_cast<uint64_t>(wire::read_u32(in)) << 32) | wire::read_u32(in + 4);
+}
+
+/**
+ * @brief Removes PT trailer from payload.
+ * @return false if payload is too short or trace id is 0.
+ */
+inline bool strip_context(std::string &payload, uint64_t &trace_id, uint64_t &publish_ns) {
+    if (payload.size() < TRACE_CONTEXT_SIZE) return false;
+    const char *context = payload.data() + payload.size() - TRACE_CONTEXT_SIZE;
+    trace_id = read_u64(context);
+    publish_ns = read_u64(context + TRACE_ID_SIZE);
+    payload.resize(payload.size() - TRACE_CONTEXT_SIZE);
+    return trace_id != 0;
+}
+
+/**
+ * @brief Removes MT trailer from payload.
+ * @return false if payload is too short or trace id is 0.
+ */
+inline bool strip_trace_id(std::string &payload, uint64_t &trace_id) {
+    if (payload.size() < TRACE_ID_SIZE) return false;
+    trace_id = read_u64(payload.data() + payload.size() - TRACE_ID_SIZE);
+    payload.resize(payload.size() - TRACE_ID_SIZE);
+    return trace_id != 0;
+}
+
+/**
+ * @brief Bounded buffer of spans, optionally exported to a file.
+ *
+ * Without an export file the oldest spans are overwritten. With one, a full
+ * buffer is appended to the file as JSON lines:
+ * {"trace":"<16 hex>","hop":"server_send","time_ns":<n>,"source":"<source>","detail":<n>}
+ */
+class span_ring {
+public:
+    explicit span_ring(std::string source, size_t capacity = DEFAULT_SPAN_CAPACITY)
+        : source(std::move(source)), capacity(capacity == 0 ? 1 : capacity) {
+        spans.reserve(this->capacity);
+    }
+    ~span_ring() {
+        flush();
+        if (file != nullptr) std::fclose(file);
+    }
+    span_ring(const span_ring &) = delete;
+    span_ring &operator=(const span_ring &) = delete;
+
+    /**
+     * @brief Appends exported spans to path, buffered spans go there on next flush.
+     * @return false if file can not be opened.
+     */
+    bool set_export_file(const std::string &path) {
+        std::FILE *opened = std::fopen(path.c_str(), "a");
+        if (opened == nullptr) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file != nullptr) std::fclose(file);
+        file = opened;
+        return true;
+    }
+
+    void record(uint64_t trace_id, hop where, uint32_t detail = 0) {
+        record_at(trace_id, where, wall_ns(), detail);
+    }
+
+    //records span taken earlier, e.g. while a lock was held
+    void record_at(uint64_t trace_id, hop where, uint64_t time_ns, uint32_t detail = 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (spans.size() < capacity) {
+            spans.push_back({trace_id, time_ns, where, detail});
+            if (spans.size() == capacity && file != nullptr) export_locked();
+            return;
+        }
+        spans[next] = {trace_id, time_ns, where, detail};
+        next = (next + 1) % capacity;
+    }
+
+    /**
+     * @brief Spans buffered and not exported yet, oldest first.
+     */
+    std::vector<span> snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<span> out(spans.begin() + static_cast<std::ptrdiff_t>(next), spans.end());
+        out.insert(out.end(), spans.begin(), spans.begin() + static_cast<std::ptrdiff_t>(next));
+        return out;
+    }
+
+    //writes buffered spans to export file, if one is set
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file != nullptr && !spans.empty()) export_locked();
+    }
+
+private:
+    void export_locked() {
+        for (size_t i = 0; i < spans.size(); ++i) {
+            const span &s = spans[(next + i) % spans.size()];
+            std::fprintf(file, "{\"trace\":\"%016llx\",\"hop\":\"%s\",\"time_ns\":%llu,\"source\":\"%s\",\"detail\":%u}\n",
+                         static_cast<unsigned long long>(s.trace_id), hop_name(s.where),
+                         static_cast<unsigned long long>(s.time_ns), source.c_str(), s.detail);
+        }
+        std::fflush(file);
+        spans.clear();
+        next = 0;
+    }
+
+    mutable std::mutex mutex;
+    std::string source;
+    size_t capacity;
+    std::vector<span> spans;
+    size_t next = 0; //oldest span once buffer wrapped
+    std::FILE *file = nullptr;
+};
+
+} // namespace trace
+
+#endif
@@ -0,0 +1,415 @@
+/**
+ * @file wire_codec.h
+ * @brief Header-only frame codec shared by the client library and the server.
+ *
+ * Every frame is [TYPE(2b)][SIZE][PAYLOAD]. SIZE is 4 bytes in network byte
+ * order, or an unsigned LEB128 varint (1-5 bytes) once compact framing was
+ * negotiated at login. Everything here is constexpr and works on caller
+ * provided buffers, nothing allocates.
+ */
+
+#ifndef MQ_WIRE_CODEC_H
+#define MQ_WIRE_CODEC_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace wire {
+
+constexpr size_t TYPE_SIZE = 2;                               //two character frame type
+constexpr size_t FIXED_HEADER_SIZE = TYPE_SIZE + 4;           //header with 4 byte length
+constexpr size_t MAX_VARINT_SIZE = 5;                         //max encoded size of uint32 varint
+constexpr size_t MAX_HEADER_SIZE = TYPE_SIZE + MAX_VARINT_SIZE;
+
+// Protocol frame types
+enum class frame_type : uint8_t {
+    LOGIN,                     // LO
+    SUBSCRIBE,                 // SS
+    UNSUBSCRIBE,               // SU
+    QUEUE_CREATE,              // PC
+    QUEUE_DELETE,              // PD
+    PUBLISH,                   // PB
+    HEARTBEAT,                 // HB
+    QUEUE_LIST,                // QL
+    MESSAGE_MULTICAST,         // MS
+    MESSAGE_TO_NEW_SUBSCRIBER, // MA
+    QUEUE_DELETED_INFO,        // ND
+    STATS,                     // ST, broker metrics request and reply
+    QUEUE_STATS,               // QS, per-queue statistics request and reply
+    CHUNK,                     // CK, part of a larger frame, see chunking.h
+    PUBLISH_TRACED,            // PT, PB carrying trace context, see tracing.h
+    MESSAGE_TRACED,            // MT, MS carrying trace id, see tracing.h
+    QUEUE_LIST_SNAPSHOT,       // QV, queue list with its version
+    QUEUE_LIST_DELTA,          // QD, queue list changes between two versions
+    QUEUE_LIST_FILTER,         // QF, queue name prefixes a client wants queue lists for
+    ERROR                      // ER, also returned for unknown types
+};
+
+// Static description of a frame type
+struct frame_descriptor {
+    frame_type type;
+    char code[TYPE_SIZE];
+};
+
+inline constexpr std::array<frame_descriptor, 20> FRAMES = {{
+    {frame_type::LOGIN, {'L', 'O'}},
+    {frame_type::SUBSCRIBE, {'S', 'S'}},
+    {frame_type::UNSUBSCRIBE, {'S', 'U'}},
+    {frame_type::QUEUE_CREATE, {'P', 'C'}},
+    {frame_type::QUEUE_DELETE, {'P', 'D'}},
+    {frame_type::PUBLISH, {'P', 'B'}},
+    {frame_type::HEARTBEAT, {'H', 'B'}},
+    {frame_type::QUEUE_LIST, {'Q', 'L'}},
+    {frame_type::MESSAGE_MULTICAST, {'M', 'S'}},
+    {frame_type::MESSAGE_TO_NEW_SUBSCRIBER, {'M', 'A'}},
+    {frame_type::QUEUE_DELETED_INFO, {'N', 'D'}},
+    {frame_type::STATS, {'S', 'T'}},
+    {frame_type::QUEUE_STATS, {'Q', 'S'}},
+    {frame_type::CHUNK, {'C', 'K'}},
+    {frame_type::PUBLISH_TRACED, {'P', 'T'}},
+    {frame_type::MESSAGE_TRACED, {'M', 'T'}},
+    {frame_type::QUEUE_LIST_SNAPSHOT, {'Q', 'V'}},
+    {frame_type::QUEUE_LIST_DELTA, {'Q', 'D'}},
+    {frame_type::QUEUE_LIST_FILTER, {'Q', 'F'}},
+    {frame_type::ERROR, {'E', 'R'}},
+}};
+
+/**
+ * @brief Packs two character type into one integer usable as a switch label.
+ */
+constexpr uint16_t type_key(char first, char second) {
+    return static_cast<uint16_t>((static_cast<uint8_t>(first) << 8) | static_cast<uint8_t>(second));
+}
+
+/**
+ * @brief Descriptor of a frame type, FRAMES is ordered like frame_type.
+ */
+constexpr const frame_descriptor &descriptor(frame_type type) {
+    return FRAMES[static_cast<size_t>(type)];
+}
+
+/**
+ * @brief Maps two character type to frame_type.
+ * @return frame_type, ERROR for unknown types.
+ */
+constexpr frame_type type_of(char first, char second) {
+    switch (type_key(first, second)) {
+        case type_key('L', 'O'): return frame_type::LOGIN;
+        case type_key('S', 'S'): return frame_type::SUBSCRIBE;
+        case type_key('S', 'U'): return frame_type::UNSUBSCRIBE;
+        case type_key('P', 'C'): return frame_type::QUEUE_CREATE;
+        case type_key('P', 'D'): return frame_type::QUEUE_DELETE;
+        case type_key('P', 'B'): return frame_type::PUBLISH;
+        case type_key('H', 'B'): return frame_type::HEARTBEAT;
+        case type_key('Q', 'L'): return frame_type::QUEUE_LIST;
+        case type_key('M', 'S'): return frame_type::MESSAGE_MULTICAST;
+        case type_key('M', 'A'): return frame_type::MESSAGE_TO_NEW_SUBSCRIBER;
+        case type_key('N', 'D'): return frame_type::QUEUE_DELETED_INFO;
+        case type_key('S', 'T'): return frame_type::STATS;
+        case type_key('Q', 'S'): return frame_type::QUEUE_STATS;
+        case type_key('C', 'K'): return frame_type::CHUNK;
+        case type_key('P', 'T'): return frame_type::PUBLISH_TRACED;
+        case type_key('M', 'T'): return frame_type::MESSAGE_TRACED;
+        case type_key('Q', 'V'): return frame_type::QUEUE_LIST_SNAPSHOT;
+        case type_key('Q', 'D'): return frame_type::QUEUE_LIST_DELTA;
+        case type_key('Q', 'F'): return frame_type::QUEUE_LIST_FILTER;
+        default: return frame_type::ERROR;
+    }
+}
+
+/**
+ * @brief Checks if two character type is a known frame type.
+ */
+constexpr bool is_known_type(char first, char second) {
+    return type_of(first, second) != frame_type::ERROR || type_key(first, second) == type_key('E', 'R');
+}
+
+/**
+ * @brief Number of bytes value takes as varint.
+ */
+constexpr size_t varint_size(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+/**
+ * @brief Writes unsigned LEB128 varint.
+ * @param out Buffer of at least MAX_VARINT_SIZE bytes.
+ * @return Number of bytes written.
+ */
+constexpr size_t write_varint(char *out, uint32_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<char>(value);
+    return size;
+}
+
+// Result of read_varint and decode_header
+enum class decode_status {
+    COMPLETE,
+    NEED_MORE,
+    MALFORMED
+};
+
+/**
+ * @brief Reads unsigned LEB128 varint.
+ * @param offset Read position, advanced past the varint only when COMPLETE is returned.
+ * @return NEED_MORE if data ends inside the varint, MALFORMED if it does not fit uint32
+ *         (a 5th byte above 0x0F, which also covers varints longer than MAX_VARINT_SIZE).
+ */
+constexpr decode_status read_varint(const char *data, size_t size, size_t &offset, uint32_t &value) {
+    uint32_t result = 0;
+    for (size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+        if (offset + i >= size) {
+            return decode_status::NEED_MORE;
+        }
+        uint8_t byte = static_cast<uint8_t>(data[offset + i]);
+        //5th byte carries bits 28-31 only
+        if (i == MAX_VARINT_SIZE - 1 && byte > 0x0F) {
+            return decode_status::MALFORMED;
+        }
+        result |= static_cast<uint32_t>(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            offset += i + 1;
+            value = result;
+            return decode_status::COMPLETE;
+        }
+    }
+    return decode_status::MALFORMED;
+}
+
+/**
+ * @brief Reads varint from string, advancing offset past it.
+ */
+inline decode_status read_varint(const std::string &data, size_t &offset, uint32_t &value) {
+    return read_varint(data.data(), data.size(), offset, value);
+}
+
+/**
+ * @brief Writes uint32 in network byte order.
+ */
+constexpr void write_u32(char *out, uint32_t value) {
+    out[0] = static_cast<char>(value >> 24);
+    out[1] = static_cast<char>(value >> 16);
+    out[2] = static_cast<char>(value >> 8);
+    out[3] = static_cast<char>(value);
+}
+
+/**
+ * @brief Reads uint32 in network byte order.
+ */
+constexpr uint32_t read_u32(const char *in) {
+    return (static_cast<uint32_t>(static_cast<uint8_t>(in[0])) << 24) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(in[1])) << 16) |
+           (static_cast<uint32_t>(static_cast<uint8_t>(in[2])) << 8) |
+           static_cast<uint32_t>(static_cast<uint8_t>(in[3]));
+}
+
+/**
+ * @brief Size of a frame header.
+ */
+constexpr size_t header_size(uint32_t payload_size, bool compact) {
+    return compact ? TYPE_SIZE + varint_size(payload_size) : FIXED_HEADER_SIZE;
+}
+
+/**
+ * @brief Writes frame header with raw two character type.
+ * @param out Buffer of at least MAX_HEADER_SIZE bytes.
+ * @return Number of bytes written.
+ */
+constexpr size_t encode_header(char *out, char first, char second, uint32_t payload_size, bool compact) {
+    out[0] = first;
+    out[1] = second;
+    if (compact) {
+        return TYPE_SIZE + write_varint(out + TYPE_SIZE, payload_size);
+    }
+    write_u32(out + TYPE_SIZE, payload_size);
+    return FIXED_HEADER_SIZE;
+}
+
+constexpr size_t encode_header(char *out, frame_type type, uint32_t payload_size, bool compact) {
+    const frame_descriptor &frame = descriptor(type);
+    return encode_header(out, frame.code[0], frame.code[1], payload_size, compact);
+}
+
+// Decoded frame header
+struct frame_header {
+    char code[TYPE_SIZE] = {0, 0};
+    uint32_t payload_size = 0;
+    size_t size = 0; //header size in bytes
+
+    constexpr frame_type type() const { return type_of(code[0], code[1]); }
+};
+
+/**
+ * @brief Decodes frame header from the start of data.
+ * @param data Received bytes.
+ * @param size Number of received bytes.
+ * @param compact Varint length negotiated.
+ * @param header Decoded header, valid only when COMPLETE is returned.
+ */
+constexpr decode_status decode_header(const char *data, size_t size, bool compact, frame_header &header) {
+    if (size < TYPE_SIZE + 1) {
+        return decode_status::NEED_MORE;
+    }
+    header.code[0] = data[0];
+    header.code[1] = data[1];
+
+    if (compact) {
+        size_t offset = TYPE_SIZE;
+        decode_status status = read_varint(data, size, offset, header.payload_size);
+        if (status != decode_status::COMPLETE) {
+            return status;
+        }
+        header.size = offset;
+        return decode_status::COMPLETE;
+    }
+
+    if (size < FIXED_HEADER_SIZE) {
+        return decode_status::NEED_MORE;
+    }
+    header.payload_size = read_u32(data + TYPE_SIZE);
+    header.size = FIXED_HEADER_SIZE;
+    return decode_status::COMPLETE;
+}
+
+// ------------------------------
+// LOGIN NEGOTIATION
+// ------------------------------
+
+/*
+LO payload of a client that negotiates, old clients send only the id:
+[CLIENT_ID(n)]['\0'][VERSION(1b)][CAPABILITIES(4b)][MAX_FRAME(4b)]
+LO reply of the server, only to clients that sent the hello:
+[OK:LOGGED or OK:RECONNECTED]['\0'][VERSION(1b)][ACCEPTED_CAPABILITIES(4b)][MAX_FRAME(4b)]
+
+VERSION is the highest protocol version the sender speaks, the connection uses
+the lower one. MAX_FRAME is the largest payload the sender accepts, 0 means
+no limit announced. Capabilities are accepted only if both sides have them.
+*/
+constexpr uint8_t PROTOCOL_VERSION = 1;
+
+constexpr uint32_t CAP_COMPACT_FRAMING = 1u << 0; //varint frame lengths and numeric queue handles
+constexpr uint32_t CAP_COMPRESSION_ZLIB = 1u << 1;  //PB, MS and MA payloads may be deflate compressed
+constexpr uint32_t CAP_COMPRESSION_ZSTD = 1u << 2;  //PB, MS and MA payloads may be zstd compressed
+constexpr uint32_t CAP_COMPRESSION_ANY = CAP_COMPRESSION_ZLIB | CAP_COMPRESSION_ZSTD;
+constexpr uint32_t CAP_CHUNKING = 1u << 3;          //frames above CHUNK_SIZE may be sent as CK chunks
+constexpr uint32_t CAP_TRACING = 1u << 4;           //sampled publishes sent as PT, their deliveries as MT
+constexpr uint32_t CAP_QUEUE_LIST_DELTA = 1u << 5;  //queue list sent as QV snapshot, then QD changes
+constexpr uint32_t CAP_QUEUE_LIST_FILTER = 1u << 6; //no queue list at login, client asks for one with QF
+constexpr uint32_t CAP_QUEUE_STATS = 1u << 7;       //server answers QS, older servers ignore it
+constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 512; //smaller payloads are not worth compressing
+
+constexpr size_t HELLO_SIZE = 1 + 4 + 4;
+
+// Version and capabilities announced in LO
+struct hello {
+    uint8_t version = 0;
+    uint32_t capabilities = 0;
+    uint32_t max_frame = 0;
+};
+
+/**
+ * @brief Writes hello (without the leading '\0').
+ * @param out Buffer of at least HELLO_SIZE bytes.
+ * @return Number of bytes written.
+ */
+constexpr size_t encode_hello(char *out, const hello &h) {
+    out[0] = static_cast<char>(h.version);
+    write_u32(out + 1, h.capabilities);
+    write_u32(out + 5, h.max_frame);
+    return HELLO_SIZE;
+}
+
+/**
+ * @brief Reads hello that follows the '\0' separator.
+ * @return false if data is too short.
+ */
+constexpr bool decode_hello(const char *data, size_t size, hello &h) {
+    if (size < HELLO_SIZE) {
+        return false;
+    }
+    h.version = static_cast<uint8_t>(data[0]);
+    h.capabilities = read_u32(data + 1);
+    h.max_frame = read_u32(data + 5);
+    return true;
+}
+
+/**
+ * @brief Smaller of two frame limits where 0 means unlimited.
+ */
+constexpr uint32_t min_frame_limit(uint32_t a, uint32_t b) {
+    if (a == 0) return b;
+    if (b == 0) return a;
+    return a < b ? a : b;
+}
+
+// ------------------------------
+// QUEUE LIST
+// ------------------------------
+
+/*
+QL payload, the full list sent to clients without CAP_QUEUE_LIST_DELTA:
+[NUMBER_OF_QUEUES(4b)] [QUEUE1_NAME_SIZE(4b)] [QUEUE1_NAME(n)] ... [QUEUEX_NAME_SIZE(4b)] [QUEUEX_NAME(n)]
+QV payload, the QL payload preceded by the version of the list:
+[VERSION(4b)] [NUMBER_OF_QUEUES(4b)] [QUEUE1_NAME_SIZE(4b)] [QUEUE1_NAME(n)] ...
+QD payload, changes that turn the list of version FROM into the list of version TO:
+[FROM(4b)] [TO(4b)] [NUMBER_OF_CHANGES(4b)] [OP(1b)] [NAME_SIZE(4b)] [NAME(n)] ...
+
+Numbers are in network byte order. Every create and delete of a queue is a
+new version. Changes of a QD are net (a queue created and deleted again
+within it does not appear), so they apply to a list of any version from
+FROM to TO. A client whose list is older than FROM missed changes and
+sends an empty QL, the server answers with a QV.
+
+QF payload, sent by clients with CAP_QUEUE_LIST_FILTER:
+[NUMBER_OF_PREFIXES(4b)] [PREFIX1_SIZE(4b)] [PREFIX1(n)] ... [PREFIXX_SIZE(4b)] [PREFIXX(n)]
+
+Such a client gets no list at login. After QF its lists (QL, QV and QD)
+hold only queues whose name starts with one of the prefixes, the server
+answers QF with the filtered list and sends changes only when one of them
+matches. An empty prefix matches every queue, no prefixes stops the lists.
+A filtered QD can skip versions without changes for the client, its FROM
+is then the version of the last list sent to it.
+*/
+constexpr char QUEUE_ADDED = '+';
+constexpr char QUEUE_REMOVED = '-';
+
+// Compile time checks of descriptor table and varint codec
+namespace detail {
+
+constexpr bool frames_match_types() {
+    for (size_t i = 0; i < FRAMES.size(); ++i) {
+        if (static_cast<size_t>(FRAMES[i].type) != i) return false;
+        if (FRAMES[i].type != frame_type::ERROR && type_of(FRAMES[i].code[0], FRAMES[i].code[1]) != FRAMES[i].type) return false;
+    }
+    return true;
+}
+
+constexpr bool varint_round_trip(uint32_t value) {
+    char buf[MAX_VARINT_SIZE] = {};
+    size_t written = write_varint(buf, value);
+    size_t offset = 0;
+    uint32_t decoded = 0;
+    return written == varint_size(value) && read_varint(buf, written, offset, decoded) == decode_status::COMPLETE && offset == written && decoded == value;
+}
+
+} // namespace detail
+
+static_assert(detail::frames_match_types(), "FRAMES must be ordered like frame_type");
+static_assert(detail::varint_round_trip(0) && detail::varint_round_trip(127) && detail::varint_round_trip(128) &&
+              detail::varint_round_trip(16383) && detail::varint_round_trip(0xFFFFFFFFu), "varint codec broken");
+static_assert(header_size(0xFFFFFFFFu, true) == MAX_HEADER_SIZE);
+
+} // namespace wire
+
+#endif
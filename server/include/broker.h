@@ -0,0 +1,167 @@
+/**
+ * @file broker.h
+ * @brief Broker lifecycle and pluggable transports.
+ *
+ * The broker serves connected stream sockets, whatever produced them. A
+ * Transport hands new connections to Broker::serve: TcpTransport accepts
+ * them from a listening socket, LoopbackTransport creates them in process
+ * from a socketpair, so tests and benchmarks can embed the broker and talk
+ * to it without the TCP stack (see MessageQueueClient::attach_socket).
+ *
+ * Every Broker owns its queues, clients, their locks and its fan-out
+ * workers (BrokerState, see common.h), so several brokers may run in one
+ * process. Liveness timers and metrics are shared by all of them: the
+ * timer wheel tracks connections of every broker, and counters add up.
+ */
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include "common.h"
+#include "liveness.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Broker;
+
+/**
+ * @brief Source of client connections for a Broker.
+ */
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    /**
+     * @brief Starts handing connections to broker.serve.
+     * @param broker Broker that serves the connections.
+     * @return bool that contains true if transport is ready, false otherwise.
+     */
+    virtual bool start(Broker& broker) = 0;
+
+    /**
+     * @brief Stops taking new connections, async-signal-safe.
+     */
+    virtual void stop() = 0;
+
+    /**
+     * @brief Waits for threads of the transport after stop and releases its resources.
+     */
+    virtual void join() {}
+};
+
+/**
+ * @brief Accepts TCP connections on a port of all IPv4 interfaces.
+ *
+ * Accepted connections get TCP keepalive if MQ_TCP_KEEPALIVE is set.
+ */
+class TcpTransport : public Transport {
+public:
+    explicit TcpTransport(std::string port) : port(std::move(port)) {}
+    ~TcpTransport() override;
+
+    bool start(Broker& broker) override;
+    void stop() override;
+    void join() override;
+
+private:
+    std::string port;
+    std::atomic<int> listening_socket{-1};
+    std::thread acceptor;
+    TcpKeepalive keepalive;
+};
+
+/**
+ * @brief In-process transport, every connect() is a socketpair served by the broker.
+ */
+class LoopbackTransport : public Transport {
+public:
+    bool start(Broker& broker) override;
+    void stop() override;
+
+    /**
+     * @brief Opens a new connection to the broker.
+     * @return int that contains client end of the connection, owned by caller, -1 on error or after stop.
+     */
+    int connect();
+
+private:
+    std::atomic<Broker*> broker{nullptr};
+};
+
+/**
+ * @brief Message broker: connection handlers, housekeeping and its transports.
+ *
+ * start() launches the cleanup worker (liveness timers, expired clients
+ * and messages), the queue list announcer and every added transport. request_stop() may be called from
+ * a signal handler, wait() then shuts all connections down and joins.
+ */
+class Broker {
+public:
+    Broker() = default;
+    ~Broker();
+    Broker(const Broker&) = delete;
+    Broker& operator=(const Broker&) = delete;
+
+    /**
+     * @brief Adds transport started with the broker, must outlive it.
+     * @param transport Transport to add, before start.
+     */
+    void add_transport(Transport& transport);
+
+    /**
+     * @brief Starts cleanup worker and all transports.
+     * @return bool that contains true if every transport started, false otherwise (broker is stopped again).
+     */
+    bool start();
+
+    /**
+     * @brief Serves connected socket in its own handler thread, takes ownership of it.
+     * @param client_socket Connected stream socket.
+     */
+    void serve(int client_socket);
+
+    /**
+     * @brief Asks broker to stop, async-signal-safe.
+     */
+    void request_stop();
+
+    /**
+     * @brief Asks cleanup worker to log lock contention report, async-signal-safe.
+     */
+    void request_lock_report();
+
+    /**
+     * @brief Blocks until request_stop, then closes all connections and joins all threads.
+     */
+    void wait();
+
+    bool is_running() const { return running.load(); }
+
+    /**
+     * @brief Queues, clients and their locks of this broker, e.g. for embedding tests and benchmarks.
+     */
+    BrokerState& broker_state() { return state; }
+
+private:
+    void cleanup_worker();
+    void handle_client(std::shared_ptr<Connection> connection);
+
+    BrokerState state;
+    std::atomic<bool> running{false};
+    std::atomic<bool> lock_report_requested{false}; //report is written by cleanup_worker
+    std::vector<Transport*> transports; //fixed once started, read by request_stop
+    std::thread worker;
+
+    std::mutex threads_mutex;
+    std::list<std::thread> client_threads;
+    std::set<std::shared_ptr<Connection>> open_connections; //connections of running handlers, shut down by wait
+};
+
+#endif
@@ -11,10 +11,11 @@
 
 /**
  * @brief Handles client first connection login or reconnection.
+ * @param state Queues and clients of the broker.
  * @param client Client struct to handle.
- * @param id Id to assign.
+ * @param payload LO payload: id to assign, optionally followed by '\0' and requested features (4b).
  * @return Updated client struct with assigned ID.
  */
-Client get_client_id(Client client, std::string &id);
+Client get_client_id(BrokerState& state, Client client, std::string &payload);
 
 #endif
@@ -16,101 +16,150 @@
 #include <unistd.h>
 #include <tuple>
 #include <map>
+#include <queue>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include "wire_codec.h"
+#include "compression.h"
+#include "chunking.h"
+#include "tracing.h"
+#include "logger.h"
+#include "metrics.h"
+#include "lock_profiler.h"
+#include "fanout.h"
+#include "connection.h"
 
 
 //configuration
-constexpr size_t PACKET_HEADER_SIZE = 6; //packet header size in bytes
+constexpr size_t PACKET_HEADER_SIZE = wire::FIXED_HEADER_SIZE; //packet header size in bytes
 constexpr int MAX_PAYLOAD_SIZE_MB = 10; //max payload size in MB
 constexpr int SECONDS_TO_CLEAR_CLIENT = 30; //seconds to clear client after disconnection
 constexpr int CLIENT_READ_TIMEOUT = 45; //client read timeout in seconds
+constexpr int CLIENT_WRITE_TIMEOUT = 10; //seconds client socket may take no data before the client is disconnected
 constexpr int HEARTBEAT_INTERVAL = 30; //heartbeat/worker thread interval in seconds
 constexpr int DEBUG = 0; //debug mode
 constexpr int LOGS = 1; //logs mode
 
+//capabilities a client can request in LOGIN hello, see wire_codec.h
+constexpr uint32_t FEATURE_COMPACT_FRAMING = wire::CAP_COMPACT_FRAMING; //varint frame lengths and numeric queue handles
+constexpr uint32_t FEATURE_CHUNKING = wire::CAP_CHUNKING; //frames above CHUNK_SIZE streamed as CK chunks
+constexpr uint32_t FEATURE_TRACING = wire::CAP_TRACING; //sampled publishes carry trace context, see tracing.h
+constexpr uint32_t FEATURE_QUEUE_LIST_DELTA = wire::CAP_QUEUE_LIST_DELTA; //queue list changes sent as QD, see queue_list.h
+constexpr uint32_t FEATURE_QUEUE_LIST_FILTER = wire::CAP_QUEUE_LIST_FILTER; //queue lists only after QF and only for its prefixes
+constexpr uint32_t FEATURE_QUEUE_STATS = wire::CAP_QUEUE_STATS; //QS is answered, announced so clients need not wait for a reply that never comes
+constexpr uint32_t SUPPORTED_FEATURES = FEATURE_COMPACT_FRAMING | FEATURE_CHUNKING | FEATURE_TRACING | FEATURE_QUEUE_LIST_DELTA | FEATURE_QUEUE_LIST_FILTER | FEATURE_QUEUE_STATS | wire::available_compression(); //compression codecs found at build time
+constexpr size_t COMPRESSION_THRESHOLD = wire::DEFAULT_COMPRESSION_THRESHOLD; //smaller MS and MA payloads are sent uncompressed
+constexpr uint32_t SERVER_MAX_FRAME = MAX_PAYLOAD_SIZE_MB * 1024 * 1024; //largest payload accepted from clients
+constexpr uint32_t MAX_MESSAGE_SIZE = wire::MAX_CHUNKED_MESSAGE_SIZE; //largest message accepted from chunking clients
+constexpr uint32_t LEGACY_CLIENT_MAX_FRAME = 1 * 1024 * 1024; //payload limit assumed for clients without hello
+
+constexpr double QUEUE_RATE_WINDOW_SECONDS = 60.0; //time constant of per-queue publish/deliver rates
+
+//queue handle layout: [generation(12b)][slot(20b)], 0 is never a valid handle
+constexpr uint32_t QUEUE_HANDLE_SLOT_BITS = 20;
+constexpr uint32_t QUEUE_HANDLE_SLOT_MASK = (1u << QUEUE_HANDLE_SLOT_BITS) - 1;
+
 // Single message in a queue
 struct Message {
-    std::string text;
+    std::string text; //content as published, compressed if encoding is not NONE
     std::chrono::steady_clock::time_point expire;
+    wire::encoding encoding = wire::encoding::NONE; //compression of text, see compression.h
+    uint32_t raw_size = 0; //size of uncompressed content
+    std::chrono::steady_clock::time_point published; //time the broker accepted the message
+};
+
+// Exponentially decaying event rate, averaged over about QUEUE_RATE_WINDOW_SECONDS
+struct RateMeter {
+    double rate = 0; //events per second at last
+    std::chrono::steady_clock::time_point last;
+
+    void add(uint64_t events, std::chrono::steady_clock::time_point now) {
+        rate = per_second(now) + static_cast<double>(events) / QUEUE_RATE_WINDOW_SECONDS;
+        last = now;
+    }
+    double per_second(std::chrono::steady_clock::time_point now) const {
+        double elapsed = std::chrono::duration<double>(now - last).count();
+        return rate * std::exp(-std::max(elapsed, 0.0) / QUEUE_RATE_WINDOW_SECONDS);
+    }
+};
+
+// Queue statistics updated after fan-out, outside of queues_mutex
+struct QueueCounters {
+    std::mutex mutex; //taken after queues_mutex if both are held
+    uint64_t published = 0;
+    uint64_t delivered = 0;
+    RateMeter publish_rate;
+    RateMeter deliver_rate;
 };
 
 // Message queue
 struct Queue {
     std::string name;
-    std::vector<Message> messages;
+    uint32_t handle = 0; //numeric handle used in compact mode
+    std::vector<std::shared_ptr<const Message>> messages; //shared with fan-out and backlog sends, never modified once stored
     std::vector<std::string> subscribers;
     int ttl = 60;
+    uint64_t retained_bytes = 0; //sum of messages text sizes, kept in sync with messages
+    //QS values, kept on publish and expiry so QS never scans messages (see account_expired_messages)
+    std::priority_queue<std::pair<std::chrono::steady_clock::time_point, uint64_t>,
+                        std::vector<std::pair<std::chrono::steady_clock::time_point, uint64_t>>,
+                        std::greater<>> expiry; //expire time and size of live messages, soonest first
+    size_t live_messages = 0; //stored messages not expired yet, expired ones stay stored until the next sweep
+    uint64_t live_bytes = 0;  //text size of live messages
+    size_t oldest_live = 0;   //index in messages, all messages before it are expired
+    std::shared_ptr<QueueCounters> counters = std::make_shared<QueueCounters>(); //shared with fan-out in progress
+    std::shared_ptr<FanoutStrand> strand = std::make_shared<FanoutStrand>(); //orders fan-out of this queue, see fanout.h
 };
 
 // Connected client
 struct Client {
     std::string id;
-    int socket = -1;
+    std::shared_ptr<Connection> connection; //nullptr while disconnected, see connection.h
+    bool compact = false; //compact framing negotiated at login
+    uint32_t features = 0; //features negotiated at login
+    uint8_t version = 0; //protocol version negotiated at login, 0 for clients without hello
+    uint32_t max_frame = LEGACY_CLIENT_MAX_FRAME; //largest payload client accepts, 0 means no limit
     std::chrono::steady_clock::time_point disconnect_time;
 };
 
-// Protocol message types
-enum class message_type {
-    LOGIN,                     // LO
-    SUBSCRIBE,                 // SS
-    UNSUBSCRIBE,               // SU
-    QUEUE_CREATE,              // PC
-    QUEUE_DELETE,              // PD
-    PUBLISH,                   // PB
-    HEARTBEAT,                 // HB
-    QUEUE_LIST,                // QL
-    MESSAGE_MULTICAST,         // MS
-    MESSAGE_TO_NEW_SUBSCRIBER, // MA
-    QUEUE_DELETED_INFO,        // ND
-    ERROR                      // ER
-};
+// Protocol message types (LO, SS, SU, PC, PD, PB, HB, QL, MS, MA, ND, ST, QS, CK, PT, MT, QV, QD, QF, ER), see wire_codec.h
+using message_type = wire::frame_type;
 
-// String to enum mapping
-inline const std::unordered_map<std::string, message_type> STR_TO_MSG_TYPE = {
-    {"LO", message_type::LOGIN},
-    {"SS", message_type::SUBSCRIBE},
-    {"SU", message_type::UNSUBSCRIBE},
-    {"PC", message_type::QUEUE_CREATE},
-    {"PD", message_type::QUEUE_DELETE},
-    {"PB", message_type::PUBLISH},
-    {"HB", message_type::HEARTBEAT},
-    {"QL", message_type::QUEUE_LIST},
-    {"MS", message_type::MESSAGE_MULTICAST},
-    {"MA", message_type::MESSAGE_TO_NEW_SUBSCRIBER},
-    {"ND", message_type::QUEUE_DELETED_INFO},
-    {"ER", message_type::ERROR}
+// Queue handle table, guarded by queues_mutex, slot 0 is never used
+struct QueueHandles {
+    std::vector<Queue*> slots = std::vector<Queue*>(1, nullptr);
+    std::vector<uint32_t> generations = std::vector<uint32_t>(1, 0);
+    std::vector<uint32_t> free_slots;
 };
 
-// Enum to string mapping
-inline const std::unordered_map<message_type, std::string> MSG_TYPE_TO_STR = {
-    {message_type::LOGIN, "LO"},
-    {message_type::SUBSCRIBE, "SS"},
-    {message_type::UNSUBSCRIBE, "SU"},
-    {message_type::QUEUE_CREATE, "PC"},
-    {message_type::QUEUE_DELETE, "PD"},
-    {message_type::PUBLISH, "PB"},
-    {message_type::HEARTBEAT, "HB"},
-    {message_type::QUEUE_LIST, "QL"},
-    {message_type::MESSAGE_MULTICAST, "MS"},
-    {message_type::MESSAGE_TO_NEW_SUBSCRIBER, "MA"},
-    {message_type::QUEUE_DELETED_INFO, "ND"},
-    {message_type::ERROR, "ER"}
-};
+// Queues, clients and their locks, owned by a Broker (see broker.h) and passed to every operation
+struct BrokerState {
+    BrokerState() = default;
+    BrokerState(const BrokerState&) = delete;
+    BrokerState& operator=(const BrokerState&) = delete;
 
-//global variables
-extern std::unordered_map<std::string, Queue> existing_queues;
-extern std::unordered_map<std::string, Client> clients;
+    //LOCKS ALWAYS IN THE SAME ORDER -> QUEUES_MUTEX THEN CLIENTS_MUTEX
+    //connection write mutex is never waited for while holding queues_mutex or clients_mutex
+    //both record wait and hold times, MeteredLock also its call site (see lock_profiler.h)
+    MeteredMutex queues_mutex{"queues", metrics::broker().queues_lock_wait, metrics::broker().queues_lock_hold};
+    MeteredMutex clients_mutex{"clients", metrics::broker().clients_lock_wait, metrics::broker().clients_lock_hold};
 
-//LOCKS ALWAYS IN THE SAME ORDER -> QUEUES_MUTEX THEN CLIENTS_MUTEX
-extern std::mutex clients_mutex;
-extern std::mutex queues_mutex;
+    std::unordered_map<std::string, Queue> existing_queues; //guarded by queues_mutex
+    std::unordered_map<std::string, Client> clients; //guarded by clients_mutex
+    QueueHandles handles; //guarded by queues_mutex
+    QueueListLog queue_list; //guarded by queues_mutex, see queue_list.h
+    QueueListAnnouncer announcer; //broadcasts queue_list changes while the broker runs
+    FanoutPool fanout; //sends publishes to subscribers while the broker runs, inline otherwise
+};
 
-//other locks we dont use together
-extern std::mutex log_mutex;
-extern std::mutex socket_map_mutex;
-extern std::map<int, std::mutex> socket_mutexes;
+//spans of traced messages, exported to MQ_TRACE_FILE if it is set
+extern trace::span_ring server_spans;
 
-//thread safe print functions
-void safe_print(const std::string& msg);
-void safe_error(const std::string& msg);
+//thread safe print functions, never block (see logger.h)
+void safe_print(const std::string& msg);  //INFO
+void safe_error(const std::string& msg);  //ERROR
 
 #endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+/**
+ * @file connection.h
+ * @brief Client connection shared by its handler and everyone sending to it.
+ *
+ * A Connection owns the socket, its write mutex and its traffic counters.
+ * The handler, the logged in Client and queued fan-out hold it by
+ * shared_ptr, and the socket is closed when the last of them lets go, so a
+ * descriptor is never reused while someone may still send to it. A handler
+ * whose client disconnected only shuts the socket down: sends still in
+ * flight fail instead of reaching a connection that got the same number.
+ */
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "liveness.h"
+#include "queue_list.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+class Connection {
+public:
+    /**
+     * @brief Takes ownership of connected socket.
+     * @param sock Connected stream socket, closed by the destructor.
+     */
+    explicit Connection(int sock);
+    ~Connection();
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    int socket() const { return sock; }
+
+    /**
+     * @brief Mutex that keeps frames of different writers from interleaving.
+     *
+     * Writers wait for it with a timeout (see send_message), a send holds it
+     * at most until its own timeout.
+     */
+    std::timed_mutex& write_mutex() { return writes; }
+
+    /**
+     * @brief Shuts socket down in both directions, wakes its reader and writers.
+     */
+    void shutdown();
+
+    //frames and bytes written to socket
+    std::atomic<uint64_t> frames_sent{0};
+    std::atomic<uint64_t> bytes_sent{0};
+    //frames read from socket
+    std::atomic<uint64_t> frames_received{0};
+
+    Liveness liveness; //idle timer state, see liveness.h
+    QueueListView queue_list; //queue list filter and version sent, see queue_list.h
+
+    /**
+     * @brief Number of Connection objects alive, closed sockets not released yet included.
+     */
+    static size_t alive();
+
+private:
+    int sock;
+    std::timed_mutex writes;
+};
+
+/**
+ * @brief Socket of connection for log messages, -1 if there is none.
+ */
+inline int socket_of(const std::shared_ptr<Connection>& connection) {
+    return connection ? connection->socket() : -1;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * @file fanout.h
+ * @brief Worker pool that sends published messages to subscribers.
+ *
+ * A connection handler hands the fan-out of a publish to the pool and goes
+ * back to reading its client. A publish becomes a FanoutJob split into
+ * chunks of subscribers; the chunks are queued on one worker and idle
+ * workers steal them, so a large fan-out is sent by several workers at
+ * once. Jobs of one queue run in order on the queue's strand: the next
+ * publish to a queue starts when every chunk of the previous one is sent,
+ * which keeps messages of a queue in order for each subscriber.
+ *
+ * Every Broker has its own pool. Without a started pool (MQ_FANOUT_WORKERS=0,
+ * or a BrokerState used without a Broker) jobs run inline on the publishing
+ * thread.
+ *
+ * Sends of a job are bounded by FANOUT_SEND_TIMEOUT. A subscriber that
+ * takes no data for that long is disconnected (it gets the backlog again
+ * when it subscribes after reconnecting); one that keeps reading is never
+ * cut off, however slow its link. A subscriber whose connection is held by
+ * another writer (a backlog MA, a chunked frame) for longer misses that
+ * message, counted in delivery_drops. Either way a worker, and through
+ * FANOUT_MAX_PENDING the publishers, waits at most about that long.
+ */
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr size_t FANOUT_CHUNK_SUBSCRIBERS = 32;  //subscribers per chunk, the unit of work stealing
+constexpr size_t FANOUT_MAX_PENDING = 256;       //jobs queued per strand before publishers wait
+constexpr size_t FANOUT_MAX_WORKERS = 8;         //default worker count is hardware threads up to this
+constexpr std::chrono::milliseconds FANOUT_SEND_TIMEOUT{1000}; //wait for a busy connection, and longest time without progress of MS
+
+class FanoutJob;
+
+// Jobs of one queue, run one after another
+struct FanoutStrand {
+    std::mutex mutex;
+    std::condition_variable drained;                //signalled when a job finished
+    std::deque<std::shared_ptr<FanoutJob>> jobs;    //front is running while active
+    bool active = false;
+};
+
+/**
+ * @brief Fan-out of one publish, chunks may run on different workers at the same time.
+ */
+class FanoutJob {
+public:
+    virtual ~FanoutJob() = default;
+
+    //number of chunks, at least 1
+    virtual size_t chunk_count() const = 0;
+    //sends chunk, called once per chunk from any worker
+    virtual void run_chunk(size_t chunk) = 0;
+    //called once after all chunks, before the next job of the strand starts
+    virtual void finish() = 0;
+
+private:
+    friend class FanoutPool;
+    std::atomic<size_t> remaining{0};
+    std::shared_ptr<FanoutStrand> strand;
+};
+
+/**
+ * @brief Worker pool of one broker (see BrokerState in common.h).
+ *
+ * Started and stopped by the Broker that owns it, after its connection
+ * handlers are joined, so no publish of the broker races with stop().
+ */
+class FanoutPool {
+public:
+    FanoutPool();
+    ~FanoutPool();
+    FanoutPool(const FanoutPool&) = delete;
+    FanoutPool& operator=(const FanoutPool&) = delete;
+
+    /**
+     * @brief Starts fan-out workers.
+     * @param count Number of workers, 0 keeps fan-out inline.
+     */
+    void start(size_t count);
+
+    /**
+     * @brief Waits until all queued jobs are finished, then stops workers.
+     */
+    void stop();
+
+    /**
+     * @brief Checks if workers run, jobs are run inline otherwise.
+     */
+    bool running() const { return active.load(); }
+
+    /**
+     * @brief Queues job on strand, never blocks, so it may be called under queues_mutex.
+     *
+     * Jobs submitted to a strand run in submit order. Without running workers
+     * the job runs before submit returns.
+     *
+     * @param strand Strand of the published queue.
+     * @param job Fan-out to run.
+     */
+    void submit(const std::shared_ptr<FanoutStrand>& strand, std::shared_ptr<FanoutJob> job);
+
+    /**
+     * @brief Waits while more than FANOUT_MAX_PENDING jobs are queued on strand.
+     *
+     * Called by publishers after releasing broker locks, so a stalled
+     * subscriber slows its publishers down instead of growing the backlog.
+     *
+     * @param strand Strand of the published queue.
+     */
+    void throttle(const std::shared_ptr<FanoutStrand>& strand);
+
+    /**
+     * @brief Waits until every submitted job is finished.
+     */
+    void wait_idle();
+
+private:
+    struct WorkerQueue;
+    struct Task;
+
+    static void run_inline(FanoutJob& job);
+    void dispatch(const std::shared_ptr<FanoutJob>& job);
+    bool take(size_t index, Task& task);
+    void worker_loop(size_t index);
+    void complete(const std::shared_ptr<FanoutJob>& job);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<bool> active{false};
+    std::atomic<size_t> next_queue{0};
+
+    std::mutex idle_mutex;
+    std::condition_variable work_ready;
+    std::atomic<size_t> queued{0}; //tasks in all worker queues
+    bool stopping = false;         //guarded by idle_mutex
+
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_done;
+    std::atomic<size_t> pending_jobs{0}; //submitted and not finished
+};
+
+/**
+ * @brief Worker count from MQ_FANOUT_WORKERS, hardware threads (at most FANOUT_MAX_WORKERS) if unset.
+ */
+size_t fanout_workers_from_env();
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * @file liveness.h
+ * @brief Idle detection of client connections with a timer wheel.
+ *
+ * Every connection has one timer in a wheel of one second slots, so a tick
+ * only looks at connections whose deadline has come instead of all of
+ * them. Sending and receiving just store the current second in the
+ * connection; the timer compares those times when it fires and is
+ * moved to the next deadline if the connection was busy. A heartbeat is
+ * sent to a logged in connection only when nothing was sent to it or
+ * received from it for HEARTBEAT_INTERVAL seconds (the client answers HB
+ * with HB), and a connection that sent nothing for CLIENT_READ_TIMEOUT
+ * seconds is shut down. Deadlines follow each connection's own traffic,
+ * so heartbeats are spread over time instead of sent in one sweep.
+ *
+ * Optional TCP keepalive lets the kernel find dead peers of idle
+ * connections as well (see tcp_keepalive_from_env).
+ */
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+constexpr size_t LIVENESS_WHEEL_SLOTS = 64;      //one second per slot, more than the longest deadline
+
+class Connection;
+
+// Idle timer state of a connection
+struct Liveness {
+    std::atomic<uint32_t> received{0};  //second of the last frame from client
+    std::atomic<uint32_t> sent{0};      //second of the last send to client
+    //guarded by the wheel mutex
+    uint64_t timer = 0;                 //id of the only timer that may fire, 0 if not tracked
+    bool logged_in = false;
+    bool compact = false;
+};
+
+/**
+ * @brief Starts timer of connection, its idle time starts now.
+ * @param connection Connection to watch, the wheel does not keep it alive.
+ */
+void liveness_track(const std::shared_ptr<Connection>& connection);
+
+/**
+ * @brief Stops timer of connection, called by its handler when the client is gone.
+ * @param connection Tracked connection.
+ */
+void liveness_untrack(Connection& connection);
+
+/**
+ * @brief Enables heartbeats of connection once its client logged in.
+ * @param connection Tracked connection.
+ * @param compact Heartbeats use compact framing.
+ */
+void liveness_logged_in(const std::shared_ptr<Connection>& connection, bool compact);
+
+/**
+ * @brief Records that a frame was received from connection, called for every frame.
+ * @param connection Connection the frame came from.
+ */
+void liveness_received(Connection& connection);
+
+/**
+ * @brief Records that data was sent to connection, called for every send.
+ * @param connection Connection the data went to.
+ */
+void liveness_sent(Connection& connection);
+
+/**
+ * @brief Fires due timers: sends heartbeats and shuts idle connections down.
+ *
+ * Called about once per second by Broker's cleanup worker, missed seconds
+ * are caught up. Never blocks on a socket, a busy socket is retried on the
+ * next tick.
+ */
+void liveness_tick();
+
+// TCP keepalive of accepted connections, times in seconds
+struct TcpKeepalive {
+    bool enabled = false;
+    int idle = 60;      //idle time before first probe
+    int interval = 10;  //time between probes
+    int count = 5;      //unanswered probes before the connection is dropped
+};
+
+/**
+ * @brief Keepalive settings from MQ_TCP_KEEPALIVE="idle[,interval[,count]]", disabled if unset or 0.
+ */
+TcpKeepalive tcp_keepalive_from_env();
+
+/**
+ * @brief Enables keepalive on TCP socket.
+ * @param sock Connected TCP socket.
+ * @param keepalive Settings, nothing is done if not enabled.
+ * @return bool that contains true if all options were set or keepalive is disabled.
+ */
+bool apply_tcp_keepalive(int sock, const TcpKeepalive& keepalive);
+
+#endif
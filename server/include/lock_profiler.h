@@ -0,0 +1,183 @@
+/**
+ * @file lock_profiler.h
+ * @brief Instrumented broker mutex and lock contention report.
+ *
+ * Every MeteredMutex records wait and hold times into its metrics histograms.
+ * Built with MQ_LOCK_PROFILING (CMake option, on by default) and enabled at
+ * run time with MQ_LOCK_PROFILE=1, locks taken through MeteredLock are also
+ * attributed to their call site, so the report names the critical sections
+ * that hold a lock longest. Call site statistics are updated while the lock
+ * is still held, so they add no contention of their own.
+ */
+
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include "metrics.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#if MQ_LOCK_PROFILING
+#include <source_location>
+#endif
+
+constexpr size_t LOCK_SITE_SLOTS = 64;       //call sites tracked per mutex, further sites are counted together
+constexpr size_t LOCK_REPORT_TOP_SITES = 8;  //call sites listed per mutex in report
+
+// Lock statistics of one call site, written by lock owner, read by report
+struct LockSite {
+    std::atomic<const char*> file{nullptr}; //nullptr while slot is free
+    std::atomic<const char*> function{nullptr};
+    std::atomic<uint32_t> line{0};
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> wait_ns{0};
+    std::atomic<uint64_t> max_wait_ns{0};
+    std::atomic<uint64_t> hold_ns{0};
+    std::atomic<uint64_t> max_hold_ns{0};
+};
+
+/**
+ * @brief Checks if call sites are recorded, set from MQ_LOCK_PROFILE by lock_profiler_start.
+ */
+bool lock_profiling_enabled();
+
+/**
+ * @brief Reads MQ_LOCK_PROFILE (1 enables call site recording, if it was built in).
+ */
+void lock_profiler_start();
+
+/**
+ * @brief Builds contention report of all MeteredMutex instances.
+ *
+ * Per mutex: acquisitions, contended share, wait and hold percentiles, then
+ * call sites ordered by total hold time.
+ *
+ * @return std::string that contains report, one line per mutex or call site.
+ */
+std::string lock_profiler_report();
+
+/**
+ * @brief Mutex that records lock wait and hold times.
+ *
+ * Satisfies Lockable, so it works with std::lock_guard and std::unique_lock.
+ * An uncontended lock skips the wait clock read and records zero wait.
+ * Locks taken with MeteredLock also carry their call site.
+ */
+class MeteredMutex {
+public:
+    MeteredMutex(const char* name, metrics::Histogram& wait, metrics::Histogram& hold);
+    ~MeteredMutex();
+    MeteredMutex(const MeteredMutex&) = delete;
+    MeteredMutex& operator=(const MeteredMutex&) = delete;
+
+    void lock() { lock_timed(); }
+    bool try_lock() {
+        if (!mutex.try_lock()) return false;
+        locked_at = metrics::now_ns();
+#if MQ_LOCK_PROFILING
+        site = nullptr;
+#endif
+        return true;
+    }
+    void unlock() {
+        uint64_t held = metrics::now_ns() - locked_at;
+#if MQ_LOCK_PROFILING
+        if (site != nullptr) {
+            //still under the lock, only the report reads concurrently
+            site->hold_ns.store(site->hold_ns.load(std::memory_order_relaxed) + held, std::memory_order_relaxed);
+            if (held > site->max_hold_ns.load(std::memory_order_relaxed)) site->max_hold_ns.store(held, std::memory_order_relaxed);
+        }
+#endif
+        mutex.unlock();
+        hold_time.record(held);
+    }
+
+#if MQ_LOCK_PROFILING
+    //lock attributed to call site, used by MeteredLock
+    void lock(const std::source_location& location) {
+        uint64_t waited = lock_timed();
+        site = lock_profiling_enabled() ? find_site(location) : nullptr;
+        if (site != nullptr) {
+            site->acquisitions.store(site->acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (waited > 0) {
+                site->contended.store(site->contended.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                site->wait_ns.store(site->wait_ns.load(std::memory_order_relaxed) + waited, std::memory_order_relaxed);
+                if (waited > site->max_wait_ns.load(std::memory_order_relaxed)) site->max_wait_ns.store(waited, std::memory_order_relaxed);
+            }
+        }
+    }
+#endif
+
+    const char* name() const { return mutex_name; }
+    const metrics::Histogram& wait_histogram() const { return wait_time; }
+    const metrics::Histogram& hold_histogram() const { return hold_time; }
+#if MQ_LOCK_PROFILING
+    //call site slots, last one collects sites that did not fit
+    const std::array<LockSite, LOCK_SITE_SLOTS>& sites() const { return site_slots; }
+#endif
+
+private:
+    //returns wait time, 0 if lock was free
+    uint64_t lock_timed() {
+        if (!mutex.try_lock()) {
+            uint64_t start = metrics::now_ns();
+            mutex.lock();
+            locked_at = metrics::now_ns();
+            wait_time.record(locked_at - start);
+#if MQ_LOCK_PROFILING
+            site = nullptr;
+#endif
+            return locked_at - start;
+        }
+        locked_at = metrics::now_ns();
+        wait_time.record(0);
+#if MQ_LOCK_PROFILING
+        site = nullptr;
+#endif
+        return 0;
+    }
+
+#if MQ_LOCK_PROFILING
+    //called under the lock, slots are claimed only by lock owners
+    LockSite* find_site(const std::source_location& location);
+#endif
+
+    std::mutex mutex;
+    const char* mutex_name;
+    metrics::Histogram& wait_time;
+    metrics::Histogram& hold_time;
+    uint64_t locked_at = 0; //written and read only by the owner
+#if MQ_LOCK_PROFILING
+    std::array<LockSite, LOCK_SITE_SLOTS> site_slots;
+    LockSite* site = nullptr; //call site of current owner, nullptr if not attributed
+#endif
+};
+
+/**
+ * @brief Scoped lock of MeteredMutex that attributes the lock to its call site.
+ *
+ * Used instead of std::lock_guard, without MQ_LOCK_PROFILING it is a plain guard.
+ */
+class MeteredLock {
+public:
+#if MQ_LOCK_PROFILING
+    explicit MeteredLock(MeteredMutex& m, const std::source_location& location = std::source_location::current()) : mutex(m) {
+        mutex.lock(location);
+    }
+#else
+    explicit MeteredLock(MeteredMutex& m) : mutex(m) { mutex.lock(); }
+#endif
+    ~MeteredLock() { mutex.unlock(); }
+    MeteredLock(const MeteredLock&) = delete;
+    MeteredLock& operator=(const MeteredLock&) = delete;
+
+private:
+    MeteredMutex& mutex;
+};
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file logger.h
+ * @brief Asynchronous logging: per-thread lock-free rings drained by a writer thread.
+ *
+ * Logging thread only copies the message into its own ring, formatting and
+ * writing to stdout/stderr happen on the writer thread. When a ring is full
+ * or a thread exceeds its rate limit the message is dropped and counted, so
+ * a slow or blocked log pipe never stalls message delivery.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Severity of log message, messages below minimal level are discarded
+enum class log_level : uint8_t {
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+constexpr size_t LOG_RING_CAPACITY = 128;    //messages buffered per thread, must be power of two
+constexpr size_t LOG_RECORD_TEXT_SIZE = 240; //longer messages are truncated
+constexpr uint32_t LOG_RATE_PER_SECOND = 2000; //messages per thread and second, also burst size
+
+/**
+ * @brief Starts writer thread.
+ *
+ * Minimal level is taken from MQ_LOG_LEVEL environment variable
+ * (debug, info, warn, error, off), default_level if it is not set.
+ * Until the writer runs, and after it stops, messages are written directly.
+ *
+ * @param default_level Minimal level used without MQ_LOG_LEVEL.
+ */
+void logger_start(log_level default_level = log_level::INFO);
+
+/**
+ * @brief Stops writer thread after it wrote all buffered messages.
+ */
+void logger_stop();
+
+/**
+ * @brief Sets minimal level of messages that are logged.
+ * @param level New minimal level.
+ */
+void set_log_level(log_level level);
+
+/**
+ * @brief Checks if messages of level are logged, lets callers skip building expensive messages.
+ * @param level Level to check.
+ * @return bool that contains true if level is enabled.
+ */
+bool log_enabled(log_level level);
+
+/**
+ * @brief Logs message, never blocks.
+ * @param level Severity of message, WARN and ERROR go to stderr.
+ * @param msg Message without trailing newline.
+ */
+void log_message(log_level level, std::string_view msg);
+
+#endif
@@ -7,12 +7,30 @@
 
 #include "common.h"
 #include "protocol_handler.h"
+#include "queue_list.h"
 
 //helper functions
-std::unordered_map<std::string, Queue>::iterator find_queue_by_name(const std::string& queue_name);
+std::unordered_map<std::string, Queue>::iterator find_queue_by_name(BrokerState& state, const std::string& queue_name);
 bool is_client_subscribed(const Queue& queue, const std::string& client_id);
 std::vector<std::string>::iterator find_subscriber(Queue& queue, const std::string& client_id);
-bool queue_exists(const std::string& queue_name);
+bool queue_exists(BrokerState& state, const std::string& queue_name);
+//Removes expired messages and keeps retained_bytes in sync (call with queues_mutex held), returns number removed
+size_t remove_expired_messages(Queue& queue, std::chrono::steady_clock::time_point now);
+//Takes messages expired by now out of the live QS values (call with queues_mutex held), touches only the expired ones
+void account_expired_messages(Queue& queue, std::chrono::steady_clock::time_point now);
+
+//queue handles (call with queues_mutex held)
+/**
+ * @brief Assigns numeric handle to queue stored in existing_queues of state.
+ * @param state Queues and clients of the broker.
+ * @param queue Queue to assign handle to.
+ * @return uint32_t that contains new handle, 0 if handle table is full.
+ */
+uint32_t assign_queue_handle(BrokerState& state, Queue& queue);
+//Releases handle of deleted queue, stale copies of handle stop resolving
+void release_queue_handle(BrokerState& state, uint32_t handle);
+//Finds queue by handle in O(1), nullptr if handle is unknown or stale
+Queue* find_queue_by_handle(BrokerState& state, uint32_t handle);
 
 
 //FUNCTIONS THAT RECEIVE DATA FROM CLIENT AND CHANGE QUEUES OR MESSAGES.
@@ -20,95 +38,179 @@ bool queue_exists(const std::string& queue_name);
  * @brief Subscribes client to queue.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name]
+ * In compact mode OK reply carries queue handle: [OK][queue_handle(varint)]
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  * @param queue_name Name of queue to subscribe to
  */
-void subscribe_to_queue(const Client& client, const std::string& queue_name);
+void subscribe_to_queue(BrokerState& state, const Client& client, const std::string& queue_name);
 
 /**
  * @brief Unsubscribes client from queue.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name]
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  * @param queue_name Name of queue to unsubscribe from
  */
-void unsubscribe_from_queue(const Client& client, const std::string& queue_name);
+void unsubscribe_from_queue(BrokerState& state, const Client& client, const std::string& queue_name);
 
 /**
  * @brief Creates new queue.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name]
+ * In compact mode OK reply carries queue handle: [OK][queue_handle(varint)]
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  * @param queue_name Name of queue to create
  */
-void create_queue(const Client& client, const std::string& queue_name);
+void create_queue(BrokerState& state, const Client& client, const std::string& queue_name);
 
 /**
  * @brief Deletes an existing queue.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name]
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  * @param queue_name Name of queue to delete
  */
-void delete_queue(const Client& client, const std::string& queue_name);
+void delete_queue(BrokerState& state, const Client& client, const std::string& queue_name);
 
 /**
  * @brief Publishes message to queue.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name_size(4b)][ttl(4b)][queue_name][message]
+ * Compact format: [TYPE(2b)][SIZE(varint)][queue_handle(varint)][ttl(varint)][message]
+ * or by name: [TYPE(2b)][SIZE(varint)][0][ttl(varint)][queue_name_size(varint)][queue_name][message]
+ * 
+ * With compression negotiated [message] is [encoding(1b)][data] (see compression.h),
+ * it is stored as received so fan-out never recompresses per subscriber.
+ * Messages over CHUNK_SIZE go to chunking subscribers as CK chunks, shared by all of them.
+ * In compact mode OK reply carries queue handle: [OK][queue_handle(varint)]
  * 
+ * Traced publish (PT, see tracing.h) records spans when the queue lock is taken, on enqueue
+ * and after each subscriber send, and goes to subscribers with tracing as MT.
+ * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  * @param content Content of message to publish (includes queue name, TTL, and message data)
+ * @param trace_id Trace id of PT publish, 0 for untraced PB
  */
-void publish_message_to_queue(const Client& client, const std::string& content);
+void publish_message_to_queue(BrokerState& state, const Client& client, const std::string& content, uint64_t trace_id = 0);
 
-//Build queue list packet
-std::string construct_queue_list();
-//Broadcast queue list to all clients
-void broadcast_queues_list();
+//Build queue list packet, framed for compact or legacy client, only queues view wants if given
+std::string construct_queue_list(BrokerState& state, bool compact = false, const QueueListView* view = nullptr);
+//Build QV packet, queue list with its version (see queue_list.h), version is set to that version
+std::string construct_queue_snapshot(BrokerState& state, bool compact, uint32_t& version, const QueueListView* view = nullptr);
+//Build QD packet of batch
+std::string construct_queue_delta(const QueueListBatch& batch, bool compact = false);
+//Sends changes not announced yet: QD to clients with FEATURE_QUEUE_LIST_DELTA, full QL to others if the list changed
+//clients with a QF filter get them only if a change matches, clients without lists are skipped
+void broadcast_queues_list(BrokerState& state);
 
 //FUNCTIONS THAT ARE SENDING TO CLIENT DATA ABOUT QUEUES OR MESSAGES.
 /**
- * @brief Sends list of all available queues to client.
+ * @brief Sends list of all available queues to client, as QV if client negotiated FEATURE_QUEUE_LIST_DELTA.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queues_count(4b)][queue_name_size(4b)][queue_name][queue_name_size(4b)][queue_name]...
+ * QV payload starts with the list version (see wire_codec.h).
+ * Client with a QF filter gets only matching queues, nothing if it opted out of lists.
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  */
-void send_single_queue_list(const Client& client);
+void send_single_queue_list(BrokerState& state, const Client& client);
 
 /**
- * @brief Sends published message to a subscriber.
+ * @brief Sets queue name prefixes client gets queue lists for and sends it the filtered list.
  * 
- * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name_size(4b)][queue_name][message]
+ * Protocol format: [TYPE(2b)][SIZE(4b)][prefixes_count(4b)][prefix_size(4b)][prefix]...
+ * An empty prefix matches every queue, no prefixes stops queue lists.
+ * Only for clients that negotiated FEATURE_QUEUE_LIST_FILTER, invalid payload is logged and ignored.
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
+ * @param content Payload of QF message
+ */
+void set_queue_list_filter(BrokerState& state, const Client& client, const std::string& content);
+
+/**
+ * @brief Builds packet delivering published message to subscribers.
+ * 
+ * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name_size(4b)][queue_name][message]
+ * Compact format: [TYPE(2b)][SIZE(varint)][queue_handle(varint)][message]
+ * [message] is [encoding(1b)][data] for subscribers with compression.
+ * 
  * @param queue_name Name of the queue the message was published to
+ * @param queue_handle Handle of the queue the message was published to
  * @param content Content of the message to send
+ * @param compact Build packet for compact mode subscriber
+ * @return std::string that contains packet, ready to be sent to every subscriber with same mode.
  */
-void send_published_message(const Client& client, const std::string &queue_name, const std::string &content);
+std::string build_published_message(const std::string &queue_name, uint32_t queue_handle, const std::string &content, bool compact);
+
+//Builds MT packet, MS payload followed by trace id (see tracing.h)
+std::string build_traced_message(const std::string &queue_name, uint32_t queue_handle, const std::string &content, uint64_t trace_id, bool compact);
+
+//Builds MS payload without frame header, used to stream large messages in chunks
+std::string build_published_payload(const std::string &queue_name, uint32_t queue_handle, const std::string &content, bool compact);
+
+/**
+ * @brief Sends published message to a subscriber, see FANOUT_SEND_TIMEOUT.
+ *
+ * Disconnects a subscriber that takes no data for FANOUT_SEND_TIMEOUT, drops the
+ * message if another writer holds the connection for longer (counted in delivery_drops).
+ * 
+ * @param client Client struct that contains client information
+ * @param packet Packet built by build_published_message
+ * @return bool that contains true if message was sent.
+ */
+bool send_published_message(const Client& client, const std::string &packet);
 
 /**
  * @brief Notifies subscribers about queue deletion.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name_size(4b)][queue_name]
  * 
+ * @param state Queues and clients of the broker.
  * @param subscriber_ids Vector of subscriber clients IDs to notify
  */
-void notify_after_delete(const std::vector<std::string>& subscriber_ids, const std::string& queue_name);
+void notify_after_delete(BrokerState& state, const std::vector<std::string>& subscriber_ids, const std::string& queue_name);
 
 /**
  * @brief Sends all existing messages from a queue to a newly subscribed client.
  * 
  * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name_size(4b)][queue_name][message_size(4b)][message][message_size(4b)][message]...
+ * Compact format: [TYPE(2b)][SIZE(varint)][queue_handle(varint)][message_size(varint)][message]...
+ * With compression negotiated the message list is [encoding(1b)][data], compressed as a whole.
+ * List is split into several frames if it exceeds client max_frame.
+ * With chunking negotiated frames over CHUNK_SIZE are sent as CK chunks (see chunking.h).
  * 
+ * @param state Queues and clients of the broker.
  * @param client Client struct that contains client information
  * @param queue_name Name of the queue to retrieve messages from
  */
-void send_messages_to_new_subscriber(const Client& client, const std::string& queue_name);
+void send_messages_to_new_subscriber(BrokerState& state, const Client& client, const std::string& queue_name);
+
+/**
+ * @brief Sends statistics of one queue, or of all queues if queue_name is empty.
+ * 
+ * Protocol format: [TYPE(2b)][SIZE(4b)][queue_name] (may be empty)
+ * Reply: [QS]["OK\n"][line]... with one line per queue:
+ * name depth retained_bytes subscribers published delivered publish_rate deliver_rate oldest_age_ms
+ * Rates are messages per second, decaying over QUEUE_RATE_WINDOW_SECONDS.
+ * All values are maintained on publish and expiry, nothing scans queue messages:
+ * depth and retained_bytes count live messages, also when expired ones were not swept yet.
+ * Unknown queue is answered with "ER:NO_QUEUE".
+ * 
+ * @param state Queues and clients of the broker.
+ * @param client Client struct that contains client information
+ * @param queue_name Name of the queue, empty for all queues
+ */
+void send_queue_stats(BrokerState& state, const Client& client, const std::string& queue_name);
 
 #endif
\ No newline at end of file
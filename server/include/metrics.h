@@ -0,0 +1,196 @@
+/**
+ * @file metrics.h
+ * @brief Broker metrics: sharded counters, gauges, log-linear latency histograms and their registry.
+ *
+ * Updates are relaxed atomic operations on a shard picked per thread, so
+ * handler threads never contend on the same cache line. Values are merged
+ * only when the registry is rendered (STATS frame or metrics endpoint).
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace metrics {
+
+constexpr size_t SHARD_COUNT = 8;              //shards per counter and histogram
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * @brief Shard of calling thread, threads are assigned shards round-robin.
+ * @return size_t that contains index in [0, SHARD_COUNT).
+ */
+size_t shard_index();
+
+/**
+ * @brief Monotonic clock in nanoseconds used by all metrics.
+ * @return uint64_t that contains steady clock time in nanoseconds.
+ */
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Monotonic counter, sharded per thread
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        shards[shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t value() const;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, SHARD_COUNT> shards;
+};
+
+// Value that goes up and down (connections, queues)
+class Gauge {
+public:
+    void set(int64_t v) { current.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { current.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> current{0};
+};
+
+/**
+ * @brief Latency histogram with HDR-style log-linear buckets over nanoseconds.
+ *
+ * Every power of two is split into 2^SUB_BUCKET_BITS sub-buckets, so any
+ * recorded value is reported with at most ~6% relative error, from 1ns to
+ * the full uint64_t range, with fixed memory and no allocation on record.
+ */
+class Histogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // Merged copy of all shards
+    struct Snapshot {
+        std::vector<uint64_t> counts; //per bucket
+        uint64_t count = 0;
+        uint64_t sum = 0;             //nanoseconds
+        uint64_t max = 0;             //nanoseconds
+
+        //value at quantile q in [0, 1], upper bound of its bucket
+        uint64_t percentile(double q) const;
+        //number of values not larger than ns (bucket resolution)
+        uint64_t count_at_most(uint64_t ns) const;
+    };
+
+    void record(uint64_t ns);
+    Snapshot snapshot() const;
+
+    static size_t bucket_of(uint64_t ns);
+    static uint64_t bucket_lower(size_t bucket);
+    static uint64_t bucket_upper(size_t bucket);
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts{};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+    std::array<Shard, SHARD_COUNT> shards;
+};
+
+// Records elapsed time into histogram when it goes out of scope
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& h) : histogram(h), start(now_ns()) {}
+    ~ScopedTimer() { histogram.record(now_ns() - start); }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& histogram;
+    uint64_t start;
+};
+
+// Named metrics rendered in Prometheus text exposition format
+class Registry {
+public:
+    void add(const std::string& name, const std::string& help, Counter& counter, const std::string& labels = "");
+    void add(const std::string& name, const std::string& help, Gauge& gauge, const std::string& labels = "");
+    void add(const std::string& name, const std::string& help, Histogram& histogram, const std::string& labels = "");
+
+    /**
+     * @brief Adds callback run before every render, for gauges computed on demand.
+     * @param collector Callback, it may take broker locks.
+     */
+    void add_collector(std::function<void()> collector);
+
+    /**
+     * @brief Renders all metrics, histograms as seconds with fixed buckets plus <name>_quantile and <name>_max gauge families after them.
+     * @return std::string that contains Prometheus text format (version 0.0.4).
+     */
+    std::string render();
+
+private:
+    enum class kind { COUNTER, GAUGE, HISTOGRAM };
+    struct Entry {
+        std::string name;
+        std::string help;
+        std::string labels; //e.g. lock="queues", without braces
+        kind type;
+        void* metric;
+    };
+    std::mutex mutex;
+    std::vector<Entry> entries; //metrics of one name are added together
+    std::vector<std::function<void()>> collectors;
+};
+
+// Metrics of the broker, registered in registry()
+struct BrokerMetrics {
+    Counter publishes;              //accepted PB
+    Counter published_bytes;        //stored message bytes of accepted PB
+    Counter publish_errors;         //rejected PB
+    Counter deliveries;             //MS frames sent to subscribers
+    Counter delivery_drops;         //MS frames not sent (over max frame, decompress failure, connection busy)
+    Counter send_errors;            //failed socket sends
+    Counter send_timeouts;          //connections shut down because the client took no data within the write timeout
+    Counter sent_bytes;             //bytes written to client sockets
+    Counter connections_accepted;
+    Gauge connections;              //open client connections
+    Gauge queues;                   //existing queues
+    Gauge retained_messages;        //messages stored in all queues
+    Gauge fanout_backlog;           //publishes waiting for or in fan-out (see fanout.h)
+    Counter fanout_steals;          //fan-out chunks taken from another worker
+    Counter heartbeats_sent;        //HB frames sent to idle connections (see liveness.h)
+    Counter idle_timeouts;          //connections shut down after CLIENT_READ_TIMEOUT without traffic
+    Histogram publish_fanout;       //PB received until last subscriber was sent MS
+    Histogram send_duration;        //one send_message call, including wait for socket buffer
+    Histogram queues_lock_wait;
+    Histogram queues_lock_hold;
+    Histogram clients_lock_wait;
+    Histogram clients_lock_hold;
+};
+
+BrokerMetrics& broker();
+Registry& registry();
+
+/**
+ * @brief Starts HTTP listener on 127.0.0.1:port that answers every request with registry().render().
+ * @param port Port to listen on.
+ * @return bool that contains true if listener was started.
+ */
+bool start_endpoint(int port);
+//Stops listener started by start_endpoint
+void stop_endpoint();
+
+} // namespace metrics
+
+#endif
@@ -13,32 +13,147 @@ enum class recv_status {
     SUCCESS,
     DISCONNECT,
     NETWORK_ERROR,
-    PROTOCOL_ERROR,
+    PROTOCOL_ERROR,     //frame of unknown type, skipped
+    MALFORMED_FRAME,    //header could not be decoded, stream is out of sync
     PAYLOAD_TOO_LARGE
 };
 
+// Status of a send that gives up when another writer holds the connection
+enum class send_status {
+    SENT,
+    BUSY,               //write mutex was held by another writer for the whole wait, nothing was sent
+    FAILED              //send failed or client stopped reading, connection is shut down
+};
+
+// Buffered reader of a single client connection
+struct FrameReader {
+    int sock = -1;
+    bool compact = false;   //frames use varint length (after negotiation)
+    std::string buffer;     //received bytes not consumed yet
+    size_t offset = 0;      //start of unconsumed data in buffer
+    char code[wire::TYPE_SIZE] = {}; //type of the last frame as sent, also when unknown
+};
+
 /**
  * @brief Receives a message from socket.
- * @param sock Socket to receive from.
+ *
+ * Reads in large chunks into the reader buffer, so a burst of small frames
+ * costs one recv call instead of two per frame.
+ *
+ * @param reader Reader of the connection to receive from.
  * @return std::tuple<recv_status, message_type, std::string> that contains status, type and payload of message.
  */
-std::tuple<recv_status, message_type, std::string> recv_message(int sock);
+std::tuple<recv_status, message_type, std::string> recv_message(FrameReader &reader);
 
 /**
- * @brief Prepares a packet: [TYPE(2b)][SIZE(4b)][PAYLOAD]
+ * @brief Prepares a packet: [TYPE(2b)][SIZE(4b)][PAYLOAD], or [TYPE(2b)][SIZE(varint)][PAYLOAD] in compact mode.
  * @param message_type Type of message from message_type enum.
  * @param payload Payload of message.
+ * @param compact Use compact framing negotiated by the receiving client.
+ * @return std::string that contains prepared packet, ready to be sent.
+ */
+std::string prepare_message(message_type message_type, const std::string &payload, bool compact = false);
+
+/**
+ * @brief Prepares a packet of a two character type, also one the server does not know.
+ *
+ * Used to answer a rejected frame with its own type, so the client can match the reply.
+ *
+ * @param code Type of the packet.
+ * @param payload Payload of message.
+ * @param compact Use compact framing negotiated by the receiving client.
  * @return std::string that contains prepared packet, ready to be sent.
  */
-std::string prepare_message(message_type message_type, const std::string &payload);
+std::string prepare_message(const char (&code)[wire::TYPE_SIZE], const std::string &payload, bool compact = false);
+
+/**
+ * @brief Splits payload into CK frames of at most CHUNK_SIZE data each (see chunking.h).
+ *
+ * Stream id is unique across the server, so the frames can be sent unchanged
+ * to every client that negotiated chunking.
+ *
+ * @param message_type Type of the chunked message.
+ * @param payload Payload of message.
+ * @param compact Use compact framing negotiated by the receiving client.
+ * @return std::vector<std::string> that contains CK packets in send order.
+ */
+std::vector<std::string> prepare_chunked_message(message_type message_type, const std::string &payload, bool compact = false);
+
+/**
+ * @brief Appends unsigned LEB128 varint (1-5 bytes).
+ * @param out String to append to.
+ * @param value Value to encode.
+ */
+void append_varint(std::string &out, uint32_t value);
+
+
+/**
+ *@brief Sends data through connection whose write mutex is already held.
+ *Connection is shut down if the client takes no data for timeout, the frame may be cut then.
+ *A client that keeps reading is never cut off, however long the frame takes.
+ *@param connection Connection to send to.
+ *@param data Data to send, it is prepared by prepare_message function.
+ *@param timeout Longest time without progress, waiting for room in socket buffer.
+ *@return bool that contains true if send was successful, false otherwise.
+*/
+bool send_message_locked(Connection& connection, const std::string &data, std::chrono::milliseconds timeout = std::chrono::seconds(CLIENT_WRITE_TIMEOUT));
 
 
 /** 
- *@brief Sends data through socket.
- *@param sock Socket to send to.
+ *@brief Sends data through connection.
+ *Waits for writers ahead, each of them gives up after timeout without progress.
+ *@param connection Connection to send to, nullptr for a client that is not connected.
+ *@param data Data to send, it is prepared by prepare_message function.
+ *@param timeout Longest time without progress, see send_message_locked.
+ *@return bool that contains true if send was successful, false otherwise.
+*/
+bool send_message(const std::shared_ptr<Connection> &connection, const std::string &data, std::chrono::milliseconds timeout = std::chrono::seconds(CLIENT_WRITE_TIMEOUT));
+
+/**
+ *@brief Sends data through connection, waits at most timeout for other writers.
+ *Used by fan-out workers, which must not wait behind a long MA or chunked frame of another writer.
+ *@param connection Connection to send to, nullptr for a client that is not connected.
  *@param data Data to send, it is prepared by prepare_message function.
+ *@param timeout Longest wait for write mutex, and longest time without progress afterwards.
+ *@return send_status, BUSY if the mutex was not free in time and nothing was sent.
+*/
+send_status send_message_within(const std::shared_ptr<Connection> &connection, const std::string &data, std::chrono::milliseconds timeout);
+
+/**
+ *@brief Sends small frame only if no other writer holds the connection and its buffer has room, never blocks.
+ *@param connection Connection to send to.
+ *@param data Data to send, a few bytes prepared by prepare_message function.
+ *@return bool that contains true if data was sent, false if it was not sent or send failed.
+*/
+bool try_send_message(Connection& connection, const std::string &data);
+
+/**
+ *@brief Sends CK packets through connection, write mutex is taken per chunk
+ *so other writers can interleave small frames between chunks.
+ *@param connection Connection to send to, nullptr for a client that is not connected.
+ *@param chunks Packets prepared by prepare_chunked_message function.
+ *@param timeout Longest time without progress of each chunk, see send_message_locked.
+ *@return bool that contains true if all chunks were sent, false otherwise.
+*/
+bool send_chunks(const std::shared_ptr<Connection> &connection, const std::vector<std::string> &chunks, std::chrono::milliseconds timeout = std::chrono::seconds(CLIENT_WRITE_TIMEOUT));
+
+/**
+ *@brief Sends CK packets like send_chunks, gives up only before the first chunk.
+ *Waits at most timeout for the write mutex before the first chunk; once the stream
+ *started, the rest is sent whatever writers ahead, so the client never keeps a partial stream.
+ *@return send_status, BUSY if nothing was sent because the mutex was not free in time.
+*/
+send_status send_chunks_within(const std::shared_ptr<Connection> &connection, const std::vector<std::string> &chunks, std::chrono::milliseconds timeout);
+
+/**
+ *@brief Sends payload as one frame, or in chunks if it is larger than CHUNK_SIZE and client negotiated chunking.
+ *@param connection Connection to send to, nullptr for a client that is not connected.
+ *@param message_type Type of message from message_type enum.
+ *@param payload Payload of message.
+ *@param compact Use compact framing negotiated by the receiving client.
+ *@param chunking Client negotiated FEATURE_CHUNKING.
  *@return bool that contains true if send was successful, false otherwise.
 */
-bool send_message(int sock, const std::string &data);
+bool send_payload(const std::shared_ptr<Connection> &connection, message_type message_type, const std::string &payload, bool compact, bool chunking);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+/**
+ * @file queue_list.h
+ * @brief Versioned queue list and coalesced announcement of its changes.
+ *
+ * Every create and delete of a queue is a new version of the queue list and
+ * is recorded as a change. Clients that negotiated FEATURE_QUEUE_LIST_DELTA
+ * get a QV snapshot at login and afterwards QD frames with the changes only
+ * (see wire_codec.h); other clients get the full QL list as before. Changes
+ * made within QUEUE_LIST_COALESCE of the first one go out as one batch, so a
+ * burst of queue churn costs every client one frame instead of one full
+ * list per change.
+ *
+ * Versions and changes are kept per broker in a QueueListLog, see
+ * BrokerState in common.h. Without a started announcer (state used without
+ * a running Broker) every change is announced inline by the thread that
+ * made it.
+ *
+ * Clients that negotiated FEATURE_QUEUE_LIST_FILTER get no list until they
+ * send QF, and afterwards only the queues matching its prefixes. Producers
+ * that never look at the list cost nothing, and batches without a match
+ * for a client are neither serialized nor sent to it.
+ */
+
+#ifndef QUEUE_LIST_H
+#define QUEUE_LIST_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr std::chrono::milliseconds QUEUE_LIST_COALESCE{20}; //changes gathered into one announcement
+
+// Net changes between two versions of the queue list
+struct QueueListBatch {
+    uint32_t from = 0;
+    uint32_t to = 0;
+    std::vector<std::pair<std::string, bool>> changes; //queue name, true if added
+};
+
+// Queue list state of a connection
+struct QueueListView {
+    //held while a queue list is built for and sent to the connection, before queues_mutex
+    std::mutex mutex;
+    //guarded by mutex
+    bool filtered = false;              //false: whole list, set by login with FEATURE_QUEUE_LIST_FILTER
+    std::vector<std::string> prefixes;  //queues sent when filtered, no prefixes: no lists at all
+    uint32_t version = 0;               //version of the last QV or QD sent
+
+    /**
+     * @brief Whether queue belongs to lists of the connection, called under mutex.
+     */
+    bool wants(const std::string& name) const;
+
+    /**
+     * @brief Whether the connection gets lists at all, called under mutex.
+     */
+    bool subscribed() const { return !filtered || !prefixes.empty(); }
+};
+
+// Versions of the queue list of one broker, guarded by its queues_mutex
+struct QueueListLog {
+    uint32_t version = 0;
+    uint32_t announced = 0; //version up to which changes were taken
+    std::unordered_map<std::string, std::pair<bool, bool>> pending; //name -> existed before the batch, exists now
+};
+
+/**
+ * @brief Records created or deleted queue as a new version, called under queues_mutex.
+ * @param log Queue list of the broker.
+ * @param name Name of the queue.
+ * @param added True if queue was created, false if deleted.
+ */
+void queue_list_changed(QueueListLog& log, const std::string& name, bool added);
+
+/**
+ * @brief Takes changes not announced yet, called under queues_mutex.
+ * @param log Queue list of the broker.
+ * @param batch Net changes since the last take.
+ * @return bool that contains true if there were changes.
+ */
+bool queue_list_take(QueueListLog& log, QueueListBatch& batch);
+
+/**
+ * @brief Thread that broadcasts queue list changes of one broker.
+ *
+ * announce() wakes it, it waits QUEUE_LIST_COALESCE for more changes and
+ * then calls the broadcast function.
+ */
+class QueueListAnnouncer {
+public:
+    QueueListAnnouncer() = default;
+    ~QueueListAnnouncer() { stop(); }
+    QueueListAnnouncer(const QueueListAnnouncer&) = delete;
+    QueueListAnnouncer& operator=(const QueueListAnnouncer&) = delete;
+
+    /**
+     * @brief Starts announcer thread.
+     * @param broadcast Sends pending changes, called without broker locks held.
+     */
+    void start(std::function<void()> broadcast);
+
+    /**
+     * @brief Broadcasts pending changes and stops announcer thread.
+     */
+    void stop();
+
+    /**
+     * @brief Wakes announcer thread, called after queues_mutex is released.
+     * @return bool that contains false if announcer does not run and caller has to broadcast itself.
+     */
+    bool announce();
+
+private:
+    void loop();
+
+    std::function<void()> broadcast;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool requested = false; //guarded by mutex
+    bool stopping = false;  //guarded by mutex
+};
+
+#endif
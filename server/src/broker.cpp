@@ -0,0 +1,479 @@
+#include "broker.h"
+#include "protocol_handler.h"
+#include "message_operations.h"
+#include "client_operations.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include <chrono>
+
+// ------------------------------
+// TRANSPORTS
+// ------------------------------
+
+TcpTransport::~TcpTransport() {
+    stop();
+    join();
+}
+
+bool TcpTransport::start(Broker& broker) {
+    struct addrinfo hints{}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int gai_err = getaddrinfo(NULL, port.c_str(), &hints, &res);
+    if (gai_err != 0) {
+        safe_error("getaddrinfo error: " + std::string(gai_strerror(gai_err)));
+        return false;
+    }
+
+    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock == -1) {
+        safe_error("socket creation failed");
+        freeaddrinfo(res);
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (bind(sock, res->ai_addr, res->ai_addrlen) == -1) {
+        safe_error("bind failed");
+        close(sock);
+        freeaddrinfo(res);
+        return false;
+    }
+    freeaddrinfo(res);
+
+    if (listen(sock, SOMAXCONN) == -1) {
+        safe_error("listen failed");
+        close(sock);
+        return false;
+    }
+    listening_socket = sock;
+
+    keepalive = tcp_keepalive_from_env();
+    if (keepalive.enabled) {
+        safe_print("TCP keepalive: idle " + std::to_string(keepalive.idle) + "s, interval " + std::to_string(keepalive.interval) +
+                   "s, " + std::to_string(keepalive.count) + " probes");
+    }
+
+    acceptor = std::thread([this, &broker, sock] {
+        while (broker.is_running()) {
+            int client_socket = accept(sock, NULL, NULL);
+            if (client_socket == -1) {
+                if (broker.is_running()) {
+                    safe_error("accept failed");
+                }
+                break;
+            }
+            if (!apply_tcp_keepalive(client_socket, keepalive)) {
+                safe_error("setsockopt TCP keepalive failed");
+            }
+            broker.serve(client_socket);
+        }
+    });
+    return true;
+}
+
+void TcpTransport::stop() {
+    //wakes acceptor blocked in accept, socket is closed by join
+    int sock = listening_socket.load();
+    if (sock != -1) {
+        shutdown(sock, SHUT_RDWR);
+    }
+}
+
+void TcpTransport::join() {
+    if (acceptor.joinable()) acceptor.join();
+    int sock = listening_socket.exchange(-1);
+    if (sock != -1) {
+        close(sock);
+    }
+}
+
+bool LoopbackTransport::start(Broker& b) {
+    broker = &b;
+    return true;
+}
+
+void LoopbackTransport::stop() {
+    broker = nullptr;
+}
+
+int LoopbackTransport::connect() {
+    Broker* b = broker.load();
+    if (b == nullptr || !b->is_running()) return -1;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        safe_error("socketpair failed");
+        return -1;
+    }
+    b->serve(fds[0]);
+    return fds[1];
+}
+
+// ------------------------------
+// BROKER
+// ------------------------------
+
+//brokers started and not stopped yet, their queues are summed into the process wide gauges
+static std::mutex running_brokers_mutex;
+static std::set<BrokerState*> running_brokers;
+
+Broker::~Broker() {
+    if (worker.joinable()) {
+        request_stop();
+        wait();
+    }
+}
+
+void Broker::add_transport(Transport& transport) {
+    transports.push_back(&transport);
+}
+
+bool Broker::start() {
+    //queue gauges are computed when metrics are rendered, not on every publish
+    static std::once_flag collector_added;
+    std::call_once(collector_added, []{
+        metrics::registry().add_collector([]{
+            std::lock_guard<std::mutex> brokers_lock(running_brokers_mutex);
+            size_t queues = 0;
+            size_t retained = 0;
+            for (BrokerState* broker : running_brokers) {
+                MeteredLock lock(broker->queues_mutex);
+                queues += broker->existing_queues.size();
+                for (const auto& [name, queue] : broker->existing_queues) {
+                    retained += queue.messages.size();
+                }
+            }
+            metrics::broker().queues.set(static_cast<int64_t>(queues));
+            metrics::broker().retained_messages.set(static_cast<int64_t>(retained));
+        });
+    });
+    {
+        std::lock_guard<std::mutex> brokers_lock(running_brokers_mutex);
+        running_brokers.insert(&state);
+    }
+
+    running = true;
+    size_t fanout_workers = fanout_workers_from_env();
+    state.fanout.start(fanout_workers);
+    safe_print("Fan-out workers: " + (fanout_workers > 0 ? std::to_string(fanout_workers) : std::string("inline")));
+    state.announcer.start([this] { broadcast_queues_list(state); });
+    worker = std::thread(&Broker::cleanup_worker, this);
+    for (Transport* transport : transports) {
+        if (!transport->start(*this)) {
+            request_stop();
+            wait();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Broker::serve(int client_socket) {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    //checked under threads_mutex, so wait never misses a handler
+    if (!running) {
+        close(client_socket);
+        return;
+    }
+    auto connection = std::make_shared<Connection>(client_socket);
+    open_connections.insert(connection);
+    client_threads.emplace_back(&Broker::handle_client, this, std::move(connection));
+}
+
+void Broker::request_stop() {
+    running = false;
+    for (Transport* transport : transports) {
+        transport->stop();
+    }
+}
+
+void Broker::request_lock_report() {
+    lock_report_requested = true;
+}
+
+void Broker::wait() {
+    for (Transport* transport : transports) {
+        transport->join();
+    }
+    if (worker.joinable()) worker.join();
+
+    //wake all handlers, also of connections that did not log in, then join them
+    std::list<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        for(const auto& connection : open_connections){
+            connection->shutdown();
+        }
+        threads.swap(client_threads);
+    }
+    for(auto& t : threads){
+        if(t.joinable()) t.join();
+    }
+    //no handler can change queues or publish anymore, pending announcements and fan-out are sent before threads stop
+    state.announcer.stop();
+    state.fanout.stop();
+
+    {
+        MeteredLock lock(state.clients_mutex);
+        state.clients.clear();
+    }
+    {
+        std::lock_guard<std::mutex> brokers_lock(running_brokers_mutex);
+        running_brokers.erase(&state);
+    }
+}
+
+void Broker::cleanup_worker() {
+    int sweep_counter = 0;
+    while (running) {
+
+        //one second tick, sliced so stop requests are noticed quickly
+        for (int slice = 0; slice < 10 && running; ++slice) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        if (!running) break;
+
+        //traced spans reach the export file at least once per second
+        server_spans.flush();
+
+        if (lock_report_requested.exchange(false)) {
+            std::string report = lock_profiler_report();
+            size_t start = 0;
+            while (start < report.size()) {
+                size_t end = report.find('\n', start);
+                safe_print(report.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+
+        //heartbeats and idle timeouts of connections whose timer is due
+        liveness_tick();
+
+        //expired clients and messages are swept every HEARTBEAT_INTERVAL seconds
+        sweep_counter++;
+        if (sweep_counter < HEARTBEAT_INTERVAL) {
+            continue;
+        }
+        else{
+            sweep_counter = 0;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+
+        //clients cleanup
+        {
+            MeteredLock lock(state.clients_mutex);
+            for (auto it = state.clients.begin(); it != state.clients.end(); ) {
+                if (!it->second.connection) {
+                    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+                        now - it->second.disconnect_time).count();
+                    if (elapsed >= SECONDS_TO_CLEAR_CLIENT) {
+                        safe_print("Removing expired client: " + it->first);
+                        it = state.clients.erase(it);
+                        continue;
+                    }
+                }
+                ++it;
+            }
+        }
+
+        //messages cleanup after ttl expire
+        {
+            MeteredLock lock(state.queues_mutex);
+            for (auto& [name, queue] : state.existing_queues) {
+                remove_expired_messages(queue, now);
+            }
+        }
+    }
+}
+
+void Broker::handle_client(std::shared_ptr<Connection> connection){
+    //liveness timer shuts connection down after CLIENT_READ_TIMEOUT seconds of no activity
+    liveness_track(connection);
+    int client_socket = connection->socket();
+
+    metrics::broker().connections_accepted.add();
+    metrics::broker().connections.add(1);
+
+    Client client;
+    client.connection = connection;
+    FrameReader reader;
+    reader.sock = client_socket;
+    wire::chunk_assembler chunks; //large frames received in chunks
+
+    while(running){
+        recv_status status;
+        message_type msg_type;
+        std::string msg_content;
+        std::tie(status, msg_type, msg_content) = recv_message(reader);
+        if (status == recv_status::SUCCESS) {
+            //any valid frame from client counts as activity, heartbeat replies included
+            liveness_received(*connection);
+            connection->frames_received.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (status == recv_status::DISCONNECT) {
+            safe_print("socket:"+ std::to_string(client_socket) +"  client id:"+ (client.id.empty() ? "Unknown" : client.id) + "  disconnected");
+            break;
+        }
+        else if (status == recv_status::NETWORK_ERROR) {
+            if (errno == ECONNRESET) {
+                 safe_print((client.id.empty() ? "Unknown" : client.id) + " disconnected abruptly (ECONNRESET)");
+            } else {
+                 safe_error("recv error from socket " + std::to_string(client_socket) + " (errno=" + std::to_string(errno) + ")");
+            }
+            break;
+        }
+        else if (status == recv_status::MALFORMED_FRAME) {
+            safe_error("MALFORMED FRAME HEADER FROM SOCKET:" + std::to_string(client_socket) + ", closing connection");
+            break;
+        }
+        else if (status == recv_status::PAYLOAD_TOO_LARGE) {
+             safe_error("Client " + (client.id.empty() ? "Unknown" : client.id) + " tried to send too huge message");
+             send_message(connection, prepare_message(msg_type, "ER:MSG_TOO_BIG", client.compact));
+             break;
+        }
+        else if (status == recv_status::PROTOCOL_ERROR) {
+            //every request gets a reply, so clients matching replies in order stay in step
+            safe_error("ERROR MESSAGE NOT VALID FROM SOCKET:" + std::to_string(client_socket));
+            if(!send_message(connection, prepare_message(reader.code, "ER:UNKNOWN_TYPE", client.compact))){
+                safe_error("ERROR SENDING MESSAGE ER:UNKNOWN_TYPE TO SOCKET:" + std::to_string(client_socket));
+            }
+            continue;
+        }
+        
+        //if client not logged in yet
+        if(client.id.empty()){
+            if(msg_type == message_type::LOGIN){
+                client.connection = connection;
+                client = get_client_id(state, client, msg_content);
+                //frames after successful login use negotiated framing
+                reader.compact = !client.id.empty() && client.compact;
+                client.compact = reader.compact;
+                if (!client.id.empty()) {
+                    liveness_logged_in(connection, client.compact);
+                }
+                if (client.features & FEATURE_QUEUE_LIST_FILTER) {
+                    //no queue lists until client sends QF
+                    std::lock_guard<std::mutex> view_lock(connection->queue_list.mutex);
+                    connection->queue_list.filtered = true;
+                }
+                send_single_queue_list(state, client);
+            }
+            else{
+                if(!send_message(client.connection, prepare_message(message_type::LOGIN,"ER:FIRST_YOU_MUST_LOG_IN"))){
+                    safe_error("ERROR SENDING MESSAGE LO:ER TO SOCKET:" + std::to_string(client_socket));
+                }
+            }
+        }
+        else //client logged in
+        {
+            //chunked frame is handled like a single frame once its last chunk arrives
+            if(msg_type == message_type::CHUNK){
+                //request carried by broken chunks can not be answered, connection is dropped
+                if(!(client.features & FEATURE_CHUNKING)){
+                    safe_error("CHUNK WITHOUT NEGOTIATED CHUNKING FROM " + client.id + ", closing connection");
+                    break;
+                }
+                std::string payload;
+                wire::chunk_assembler::result result = chunks.feed(msg_content, reader.code, payload);
+                if(result == wire::chunk_assembler::result::INCOMPLETE){
+                    continue;
+                }
+                if(result == wire::chunk_assembler::result::ERROR){
+                    safe_error("INVALID CHUNK FROM " + client.id + ", closing connection");
+                    break;
+                }
+                msg_type = wire::type_of(reader.code[0], reader.code[1]);
+                msg_content = std::move(payload);
+            }
+
+            if(msg_type == message_type::HEARTBEAT){ //sends heartbeat to client
+                continue;
+            }
+            else if(msg_type == message_type::SUBSCRIBE){
+                subscribe_to_queue(state, client, msg_content);
+            }
+            else if(msg_type == message_type::UNSUBSCRIBE){
+                unsubscribe_from_queue(state, client,msg_content);
+            }
+            else if(msg_type == message_type::QUEUE_CREATE){
+                create_queue(state, client,msg_content);
+            }
+            else if(msg_type == message_type::QUEUE_DELETE){
+                delete_queue(state, client,msg_content);
+            }
+            else if(msg_type == message_type::PUBLISH){
+                publish_message_to_queue(state, client,msg_content);
+            }
+            else if(msg_type == message_type::PUBLISH_TRACED && (client.features & FEATURE_TRACING)){
+                //PB payload followed by trace context, see tracing.h
+                uint64_t trace_id = 0;
+                uint64_t publish_ns = 0;
+                if(trace::strip_context(msg_content, trace_id, publish_ns)){
+                    server_spans.record(trace_id, trace::hop::SERVER_RECEIVE);
+                }
+                publish_message_to_queue(state, client, msg_content, trace_id);
+            }
+            else if(msg_type == message_type::QUEUE_LIST){
+                //client asks for the current list, e.g. after it missed queue list changes
+                send_single_queue_list(state, client);
+            }
+            else if(msg_type == message_type::QUEUE_LIST_FILTER && (client.features & FEATURE_QUEUE_LIST_FILTER)){
+                set_queue_list_filter(state, client, msg_content);
+            }
+            else if(msg_type == message_type::QUEUE_STATS){
+                send_queue_stats(state, client, msg_content);
+            }
+            else if(msg_type == message_type::STATS){
+                //reply: "OK\n" followed by metrics in Prometheus text format
+                if(!send_payload(client.connection, message_type::STATS, "OK\n" + metrics::registry().render(), client.compact, (client.features & FEATURE_CHUNKING) != 0)){
+                    safe_error("ERROR SENDING MESSAGE ST TO " + client.id);
+                }
+            }
+            else if(msg_type == message_type::LOGIN){
+                if(!send_message(client.connection, prepare_message(message_type::LOGIN,"ER:USER_ID_ALREADY_GIVEN", client.compact))){
+                    safe_error("ERROR SENDING MESSAGE LO:ER TO " + client.id);
+                }
+            }
+            else{
+                //types only the server sends, or features not negotiated, are answered too
+                if(!send_message(client.connection, prepare_message(reader.code, "ER:UNEXPECTED_TYPE", client.compact))){
+                    safe_error("ERROR SENDING MESSAGE ER:UNEXPECTED_TYPE TO " + client.id);
+                }
+            }
+        }
+        
+    }
+
+    //client disconnected, a newer connection of the same client is left alone
+    {
+        MeteredLock lock(state.clients_mutex);
+        auto it = state.clients.find(client.id);
+        if (it != state.clients.end() && it->second.connection == connection) {
+            it->second.disconnect_time = std::chrono::steady_clock::now();
+            it->second.connection.reset();
+            safe_print("Client " + client.id + " disconnected (session preserved, " + std::to_string(connection->frames_received.load()) +
+                       " frames received, " + std::to_string(connection->frames_sent.load()) + " sent)");
+        }
+    }
+
+    liveness_untrack(*connection);
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        open_connections.erase(connection);
+    }
+    //socket is closed once queued fan-out releases the connection as well
+    connection->shutdown();
+    metrics::broker().connections.add(-1);
+    return;
+}
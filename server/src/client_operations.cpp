@@ -1,10 +1,26 @@
 #include "client_operations.h"
 #include <algorithm>
 
-Client get_client_id(Client client, std::string& id) {
+Client get_client_id(BrokerState& state, Client client, std::string& payload) {
+    //LO payload of negotiating client: [client_id]['\0'][hello], see wire_codec.h
+    std::string id = payload;
+    bool hello_received = false;
+    size_t separator = payload.find('\0');
+    if (separator != std::string::npos) {
+        id = payload.substr(0, separator);
+        wire::hello hello;
+        if (wire::decode_hello(payload.data() + separator + 1, payload.length() - separator - 1, hello)) {
+            client.version = std::min(hello.version, wire::PROTOCOL_VERSION);
+            client.features = hello.capabilities & SUPPORTED_FEATURES;
+            client.max_frame = hello.max_frame;
+            hello_received = true;
+        }
+    }
+    client.compact = (client.features & FEATURE_COMPACT_FRAMING) != 0;
+
     if (id.length() < 2) {
-        if(!send_message(client.socket, prepare_message(message_type::LOGIN, "ER:ID_TOO_SHORT"))){
-            safe_error("SEND_ERROR: LO:ER to socket:" + std::to_string(client.socket));
+        if(!send_message(client.connection, prepare_message(message_type::LOGIN, "ER:ID_TOO_SHORT"))){
+            safe_error("SEND_ERROR: LO:ER to socket:" + std::to_string(socket_of(client.connection)));
         }
         client.id = "";
         return client;
@@ -16,18 +32,18 @@ Client get_client_id(Client client, std::string& id) {
     //LOCKS ALWAYS IN THE SAME ORDER -> QUEUES_MUTEX THEN CLIENTS_MUTEX
     {
         //lock on queues_mutex to prevent data race when checking if client exists and getting sockets of subscribers
-        std::lock_guard<std::mutex> lock_q(queues_mutex);
+        MeteredLock lock_q(state.queues_mutex);
         //lock on clients_mutex to prevent data race when checking if client exists and getting sockets of subscribers
-        std::lock_guard<std::mutex> lock_c(clients_mutex);
-        auto it = clients.find(id);
+        MeteredLock lock_c(state.clients_mutex);
+        auto it = state.clients.find(id);
         
-        if (it != clients.end()) {
-            if (it->second.socket == -1) {
+        if (it != state.clients.end()) {
+            if (!it->second.connection) {
                 auto now = std::chrono::steady_clock::now();
                 auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - it->second.disconnect_time).count();
                 
                 if (elapsed >= SECONDS_TO_CLEAR_CLIENT) {
-                    for (auto& [name, queue] : existing_queues) {
+                    for (auto& [name, queue] : state.existing_queues) {
                         auto sub_it = std::find(queue.subscribers.begin(), 
                                                queue.subscribers.end(), id);
                         if (sub_it != queue.subscribers.end()) {
@@ -35,13 +51,21 @@ Client get_client_id(Client client, std::string& id) {
                         }
                     }
                     //new connection
-                    it->second.socket = client.socket;
+                    it->second.connection = client.connection;
+                    it->second.compact = client.compact;
+                    it->second.features = client.features;
+                    it->second.version = client.version;
+                    it->second.max_frame = client.max_frame;
                     it->second.disconnect_time = {};
                     client = it->second;
 
                 } else {
                     //reconnection
-                    it->second.socket = client.socket;
+                    it->second.connection = client.connection;
+                    it->second.compact = client.compact;
+                    it->second.features = client.features;
+                    it->second.version = client.version;
+                    it->second.max_frame = client.max_frame;
                     it->second.disconnect_time = {};
                     client = it->second;
                     reconnected = true;
@@ -51,25 +75,34 @@ Client get_client_id(Client client, std::string& id) {
             }
         } else {
             client.id = id;
-            clients[id] = client;
+            state.clients[id] = client;
         }
     }
     
     if (id_active) {
-        if(!send_message(client.socket, prepare_message(message_type::LOGIN, "ER:ID_TAKEN"))){
-            safe_error("SEND_ERROR: LO:ER to socket:" + std::to_string(client.socket));
+        if(!send_message(client.connection, prepare_message(message_type::LOGIN, "ER:ID_TAKEN"))){
+            safe_error("SEND_ERROR: LO:ER to socket:" + std::to_string(socket_of(client.connection)));
         }
         client.id = "";
         return client;
     }
     
+    //LO reply is always in legacy framing, client switches to compact framing after reading it
+    //hello with accepted capabilities is appended only if client sent one: [OK:...]['\0'][hello]
+    std::string accepted;
+    if (hello_received) {
+        char encoded[wire::HELLO_SIZE];
+        accepted.push_back('\0');
+        accepted.append(encoded, wire::encode_hello(encoded, {client.version, client.features, SERVER_MAX_FRAME}));
+    }
+
     if (reconnected) {
-        if(!send_message(client.socket, prepare_message(message_type::LOGIN, "OK:RECONNECTED"))){
+        if(!send_message(client.connection, prepare_message(message_type::LOGIN, "OK:RECONNECTED" + accepted))){
             safe_error("SEND_ERROR: LO:OK to " + client.id);
         }
         safe_print("Client " + client.id + " reconnected");
     } else {
-        if(!send_message(client.socket, prepare_message(message_type::LOGIN, "OK:LOGGED"))){
+        if(!send_message(client.connection, prepare_message(message_type::LOGIN, "OK:LOGGED" + accepted))){
             safe_error("SEND_ERROR: LO:OK to " + client.id);
         }
         safe_print("Client " + client.id + " connected");
@@ -0,0 +1,23 @@
+#include "connection.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static std::atomic<size_t> connections_alive{0};
+
+Connection::Connection(int sock) : sock(sock) {
+    connections_alive.fetch_add(1, std::memory_order_relaxed);
+}
+
+Connection::~Connection() {
+    close(sock);
+    connections_alive.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Connection::shutdown() {
+    ::shutdown(sock, SHUT_RDWR);
+}
+
+size_t Connection::alive() {
+    return connections_alive.load(std::memory_order_relaxed);
+}
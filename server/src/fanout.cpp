@@ -0,0 +1,189 @@
+#include "fanout.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Chunk of a job waiting for a worker
+struct FanoutPool::Task {
+    std::shared_ptr<FanoutJob> job;
+    size_t chunk = 0;
+};
+
+// Tasks of one worker, it takes from the front, others steal from the back
+struct alignas(metrics::CACHE_LINE_SIZE) FanoutPool::WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+FanoutPool::FanoutPool() = default;
+
+FanoutPool::~FanoutPool() {
+    stop();
+}
+
+void FanoutPool::start(size_t count) {
+    if (count == 0 || active.load()) return;
+    stopping = false;
+    for (size_t i = 0; i < count; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < count; ++i) {
+        workers.emplace_back(&FanoutPool::worker_loop, this, i);
+    }
+    active = true;
+}
+
+void FanoutPool::stop() {
+    if (!active.exchange(false)) return;
+    //publishes from now on run inline, queued ones are still sent
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& t : workers) {
+        t.join();
+    }
+    workers.clear();
+    queues.clear();
+}
+
+void FanoutPool::submit(const std::shared_ptr<FanoutStrand>& strand, std::shared_ptr<FanoutJob> job) {
+    if (!active.load()) {
+        run_inline(*job);
+        return;
+    }
+    job->strand = strand;
+    job->remaining = std::max<size_t>(1, job->chunk_count());
+    pending_jobs.fetch_add(1);
+    metrics::broker().fanout_backlog.add(1);
+
+    bool start = false;
+    {
+        std::lock_guard<std::mutex> lock(strand->mutex);
+        strand->jobs.push_back(job);
+        if (!strand->active) {
+            strand->active = true;
+            start = true;
+        }
+    }
+    if (start) {
+        dispatch(job);
+    }
+}
+
+void FanoutPool::throttle(const std::shared_ptr<FanoutStrand>& strand) {
+    if (!active.load()) return;
+    std::unique_lock<std::mutex> lock(strand->mutex);
+    strand->drained.wait(lock, [&] { return strand->jobs.size() <= FANOUT_MAX_PENDING || !active.load(); });
+}
+
+void FanoutPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    jobs_done.wait(lock, [&] { return pending_jobs.load() == 0; });
+}
+
+void FanoutPool::run_inline(FanoutJob& job) {
+    size_t chunks = std::max<size_t>(1, job.chunk_count());
+    for (size_t i = 0; i < chunks; ++i) {
+        job.run_chunk(i);
+    }
+    job.finish();
+}
+
+//all chunks go to one worker, idle workers steal them from there
+void FanoutPool::dispatch(const std::shared_ptr<FanoutJob>& job) {
+    size_t chunks = job->remaining.load();
+    WorkerQueue& queue = *queues[next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (size_t i = 0; i < chunks; ++i) {
+            queue.tasks.push_back({job, i});
+        }
+    }
+    queued.fetch_add(chunks);
+    {
+        //empty critical section orders the wake-up after waiters checked queued
+        std::lock_guard<std::mutex> lock(idle_mutex);
+    }
+    if (chunks == 1) work_ready.notify_one();
+    else work_ready.notify_all();
+}
+
+bool FanoutPool::take(size_t index, Task& task) {
+    {
+        WorkerQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            queued.fetch_sub(1);
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        WorkerQueue& victim = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            queued.fetch_sub(1);
+            metrics::broker().fanout_steals.add();
+            return true;
+        }
+    }
+    return false;
+}
+
+void FanoutPool::worker_loop(size_t index) {
+    for (;;) {
+        Task task;
+        if (take(index, task)) {
+            task.job->run_chunk(task.chunk);
+            if (task.job->remaining.fetch_sub(1) == 1) {
+                complete(task.job);
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        work_ready.wait(lock, [&] { return queued.load() > 0 || stopping; });
+        if (stopping && queued.load() == 0) break;
+    }
+}
+
+//last chunk of job is done, next job of its strand may start
+void FanoutPool::complete(const std::shared_ptr<FanoutJob>& job) {
+    job->finish();
+    std::shared_ptr<FanoutStrand> strand = std::move(job->strand);
+    std::shared_ptr<FanoutJob> next;
+    {
+        std::lock_guard<std::mutex> lock(strand->mutex);
+        strand->jobs.pop_front();
+        if (strand->jobs.empty()) {
+            strand->active = false;
+        }
+        else {
+            next = strand->jobs.front();
+        }
+    }
+    strand->drained.notify_all();
+    if (next) {
+        dispatch(next);
+    }
+
+    metrics::broker().fanout_backlog.add(-1);
+    if (pending_jobs.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        jobs_done.notify_all();
+    }
+}
+
+size_t fanout_workers_from_env() {
+    if (const char* env = std::getenv("MQ_FANOUT_WORKERS")) {
+        return std::strtoul(env, nullptr, 10);
+    }
+    size_t hardware = std::thread::hardware_concurrency();
+    return std::clamp<size_t>(hardware, 2, FANOUT_MAX_WORKERS);
+}
@@ -0,0 +1,19 @@
+#include "common.h"
+
+//process wide state, queues and clients belong to their Broker (see BrokerState in common.h)
+//defined apart from server.cpp so server_core can be linked without main()
+
+trace::span_ring server_spans("server");
+
+
+void safe_print(const std::string& msg) {
+    if(LOGS){
+        log_message(log_level::INFO, msg);
+    }
+}
+
+void safe_error(const std::string& msg) {
+    if(LOGS){
+        log_message(log_level::ERROR, msg);
+    }
+}
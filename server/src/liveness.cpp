@@ -0,0 +1,174 @@
+#include "liveness.h"
+#include "connection.h"
+#include "protocol_handler.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+// Timer in a wheel slot, stale once its connection got a newer timer or is gone
+struct WheelTimer {
+    std::weak_ptr<Connection> connection;
+    uint64_t id;
+};
+
+//seconds since start, advanced by liveness_tick, 0 until the first tick
+static std::atomic<uint32_t> current_second{0};
+static const auto clock_start = std::chrono::steady_clock::now();
+
+static std::mutex wheel_mutex;
+static std::vector<WheelTimer> wheel[LIVENESS_WHEEL_SLOTS];
+static uint32_t wheel_second = 0;    //last second whose slot was fired
+static uint64_t next_timer = 1;
+
+static void note(std::atomic<uint32_t>& at) {
+    //skipping equal stores keeps the line shared while a connection is busy
+    uint32_t now = current_second.load(std::memory_order_relaxed);
+    if (at.load(std::memory_order_relaxed) != now) {
+        at.store(now, std::memory_order_relaxed);
+    }
+}
+
+//deadlines are less than LIVENESS_WHEEL_SLOTS seconds away, so a slot holds one second only
+static void schedule(const std::shared_ptr<Connection>& connection, uint32_t deadline) {
+    deadline = std::max(deadline, wheel_second + 1);
+    connection->liveness.timer = next_timer++;
+    wheel[deadline % LIVENESS_WHEEL_SLOTS].push_back({connection, connection->liveness.timer});
+}
+
+//times are whole seconds of the last tick, so a limit is over only once a full second more passed
+static bool over(uint32_t now, uint32_t since, int limit) {
+    return now - since > static_cast<uint32_t>(limit);
+}
+
+//earliest second a heartbeat or timeout may be due
+static uint32_t next_deadline(const Liveness& liveness, uint32_t now, uint32_t received, uint32_t sent) {
+    uint32_t deadline = received + CLIENT_READ_TIMEOUT + 1;
+    if (liveness.logged_in) {
+        if (!over(now, received, HEARTBEAT_INTERVAL)) {
+            deadline = std::min<uint32_t>(deadline, received + HEARTBEAT_INTERVAL + 1);
+        }
+        deadline = std::min<uint32_t>(deadline, sent + HEARTBEAT_INTERVAL + 1);
+    }
+    return std::max(deadline, now + 1);
+}
+
+//timer of connection fired, called under wheel_mutex
+static void expire(const std::shared_ptr<Connection>& connection, uint32_t now) {
+    static const std::string heartbeats[2] = {prepare_message(message_type::HEARTBEAT, ""),
+                                              prepare_message(message_type::HEARTBEAT, "", true)};
+    Liveness& liveness = connection->liveness;
+    uint32_t received = liveness.received.load(std::memory_order_relaxed);
+    uint32_t sent = liveness.sent.load(std::memory_order_relaxed);
+
+    if (over(now, received, CLIENT_READ_TIMEOUT)) {
+        //handler wakes up from recv and disconnects, it untracks the connection
+        safe_print("socket:" + std::to_string(connection->socket()) + "  idle for " + std::to_string(now - received) + "s, closing");
+        metrics::broker().idle_timeouts.add();
+        connection->shutdown();
+        return;
+    }
+
+    if (liveness.logged_in && (over(now, received, HEARTBEAT_INTERVAL) || over(now, sent, HEARTBEAT_INTERVAL))) {
+        if (!try_send_message(*connection, heartbeats[liveness.compact ? 1 : 0])) {
+            //another writer or a full socket buffer, try again next second
+            schedule(connection, now + 1);
+            return;
+        }
+        metrics::broker().heartbeats_sent.add();
+        sent = now;
+    }
+    schedule(connection, next_deadline(liveness, now, received, sent));
+}
+
+void liveness_track(const std::shared_ptr<Connection>& connection) {
+    uint32_t now = current_second.load();
+    connection->liveness.received.store(now, std::memory_order_relaxed);
+    connection->liveness.sent.store(now, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    schedule(connection, next_deadline(connection->liveness, now, now, now));
+}
+
+void liveness_untrack(Connection& connection) {
+    //timers left in the wheel do not match anymore
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    connection.liveness.timer = 0;
+}
+
+void liveness_logged_in(const std::shared_ptr<Connection>& connection, bool compact) {
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    Liveness& liveness = connection->liveness;
+    if (liveness.timer == 0) return;
+    liveness.logged_in = true;
+    liveness.compact = compact;
+    //timer runs until the timeout, heartbeats need an earlier one
+    uint32_t now = current_second.load();
+    schedule(connection, next_deadline(liveness, now, liveness.received.load(), liveness.sent.load()));
+}
+
+void liveness_received(Connection& connection) {
+    note(connection.liveness.received);
+}
+
+void liveness_sent(Connection& connection) {
+    note(connection.liveness.sent);
+}
+
+void liveness_tick() {
+    uint32_t now = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - clock_start).count()) + 1;
+    current_second = now;
+
+    std::lock_guard<std::mutex> lock(wheel_mutex);
+    std::vector<WheelTimer> due;
+    while (wheel_second < now) {
+        ++wheel_second;
+        due.clear();
+        due.swap(wheel[wheel_second % LIVENESS_WHEEL_SLOTS]);
+        for (const WheelTimer& timer : due) {
+            std::shared_ptr<Connection> connection = timer.connection.lock();
+            if (!connection || connection->liveness.timer != timer.id) continue;
+            expire(connection, now);
+        }
+    }
+}
+
+// ------------------------------
+// TCP KEEPALIVE
+// ------------------------------
+
+TcpKeepalive tcp_keepalive_from_env() {
+    TcpKeepalive keepalive;
+    const char* env = std::getenv("MQ_TCP_KEEPALIVE");
+    if (env == nullptr) return keepalive;
+
+    int values[3] = {keepalive.idle, keepalive.interval, keepalive.count};
+    char* next = const_cast<char*>(env);
+    for (int i = 0; i < 3 && *next != '\0'; ++i) {
+        long value = std::strtol(next, &next, 10);
+        if (value > 0) values[i] = static_cast<int>(value);
+        else if (i == 0) return keepalive;
+        if (*next == ',') ++next;
+    }
+    keepalive.enabled = true;
+    keepalive.idle = values[0];
+    keepalive.interval = values[1];
+    keepalive.count = values[2];
+    return keepalive;
+}
+
+bool apply_tcp_keepalive(int sock, const TcpKeepalive& keepalive) {
+    if (!keepalive.enabled) return true;
+    int on = 1;
+    return setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) == 0 &&
+           setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepalive.idle, sizeof(keepalive.idle)) == 0 &&
+           setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepalive.interval, sizeof(keepalive.interval)) == 0 &&
+           setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepalive.count, sizeof(keepalive.count)) == 0;
+}
@@ -0,0 +1,145 @@
+#include "lock_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static std::atomic<bool> profiling{false};
+
+//all metered mutexes, registered while they exist
+static std::mutex mutexes_mutex;
+static std::vector<const MeteredMutex*>& metered_mutexes() {
+    static std::vector<const MeteredMutex*> list;
+    return list;
+}
+
+MeteredMutex::MeteredMutex(const char* name, metrics::Histogram& wait, metrics::Histogram& hold)
+    : mutex_name(name), wait_time(wait), hold_time(hold) {
+    std::lock_guard<std::mutex> lock(mutexes_mutex);
+    metered_mutexes().push_back(this);
+}
+
+MeteredMutex::~MeteredMutex() {
+    std::lock_guard<std::mutex> lock(mutexes_mutex);
+    auto& list = metered_mutexes();
+    list.erase(std::remove(list.begin(), list.end(), this), list.end());
+}
+
+bool lock_profiling_enabled() {
+    return profiling.load(std::memory_order_relaxed);
+}
+
+void lock_profiler_start() {
+#if MQ_LOCK_PROFILING
+    const char* env = std::getenv("MQ_LOCK_PROFILE");
+    profiling.store(env != nullptr && std::strcmp(env, "1") == 0, std::memory_order_relaxed);
+#endif
+}
+
+#if MQ_LOCK_PROFILING
+LockSite* MeteredMutex::find_site(const std::source_location& location) {
+    const char* file = location.file_name();
+    uint32_t line = location.line();
+    //open addressing over all slots but the last, which takes the overflow
+    size_t start = (reinterpret_cast<uintptr_t>(file) / 8 + line * 31u) % (LOCK_SITE_SLOTS - 1);
+    for (size_t i = 0; i < LOCK_SITE_SLOTS - 1; ++i) {
+        LockSite& slot = site_slots[(start + i) % (LOCK_SITE_SLOTS - 1)];
+        const char* slot_file = slot.file.load(std::memory_order_relaxed);
+        if (slot_file == nullptr) {
+            slot.function.store(location.function_name(), std::memory_order_relaxed);
+            slot.line.store(line, std::memory_order_relaxed);
+            slot.file.store(file, std::memory_order_release);
+            return &slot;
+        }
+        if (slot_file == file && slot.line.load(std::memory_order_relaxed) == line) {
+            return &slot;
+        }
+    }
+    LockSite& other = site_slots[LOCK_SITE_SLOTS - 1];
+    if (other.file.load(std::memory_order_relaxed) == nullptr) {
+        other.function.store("other call sites", std::memory_order_relaxed);
+        other.file.store("", std::memory_order_release);
+    }
+    return &other;
+}
+#endif
+
+static std::string format_duration(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) snprintf(buf, sizeof(buf), "%lluns", static_cast<unsigned long long>(ns));
+    else if (ns < 1000000) snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    return buf;
+}
+
+#if MQ_LOCK_PROFILING
+//file name without directories
+static const char* base_name(const char* path) {
+    const char* slash = std::strrchr(path, '/');
+    return slash != nullptr ? slash + 1 : path;
+}
+
+//"void f(int)" -> "f", function_name() has return and parameter types
+static std::string short_function(const char* signature) {
+    std::string name(signature);
+    size_t paren = name.find('(');
+    if (paren != std::string::npos) name.resize(paren);
+    size_t space = name.rfind(' ');
+    return space != std::string::npos ? name.substr(space + 1) : name;
+}
+#endif
+
+std::string lock_profiler_report() {
+    //held while mutexes are read, so a broker being destroyed waits for the report
+    std::lock_guard<std::mutex> lock(mutexes_mutex);
+    const std::vector<const MeteredMutex*>& list = metered_mutexes();
+
+    std::string out;
+    char line[512];
+    for (const MeteredMutex* m : list) {
+        metrics::Histogram::Snapshot wait = m->wait_histogram().snapshot();
+        metrics::Histogram::Snapshot hold = m->hold_histogram().snapshot();
+        uint64_t contended = wait.count - std::min(wait.count, wait.count_at_most(0));
+        snprintf(line, sizeof(line), "lock %s: %llu acquisitions, %llu contended (%.2f%%), wait p50 %s p99 %s max %s, hold p50 %s p99 %s max %s\n",
+                 m->name(), static_cast<unsigned long long>(wait.count), static_cast<unsigned long long>(contended),
+                 wait.count > 0 ? 100.0 * static_cast<double>(contended) / static_cast<double>(wait.count) : 0.0,
+                 format_duration(wait.percentile(0.5)).c_str(), format_duration(wait.percentile(0.99)).c_str(), format_duration(wait.max).c_str(),
+                 format_duration(hold.percentile(0.5)).c_str(), format_duration(hold.percentile(0.99)).c_str(), format_duration(hold.max).c_str());
+        out += line;
+
+#if MQ_LOCK_PROFILING
+        if (!lock_profiling_enabled()) {
+            out += "  call sites not recorded, start with MQ_LOCK_PROFILE=1\n";
+            continue;
+        }
+        //call sites holding the lock longest in total first
+        std::vector<const LockSite*> sites;
+        for (const LockSite& site : m->sites()) {
+            if (site.file.load(std::memory_order_acquire) != nullptr) sites.push_back(&site);
+        }
+        std::sort(sites.begin(), sites.end(), [](const LockSite* a, const LockSite* b) {
+            return a->hold_ns.load(std::memory_order_relaxed) > b->hold_ns.load(std::memory_order_relaxed);
+        });
+        if (sites.size() > LOCK_REPORT_TOP_SITES) sites.resize(LOCK_REPORT_TOP_SITES);
+        for (const LockSite* site : sites) {
+            uint64_t acquisitions = site->acquisitions.load(std::memory_order_relaxed);
+            uint64_t held = site->hold_ns.load(std::memory_order_relaxed);
+            snprintf(line, sizeof(line), "  %s:%u %s: %llu acquisitions, %llu contended, hold total %s avg %s max %s, wait total %s max %s\n",
+                     base_name(site->file.load(std::memory_order_relaxed)), site->line.load(std::memory_order_relaxed),
+                     short_function(site->function.load(std::memory_order_relaxed)).c_str(), static_cast<unsigned long long>(acquisitions),
+                     static_cast<unsigned long long>(site->contended.load(std::memory_order_relaxed)),
+                     format_duration(held).c_str(), format_duration(acquisitions > 0 ? held / acquisitions : 0).c_str(),
+                     format_duration(site->max_hold_ns.load(std::memory_order_relaxed)).c_str(),
+                     format_duration(site->wait_ns.load(std::memory_order_relaxed)).c_str(),
+                     format_duration(site->max_wait_ns.load(std::memory_order_relaxed)).c_str());
+            out += line;
+        }
+#else
+        out += "  call sites not recorded, built without MQ_LOCK_PROFILING\n";
+#endif
+    }
+    return out;
+}
@@ -0,0 +1,259 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <strings.h>
+#include <unistd.h>
+
+static_assert((LOG_RING_CAPACITY & (LOG_RING_CAPACITY - 1)) == 0, "LOG_RING_CAPACITY must be power of two");
+
+constexpr auto LOG_IDLE_SLEEP = std::chrono::milliseconds(2); //writer poll interval when rings are empty
+constexpr uint64_t NS_PER_SECOND = 1000000000ull;
+
+// One buffered message
+struct LogRecord {
+    uint64_t time_ns;   //wall clock time
+    uint32_t length;    //bytes used in text
+    log_level level;
+    bool truncated;
+    char text[LOG_RECORD_TEXT_SIZE];
+};
+
+// Single producer (owning thread), single consumer (writer thread) ring
+struct LogRing {
+    LogRecord records[LOG_RING_CAPACITY];
+    std::atomic<uint64_t> head{0};          //next record written by owner
+    std::atomic<uint64_t> tail{0};          //next record read by writer
+    std::atomic<uint64_t> dropped{0};       //messages lost because ring was full
+    std::atomic<uint64_t> rate_limited{0};  //messages lost because of rate limit
+    std::atomic<bool> closed{false};        //owner thread exited, ring is freed once drained
+
+    //token bucket of owning thread, touched only by owner
+    uint64_t tokens = LOG_RATE_PER_SECOND;
+    uint64_t refill_ns = 0;
+};
+
+static std::atomic<log_level> min_level{log_level::INFO};
+static std::atomic<bool> writer_running{false};
+static std::atomic<bool> writer_stop{false};
+static std::thread writer_thread;
+
+//rings of all threads that logged, mutex is taken only on first log of a thread and by writer
+static std::mutex rings_mutex;
+static std::vector<std::shared_ptr<LogRing>> rings;
+
+// Registers ring of calling thread on first use, marks it closed when thread exits
+struct ThreadRing {
+    std::shared_ptr<LogRing> ring;
+
+    ThreadRing() : ring(std::make_shared<LogRing>()) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+    }
+    ~ThreadRing() {
+        ring->closed.store(true, std::memory_order_release);
+    }
+};
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * NS_PER_SECOND + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static const char* level_name(log_level level) {
+    switch (level) {
+        case log_level::DEBUG: return "DEBUG";
+        case log_level::INFO: return "INFO";
+        case log_level::WARN: return "WARN";
+        case log_level::ERROR: return "ERROR";
+        default: return "";
+    }
+}
+
+static int level_fd(log_level level) {
+    return level >= log_level::WARN ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+//appends "YYYY-MM-DD HH:MM:SS.mmm LEVEL message\n"
+static void format_record(std::string& out, uint64_t time_ns, log_level level, std::string_view text, bool truncated) {
+    time_t seconds = static_cast<time_t>(time_ns / NS_PER_SECOND);
+    tm local{};
+    localtime_r(&seconds, &local);
+    char prefix[64];
+    size_t n = strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &local);
+    n += snprintf(prefix + n, sizeof(prefix) - n, ".%03u %-5s ", static_cast<unsigned>(time_ns % NS_PER_SECOND / 1000000), level_name(level));
+    out.append(prefix, std::min(n, sizeof(prefix) - 1));
+    out.append(text);
+    if (truncated) out.append("...");
+    out.push_back('\n');
+}
+
+static void write_all(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return; //log output is gone, nothing to report it to
+        written += static_cast<size_t>(n);
+    }
+}
+
+//drains all rings, writes records ordered by time, returns number of records written
+static size_t drain_rings() {
+    std::vector<std::shared_ptr<LogRing>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        snapshot = rings;
+    }
+
+    std::vector<LogRecord> batch;
+    uint64_t dropped = 0;
+    uint64_t rate_limited = 0;
+    for (auto& ring : snapshot) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            batch.push_back(ring->records[tail & (LOG_RING_CAPACITY - 1)]);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+        rate_limited += ring->rate_limited.exchange(0, std::memory_order_relaxed);
+    }
+
+    //rings of exited threads are freed once their records were taken
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<LogRing>& ring) {
+                        return ring->closed.load(std::memory_order_acquire) &&
+                               ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire);
+                    }),
+                    rings.end());
+    }
+
+    if (batch.empty() && dropped == 0 && rate_limited == 0) return 0;
+
+    //records of different threads are interleaved by time
+    std::stable_sort(batch.begin(), batch.end(), [](const LogRecord& a, const LogRecord& b) { return a.time_ns < b.time_ns; });
+    std::string out[2];
+    for (const LogRecord& record : batch) {
+        format_record(out[level_fd(record.level) == STDERR_FILENO], record.time_ns, record.level, std::string_view(record.text, record.length), record.truncated);
+    }
+    if (dropped > 0 || rate_limited > 0) {
+        format_record(out[1], now_ns(), log_level::WARN, "log: " + std::to_string(dropped) + " messages dropped (ring full), " + std::to_string(rate_limited) + " rate limited", false);
+    }
+    write_all(STDOUT_FILENO, out[0]);
+    write_all(STDERR_FILENO, out[1]);
+    return batch.size();
+}
+
+static void writer_loop() {
+    while (!writer_stop.load(std::memory_order_acquire)) {
+        if (drain_rings() == 0) {
+            std::this_thread::sleep_for(LOG_IDLE_SLEEP);
+        }
+    }
+    drain_rings();
+}
+
+static bool parse_level(const char* text, log_level& level) {
+    static const std::pair<const char*, log_level> names[] = {
+        {"debug", log_level::DEBUG}, {"info", log_level::INFO}, {"warn", log_level::WARN},
+        {"error", log_level::ERROR}, {"off", log_level::OFF}};
+    for (const auto& [name, value] : names) {
+        if (strcasecmp(text, name) == 0) {
+            level = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void logger_start(log_level default_level) {
+    log_level level = default_level;
+    const char* env = std::getenv("MQ_LOG_LEVEL");
+    if (env != nullptr && !parse_level(env, level)) {
+        log_message(log_level::WARN, "Unknown MQ_LOG_LEVEL " + std::string(env) + ", using default");
+    }
+    set_log_level(level);
+
+    if (writer_running.exchange(true)) return;
+    writer_stop.store(false, std::memory_order_release);
+    writer_thread = std::thread(writer_loop);
+
+    //buffered messages are written also when main returns early
+    static std::once_flag exit_hook;
+    std::call_once(exit_hook, [] { std::atexit(logger_stop); });
+}
+
+void logger_stop() {
+    if (!writer_running.load()) return;
+    writer_stop.store(true, std::memory_order_release);
+    if (writer_thread.joinable()) writer_thread.join();
+    writer_running.store(false);
+}
+
+void set_log_level(log_level level) {
+    min_level.store(level, std::memory_order_relaxed);
+}
+
+bool log_enabled(log_level level) {
+    return level != log_level::OFF && level >= min_level.load(std::memory_order_relaxed);
+}
+
+void log_message(log_level level, std::string_view msg) {
+    if (!log_enabled(level)) return;
+
+    //without writer thread message is written directly, one write call per line
+    if (!writer_running.load(std::memory_order_acquire)) {
+        std::string line;
+        format_record(line, now_ns(), level, msg, false);
+        write_all(level_fd(level), line);
+        return;
+    }
+
+    thread_local ThreadRing local;
+    LogRing& ring = *local.ring;
+    uint64_t time_ns = now_ns();
+
+    //token bucket refilled by elapsed time
+    if (ring.tokens < LOG_RATE_PER_SECOND) {
+        uint64_t elapsed = time_ns - std::min(ring.refill_ns, time_ns);
+        uint64_t refill = elapsed * LOG_RATE_PER_SECOND / NS_PER_SECOND;
+        if (refill > 0) {
+            ring.tokens = std::min<uint64_t>(LOG_RATE_PER_SECOND, ring.tokens + refill);
+            ring.refill_ns = time_ns;
+        }
+    }
+    else {
+        ring.refill_ns = time_ns;
+    }
+    if (ring.tokens == 0) {
+        ring.rate_limited.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    --ring.tokens;
+
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= LOG_RING_CAPACITY) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    LogRecord& record = ring.records[head & (LOG_RING_CAPACITY - 1)];
+    record.time_ns = time_ns;
+    record.level = level;
+    record.length = static_cast<uint32_t>(std::min(msg.size(), LOG_RECORD_TEXT_SIZE));
+    record.truncated = msg.size() > LOG_RECORD_TEXT_SIZE;
+    std::memcpy(record.text, msg.data(), record.length);
+    ring.head.store(head + 1, std::memory_order_release);
+}
@@ -5,8 +5,8 @@
 #include <algorithm>
 
 
-std::unordered_map<std::string, Queue>::iterator find_queue_by_name(const std::string& queue_name) {
-    return existing_queues.find(queue_name);
+std::unordered_map<std::string, Queue>::iterator find_queue_by_name(BrokerState& state, const std::string& queue_name) {
+    return state.existing_queues.find(queue_name);
 }
 
 bool is_client_subscribed(const Queue& queue, const std::string& client_id) {
@@ -18,23 +18,427 @@ std::vector<std::string>::iterator find_subscriber(Queue& queue, const std::stri
     return std::find(queue.subscribers.begin(), queue.subscribers.end(), client_id);
 }
 
-bool queue_exists(const std::string& queue_name) {
-    return find_queue_by_name(queue_name) != existing_queues.end();
+bool queue_exists(BrokerState& state, const std::string& queue_name) {
+    return find_queue_by_name(state, queue_name) != state.existing_queues.end();
 }
 
-void subscribe_to_queue(const Client& client, const std::string& queue_name) {
+void account_expired_messages(Queue& queue, std::chrono::steady_clock::time_point now) {
+    while (!queue.expiry.empty() && queue.expiry.top().first <= now) {
+        queue.live_messages -= 1;
+        queue.live_bytes -= queue.expiry.top().second;
+        queue.expiry.pop();
+    }
+    //messages are kept in publish order, each one is passed at most once until the next sweep
+    while (queue.oldest_live < queue.messages.size() && queue.messages[queue.oldest_live]->expire <= now) {
+        ++queue.oldest_live;
+    }
+}
+
+size_t remove_expired_messages(Queue& queue, std::chrono::steady_clock::time_point now) {
+    account_expired_messages(queue, now);
+    auto& messages = queue.messages;
+    //sizes are taken in the predicate, elements past the new end are moved-from
+    auto expired = std::remove_if(messages.begin(), messages.end(), [&](const std::shared_ptr<const Message>& m) {
+        if (m->expire > now) return false;
+        queue.retained_bytes -= m->text.size();
+        return true;
+    });
+    size_t removed = static_cast<size_t>(messages.end() - expired);
+    messages.erase(expired, messages.end());
+    if (removed > 0) {
+        queue.oldest_live = 0;
+    }
+    return removed;
+}
+
+uint32_t assign_queue_handle(BrokerState& state, Queue& queue) {
+    uint32_t slot;
+    if (!state.handles.free_slots.empty()) {
+        slot = state.handles.free_slots.back();
+        state.handles.free_slots.pop_back();
+    }
+    else {
+        slot = static_cast<uint32_t>(state.handles.slots.size());
+        if (slot > QUEUE_HANDLE_SLOT_MASK) {
+            return 0; //table full, queue is usable by name only
+        }
+        state.handles.slots.push_back(nullptr);
+        state.handles.generations.push_back(0);
+    }
+    state.handles.slots[slot] = &queue;
+    queue.handle = (state.handles.generations[slot] << QUEUE_HANDLE_SLOT_BITS) | slot;
+    return queue.handle;
+}
+
+void release_queue_handle(BrokerState& state, uint32_t handle) {
+    uint32_t slot = handle & QUEUE_HANDLE_SLOT_MASK;
+    if (handle == 0 || slot >= state.handles.slots.size() || state.handles.slots[slot] == nullptr) {
+        return;
+    }
+    state.handles.slots[slot] = nullptr;
+    //new generation so stale handles of deleted queue are rejected
+    state.handles.generations[slot] = (state.handles.generations[slot] + 1) & (0xFFFFFFFFu >> QUEUE_HANDLE_SLOT_BITS);
+    state.handles.free_slots.push_back(slot);
+}
+
+Queue* find_queue_by_handle(BrokerState& state, uint32_t handle) {
+    uint32_t slot = handle & QUEUE_HANDLE_SLOT_MASK;
+    if (slot == 0 || slot >= state.handles.slots.size()) {
+        return nullptr;
+    }
+    Queue* queue = state.handles.slots[slot];
+    if (queue == nullptr || queue->handle != handle) {
+        return nullptr;
+    }
+    return queue;
+}
+
+//"OK" reply, in compact mode followed by queue handle (varint)
+static std::string ok_with_handle(const Client& client, uint32_t handle) {
+    std::string reply = "OK";
+    if (client.compact) {
+        append_varint(reply, handle);
+    }
+    return reply;
+}
+
+//largest MS or MA payload a client accepts, chunking clients reassemble frames over max_frame
+static uint32_t message_limit(uint32_t features, uint32_t max_frame) {
+    return (features & FEATURE_CHUNKING) ? MAX_MESSAGE_SIZE : max_frame;
+}
+
+//PB error reply, counted as rejected publish
+static void reject_publish(const Client& client, const std::string& status) {
+    metrics::broker().publish_errors.add();
+    if(!send_message(client.connection, prepare_message(message_type::PUBLISH, status, client.compact))){
+        safe_error("SEND_ERROR: PB:ER to " + client.id);
+    }
+}
+
+//encoding used for a subscriber with compression: stored encoding if it knows it,
+//preferred codec for large uncompressed messages, NONE otherwise
+static wire::encoding choose_encoding(uint32_t features, const Message& message) {
+    if (message.encoding != wire::encoding::NONE && (features & wire::encoding_capability(message.encoding))) {
+        return message.encoding;
+    }
+    if (message.raw_size >= COMPRESSION_THRESHOLD) {
+        return wire::preferred_encoding(features & SUPPORTED_FEATURES);
+    }
+    return wire::encoding::NONE;
+}
+
+//payload of one stored message in the forms subscribers need, every form is built at most once
+class MessagePayloads {
+public:
+    explicit MessagePayloads(const Message& message) : message(message) {}
+
+    //plain content, nullptr if stored data can not be decompressed
+    const std::string* plain() {
+        if (message.encoding == wire::encoding::NONE) {
+            return &message.text;
+        }
+        if (!plain_ready) {
+            plain_ready = true;
+            //raw_size was checked against frame limit and codec bound when the message was published
+            plain_ok = wire::decompress(message.encoding, message.text, message.raw_size, plain_text);
+        }
+        return plain_ok ? &plain_text : nullptr;
+    }
+
+    //[encoding(1b)][data], falls back to NONE if compression fails
+    const std::string* encoded(wire::encoding enc) {
+        std::string& out = encoded_forms[static_cast<size_t>(enc)];
+        if (!out.empty()) {
+            return &out;
+        }
+        out.push_back(static_cast<char>(enc));
+        if (enc == message.encoding) {
+            out.append(message.text);
+            return &out;
+        }
+        const std::string* content = plain();
+        if (content == nullptr) {
+            out.clear();
+            return nullptr;
+        }
+        if (enc != wire::encoding::NONE && !wire::compress(enc, *content, out)) {
+            out.clear();
+            return encoded(wire::encoding::NONE);
+        }
+        if (enc == wire::encoding::NONE) {
+            out.append(*content);
+        }
+        return &out;
+    }
+
+private:
+    const Message& message;
+    std::string plain_text;
+    bool plain_ready = false;
+    bool plain_ok = false;
+    std::string encoded_forms[wire::ENCODING_COUNT];
+};
+
+//subscriber connection and its negotiated framing
+struct FanoutSubscriber {
+    std::shared_ptr<Connection> connection; //keeps socket from being closed and reused until the job is done
+    bool compact;
+    uint32_t features;
+    uint32_t max_frame;
+};
+
+//counts outcome of one MS delivery, a subscriber busy with another frame misses this message
+static bool delivery_sent(send_status status, const std::shared_ptr<Connection>& connection) {
+    if (status == send_status::SENT) {
+        metrics::broker().deliveries.add();
+        return true;
+    }
+    if (status == send_status::BUSY) {
+        safe_error("MS to socket:" + std::to_string(socket_of(connection)) + " dropped, another frame is still being sent");
+        metrics::broker().delivery_drops.add();
+        return false;
+    }
+    safe_error("SEND_ERROR: MS to socket:" + std::to_string(socket_of(connection)));
+    return false;
+}
+
+//fan-out of one accepted publish, chunks of subscribers may be sent by different workers (see fanout.h)
+class PublishFanout : public FanoutJob {
+public:
+    PublishFanout(std::shared_ptr<const Message> message, std::string queue_name, uint32_t handle, uint64_t trace_id, uint64_t received_at,
+                  std::vector<FanoutSubscriber> subscribers, std::shared_ptr<QueueCounters> counters)
+        : message(std::move(message)), queue_name(std::move(queue_name)), handle(handle), trace_id(trace_id), received_at(received_at),
+          subscribers(std::move(subscribers)), counters(std::move(counters)), payloads(*this->message) {}
+
+    size_t chunk_count() const override {
+        return (subscribers.size() + FANOUT_CHUNK_SUBSCRIBERS - 1) / FANOUT_CHUNK_SUBSCRIBERS;
+    }
+
+    void run_chunk(size_t chunk) override {
+        size_t begin = chunk * FANOUT_CHUNK_SUBSCRIBERS;
+        size_t end = std::min(subscribers.size(), begin + FANOUT_CHUNK_SUBSCRIBERS);
+        for (size_t i = begin; i < end; ++i) {
+            deliver(subscribers[i]);
+        }
+    }
+
+    void finish() override {
+        metrics::broker().publish_fanout.record(metrics::now_ns() - received_at);
+        {
+            std::lock_guard<std::mutex> lock(counters->mutex);
+            auto done = std::chrono::steady_clock::now();
+            counters->published += 1;
+            counters->delivered += delivered.load();
+            counters->publish_rate.add(1, done);
+            counters->deliver_rate.add(delivered.load(), done);
+        }
+        if (DEBUG == 1 && log_enabled(log_level::DEBUG)){
+            log_message(log_level::DEBUG, "Published to " + queue_name + " for " + std::to_string(subscribers.size()) + " subs.");
+        }
+    }
+
+private:
+    void deliver(const FanoutSubscriber& sub) {
+        //packets are built once per framing mode and encoding by the first chunk that needs them
+        //index 0 is plain content for subscribers without compression, 1 + encoding otherwise
+        const std::string* packet = nullptr;
+        const std::vector<std::string>* chunks = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(build_mutex);
+            size_t variant = 0;
+            const std::string* body = nullptr;
+            if (sub.features & wire::CAP_COMPRESSION_ANY) {
+                wire::encoding enc = choose_encoding(sub.features, *message);
+                body = payloads.encoded(enc);
+                variant = 1 + static_cast<size_t>(enc);
+            }
+            else {
+                body = payloads.plain();
+            }
+            if (body == nullptr) {
+                safe_error("MS for socket:" + std::to_string(sub.connection->socket()) + " not sent, message can not be decompressed");
+                metrics::broker().delivery_drops.add();
+                return;
+            }
+
+            //subscriber would drop frame over its max_frame, so it is not sent at all
+            //traced message goes to subscribers with tracing as MT, with trace id after MS payload
+            bool traced = trace_id != 0 && (sub.features & FEATURE_TRACING);
+            size_t payload_size = (sub.compact ? wire::varint_size(handle) : 4 + queue_name.size()) + body->size() + (traced ? trace::TRACE_ID_SIZE : 0);
+            uint32_t limit = message_limit(sub.features, sub.max_frame);
+            if (limit != 0 && payload_size > limit) {
+                safe_error("MS over max frame of socket:" + std::to_string(sub.connection->socket()) + " not sent");
+                metrics::broker().delivery_drops.add();
+                return;
+            }
+
+            //large message is streamed in chunks, chunks of one message are shared by all subscribers
+            if ((sub.features & FEATURE_CHUNKING) && payload_size > wire::CHUNK_SIZE) {
+                std::vector<std::string>& built = chunked_packets[sub.compact ? 1 : 0][variant];
+                if (built.empty()) {
+                    built = prepare_chunked_message(message_type::MESSAGE_MULTICAST, build_published_payload(queue_name, handle, *body, sub.compact), sub.compact);
+                }
+                chunks = &built;
+            }
+            else {
+                std::string& built = (traced ? traced_packets : packets)[sub.compact ? 1 : 0][variant];
+                if (built.empty()) {
+                    built = traced ? build_traced_message(queue_name, handle, *body, trace_id, sub.compact)
+                                   : build_published_message(queue_name, handle, *body, sub.compact);
+                }
+                packet = &built;
+            }
+        }
+
+        //built packets are never changed again, so they are sent without build_mutex
+        bool sent = false;
+        if (chunks != nullptr) {
+            send_status status = send_chunks_within(sub.connection, *chunks, FANOUT_SEND_TIMEOUT);
+            sent = delivery_sent(status, sub.connection);
+        }
+        else {
+            Client temp_client;
+            temp_client.connection = sub.connection;
+            sent = send_published_message(temp_client, *packet);
+        }
+        if (sent) {
+            delivered.fetch_add(1, std::memory_order_relaxed);
+            if (trace_id != 0) {
+                server_spans.record(trace_id, trace::hop::SERVER_SEND, static_cast<uint32_t>(sub.connection->socket()));
+            }
+        }
+    }
+
+    std::shared_ptr<const Message> message;
+    std::string queue_name;
+    uint32_t handle;
+    uint64_t trace_id;
+    uint64_t received_at;
+    std::vector<FanoutSubscriber> subscribers;
+    std::shared_ptr<QueueCounters> counters;
+    std::atomic<uint64_t> delivered{0};
+
+    std::mutex build_mutex;
+    MessagePayloads payloads;
+    std::string packets[2][wire::ENCODING_COUNT + 1];
+    std::vector<std::string> chunked_packets[2][wire::ENCODING_COUNT + 1];
+    std::string traced_packets[2][wire::ENCODING_COUNT + 1];
+};
+
+//prefix of MA frames and live messages of queue for client (call with queues_mutex held)
+static void take_backlog(const Client& client, Queue& queue, std::string& prefix, std::vector<std::shared_ptr<const Message>>& live_messages) {
+    if (client.compact) {
+        append_varint(prefix, queue.handle);
+    }
+    else {
+        uint32_t n_len = htonl(static_cast<uint32_t>(queue.name.length()));
+        prefix.append(reinterpret_cast<const char*>(&n_len), 4);
+        prefix.append(queue.name);
+    }
+
+    remove_expired_messages(queue, std::chrono::steady_clock::now());
+    live_messages = queue.messages; //copies pointers only, bodies are shared
+}
+
+//sends messages taken by take_backlog as MA frames
+static void send_backlog(const Client& client, const std::string& queue_name, const std::string& prefix,
+                         const std::vector<std::shared_ptr<const Message>>& live_messages) {
+    /*
+    SENDING MESSAGE THAT LOOKS LIKE THIS: 
+    [TYPE(2b)] [CONTENT_SIZE(4b)] [QUEUE_NAME_SIZE(4b)] [QUEUE_NAME(n)] [MESSAGE1_SIZE(4b)] [MESSAGE1(n)] ... [MESSAGEn_SIZE(4b)] [MESSAGEn(n)] 
+    OR IN COMPACT MODE:
+    [TYPE(2b)] [CONTENT_SIZE(varint)] [QUEUE_HANDLE(varint)] [MESSAGE1_SIZE(varint)] [MESSAGE1(n)] ... [MESSAGEn_SIZE(varint)] [MESSAGEn(n)] 
+    with compression negotiated the message list after queue name/handle is [encoding(1b)][data], compressed as a whole
+    messages are split into several MA frames so no frame exceeds client max_frame
+    with chunking negotiated frames are limited by MAX_MESSAGE_SIZE and large ones are streamed in chunks
+    */
+    if (live_messages.empty()) return;
+
+    //message list is built and compressed outside of queues_mutex
+    bool compression = (client.features & wire::CAP_COMPRESSION_ANY) != 0;
+    size_t frame_overhead = prefix.size() + (compression ? 1 : 0);
+    uint32_t limit = message_limit(client.features, client.max_frame);
+    std::vector<std::string> batches;
+    size_t skipped = 0;
+
+    for (const std::shared_ptr<const Message>& message : live_messages) {
+        MessagePayloads payloads(*message);
+        const std::string* text = payloads.plain();
+        if (text == nullptr) {
+            ++skipped;
+            continue;
+        }
+        uint32_t text_len = static_cast<uint32_t>(text->length());
+        size_t entry_size = (client.compact ? wire::varint_size(text_len) : 4) + text_len;
+
+        //message that does not fit even alone would be dropped by client
+        if (limit != 0 && frame_overhead + entry_size > limit) {
+            ++skipped;
+            continue;
+        }
+        if (batches.empty() || (limit != 0 && frame_overhead + batches.back().size() + entry_size > limit)) {
+            batches.emplace_back();
+        }
+
+        std::string& entries = batches.back();
+        if (client.compact) {
+            append_varint(entries, text_len);
+        }
+        else {
+            uint32_t m_len = htonl(text_len);
+            entries.append(reinterpret_cast<const char*>(&m_len), 4);
+        }
+        entries.append(*text);
+    }
+
+    if (skipped > 0) {
+        safe_error("Skipped " + std::to_string(skipped) + " messages of " + queue_name + " for " + client.id);
+    }
+    if (batches.empty()) return;
+
+    if(DEBUG == 1 && log_enabled(log_level::DEBUG)){
+        log_message(log_level::DEBUG, "Queue: " + queue_name + " | MA frames to send: " + std::to_string(batches.size()));
+    }
+
+    wire::encoding batch_encoding = wire::preferred_encoding(client.features & SUPPORTED_FEATURES);
+    for (const std::string& entries : batches) {
+        std::string internal_data = prefix;
+        if (compression) {
+            //whole list is compressed at once, repeated content across messages compresses well
+            size_t encoding_pos = internal_data.size();
+            internal_data.push_back(static_cast<char>(wire::encoding::NONE));
+            if (entries.size() >= COMPRESSION_THRESHOLD && wire::compress(batch_encoding, entries, internal_data)) {
+                internal_data[encoding_pos] = static_cast<char>(batch_encoding);
+            }
+            else {
+                internal_data.append(entries);
+            }
+        }
+        else {
+            internal_data.append(entries);
+        }
+
+        if(!send_payload(client.connection, message_type::MESSAGE_TO_NEW_SUBSCRIBER, internal_data, client.compact, (client.features & FEATURE_CHUNKING) != 0)){
+            safe_error("SEND_ERROR: MA to socket:" + std::to_string(socket_of(client.connection)));
+            return;
+        }
+    }
+}
+
+void subscribe_to_queue(BrokerState& state, const Client& client, const std::string& queue_name) {
     bool valid_op = false;
     bool already_subscribed = false;
+    uint32_t handle = 0;
     
     {
         //lock on queues_mutex to prevent data race when taking data from existing_queues
-        std::lock_guard<std::mutex> lock(queues_mutex);
+        MeteredLock lock(state.queues_mutex);
         
-        auto it = find_queue_by_name(queue_name);
+        auto it = find_queue_by_name(state, queue_name);
         
-        if (it != existing_queues.end()) {
+        if (it != state.existing_queues.end()) {
             if(!is_client_subscribed(it->second, client.id)){
-                it->second.subscribers.push_back(client.id);
+                handle = it->second.handle;
                 valid_op = true;
             }
             else{
@@ -44,21 +448,52 @@ void subscribe_to_queue(const Client& client, const std::string& queue_name) {
     }
     
     if(valid_op){
-        safe_print("Subscribed client " + client.id + " to queue: " + queue_name);
-        if(!send_message(client.socket, prepare_message(message_type::SUBSCRIBE,"OK"))){
+        //SS:OK (with queue handle) is sent before publishers can see the new subscriber, so it always goes out
+        //before first MS of this queue; messages published meanwhile are stored and sent with the backlog
+        if(!send_message(client.connection, prepare_message(message_type::SUBSCRIBE, ok_with_handle(client, handle), client.compact))){
             safe_error("SEND_ERROR: SS:OK to " + client.id);
         }
-        send_messages_to_new_subscriber(client, queue_name);
+
+        //subscriber is added and backlog taken at once, so every message is sent exactly once, as MS or in MA
+        std::vector<std::shared_ptr<const Message>> live_messages;
+        std::string prefix;
+        bool subscribed = false;
+        bool deleted = false;
+        {
+            MeteredLock lock(state.queues_mutex);
+            auto it = find_queue_by_name(state, queue_name);
+            if (it != state.existing_queues.end() && it->second.handle == handle) {
+                if (!is_client_subscribed(it->second, client.id)) {
+                    it->second.subscribers.push_back(client.id);
+                    take_backlog(client, it->second, prefix, live_messages);
+                    subscribed = true;
+                }
+            }
+            else {
+                //queue deleted (or deleted and created again) after SS:OK, the delete did not see this client
+                deleted = true;
+            }
+        }
+        if (subscribed) {
+            safe_print("Subscribed client " + client.id + " to queue: " + queue_name);
+            send_backlog(client, queue_name, prefix, live_messages);
+        }
+        else if (deleted) {
+            //client would keep the subscription and restore it on every reconnect
+            if(!send_message(client.connection, prepare_message(message_type::QUEUE_DELETED_INFO, queue_name + " was deleted", client.compact))){
+                safe_error("SEND_ERROR: ND to " + client.id);
+            }
+        }
     }
     else{
         if(already_subscribed){
             safe_print("cant subscribe to queue: " + queue_name);
-            if(!send_message(client.socket, prepare_message(message_type::SUBSCRIBE, "ER:ALREADY_SUBSCRIBED"))){
+            if(!send_message(client.connection, prepare_message(message_type::SUBSCRIBE, "ER:ALREADY_SUBSCRIBED", client.compact))){
                 safe_error("SEND_ERROR: SS:ER to " + client.id);
             }
         }
         else{
-            if(!send_message(client.socket, prepare_message(message_type::SUBSCRIBE, "ER:NO_QUEUE"))){
+            if(!send_message(client.connection, prepare_message(message_type::SUBSCRIBE, "ER:NO_QUEUE", client.compact))){
                 safe_error("SEND_ERROR: SS:ER to " + client.id);
             }
         }
@@ -66,17 +501,17 @@ void subscribe_to_queue(const Client& client, const std::string& queue_name) {
     return;
 }
 
-void unsubscribe_from_queue(const Client& client, const std::string& queue_name) {  
+void unsubscribe_from_queue(BrokerState& state, const Client& client, const std::string& queue_name) {  
     bool valid_op = false;
     bool subscribing = true;
     
     {
         //lock on queues_mutex to prevent data race when taking data from existing_queues
-        std::lock_guard<std::mutex> lock(queues_mutex);
+        MeteredLock lock(state.queues_mutex);
         
-        auto it = find_queue_by_name(queue_name);
+        auto it = find_queue_by_name(state, queue_name);
         
-        if (it != existing_queues.end()) {
+        if (it != state.existing_queues.end()) {
             auto sub_it = find_subscriber(it->second, client.id);
             if(sub_it != it->second.subscribers.end()){
                 it->second.subscribers.erase(sub_it);
@@ -90,19 +525,19 @@ void unsubscribe_from_queue(const Client& client, const std::string& queue_name)
     
     if(valid_op){
         safe_print("Unsubscribed client " + client.id + " from queue: " + queue_name);
-        if(!send_message(client.socket, prepare_message(message_type::UNSUBSCRIBE, "OK"))){
+        if(!send_message(client.connection, prepare_message(message_type::UNSUBSCRIBE, "OK", client.compact))){
             safe_error("SEND_ERROR: SU:OK to " + client.id);
         }
     }
     else{
         safe_print("cant unsubscribe from queue: " + queue_name);
         if(!subscribing){
-            if(!send_message(client.socket, prepare_message(message_type::UNSUBSCRIBE, "ER:NOT_SUBSCRIBING"))){
+            if(!send_message(client.connection, prepare_message(message_type::UNSUBSCRIBE, "ER:NOT_SUBSCRIBING", client.compact))){
                 safe_error("SEND_ERROR: SU:ER to " + client.id);
             }
         }
         else{
-            if(!send_message(client.socket, prepare_message(message_type::UNSUBSCRIBE, "ER:NO_QUEUE"))){
+            if(!send_message(client.connection, prepare_message(message_type::UNSUBSCRIBE, "ER:NO_QUEUE", client.compact))){
                 safe_error("SEND_ERROR: SU:ER to " + client.id);
             }
         }
@@ -110,65 +545,77 @@ void unsubscribe_from_queue(const Client& client, const std::string& queue_name)
     return;
 }
 
-void create_queue(const Client& client, const std::string& queue_name) {
+//wakes queue list announcer of the broker, without a running one changes are broadcast before this returns
+static void queue_list_announce(BrokerState& state) {
+    if (!state.announcer.announce()) {
+        broadcast_queues_list(state);
+    }
+}
+
+void create_queue(BrokerState& state, const Client& client, const std::string& queue_name) {
     Queue new_queue;
     bool valid_op = false;
+    uint32_t handle = 0;
     {
         //lock on queues_mutex to prevent data race when taking data from existing_queues and adding new queue
-        std::lock_guard<std::mutex> lock(queues_mutex);
+        MeteredLock lock(state.queues_mutex);
 
-        auto it = find_queue_by_name(queue_name);
+        auto it = find_queue_by_name(state, queue_name);
 
-        if (it == existing_queues.end()) {
+        if (it == state.existing_queues.end()) {
             new_queue.name = queue_name;
-            existing_queues[queue_name] = new_queue;
+            Queue& stored = state.existing_queues[queue_name] = new_queue;
+            handle = assign_queue_handle(state, stored);
+            queue_list_changed(state.queue_list, queue_name, true);
             valid_op = true;
         }
     }
     if(valid_op){
         safe_print("Created Queue: " + queue_name);
-        if(!send_message(client.socket, prepare_message(message_type::QUEUE_CREATE, "OK"))){
+        if(!send_message(client.connection, prepare_message(message_type::QUEUE_CREATE, ok_with_handle(client, handle), client.compact))){
             safe_error("SEND_ERROR: PC:OK to " + client.id);
         }
-        broadcast_queues_list();
+        queue_list_announce(state);
     }
     else{
         safe_print("cant create queue: " + queue_name);
-        if(!send_message(client.socket, prepare_message(message_type::QUEUE_CREATE, "ER:QUEUE_EXISTS"))){
+        if(!send_message(client.connection, prepare_message(message_type::QUEUE_CREATE, "ER:QUEUE_EXISTS", client.compact))){
             safe_error("SEND_ERROR: PC:ER to " + client.id);
         }
     }
     return;
 }
 
-void delete_queue(const Client& client, const std::string& queue_name) {
+void delete_queue(BrokerState& state, const Client& client, const std::string& queue_name) {
     bool valid_op = false;
     std::vector<std::string> ids;
     
     {
         //lock on queues_mutex to prevent data race when taking data from existing_queues and erasing queue
-        std::lock_guard<std::mutex> lock(queues_mutex);
+        MeteredLock lock(state.queues_mutex);
         
-        auto it = find_queue_by_name(queue_name);
+        auto it = find_queue_by_name(state, queue_name);
         
-        if (it != existing_queues.end()) {
+        if (it != state.existing_queues.end()) {
             ids = it->second.subscribers;
-            existing_queues.erase(it);
+            release_queue_handle(state, it->second.handle);
+            state.existing_queues.erase(it);
+            queue_list_changed(state.queue_list, queue_name, false);
             valid_op = true;
         }
     }
 
     if (valid_op) {
         safe_print("Deleted Queue: " + queue_name);
-        if(!send_message(client.socket, prepare_message(message_type::QUEUE_DELETE, "OK"))){
+        if(!send_message(client.connection, prepare_message(message_type::QUEUE_DELETE, "OK", client.compact))){
             safe_error("SEND_ERROR: PD:OK to " + client.id);
         }
         
-        notify_after_delete(ids, queue_name);
-        broadcast_queues_list();
+        notify_after_delete(state, ids, queue_name);
+        queue_list_announce(state);
     } else {
         safe_print("Cannot delete queue: " + queue_name + " (not found)");
-        if(!send_message(client.socket, prepare_message(message_type::QUEUE_DELETE, "ER:NO_QUEUE"))){
+        if(!send_message(client.connection, prepare_message(message_type::QUEUE_DELETE, "ER:NO_QUEUE", client.compact))){
             safe_error("SEND_ERROR: PD:ER to " + client.id);
         }
     }
@@ -176,94 +623,203 @@ void delete_queue(const Client& client, const std::string& queue_name) {
     return;
 }
 
-void publish_message_to_queue(const Client& client, const std::string& content) {
-    
-    //must have queue_name_size and ttl (8 bytes)
-    if (content.length() < 8) {
-        if(!send_message(client.socket, prepare_message(message_type::PUBLISH, "ER:DATA_TOO_SHORT"))){
-            safe_error("SEND_ERROR: PB:ER to " + client.id);
+void publish_message_to_queue(BrokerState& state, const Client& client, const std::string& content, uint64_t trace_id) {
+    uint64_t received_at = metrics::now_ns();
+    std::string queue_name;
+    uint32_t handle = 0;
+    uint32_t ttl = 0;
+    size_t body_offset = 0;
+
+    if (client.compact) {
+        //compact format: [queue_handle(varint)][ttl(varint)][message]
+        //queue handle 0 means queue given by name: [0][ttl(varint)][queue_name_size(varint)][queue_name][message]
+        size_t offset = 0;
+        bool valid = wire::read_varint(content, offset, handle) == wire::decode_status::COMPLETE &&
+                     wire::read_varint(content, offset, ttl) == wire::decode_status::COMPLETE;
+        if (valid && handle == 0) {
+            uint32_t queue_name_size = 0;
+            valid = wire::read_varint(content, offset, queue_name_size) == wire::decode_status::COMPLETE && content.length() >= offset + queue_name_size;
+            if (valid) {
+                queue_name = content.substr(offset, queue_name_size);
+                offset += queue_name_size;
+            }
         }
-        return;
+        if (!valid) {
+            reject_publish(client, "ER:INVALID_DATA");
+            return;
+        }
+        body_offset = offset;
     }
+    else {
+        //must have queue_name_size and ttl (8 bytes)
+        if (content.length() < 8) {
+            reject_publish(client, "ER:DATA_TOO_SHORT");
+            return;
+        }
 
-    uint32_t n_len, n_ttl;
-    std::memcpy(&n_len, content.data(), 4);
-    std::memcpy(&n_ttl, content.data() + 4, 4);
-    
-    uint32_t queue_name_size = ntohl(n_len);
-    uint32_t ttl = ntohl(n_ttl);
+        uint32_t n_len, n_ttl;
+        std::memcpy(&n_len, content.data(), 4);
+        std::memcpy(&n_ttl, content.data() + 4, 4);
+        
+        uint32_t queue_name_size = ntohl(n_len);
+        ttl = ntohl(n_ttl);
 
-    //content at minimum must have queue_name_size and message_body
-    if (content.length() < (8 + queue_name_size)) {
-        if(!send_message(client.socket, prepare_message(message_type::PUBLISH, "ER:INVALID_DATA"))){
-            safe_error("SEND_ERROR: PB:ER to " + client.id);
+        //content at minimum must have queue_name_size and message_body
+        if (content.length() < (8 + static_cast<size_t>(queue_name_size))) {
+            reject_publish(client, "ER:INVALID_DATA");
+            return;
         }
-        return;
+        queue_name = content.substr(8, queue_name_size);
+        body_offset = 8 + queue_name_size;
     }
     
-    std::string queue_name = content.substr(8, queue_name_size);
-    std::string message_body = content.substr(8 + queue_name_size);
+    //with compression negotiated message starts with encoding byte: [encoding(1b)][data], see compression.h
+    wire::encoding body_encoding = wire::encoding::NONE;
+    if (client.features & wire::CAP_COMPRESSION_ANY) {
+        bool valid = content.length() > body_offset;
+        if (valid) {
+            body_encoding = static_cast<wire::encoding>(content[body_offset]);
+            valid = body_encoding == wire::encoding::NONE || (client.features & wire::encoding_capability(body_encoding)) != 0;
+            ++body_offset;
+        }
+        if (!valid) {
+            reject_publish(client, "ER:INVALID_DATA");
+            return;
+        }
+    }
+
+    std::string message_body = content.substr(body_offset);
     auto msg_expire= std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+    uint32_t raw_size = static_cast<uint32_t>(message_body.size());
+    if (body_encoding != wire::encoding::NONE && !wire::compressed_raw_size(message_body, raw_size)) {
+        raw_size = 0;
+    }
 
     //message body must have at least 1 character
-    if(message_body.size() < 1){
-        if(!send_message(client.socket, prepare_message(message_type::PUBLISH, "ER:MESSAGE_TOO_SHORT"))){
-            safe_error("SEND_ERROR: PB:ER to " + client.id);
-        }
+    if(raw_size < 1){
+        reject_publish(client, "ER:MESSAGE_TOO_SHORT");
         return;
     }
 
+    //decompressed content must fit what the client could have sent plain and what the codec can expand to,
+    //raw_size is trusted later to size the decompression buffer
+    if (body_encoding != wire::encoding::NONE &&
+        (raw_size > message_limit(client.features, SERVER_MAX_FRAME) || raw_size > wire::max_decompressed_size(body_encoding, message_body.size()))) {
+        reject_publish(client, "ER:MESSAGE_TOO_LARGE");
+        return;
+    }
 
-    std::vector<int> subscribers_sockets;
+    auto now = std::chrono::steady_clock::now();
+    auto message = std::make_shared<const Message>(Message{std::move(message_body), msg_expire, body_encoding, raw_size, now});
+    size_t stored_size = message->text.size();
+    std::vector<FanoutSubscriber> subscribers;
+    std::shared_ptr<FanoutJob> fanout;
+    std::shared_ptr<FanoutStrand> strand;
+    //with workers running fan-out is queued under the lock, so it runs in the order messages were stored
+    bool async_fanout = state.fanout.running();
     bool valid_op = false;
+    //span times taken under the lock, recorded after it is released
+    uint64_t locked_ns = 0;
+    uint64_t enqueued_ns = 0;
 
     //LOCKS ALWAYS IN THE SAME ORDER -> QUEUES_MUTEX THEN CLIENTS_MUTEX
     {
         //lock on queues_mutex to prevent data race when taking data from existing_queues and adding new message
-        std::lock_guard<std::mutex> lock(queues_mutex);
-        auto it = find_queue_by_name(queue_name);
+        MeteredLock lock(state.queues_mutex);
+        if (trace_id != 0) {
+            locked_ns = trace::wall_ns();
+        }
+        Queue* queue = nullptr;
+        if (handle != 0) {
+            queue = find_queue_by_handle(state, handle);
+        }
+        else {
+            auto it = find_queue_by_name(state, queue_name);
+            if (it != state.existing_queues.end()) {
+                queue = &it->second;
+            }
+        }
 
-        if (it != existing_queues.end()) {
-            it->second.messages.push_back({message_body,msg_expire});
+        if (queue != nullptr) {
+            queue_name = queue->name;
+            handle = queue->handle;
+            queue->messages.push_back(message);
+            queue->retained_bytes += stored_size;
+            queue->expiry.emplace(msg_expire, stored_size);
+            queue->live_messages += 1;
+            queue->live_bytes += stored_size;
+            if (trace_id != 0) {
+                enqueued_ns = trace::wall_ns();
+            }
             
-            //lock on clients_mutex to prevent data race when checking if subscribers still active
-            std::lock_guard<std::mutex> lock_c(clients_mutex);
-            for (const std::string& sub_id : it->second.subscribers) {
-                if (clients.count(sub_id)) {
-                    if(clients[sub_id].socket != -1){
-                        subscribers_sockets.push_back(clients[sub_id].socket);
+            {
+                //lock on clients_mutex to prevent data race when checking if subscribers still active
+                MeteredLock lock_c(state.clients_mutex);
+                for (const std::string& sub_id : queue->subscribers) {
+                    auto client_it = state.clients.find(sub_id);
+                    if (client_it != state.clients.end() && client_it->second.connection) {
+                        subscribers.push_back({client_it->second.connection, client_it->second.compact, client_it->second.features, client_it->second.max_frame});
                     }
                 }
             }
+            strand = queue->strand;
+            fanout = std::make_shared<PublishFanout>(std::move(message), queue_name, handle, trace_id, received_at, std::move(subscribers), queue->counters);
+            if (async_fanout) {
+                state.fanout.submit(strand, fanout);
+            }
             valid_op = true;
         }
     }
 
 
     if (valid_op) {
-        if(!send_message(client.socket, prepare_message(message_type::PUBLISH, "OK"))){
+        if (trace_id != 0) {
+            server_spans.record_at(trace_id, trace::hop::SERVER_LOCKED, locked_ns);
+            server_spans.record_at(trace_id, trace::hop::SERVER_ENQUEUE, enqueued_ns);
+        }
+        metrics::broker().publishes.add();
+        metrics::broker().published_bytes.add(stored_size);
+        if(!send_message(client.connection, prepare_message(message_type::PUBLISH, ok_with_handle(client, handle), client.compact))){
             safe_error("SEND_ERROR: PB:OK to " + client.id);
         }
 
-        for (int sub_sock : subscribers_sockets) {
-            Client temp_client; 
-            temp_client.socket = sub_sock;
-            send_published_message(temp_client, queue_name, message_body);
+        if (async_fanout) {
+            //handler goes back to reading its client, unless this queue has a long fan-out backlog
+            state.fanout.throttle(strand);
         }
-        if (DEBUG == 1){
-            safe_print("DEBUG: Published to " + queue_name + " for " + std::to_string(subscribers_sockets.size()) + " subs.");
+        else {
+            state.fanout.submit(strand, fanout);
         }
     } 
     else {
-        if(!send_message(client.socket, prepare_message(message_type::PUBLISH, "ER:NO_QUEUE"))){
-            safe_error("SEND_ERROR: PB:ER to " + client.id);
-        }
+        reject_publish(client, "ER:NO_QUEUE");
     }
 }
 
 
 
-std::string construct_queue_list(){
+//appends [NUMBER_OF_QUEUES(4b)] [QUEUE1_NAME_SIZE(4b)] [QUEUE1_NAME(n)] ... (call with queues_mutex held)
+//only queues the view wants if it is given
+static void append_queue_names(BrokerState& state, std::string& internal_data, const QueueListView* view){
+    size_t count_offset = internal_data.size();
+    uint32_t queues_count = 0;
+    internal_data.append(reinterpret_cast<const char*>(&queues_count), 4);
+
+    for (const auto& [name, q] : state.existing_queues) {
+        if (view && !view->wants(q.name)) {
+            continue;
+        }
+        //For every queue: name lenght(4b):Name
+        uint32_t n_len = htonl(static_cast<uint32_t>(q.name.length()));
+        internal_data.append(reinterpret_cast<const char*>(&n_len), 4);
+        internal_data.append(q.name);
+        queues_count++;
+    }
+    queues_count = htonl(queues_count);
+    internal_data.replace(count_offset, 4, reinterpret_cast<const char*>(&queues_count), 4);
+}
+
+std::string construct_queue_list(BrokerState& state, bool compact, const QueueListView* view){
      /*
     PREPARING MESSAGE THAT LOOKS LIKE THIS: 
     [TYPE(2b)] [CONTENT_SIZE(4b)] [NUMBER_OF_QUEUES(4b)] [QUEUE1_NAME_SIZE(4b)] [QUEUE1_NAME(n)] [QUEUEX_NAME_SIZE(4b)] [QUEUEX_NAME(n)] 
@@ -272,157 +828,353 @@ std::string construct_queue_list(){
    
     {
         //lock on queues_mutex to prevent data race when taking data from existing_queues
-        std::lock_guard<std::mutex> lock(queues_mutex);
-        internal_data.reserve(existing_queues.size() * 32); //approximate size reservation
-        
-        uint32_t queues_count = htonl(static_cast<uint32_t>(existing_queues.size()));
-        internal_data.append(reinterpret_cast<const char*>(&queues_count), 4);
-
-        for (const auto& [name, q] : existing_queues) {
-            //For every queue: name lenght(4b):Name
-            uint32_t n_len = htonl(static_cast<uint32_t>(q.name.length()));
-            internal_data.append(reinterpret_cast<const char*>(&n_len), 4);
-            internal_data.append(q.name);
-        }
+        MeteredLock lock(state.queues_mutex);
+        internal_data.reserve(state.existing_queues.size() * 32); //approximate size reservation
+        append_queue_names(state, internal_data, view);
     }
 
-    std::string packet = prepare_message(message_type::QUEUE_LIST, internal_data);
+    std::string packet = prepare_message(message_type::QUEUE_LIST, internal_data, compact);
 
     return packet;
 }
 
-void broadcast_queues_list(){
+std::string construct_queue_snapshot(BrokerState& state, bool compact, uint32_t& version, const QueueListView* view){
     /*
-    SENDING MESSAGE THAT LOOKS LIKE THIS: 
-    [TYPE(2b)] [CONTENT_SIZE(4b)] [NUMBER_OF_QUEUES(4b)] [QUEUE1_NAME_SIZE(4b)] [QUEUE1_NAME(n)] [QUEUEX_NAME_SIZE(4b)] [QUEUEX_NAME(n)] 
+    [TYPE(2b)] [CONTENT_SIZE(4b)] [VERSION(4b)] [NUMBER_OF_QUEUES(4b)] [QUEUE1_NAME_SIZE(4b)] [QUEUE1_NAME(n)] ...
+    */
+    std::string internal_data;
+    {
+        //list and version taken under the same lock, so they match
+        MeteredLock lock(state.queues_mutex);
+        internal_data.reserve(4 + state.existing_queues.size() * 32);
+        version = state.queue_list.version;
+        uint32_t version_net = htonl(version);
+        internal_data.append(reinterpret_cast<const char*>(&version_net), 4);
+        append_queue_names(state, internal_data, view);
+    }
+    return prepare_message(message_type::QUEUE_LIST_SNAPSHOT, internal_data, compact);
+}
+
+std::string construct_queue_delta(const QueueListBatch& batch, bool compact){
+    /*
+    [TYPE(2b)] [CONTENT_SIZE(4b)] [FROM(4b)] [TO(4b)] [NUMBER_OF_CHANGES(4b)] [OP(1b)] [NAME_SIZE(4b)] [NAME(n)] ...
     */
+    std::string internal_data;
+    internal_data.reserve(12 + batch.changes.size() * 32);
+    for (uint32_t value : {batch.from, batch.to, static_cast<uint32_t>(batch.changes.size())}) {
+        uint32_t net = htonl(value);
+        internal_data.append(reinterpret_cast<const char*>(&net), 4);
+    }
+    for (const auto& [name, added] : batch.changes) {
+        internal_data.push_back(added ? wire::QUEUE_ADDED : wire::QUEUE_REMOVED);
+        uint32_t n_len = htonl(static_cast<uint32_t>(name.length()));
+        internal_data.append(reinterpret_cast<const char*>(&n_len), 4);
+        internal_data.append(name);
+    }
+    return prepare_message(message_type::QUEUE_LIST_DELTA, internal_data, compact);
+}
 
-    std::string packet = construct_queue_list();
+void broadcast_queues_list(BrokerState& state){
+    QueueListBatch batch;
+    size_t queue_count = 0;
+    {
+        MeteredLock lock(state.queues_mutex);
+        if (!queue_list_take(state.queue_list, batch)) {
+            return;
+        }
+        queue_count = state.existing_queues.size();
+    }
 
-    std::vector<int> target_sockets;
+    struct Target {
+        std::shared_ptr<Connection> connection;
+        bool compact;
+        bool delta;
+    };
+    std::vector<Target> targets;
     {
         //lock clients_mutex to prevent data race when taking data from clients
         //takes snapshot of clients and sends message not in lock, 
         //if clients are deleted while sending message, it will be skipped
-        std::lock_guard<std::mutex> lock(clients_mutex);
-        for (auto const& [id, client] : clients) {
-            if (client.socket != -1){
-                target_sockets.push_back(client.socket);
+        MeteredLock lock(state.clients_mutex);
+        targets.reserve(state.clients.size());
+        for (auto const& [id, client] : state.clients) {
+            if (client.connection){
+                targets.push_back({client.connection, client.compact, (client.features & FEATURE_QUEUE_LIST_DELTA) != 0});
             }
         }
     }
 
-    for (int sock : target_sockets) {
-        if (!send_message(sock, packet)) {
-            safe_error("SEND_ERROR: QL to socket:" + std::to_string(sock));
+    //delta larger than the list itself goes out as snapshot
+    bool snapshot = batch.changes.size() > queue_count;
+    //packets of unfiltered clients are shared, built on first use
+    std::string lists[2];
+    std::string deltas[2];
+    uint32_t delta_versions[2] = {batch.to, batch.to}; //snapshot may be newer than the batch
+    QueueListBatch matching;
+    for (const Target& target : targets) {
+        QueueListView& view = target.connection->queue_list;
+        std::lock_guard<std::mutex> view_lock(view.mutex);
+        if (!view.subscribed()) {
+            continue;
+        }
+        //snapshot sent after the batch was taken already has its changes
+        if (target.delta && batch.to <= view.version) {
+            continue;
+        }
+
+        std::string filtered;
+        std::string* packet = nullptr;
+        uint32_t version = batch.to;
+        if (view.filtered) {
+            matching.changes.clear();
+            for (const auto& change : batch.changes) {
+                if (view.wants(change.first)) {
+                    matching.changes.push_back(change);
+                }
+            }
+            //client keeps its version, next delta starts from it
+            if (matching.changes.empty()) {
+                continue;
+            }
+            packet = &filtered;
+            if (!target.delta) {
+                filtered = construct_queue_list(state, target.compact, &view);
+            }
+            else if (snapshot) {
+                filtered = construct_queue_snapshot(state, target.compact, version, &view);
+            }
+            else {
+                //skipped versions had no changes for client
+                matching.from = std::min(view.version, batch.from);
+                matching.to = batch.to;
+                filtered = construct_queue_delta(matching, target.compact);
+            }
+        }
+        else if (target.delta) {
+            //empty delta still moves clients to the new version
+            packet = &deltas[target.compact ? 1 : 0];
+            if (packet->empty()) {
+                *packet = snapshot ? construct_queue_snapshot(state, target.compact, delta_versions[target.compact ? 1 : 0]) : construct_queue_delta(batch, target.compact);
+            }
+            version = delta_versions[target.compact ? 1 : 0];
+        }
+        else {
+            if (batch.changes.empty()) continue;
+            packet = &lists[target.compact ? 1 : 0];
+            if (packet->empty()) {
+                *packet = construct_queue_list(state, target.compact);
+            }
+        }
+        if (!send_message(target.connection, *packet)) {
+            safe_error("SEND_ERROR: QL to socket:" + std::to_string(target.connection->socket()));
+        }
+        else if (target.delta) {
+            view.version = version;
         }
     }
 }
 
-void send_single_queue_list(const Client& client){
-    std::string packet = construct_queue_list();
-     if (!send_message(client.socket, packet)) {
-        safe_error("SEND_ERROR: QL to socket:" + std::to_string(client.socket));
-     }
+//sends list the view wants, called with view.mutex held
+static void send_queue_list_locked(BrokerState& state, const Client& client, QueueListView& view){
+    if (!view.subscribed()) {
+        return;
+    }
+    bool delta = (client.features & FEATURE_QUEUE_LIST_DELTA) != 0;
+    uint32_t version = 0;
+    std::string packet = delta ? construct_queue_snapshot(state, client.compact, version, &view) : construct_queue_list(state, client.compact, &view);
+    if (!send_message(client.connection, packet)) {
+        safe_error("SEND_ERROR: QL to socket:" + std::to_string(socket_of(client.connection)));
+    }
+    else if (delta) {
+        view.version = version;
+    }
 }
 
-void send_published_message(const Client& client, const std::string &queue_name, const std::string &content){
-    /*
-    SENDING MESSAGE THAT LOOKS LIKE THIS: 
-    [TYPE(2b)] [CONTENT_SIZE(4b)] [QUEUE_NAME_SIZE(4b)] [QUEUE_NAME(n)] [MESSAGE(n)] 
-    */
-    std::string internal_data;
-    bool exists = false;
-
-    {
-        //lock on queues_mutex to prevent data race when checking if queue exists and creating internal data
-    std::lock_guard<std::mutex> lock(queues_mutex);
-    if (queue_exists(queue_name)) {
-        exists = true;
-        internal_data.reserve(4 + queue_name.size() + content.size());
-
-        uint32_t n_len = htonl(static_cast<uint32_t>(queue_name.length()));
-        internal_data.append(reinterpret_cast<const char*>(&n_len), sizeof(n_len));
+void send_single_queue_list(BrokerState& state, const Client& client){
+    if (!client.connection) {
+        return;
+    }
+    QueueListView& view = client.connection->queue_list;
+    std::lock_guard<std::mutex> view_lock(view.mutex);
+    send_queue_list_locked(state, client, view);
+}
 
-        internal_data.append(queue_name);
-        internal_data.append(content);
+void set_queue_list_filter(BrokerState& state, const Client& client, const std::string& content){
+    //[NUMBER_OF_PREFIXES(4b)] [PREFIX1_SIZE(4b)] [PREFIX1(n)] ...
+    std::vector<std::string> prefixes;
+    uint32_t count = 0;
+    size_t offset = 0;
+    bool valid = content.size() >= 4;
+    if (valid) {
+        std::memcpy(&count, content.data(), 4);
+        count = ntohl(count);
+        offset = 4;
     }
+    for (uint32_t i = 0; valid && i < count; ++i) {
+        uint32_t size = 0;
+        valid = offset + 4 <= content.size();
+        if (!valid) break;
+        std::memcpy(&size, content.data() + offset, 4);
+        size = ntohl(size);
+        offset += 4;
+        valid = size <= content.size() - offset;
+        if (!valid) break;
+        prefixes.emplace_back(content, offset, size);
+        offset += size;
     }
-
-    if (!exists){ 
+    if (!valid || offset != content.size()) {
+        safe_error("INVALID QUEUE LIST FILTER FROM " + client.id);
         return;
     }
 
-    std::string full_packet = prepare_message(message_type::MESSAGE_MULTICAST, internal_data);
+    //filter and the list matching it change together for broadcasts
+    QueueListView& view = client.connection->queue_list;
+    std::lock_guard<std::mutex> view_lock(view.mutex);
+    view.filtered = true;
+    view.prefixes = std::move(prefixes);
+    send_queue_list_locked(state, client, view);
+}
 
-    if (!send_message(client.socket, full_packet)) {
-        safe_error("SEND_ERROR: MS to socket:" + std::to_string(client.socket));
-    }
+std::string build_published_message(const std::string &queue_name, uint32_t queue_handle, const std::string &content, bool compact){
+    return prepare_message(message_type::MESSAGE_MULTICAST, build_published_payload(queue_name, queue_handle, content, compact), compact);
 }
 
-void send_messages_to_new_subscriber(const Client& client, const std::string& queue_name) { 
+std::string build_traced_message(const std::string &queue_name, uint32_t queue_handle, const std::string &content, uint64_t trace_id, bool compact){
+    std::string payload = build_published_payload(queue_name, queue_handle, content, compact);
+    char id[trace::TRACE_ID_SIZE];
+    trace::write_u64(id, trace_id);
+    payload.append(id, sizeof(id));
+    return prepare_message(message_type::MESSAGE_TRACED, payload, compact);
+}
+
+std::string build_published_payload(const std::string &queue_name, uint32_t queue_handle, const std::string &content, bool compact){
     /*
-    SENDING MESSAGE THAT LOOKS LIKE THIS: 
-    [TYPE(2b)] [CONTENT_SIZE(4b)] [QUEUE_NAME_SIZE(4b)] [QUEUE_NAME(n)] [MESSAGE1_SIZE(4b)] [MESSAGE1(n)] ... [MESSAGEn_SIZE(4b)] [MESSAGEn(n)] 
+    PREPARING PAYLOAD THAT LOOKS LIKE THIS: 
+    [TYPE(2b)] [CONTENT_SIZE(4b)] [QUEUE_NAME_SIZE(4b)] [QUEUE_NAME(n)] [MESSAGE(n)] 
+    OR IN COMPACT MODE:
+    [TYPE(2b)] [CONTENT_SIZE(varint)] [QUEUE_HANDLE(varint)] [MESSAGE(n)] 
     */
     std::string internal_data;
-    bool exists = false;
-    bool has_messages = false;
-
-    {
-        //lock on queues_mutex to prevent data race when creating internal data for message list
-        std::lock_guard<std::mutex> lock(queues_mutex);
-        auto it = find_queue_by_name(queue_name);
-        if (it != existing_queues.end()) {
-            exists = true;
-            auto now = std::chrono::steady_clock::now();
-
-            uint32_t n_len = htonl(static_cast<uint32_t>(queue_name.length()));
-            internal_data.append(reinterpret_cast<const char*>(&n_len), 4);
-            internal_data.append(queue_name);
-
-            auto msg_it = it->second.messages.begin();
-            while (msg_it != it->second.messages.end()) {
-                if (msg_it->expire <= now) {
-                    msg_it = it->second.messages.erase(msg_it);
-                } else {
-                    has_messages = true;
-                    uint32_t m_len = htonl(static_cast<uint32_t>(msg_it->text.length()));
-                    internal_data.append(reinterpret_cast<const char*>(&m_len), 4);
-                    internal_data.append(msg_it->text);
-                    ++msg_it;
-                }
-            }
-        }
+    if (compact) {
+        internal_data.reserve(5 + content.size());
+        append_varint(internal_data, queue_handle);
+    }
+    else {
+        internal_data.reserve(4 + queue_name.size() + content.size());
+        uint32_t n_len = htonl(static_cast<uint32_t>(queue_name.length()));
+        internal_data.append(reinterpret_cast<const char*>(&n_len), sizeof(n_len));
+        internal_data.append(queue_name);
     }
+    internal_data.append(content);
 
-    if (!exists || !has_messages) return;
+    return internal_data;
+}
 
-    if(DEBUG == 1){
-        safe_print("Queue: " + queue_name + " | Messages to send: " + std::to_string(internal_data.size()));
-    }
+bool send_published_message(const Client& client, const std::string &packet){
+    return delivery_sent(send_message_within(client.connection, packet, FANOUT_SEND_TIMEOUT), client.connection);
+}
 
-    std::string full_packet = prepare_message(message_type::MESSAGE_TO_NEW_SUBSCRIBER, internal_data);
-    if(!send_message(client.socket, full_packet)){
-        safe_error("SEND_ERROR: MA to socket:" + std::to_string(client.socket));
+void send_messages_to_new_subscriber(BrokerState& state, const Client& client, const std::string& queue_name) { 
+    std::vector<std::shared_ptr<const Message>> live_messages;
+    std::string prefix;
+    {
+        //lock on queues_mutex to prevent data race when taking message list
+        MeteredLock lock(state.queues_mutex);
+        auto it = find_queue_by_name(state, queue_name);
+        if (it != state.existing_queues.end()) {
+            take_backlog(client, it->second, prefix, live_messages);
+        }
     }
-    return;
+    //message list is built and compressed outside of queues_mutex
+    send_backlog(client, queue_name, prefix, live_messages);
 }
 
-void notify_after_delete(const std::vector<std::string>& ids, const std::string &queue_name){
-    std::string packet = prepare_message(message_type::QUEUE_DELETED_INFO, queue_name + " was deleted");
+void notify_after_delete(BrokerState& state, const std::vector<std::string>& ids, const std::string &queue_name){
+    std::string payload = queue_name + " was deleted";
+    std::string packets[2];
     for (auto const& id : ids){
-        int sock = -1;
+        std::shared_ptr<Connection> connection;
+        bool compact = false;
         {
             //lock on clients_mutex to prevent data race when checking if client exists and getting sockets of subscribers
-            std::lock_guard<std::mutex> lock(clients_mutex);
-            if (clients.count(id)) {
-                sock = clients[id].socket;
+            MeteredLock lock(state.clients_mutex);
+            auto it = state.clients.find(id);
+            if (it != state.clients.end()) {
+                connection = it->second.connection;
+                compact = it->second.compact;
             }
         }
-        if(sock != -1) {
-            send_message(sock, packet);
+        if(connection) {
+            std::string& packet = packets[compact ? 1 : 0];
+            if (packet.empty()) {
+                packet = prepare_message(message_type::QUEUE_DELETED_INFO, payload, compact);
+            }
+            send_message(connection, packet);
         }
     }
 }
 
+void send_queue_stats(BrokerState& state, const Client& client, const std::string& queue_name){
+    //values taken under queues_mutex, counters read after it is released
+    struct Row {
+        std::string name;
+        size_t depth;
+        uint64_t retained_bytes;
+        size_t subscribers;
+        std::chrono::steady_clock::time_point oldest;
+        std::shared_ptr<QueueCounters> counters;
+    };
+    std::vector<Row> rows;
+    auto now = std::chrono::steady_clock::now();
+    {
+        MeteredLock lock(state.queues_mutex);
+        auto add_row = [&rows, &now](Queue& queue) {
+            //expired messages not swept yet are not reported, only messages expired since the last QS are touched
+            account_expired_messages(queue, now);
+            bool any_live = queue.oldest_live < queue.messages.size();
+            rows.push_back({queue.name, queue.live_messages, queue.live_bytes, queue.subscribers.size(),
+                            any_live ? queue.messages[queue.oldest_live]->published : now, queue.counters});
+        };
+        if (queue_name.empty()) {
+            rows.reserve(state.existing_queues.size());
+            for (auto& [name, queue] : state.existing_queues) {
+                add_row(queue);
+            }
+        }
+        else {
+            auto it = find_queue_by_name(state, queue_name);
+            if (it != state.existing_queues.end()) {
+                add_row(it->second);
+            }
+        }
+    }
+
+    if (!queue_name.empty() && rows.empty()) {
+        if(!send_message(client.connection, prepare_message(message_type::QUEUE_STATS, "ER:NO_QUEUE", client.compact))){
+            safe_error("SEND_ERROR: QS:ER to " + client.id);
+        }
+        return;
+    }
+
+    std::string payload = "OK\n";
+    for (const Row& row : rows) {
+        uint64_t published, delivered;
+        double publish_rate, deliver_rate;
+        {
+            std::lock_guard<std::mutex> lock(row.counters->mutex);
+            published = row.counters->published;
+            delivered = row.counters->delivered;
+            publish_rate = row.counters->publish_rate.per_second(now);
+            deliver_rate = row.counters->deliver_rate.per_second(now);
+        }
+        char rates[64];
+        snprintf(rates, sizeof(rates), "%.3f %.3f", publish_rate, deliver_rate);
+        auto oldest_age = std::chrono::duration_cast<std::chrono::milliseconds>(now - row.oldest).count();
+        payload += row.name + " " + std::to_string(row.depth) + " " + std::to_string(row.retained_bytes) + " " +
+                   std::to_string(row.subscribers) + " " + std::to_string(published) + " " + std::to_string(delivered) + " " +
+                   rates + " " + std::to_string(std::max<int64_t>(oldest_age, 0)) + "\n";
+    }
+    if(!send_payload(client.connection, message_type::QUEUE_STATS, payload, client.compact, (client.features & FEATURE_CHUNKING) != 0)){
+        safe_error("SEND_ERROR: QS to " + client.id);
+    }
+}
@@ -0,0 +1,342 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace metrics {
+
+constexpr int HISTOGRAM_LE_COUNT = 25;                  //bucket bounds 1us * 2^i in exposition
+constexpr double HISTOGRAM_LE_START_SECONDS = 1e-6;
+constexpr double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+constexpr int ENDPOINT_RECV_TIMEOUT = 2;                 //seconds to wait for HTTP request
+constexpr std::chrono::milliseconds ENDPOINT_ACCEPT_BACKOFF{100}; //wait after accept failed, e.g. out of descriptors
+
+size_t shard_index() {
+    static std::atomic<size_t> next_shard{0};
+    thread_local size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+    return shard;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// ------------------------------
+// HISTOGRAM
+// ------------------------------
+
+size_t Histogram::bucket_of(uint64_t ns) {
+    if (ns < SUB_BUCKETS) {
+        return static_cast<size_t>(ns);
+    }
+    unsigned exponent = 63 - static_cast<unsigned>(std::countl_zero(ns));
+    unsigned shift = exponent - SUB_BUCKET_BITS;
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + static_cast<size_t>((ns >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t Histogram::bucket_lower(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+    return (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+uint64_t Histogram::bucket_upper(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS) - 1;
+    return bucket_lower(bucket) + ((uint64_t{1} << shift) - 1);
+}
+
+void Histogram::record(uint64_t ns) {
+    Shard& shard = shards[shard_index()];
+    shard.counts[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = shard.max.load(std::memory_order_relaxed);
+    while (ns > max && !shard.max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snap;
+    snap.counts.assign(BUCKET_COUNT, 0);
+    for (const Shard& shard : shards) {
+        for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+            uint64_t c = shard.counts[i].load(std::memory_order_relaxed);
+            snap.counts[i] += c;
+            snap.count += c;
+        }
+        snap.sum += shard.sum.load(std::memory_order_relaxed);
+        snap.max = std::max(snap.max, shard.max.load(std::memory_order_relaxed));
+    }
+    return snap;
+}
+
+uint64_t Histogram::Snapshot::percentile(double q) const {
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count));
+    rank = std::clamp<uint64_t>(rank, 1, count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(bucket_upper(i), max);
+        }
+    }
+    return max;
+}
+
+uint64_t Histogram::Snapshot::count_at_most(uint64_t ns) const {
+    uint64_t total = 0;
+    size_t last = bucket_of(ns);
+    for (size_t i = 0; i <= last; ++i) {
+        total += counts[i];
+    }
+    return total;
+}
+
+// ------------------------------
+// REGISTRY
+// ------------------------------
+
+void Registry::add(const std::string& name, const std::string& help, Counter& counter, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back({name, help, labels, kind::COUNTER, &counter});
+}
+
+void Registry::add(const std::string& name, const std::string& help, Gauge& gauge, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back({name, help, labels, kind::GAUGE, &gauge});
+}
+
+void Registry::add(const std::string& name, const std::string& help, Histogram& histogram, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back({name, help, labels, kind::HISTOGRAM, &histogram});
+}
+
+void Registry::add_collector(std::function<void()> collector) {
+    std::lock_guard<std::mutex> lock(mutex);
+    collectors.push_back(std::move(collector));
+}
+
+static std::string format_seconds(uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", static_cast<double>(ns) / 1e9);
+    return buf;
+}
+
+//{labels} with extra label appended, empty string without any label
+static std::string label_set(const std::string& labels, const std::string& extra = "") {
+    if (labels.empty() && extra.empty()) return "";
+    if (labels.empty()) return "{" + extra + "}";
+    if (extra.empty()) return "{" + labels + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+std::string Registry::render() {
+    std::vector<std::function<void()>> hooks;
+    std::vector<Entry> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hooks = collectors;
+        snapshot = entries;
+    }
+    //collectors may take broker locks, so they run without registry mutex
+    for (auto& hook : hooks) {
+        hook();
+    }
+
+    std::string out;
+    //quantiles and max of histograms are gauge families of their own, rendered after all
+    //histograms; series of one name are registered together, so each family stays contiguous
+    std::string summaries;
+    std::string quantiles;
+    std::string maxima;
+    std::string last_name;
+    for (const Entry& entry : snapshot) {
+        bool first = entry.name != last_name;
+        last_name = entry.name;
+        if (first) {
+            summaries += quantiles + maxima;
+            quantiles.clear();
+            maxima.clear();
+        }
+        if (entry.type == kind::COUNTER || entry.type == kind::GAUGE) {
+            if (first) {
+                out += "# HELP " + entry.name + " " + entry.help + "\n";
+                out += "# TYPE " + entry.name + (entry.type == kind::COUNTER ? " counter\n" : " gauge\n");
+            }
+            std::string value = entry.type == kind::COUNTER
+                                    ? std::to_string(static_cast<Counter*>(entry.metric)->value())
+                                    : std::to_string(static_cast<Gauge*>(entry.metric)->value());
+            out += entry.name + label_set(entry.labels) + " " + value + "\n";
+            continue;
+        }
+
+        Histogram::Snapshot snap = static_cast<Histogram*>(entry.metric)->snapshot();
+        if (first) {
+            out += "# HELP " + entry.name + " " + entry.help + "\n";
+            out += "# TYPE " + entry.name + " histogram\n";
+        }
+        double bound = HISTOGRAM_LE_START_SECONDS;
+        for (int i = 0; i < HISTOGRAM_LE_COUNT; ++i, bound *= 2) {
+            char le[32];
+            snprintf(le, sizeof(le), "le=\"%g\"", bound);
+            uint64_t count = snap.count_at_most(static_cast<uint64_t>(bound * 1e9));
+            out += entry.name + "_bucket" + label_set(entry.labels, le) + " " + std::to_string(count) + "\n";
+        }
+        out += entry.name + "_bucket" + label_set(entry.labels, "le=\"+Inf\"") + " " + std::to_string(snap.count) + "\n";
+        out += entry.name + "_sum" + label_set(entry.labels) + " " + format_seconds(snap.sum) + "\n";
+        out += entry.name + "_count" + label_set(entry.labels) + " " + std::to_string(snap.count) + "\n";
+
+        //quantiles at full histogram resolution, for alerting on tail latency
+        if (first) {
+            quantiles += "# HELP " + entry.name + "_quantile Quantiles of " + entry.name + " at histogram resolution.\n";
+            quantiles += "# TYPE " + entry.name + "_quantile gauge\n";
+            maxima += "# HELP " + entry.name + "_max Largest value recorded in " + entry.name + ".\n";
+            maxima += "# TYPE " + entry.name + "_max gauge\n";
+        }
+        for (double q : QUANTILES) {
+            char quantile[32];
+            snprintf(quantile, sizeof(quantile), "quantile=\"%g\"", q);
+            quantiles += entry.name + "_quantile" + label_set(entry.labels, quantile) + " " + format_seconds(snap.percentile(q)) + "\n";
+        }
+        maxima += entry.name + "_max" + label_set(entry.labels) + " " + format_seconds(snap.max) + "\n";
+    }
+    return out + summaries + quantiles + maxima;
+}
+
+// ------------------------------
+// BROKER METRICS
+// ------------------------------
+
+BrokerMetrics& broker() {
+    static BrokerMetrics metrics;
+    return metrics;
+}
+
+Registry& registry() {
+    static Registry* instance = [] {
+        Registry* r = new Registry();
+        BrokerMetrics& m = broker();
+        r->add("mq_publishes_total", "Messages accepted from publishers.", m.publishes);
+        r->add("mq_published_bytes_total", "Bytes of messages accepted from publishers.", m.published_bytes);
+        r->add("mq_publish_errors_total", "Publishes rejected by the broker.", m.publish_errors);
+        r->add("mq_deliveries_total", "Messages sent to subscribers.", m.deliveries);
+        r->add("mq_delivery_drops_total", "Messages not sent to a subscriber that could not accept them.", m.delivery_drops);
+        r->add("mq_send_errors_total", "Failed writes to client sockets.", m.send_errors);
+        r->add("mq_send_timeouts_total", "Connections closed because a client did not read its socket.", m.send_timeouts);
+        r->add("mq_sent_bytes_total", "Bytes written to client sockets.", m.sent_bytes);
+        r->add("mq_connections_accepted_total", "Accepted client connections.", m.connections_accepted);
+        r->add("mq_connections", "Open client connections.", m.connections);
+        r->add("mq_queues", "Existing queues.", m.queues);
+        r->add("mq_retained_messages", "Messages stored in all queues.", m.retained_messages);
+        r->add("mq_fanout_backlog", "Publishes waiting for or in fan-out.", m.fanout_backlog);
+        r->add("mq_fanout_steals_total", "Fan-out chunks taken over by another worker.", m.fanout_steals);
+        r->add("mq_heartbeats_sent_total", "Heartbeats sent to idle connections.", m.heartbeats_sent);
+        r->add("mq_idle_timeouts_total", "Connections closed because the client sent nothing for too long.", m.idle_timeouts);
+        r->add("mq_publish_fanout_seconds", "Time from receiving a publish to sending it to the last subscriber.", m.publish_fanout);
+        r->add("mq_send_seconds", "Duration of one frame send, including wait for socket buffer space.", m.send_duration);
+        r->add("mq_lock_wait_seconds", "Time spent waiting for broker locks.", m.queues_lock_wait, "lock=\"queues\"");
+        r->add("mq_lock_wait_seconds", "Time spent waiting for broker locks.", m.clients_lock_wait, "lock=\"clients\"");
+        r->add("mq_lock_hold_seconds", "Time broker locks were held.", m.queues_lock_hold, "lock=\"queues\"");
+        r->add("mq_lock_hold_seconds", "Time broker locks were held.", m.clients_lock_hold, "lock=\"clients\"");
+        return r;
+    }();
+    return *instance;
+}
+
+// ------------------------------
+// ENDPOINT
+// ------------------------------
+
+static std::atomic<int> endpoint_socket{-1};
+static std::thread endpoint_thread;
+
+static void send_all(int sock, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        sent += static_cast<size_t>(n);
+    }
+}
+
+static void endpoint_loop(int listening) {
+    while (true) {
+        int sock = accept(listening, nullptr, nullptr);
+        if (sock == -1) {
+            if (endpoint_socket.load() == -1) break; //stopped
+            //persistent errors like EMFILE would fail again at once
+            if (errno != EINTR && errno != ECONNABORTED) {
+                std::this_thread::sleep_for(ENDPOINT_ACCEPT_BACKOFF);
+            }
+            continue;
+        }
+        timeval tv{ENDPOINT_RECV_TIMEOUT, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        //request is read until end of headers and otherwise ignored, every path returns metrics
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            ssize_t n = recv(sock, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            request.append(buf, static_cast<size_t>(n));
+        }
+        std::string body = registry().render();
+        send_all(sock, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+    }
+}
+
+bool start_endpoint(int port) {
+    int listening = socket(AF_INET, SOCK_STREAM, 0);
+    if (listening == -1) return false;
+    int opt = 1;
+    setsockopt(listening, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    //local only, metrics are not meant to be exposed to clients
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listening, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || listen(listening, SOMAXCONN) == -1) {
+        close(listening);
+        return false;
+    }
+    endpoint_socket = listening;
+    endpoint_thread = std::thread(endpoint_loop, listening);
+
+    //listener thread is joined also when main returns early
+    static std::once_flag exit_hook;
+    std::call_once(exit_hook, [] { std::atexit(stop_endpoint); });
+    return true;
+}
+
+void stop_endpoint() {
+    int listening = endpoint_socket.exchange(-1);
+    if (listening == -1) return;
+    shutdown(listening, SHUT_RDWR);
+    close(listening);
+    if (endpoint_thread.joinable()) endpoint_thread.join();
+}
+
+} // namespace metrics
@@ -1,70 +1,99 @@
 #include "protocol_handler.h"
+#include "liveness.h"
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <poll.h>
 #include <iostream>
 #include <charconv>
 #include <cstring>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <map>
+#include <atomic>
+#include <chrono>
 
-std::string prepare_message(message_type message_type, const std::string &payload) {
+constexpr size_t RECV_CHUNK_SIZE = 64 * 1024; //bytes requested from socket per recv call
+
+static std::atomic<uint32_t> next_stream_id{1}; //ids of outgoing chunk streams
+
+std::string prepare_message(message_type message_type, const std::string &payload, bool compact) {
+    //header encoded on stack, packet is allocated once with exact size
+    char header[wire::MAX_HEADER_SIZE];
+    size_t header_size = wire::encode_header(header, message_type, static_cast<uint32_t>(payload.size()), compact);
     std::string buf;
-    std::string type_str = MSG_TYPE_TO_STR.at(message_type);
-    buf.reserve(PACKET_HEADER_SIZE + payload.size());
-    buf += type_str;
-    uint32_t len = htonl(static_cast<uint32_t>(payload.size()));
-    buf.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    buf.reserve(header_size + payload.size());
+    buf.append(header, header_size);
     buf.append(payload);
     return buf;
 }
 
-static ssize_t recv_exact(int sock, char* buffer, size_t n) {
-    size_t total_received = 0;
-    while (total_received < n) {
-        ssize_t received = recv(sock, buffer + total_received, n - total_received, 0);
-        if (received <= 0) {
-            return received;
-        }
-        total_received += received;
-    }
-    return static_cast<ssize_t>(total_received);
+std::string prepare_message(const char (&code)[wire::TYPE_SIZE], const std::string &payload, bool compact) {
+    char header[wire::MAX_HEADER_SIZE];
+    size_t header_size = wire::encode_header(header, code[0], code[1], static_cast<uint32_t>(payload.size()), compact);
+    std::string buf;
+    buf.reserve(header_size + payload.size());
+    buf.append(header, header_size);
+    buf.append(payload);
+    return buf;
 }
 
+std::vector<std::string> prepare_chunked_message(message_type message_type, const std::string &payload, bool compact) {
+    const wire::frame_descriptor &descriptor = wire::descriptor(message_type);
+    uint32_t stream_id = next_stream_id.fetch_add(1, std::memory_order_relaxed);
+    return wire::chunk_frames(stream_id, descriptor.code[0], descriptor.code[1], payload, compact);
+}
 
-std::tuple<recv_status, message_type, std::string> recv_message(int sock) {
-    //receive header
-    char header[PACKET_HEADER_SIZE];
-    ssize_t header_result = recv_exact(sock, header, PACKET_HEADER_SIZE);
-    if (header_result == 0){ 
-        return {recv_status::DISCONNECT, message_type::ERROR, ""};  
-    }
-    else if (header_result < 0){ 
-        return {recv_status::NETWORK_ERROR, message_type::ERROR, ""};  
+void append_varint(std::string &out, uint32_t value) {
+    char encoded[wire::MAX_VARINT_SIZE];
+    out.append(encoded, wire::write_varint(encoded, value));
+}
+
+//receives more data into reader buffer, at least min_bytes if possible
+static ssize_t fill_reader(FrameReader &reader, size_t min_bytes) {
+    //drop consumed data before growing buffer
+    if (reader.offset > 0) {
+        reader.buffer.erase(0, reader.offset);
+        reader.offset = 0;
     }
-    
-    std::string msg_type_str(header, 2);
-    message_type msg_type;
-    if(STR_TO_MSG_TYPE.contains(msg_type_str)){
-        msg_type = STR_TO_MSG_TYPE.at(msg_type_str);
+    size_t old_size = reader.buffer.size();
+    size_t request = std::max(RECV_CHUNK_SIZE, min_bytes);
+    reader.buffer.resize(old_size + request);
+    ssize_t received = recv(reader.sock, reader.buffer.data() + old_size, request, 0);
+    reader.buffer.resize(old_size + (received > 0 ? received : 0));
+    return received;
+}
+
+std::tuple<recv_status, message_type, std::string> recv_message(FrameReader &reader) {
+    //receive header
+    wire::frame_header header;
+    wire::decode_status decoded;
+    while ((decoded = wire::decode_header(reader.buffer.data() + reader.offset, reader.buffer.size() - reader.offset, reader.compact, header)) == wire::decode_status::NEED_MORE) {
+        ssize_t header_result = fill_reader(reader, 0);
+        if (header_result == 0){ 
+            return {recv_status::DISCONNECT, message_type::ERROR, ""};  
+        }
+        else if (header_result < 0){ 
+            return {recv_status::NETWORK_ERROR, message_type::ERROR, ""};  
+        }
     }
-    else{
-        return {recv_status::PROTOCOL_ERROR, message_type::ERROR, ""};
+    if (decoded == wire::decode_status::MALFORMED) {
+        //frame boundary is lost, nothing after it can be read
+        return {recv_status::MALFORMED_FRAME, message_type::ERROR, ""};
     }
-    
-    uint32_t network_len;
-    std::memcpy(&network_len, header + 2, sizeof(uint32_t));
-    uint32_t payload_size = ntohl(network_len);
+
+    message_type msg_type = header.type();
+    std::memcpy(reader.code, header.code, wire::TYPE_SIZE);
+    size_t header_size = header.size;
+    uint32_t payload_size = header.payload_size;
     
     //10MB limit
-    if (payload_size > MAX_PAYLOAD_SIZE_MB * 1024 * 1024) {
+    if (payload_size > SERVER_MAX_FRAME) {
         return {recv_status::PAYLOAD_TOO_LARGE, msg_type, ""};
     }
 
     //receive payload
-    std::string msg_content;
-    if (payload_size > 0) {
-        msg_content.resize(payload_size);
-        ssize_t payload_result = recv_exact(sock, msg_content.data(), payload_size);
+    while (reader.buffer.size() - reader.offset < header_size + payload_size) {
+        size_t missing = header_size + payload_size - (reader.buffer.size() - reader.offset);
+        ssize_t payload_result = fill_reader(reader, missing);
         if (payload_result == 0) {
             return {recv_status::DISCONNECT, message_type::ERROR, ""};
         }
@@ -72,43 +101,145 @@ std::tuple<recv_status, message_type, std::string> recv_message(int sock) {
             return {recv_status::NETWORK_ERROR, msg_type, ""};
         }
     }
+    std::string msg_content = reader.buffer.substr(reader.offset + header_size, payload_size);
+    reader.offset += header_size + payload_size;
+    if (reader.offset == reader.buffer.size()) {
+        reader.buffer.clear();
+        reader.offset = 0;
+    }
     
-    if (DEBUG == 1){
-        safe_print("DEBUG: TYPE: " + msg_type_str + " SIZE: " + std::to_string(payload_size) + " CONTENT: " + msg_content);
+    if (DEBUG == 1 && log_enabled(log_level::DEBUG)){
+        //content is truncated by logger, only its start is copied
+        log_message(log_level::DEBUG, "TYPE: " + std::string(header.code, wire::TYPE_SIZE) + " SIZE: " + std::to_string(payload_size) + " CONTENT: " + msg_content.substr(0, LOG_RECORD_TEXT_SIZE));
     }
     
-    //check if message is valid
+    //check if message is valid, unknown types are skipped so the stream stays in sync
     if (msg_type != message_type::ERROR) {
         return {recv_status::SUCCESS, msg_type, msg_content};
     }
     return {recv_status::PROTOCOL_ERROR, msg_type, ""};
 }
 
-bool send_message(int sock, const std::string &data) {
-    //mutex for each socket
-    std::mutex* m;
-    { 
-        std::lock_guard<std::mutex> lock(socket_map_mutex); 
-        //client inactive
-        if (sock == -1) return false;
-        m = &socket_mutexes[sock]; 
-    }
-    std::lock_guard<std::mutex> lock(*m);
+//bytes written to socket and not yet taken by the client, -1 if unknown
+static int unsent_bytes(int sock) {
+    int queued = 0;
+    return ioctl(sock, TIOCOUTQ, &queued) == 0 ? queued : -1;
+}
+
+//counts connection closed because it could not take a frame in time, shuts it down
+static void write_timed_out(Connection& connection, const char* reason) {
+    safe_error(std::string("send timeout sock=") + std::to_string(connection.socket()) + ", " + reason + ", closing connection");
+    metrics::broker().send_timeouts.add();
+    metrics::broker().send_errors.add();
+    connection.shutdown();
+}
+
+bool send_message(const std::shared_ptr<Connection> &connection, const std::string &data, std::chrono::milliseconds timeout) {
+    //client inactive
+    if (!connection) return false;
+    //writer ahead either makes progress or shuts the connection down within its timeout
+    std::unique_lock<std::timed_mutex> lock(connection->write_mutex());
+    return send_message_locked(*connection, data, timeout);
+}
+
+send_status send_message_within(const std::shared_ptr<Connection> &connection, const std::string &data, std::chrono::milliseconds timeout) {
+    if (!connection) return send_status::FAILED;
+    //a long MA or chunked frame may hold the mutex while its client reads, that is no reason to close
+    std::unique_lock<std::timed_mutex> lock(connection->write_mutex(), timeout);
+    if (!lock.owns_lock()) return send_status::BUSY;
+    return send_message_locked(*connection, data, timeout) ? send_status::SENT : send_status::FAILED;
+}
+
+bool send_message_locked(Connection& connection, const std::string &data, std::chrono::milliseconds timeout) {
+    metrics::ScopedTimer timer(metrics::broker().send_duration);
 
     //send data
+    int sock = connection.socket();
     size_t total_sent = 0;
     size_t data_len = data.size();
     const char *raw_data = data.data();
 
+    //socket is written without blocking; a client that takes nothing for timeout holds the
+    //write mutex no longer than that, its frame may be cut, so the connection is shut down then
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int unsent = -1; //socket queue when the wait for room started
     while (total_sent < data_len) {
-        ssize_t sent = send(sock, raw_data + total_sent, data_len - total_sent, MSG_NOSIGNAL);
+        ssize_t sent = send(sock, raw_data + total_sent, data_len - total_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            if (unsent < 0) {
+                unsent = unsent_bytes(sock);
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            struct pollfd pfd{sock, POLLOUT, 0};
+            if (left.count() > 0 && poll(&pfd, 1, static_cast<int>(left.count())) != 0) {
+                continue;
+            }
+            //a large send buffer is writable again only after a big part of it drained,
+            //a client that took anything from it meanwhile is still reading
+            int still_unsent = unsent_bytes(sock);
+            if (still_unsent >= 0 && still_unsent < unsent) {
+                unsent = still_unsent;
+                deadline = std::chrono::steady_clock::now() + timeout;
+                continue;
+            }
+            write_timed_out(connection, "client does not read");
+            return false;
+        }
         if (sent <= 0) { 
             if (sent == -1 && errno != EPIPE && errno != ECONNRESET && errno != EBADF) {
                 safe_error("send error errno=" + std::to_string(errno) + " sock=" + std::to_string(sock));
             }
+            metrics::broker().send_errors.add();
             return false;
         }
         total_sent += sent;
+        //client is reading, slow links get the whole timeout again for the rest
+        deadline = std::chrono::steady_clock::now() + timeout;
+        unsent = -1;
+    }
+    metrics::broker().sent_bytes.add(data_len);
+    connection.frames_sent.fetch_add(1, std::memory_order_relaxed);
+    connection.bytes_sent.fetch_add(data_len, std::memory_order_relaxed);
+    liveness_sent(connection);
+    return true;
+}
+
+bool try_send_message(Connection& connection, const std::string &data) {
+    std::unique_lock<std::timed_mutex> lock(connection.write_mutex(), std::try_to_lock);
+    if (!lock.owns_lock()) return false;
+
+    //writable socket has room for a small frame, so send does not block
+    struct pollfd pfd{connection.socket(), POLLOUT, 0};
+    if (poll(&pfd, 1, 0) != 1 || !(pfd.revents & POLLOUT)) return false;
+    return send_message_locked(connection, data);
+}
+
+bool send_chunks(const std::shared_ptr<Connection> &connection, const std::vector<std::string> &chunks, std::chrono::milliseconds timeout) {
+    for (const std::string &chunk : chunks) {
+        //lock is released between chunks
+        if (!send_message(connection, chunk, timeout)) {
+            return false;
+        }
     }
     return true;
-}   
\ No newline at end of file
+}
+
+send_status send_chunks_within(const std::shared_ptr<Connection> &connection, const std::vector<std::string> &chunks, std::chrono::milliseconds timeout) {
+    if (chunks.empty()) return send_status::SENT;
+    send_status status = send_message_within(connection, chunks.front(), timeout);
+    if (status != send_status::SENT) return status;
+    //stream started, the client must get all of it
+    for (size_t i = 1; i < chunks.size(); ++i) {
+        if (!send_message(connection, chunks[i], timeout)) {
+            return send_status::FAILED;
+        }
+    }
+    return send_status::SENT;
+}
+
+bool send_payload(const std::shared_ptr<Connection> &connection, message_type message_type, const std::string &payload, bool compact, bool chunking) {
+    if (chunking && payload.size() > wire::CHUNK_SIZE) {
+        return send_chunks(connection, prepare_chunked_message(message_type, payload, compact));
+    }
+    return send_message(connection, prepare_message(message_type, payload, compact));
+}
@@ -0,0 +1,78 @@
+#include "queue_list.h"
+
+bool QueueListView::wants(const std::string& name) const {
+    if (!filtered) return true;
+    for (const std::string& prefix : prefixes) {
+        if (name.compare(0, prefix.size(), prefix) == 0) return true;
+    }
+    return false;
+}
+
+void queue_list_changed(QueueListLog& log, const std::string& name, bool added) {
+    ++log.version;
+    auto [it, inserted] = log.pending.try_emplace(name, !added, added);
+    if (!inserted) {
+        it->second.second = added;
+    }
+}
+
+bool queue_list_take(QueueListLog& log, QueueListBatch& batch) {
+    if (log.version == log.announced) return false;
+    batch.from = log.announced;
+    batch.to = log.version;
+    batch.changes.clear();
+    for (const auto& [name, state] : log.pending) {
+        //queue created and deleted again within the batch is left out
+        if (state.first != state.second) {
+            batch.changes.emplace_back(name, state.second);
+        }
+    }
+    log.pending.clear();
+    log.announced = log.version;
+    return true;
+}
+
+void QueueListAnnouncer::start(std::function<void()> broadcast_changes) {
+    if (running.load()) return;
+    broadcast = std::move(broadcast_changes);
+    stopping = false;
+    requested = false;
+    thread = std::thread(&QueueListAnnouncer::loop, this);
+    running = true;
+}
+
+void QueueListAnnouncer::stop() {
+    if (!running.exchange(false)) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+    //changes made while stopping
+    broadcast();
+}
+
+bool QueueListAnnouncer::announce() {
+    if (!running.load()) return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requested = true;
+    }
+    wake.notify_one();
+    return true;
+}
+
+void QueueListAnnouncer::loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&] { return requested || stopping; });
+        if (stopping) break;
+        //rest of a burst joins the batch of its first change
+        wake.wait_for(lock, QUEUE_LIST_COALESCE, [&] { return stopping; });
+        requested = false;
+        lock.unlock();
+        broadcast();
+        lock.lock();
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+// Broker embedded in the test process, for behaviour tests that run real
+// clients against it.
+//
+// Clients reach it over loopback connections (socketpairs, see
+// LoopbackTransport) and, when a port is given, over TCP, which is what
+// clients that reconnect or open several connections need.
+
+#include "MessageQueueClient.h"
+
+#include "broker.h"
+#include "message_operations.h"
+#include "queue_list.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// ------------------------------
+// FIXTURES
+// ------------------------------
+
+class EmbeddedBroker {
+ public:
+    // Starts broker at once, tcp_port empty for loopback connections only.
+    // Queues given exist before the first client logs in.
+    explicit EmbeddedBroker(const std::string &tcp_port = "", const std::vector<std::string> &queues = {}) {
+        for (const std::string &name : queues) add_queue(name);
+        _broker.add_transport(_loopback);
+        if (!tcp_port.empty()) {
+            _tcp = std::make_unique<TcpTransport>(tcp_port);
+            _broker.add_transport(*_tcp);
+        }
+        if (!_broker.start()) {
+            std::cerr << "Can not start broker\n";
+            std::exit(1);
+        }
+    }
+
+    ~EmbeddedBroker() { stop(); }
+
+    EmbeddedBroker(const EmbeddedBroker &) = delete;
+    EmbeddedBroker &operator=(const EmbeddedBroker &) = delete;
+
+    // Closes all connections, like SIGINT does for the server.
+    void stop() {
+        if (!_stopped) {
+            _stopped = true;
+            _broker.request_stop();
+            _broker.wait();
+        }
+    }
+
+    // Logs client in over a new loopback connection.
+    void attach(MessageQueueClient &client) {
+        int sock = _loopback.connect();
+        if (sock == -1 || !client.attach_socket(sock)) {
+            std::cerr << "Can not attach client\n";
+            std::exit(1);
+        }
+    }
+
+    // Client end of a new loopback connection, for tests that speak the protocol themselves.
+    int connect() { return _loopback.connect(); }
+
+    BrokerState &state() { return _broker.broker_state(); }
+
+    // Creates queue the way create_queue does, without a client asking for it.
+    void add_queue(const std::string &name) {
+        BrokerState &broker_state = state();
+        MeteredLock lock(broker_state.queues_mutex);
+        Queue &queue = broker_state.existing_queues[name];
+        queue.name = name;
+        assign_queue_handle(broker_state, queue);
+        queue_list_changed(broker_state.queue_list, name, true);
+    }
+
+    // Subscribers of queue, empty if it does not exist.
+    std::vector<std::string> subscribers(const std::string &name) {
+        BrokerState &broker_state = state();
+        MeteredLock lock(broker_state.queues_mutex);
+        auto it = broker_state.existing_queues.find(name);
+        return it == broker_state.existing_queues.end() ? std::vector<std::string>() : it->second.subscribers;
+    }
+
+ private:
+    LoopbackTransport _loopback;
+    std::unique_ptr<TcpTransport> _tcp;
+    Broker _broker;
+    bool _stopped = false;
+};
+
+// Port no socket listens on right now, for a broker reachable over TCP.
+inline std::string free_tcp_port() {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(addr);
+    if (sock == -1 || bind(sock, reinterpret_cast<sockaddr *>(&addr), size) != 0 ||
+        getsockname(sock, reinterpret_cast<sockaddr *>(&addr), &size) != 0) {
+        std::perror("free_tcp_port");
+        std::exit(1);
+    }
+    close(sock);
+    return std::to_string(ntohs(addr.sin_port));
+}
+
+// Next event of the given type, events of other types are skipped. False if none came in time.
+template <typename Client>
+bool next_event(Client &client, Event::Type type, Event &ev, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (client.poll_event(ev) && ev.type() == type) return true;
+    }
+    return false;
+}
+
+// Waits until condition holds, false if it did not in time.
+template <typename Condition>
+bool eventually(Condition condition, std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
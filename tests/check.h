@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Minimal in-house unit test harness.
+//
+// TEST(name) registers a test body, CHECK and CHECK_EQ report a failed
+// condition with its location and let the test go on, so one run shows
+// every broken case. run_tests() runs the tests whose name contains the
+// optional first argument and returns non-zero if any check failed, which
+// is all ctest looks at.
+namespace check {
+
+struct Test {
+    const char *name;
+    std::function<void()> body;
+};
+
+inline std::vector<Test> &tests() {
+    static std::vector<Test> registered;
+    return registered;
+}
+
+inline size_t &failures() {
+    static size_t count = 0;
+    return count;
+}
+
+struct Registrar {
+    Registrar(const char *name, std::function<void()> body) { tests().push_back({name, std::move(body)}); }
+};
+
+inline void fail(const char *file, int line, const std::string &what) {
+    ++failures();
+    std::cerr << file << ":" << line << ": check failed: " << what << "\n";
+}
+
+inline int run_tests(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : "";
+    size_t run = 0;
+    for (const Test &test : tests()) {
+        if (std::strstr(test.name, filter) == nullptr) continue;
+        size_t before = failures();
+        test.body();
+        ++run;
+        std::cout << (failures() == before ? "[ OK ] " : "[FAIL] ") << test.name << "\n";
+    }
+    std::cout << run << " tests, " << failures() << " failed checks\n";
+    return failures() == 0 ? 0 : 1;
+}
+
+} // namespace check
+
+#define TEST(name)                                                  \
+    static void name();                                             \
+    static const check::Registrar name##_registrar(#name, name);    \
+    static void name()
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) check::fail(__FILE__, __LINE__, #condition);      \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                  \
+    do {                                                                                            \
+        const auto &check_actual_ = (actual);                                                       \
+        const auto &check_expected_ = (expected);                                                   \
+        if (!(check_actual_ == check_expected_)) {                                                  \
+            check::fail(__FILE__, __LINE__, #actual " == " #expected);                              \
+        }                                                                                           \
+    } while (0)
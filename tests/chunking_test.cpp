@@ -0,0 +1,224 @@
+// Unit tests of chunked frames: CK headers, splitting and reassembly.
+
+#include "check.h"
+
+#include "chunking.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace wire;
+
+// ------------------------------
+// HELPERS
+// ------------------------------
+
+// Payload whose bytes depend on their position, so reordered or lost data shows.
+static std::string pattern(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; ++i) data[i] = static_cast<char>(i * 31 + i / 251);
+    return data;
+}
+
+// CK payload of a complete CK frame, as the reader hands it to the assembler.
+static std::string chunk_payload(const std::string &frame, bool compact) {
+    frame_header header;
+    if (decode_header(frame.data(), frame.size(), compact, header) != decode_status::COMPLETE ||
+        header.type() != frame_type::CHUNK || header.size + header.payload_size != frame.size()) {
+        return {};
+    }
+    return frame.substr(header.size);
+}
+
+// CK payload built by hand, for chunks chunk_frames never produces.
+static std::string make_chunk(uint32_t stream_id, uint8_t flags, uint32_t total_size, const std::string &data) {
+    chunk_header header;
+    header.stream_id = stream_id;
+    header.flags = flags;
+    header.code[0] = 'P';
+    header.code[1] = 'B';
+    header.total_size = total_size;
+    char buf[MAX_CHUNK_HEADER_SIZE];
+    return std::string(buf, encode_chunk_header(buf, header)) + data;
+}
+
+// ------------------------------
+// CHUNK HEADER
+// ------------------------------
+
+TEST(chunk_header_round_trips) {
+    chunk_header sent;
+    sent.stream_id = 300;
+    sent.flags = CHUNK_FIRST;
+    sent.code[0] = 'M';
+    sent.code[1] = 'S';
+    sent.total_size = 5 * CHUNK_SIZE;
+
+    char buf[MAX_CHUNK_HEADER_SIZE];
+    size_t written = encode_chunk_header(buf, sent);
+
+    chunk_header received;
+    CHECK(decode_chunk_header(buf, written, received));
+    CHECK_EQ(received.stream_id, sent.stream_id);
+    CHECK_EQ(received.flags, sent.flags);
+    CHECK_EQ(std::string(received.code, 2), std::string("MS"));
+    CHECK_EQ(received.total_size, sent.total_size);
+    CHECK_EQ(received.size, written);
+
+    for (size_t size = 0; size < written; ++size) {
+        CHECK(!decode_chunk_header(buf, size, received));
+    }
+}
+
+TEST(continuation_chunk_header_has_no_type) {
+    chunk_header sent;
+    sent.stream_id = 1;
+    sent.flags = CHUNK_LAST;
+    char buf[MAX_CHUNK_HEADER_SIZE];
+    CHECK_EQ(encode_chunk_header(buf, sent), size_t{2});
+
+    chunk_header received;
+    CHECK(decode_chunk_header(buf, 2, received));
+    CHECK_EQ(received.flags, CHUNK_LAST);
+    CHECK_EQ(received.size, size_t{2});
+}
+
+// ------------------------------
+// SPLIT AND REASSEMBLE
+// ------------------------------
+
+TEST(chunk_frames_reassemble) {
+    for (bool compact : {false, true}) {
+        for (size_t size : {size_t{0}, size_t{1}, CHUNK_SIZE, CHUNK_SIZE + 1, 3 * CHUNK_SIZE + 5}) {
+            std::string payload = pattern(size);
+            std::vector<std::string> frames = chunk_frames(7, 'P', 'B', payload, compact);
+            CHECK_EQ(frames.size(), size == 0 ? size_t{1} : (size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+
+            chunk_assembler assembler;
+            char code[TYPE_SIZE] = {0, 0};
+            std::string out;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                std::string chunk = chunk_payload(frames[i], compact);
+                CHECK(!chunk.empty());
+                auto expected = i + 1 == frames.size() ? chunk_assembler::result::COMPLETE : chunk_assembler::result::INCOMPLETE;
+                CHECK(assembler.feed(chunk, code, out) == expected);
+            }
+            CHECK_EQ(std::string(code, 2), std::string("PB"));
+            CHECK(out == payload);
+        }
+    }
+}
+
+TEST(interleaved_streams_reassemble) {
+    std::string first = pattern(2 * CHUNK_SIZE + 10);
+    std::string second = pattern(3 * CHUNK_SIZE).substr(7);
+    std::vector<std::string> a = chunk_frames(1, 'M', 'S', first, true);
+    std::vector<std::string> b = chunk_frames(2, 'M', 'A', second, true);
+
+    chunk_assembler assembler;
+    char code[TYPE_SIZE] = {0, 0};
+    std::string out;
+    size_t completed = 0;
+    for (size_t i = 0; i < std::max(a.size(), b.size()); ++i) {
+        for (const std::vector<std::string> *frames : {&b, &a}) {
+            if (i >= frames->size()) continue;
+            if (assembler.feed(chunk_payload((*frames)[i], true), code, out) != chunk_assembler::result::COMPLETE) continue;
+            ++completed;
+            if (frames == &a) {
+                CHECK_EQ(std::string(code, 2), std::string("MS"));
+                CHECK(out == first);
+            } else {
+                CHECK_EQ(std::string(code, 2), std::string("MA"));
+                CHECK(out == second);
+            }
+        }
+    }
+    CHECK_EQ(completed, size_t{2});
+}
+
+TEST(stream_id_is_reusable_after_completion) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed(make_chunk(4, CHUNK_FIRST | CHUNK_LAST, 3, "abc"), code, out) == chunk_assembler::result::COMPLETE);
+    CHECK(assembler.feed(make_chunk(4, CHUNK_FIRST | CHUNK_LAST, 2, "de"), code, out) == chunk_assembler::result::COMPLETE);
+    CHECK_EQ(out, std::string("de"));
+}
+
+// ------------------------------
+// ERRORS
+// ------------------------------
+
+TEST(chunk_of_unknown_stream_is_error) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed(make_chunk(9, 0, 0, "abc"), code, out) == chunk_assembler::result::ERROR);
+    CHECK(assembler.feed(make_chunk(9, CHUNK_LAST, 0, "abc"), code, out) == chunk_assembler::result::ERROR);
+}
+
+TEST(malformed_chunk_header_is_error) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed("", code, out) == chunk_assembler::result::ERROR);
+    //first chunk cut inside its frame type
+    CHECK(assembler.feed(std::string("\x01\x01P", 3), code, out) == chunk_assembler::result::ERROR);
+}
+
+TEST(duplicate_first_chunk_is_error_and_drops_stream) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed(make_chunk(1, CHUNK_FIRST, 6, "abc"), code, out) == chunk_assembler::result::INCOMPLETE);
+    CHECK(assembler.feed(make_chunk(1, CHUNK_FIRST, 6, "abc"), code, out) == chunk_assembler::result::ERROR);
+    //the stream is gone, its continuation has nothing to attach to
+    CHECK(assembler.feed(make_chunk(1, CHUNK_LAST, 0, "def"), code, out) == chunk_assembler::result::ERROR);
+}
+
+TEST(data_beyond_total_size_is_error) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed(make_chunk(1, CHUNK_FIRST | CHUNK_LAST, 2, "abc"), code, out) == chunk_assembler::result::ERROR);
+    CHECK(assembler.feed(make_chunk(2, CHUNK_FIRST, 4, "abc"), code, out) == chunk_assembler::result::INCOMPLETE);
+    CHECK(assembler.feed(make_chunk(2, CHUNK_LAST, 0, "de"), code, out) == chunk_assembler::result::ERROR);
+}
+
+TEST(short_last_chunk_is_error) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed(make_chunk(1, CHUNK_FIRST, 10, "abc"), code, out) == chunk_assembler::result::INCOMPLETE);
+    CHECK(assembler.feed(make_chunk(1, CHUNK_LAST, 0, "def"), code, out) == chunk_assembler::result::ERROR);
+}
+
+TEST(oversized_frame_is_error) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    CHECK(assembler.feed(make_chunk(1, CHUNK_FIRST, MAX_CHUNKED_MESSAGE_SIZE + 1, "abc"), code, out) == chunk_assembler::result::ERROR);
+    CHECK(assembler.feed(make_chunk(1, CHUNK_FIRST, MAX_CHUNKED_MESSAGE_SIZE, "abc"), code, out) == chunk_assembler::result::INCOMPLETE);
+}
+
+TEST(too_many_streams_is_error) {
+    chunk_assembler assembler;
+    char code[TYPE_SIZE];
+    std::string out;
+    for (uint32_t id = 0; id < MAX_STREAMS_PER_CONNECTION; ++id) {
+        CHECK(assembler.feed(make_chunk(id, CHUNK_FIRST, 2, "a"), code, out) == chunk_assembler::result::INCOMPLETE);
+    }
+    CHECK(assembler.feed(make_chunk(100, CHUNK_FIRST, 2, "a"), code, out) == chunk_assembler::result::ERROR);
+
+    //completing one stream makes room for another
+    CHECK(assembler.feed(make_chunk(0, CHUNK_LAST, 0, "b"), code, out) == chunk_assembler::result::COMPLETE);
+    CHECK(assembler.feed(make_chunk(100, CHUNK_FIRST, 2, "a"), code, out) == chunk_assembler::result::INCOMPLETE);
+
+    assembler.clear();
+    CHECK(assembler.feed(make_chunk(1, CHUNK_LAST, 0, "b"), code, out) == chunk_assembler::result::ERROR);
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
@@ -0,0 +1,152 @@
+// Unit tests of payload compression with the codecs compiled into this build.
+
+#include "check.h"
+
+#include "compression.h"
+
+#include <string>
+#include <vector>
+
+using namespace wire;
+
+// ------------------------------
+// HELPERS
+// ------------------------------
+
+// Encodings compiled in, a build without codecs tests only the fallbacks.
+static std::vector<encoding> available_encodings() {
+    std::vector<encoding> encodings;
+    for (encoding enc : {encoding::ZLIB, encoding::ZSTD}) {
+        if (available_compression() & encoding_capability(enc)) encodings.push_back(enc);
+    }
+    return encodings;
+}
+
+// Text like payload that compresses well but not to nothing.
+static std::string sample_payload(size_t size) {
+    std::string data;
+    data.reserve(size);
+    for (size_t i = 0; data.size() < size; ++i) data += "{\"id\":" + std::to_string(i) + ",\"queue\":\"orders\"}";
+    data.resize(size);
+    return data;
+}
+
+// ------------------------------
+// ROUND TRIPS
+// ------------------------------
+
+TEST(payloads_round_trip) {
+    for (encoding enc : available_encodings()) {
+        for (size_t size : {size_t{0}, size_t{1}, DEFAULT_COMPRESSION_THRESHOLD, size_t{1} << 20}) {
+            std::string input = sample_payload(size);
+            std::string compressed;
+            CHECK(compress(enc, input, compressed));
+
+            uint32_t raw_size = 0;
+            CHECK(compressed_raw_size(compressed, raw_size));
+            CHECK_EQ(raw_size, static_cast<uint32_t>(size));
+
+            std::string output;
+            CHECK(decompress(enc, compressed, static_cast<uint32_t>(size), output));
+            CHECK(output == input);
+        }
+    }
+}
+
+TEST(compress_appends_to_out) {
+    for (encoding enc : available_encodings()) {
+        std::string input = sample_payload(4096);
+        std::string out = "prefix";
+        CHECK(compress(enc, input, out));
+        CHECK_EQ(out.substr(0, 6), std::string("prefix"));
+        CHECK(out.size() < 6 + input.size());
+
+        std::string output;
+        CHECK(decompress(enc, std::string_view(out).substr(6), 4096, output));
+        CHECK(output == input);
+    }
+}
+
+TEST(compressed_size_stays_within_decompression_bound) {
+    for (encoding enc : available_encodings()) {
+        //the best ratio a codec reaches, the bound must still allow it
+        std::string zeros(16u << 20, '\0');
+        std::string compressed;
+        CHECK(compress(enc, zeros, compressed));
+        uint32_t raw_size = 0;
+        CHECK(compressed_raw_size(compressed, raw_size));
+        CHECK(raw_size <= max_decompressed_size(enc, compressed.size()));
+    }
+    CHECK_EQ(max_decompressed_size(encoding::NONE, 100), uint64_t{100});
+}
+
+// ------------------------------
+// REJECTED INPUT
+// ------------------------------
+
+TEST(raw_size_above_max_is_rejected) {
+    for (encoding enc : available_encodings()) {
+        std::string input = sample_payload(10000);
+        std::string compressed;
+        CHECK(compress(enc, input, compressed));
+        std::string output;
+        CHECK(!decompress(enc, compressed, 9999, output));
+    }
+}
+
+TEST(wrong_raw_size_is_rejected) {
+    for (encoding enc : available_encodings()) {
+        std::string input = sample_payload(10000);
+        std::string compressed;
+        CHECK(compress(enc, input, compressed));
+
+        //same data claiming a larger and a smaller RAW_SIZE
+        size_t offset = 0;
+        uint32_t raw_size = 0;
+        CHECK(read_varint(compressed, offset, raw_size) == decode_status::COMPLETE);
+        std::string data = compressed.substr(offset);
+        for (uint32_t claimed : {raw_size + 1, raw_size - 1}) {
+            char buf[MAX_VARINT_SIZE];
+            std::string forged(buf, write_varint(buf, claimed));
+            forged += data;
+            std::string output;
+            CHECK(!decompress(enc, forged, 1u << 20, output));
+        }
+    }
+}
+
+TEST(corrupt_data_is_rejected) {
+    for (encoding enc : available_encodings()) {
+        std::string compressed;
+        CHECK(compress(enc, sample_payload(10000), compressed));
+        std::string output;
+        //truncated
+        CHECK(!decompress(enc, std::string_view(compressed).substr(0, compressed.size() / 2), 1u << 20, output));
+        //garbage after a valid RAW_SIZE
+        char buf[MAX_VARINT_SIZE];
+        std::string garbage(buf, write_varint(buf, 10000));
+        garbage += std::string(64, '\x5A');
+        CHECK(!decompress(enc, garbage, 1u << 20, output));
+    }
+    std::string output;
+    CHECK(!decompress(encoding::ZLIB, "", 1u << 20, output));
+}
+
+TEST(missing_codec_is_rejected) {
+    std::string out = "kept";
+    CHECK(!compress(encoding::NONE, "data", out));
+    CHECK_EQ(out, std::string("kept"));
+    std::string output;
+    CHECK(!decompress(encoding::NONE, std::string("\x04" "data", 5), 100, output));
+}
+
+TEST(preferred_encoding_follows_capabilities) {
+    CHECK(preferred_encoding(0) == encoding::NONE);
+    CHECK(preferred_encoding(CAP_COMPRESSION_ZLIB) == encoding::ZLIB);
+    CHECK(preferred_encoding(CAP_COMPRESSION_ANY) == encoding::ZSTD);
+    CHECK_EQ(encoding_capability(encoding::NONE), 0u);
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
@@ -0,0 +1,88 @@
+// Behaviour tests of publish fan-out by the worker pool against an embedded
+// broker: every subscriber receives the messages of a queue in publish
+// order, however the workers split and steal the subscriber chunks.
+
+#include "check.h"
+
+#include "broker_fixture.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Messages a subscriber received, in arrival order per queue.
+struct Received {
+    std::map<std::string, std::vector<std::string>> by_queue;
+    size_t count = 0;
+};
+
+static void collect(MessageQueueClient &client, size_t expected, Received &received) {
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    Event ev;
+    while (received.count < expected && std::chrono::steady_clock::now() < deadline) {
+        if (!client.poll_event(ev) || ev.type() != Event::Type::Message) continue;
+        received.by_queue[ev.source()].push_back(ev.text());
+        ++received.count;
+    }
+}
+
+TEST(every_subscriber_gets_each_queue_in_publish_order) {
+    //chunks of one publish run on several workers and get stolen
+    setenv("MQ_FANOUT_WORKERS", "4", 1);
+    EmbeddedBroker broker;
+    CHECK(broker.state().fanout.running());
+
+    const std::vector<std::string> queues = {"fanout_a", "fanout_b"};
+    MessageQueueClient publisher("fanout-publisher");
+    broker.attach(publisher);
+    for (const std::string &name : queues) CHECK(publisher.create_queue_async(name).wait().ok);
+
+    //several chunks per publish
+    const size_t subscriber_count = 3 * FANOUT_CHUNK_SUBSCRIBERS + 5;
+    std::vector<std::unique_ptr<MessageQueueClient>> subscribers;
+    for (size_t i = 0; i < subscriber_count; ++i) {
+        subscribers.push_back(std::make_unique<MessageQueueClient>("fanout-subscriber" + std::to_string(i)));
+        broker.attach(*subscribers.back());
+        for (const std::string &name : queues) CHECK(subscribers.back()->subscribe_async(name).wait().ok);
+    }
+    //all publishes below are fanned out as MS, none is part of a backlog
+    for (const std::string &name : queues) {
+        CHECK(eventually([&] { return broker.subscribers(name).size() == subscriber_count; }));
+    }
+
+    const size_t per_queue = 300;
+    std::vector<Received> received(subscriber_count);
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < subscriber_count; ++i) {
+        readers.emplace_back(collect, std::ref(*subscribers[i]), per_queue * queues.size(), std::ref(received[i]));
+    }
+    for (size_t i = 0; i < per_queue; ++i) {
+        for (const std::string &name : queues) CHECK(publisher.publish(name, name + ":" + std::to_string(i), 60));
+    }
+    for (std::thread &reader : readers) reader.join();
+
+    for (const Received &subscriber : received) {
+        CHECK_EQ(subscriber.count, per_queue * queues.size());
+        for (const std::string &name : queues) {
+            const std::vector<std::string> &messages = subscriber.by_queue.at(name);
+            bool ordered = messages.size() == per_queue;
+            for (size_t i = 0; ordered && i < per_queue; ++i) {
+                ordered = messages[i] == name + ":" + std::to_string(i);
+            }
+            CHECK(ordered);
+        }
+    }
+
+    for (auto &subscriber : subscribers) subscriber->disconnect();
+    publisher.disconnect();
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
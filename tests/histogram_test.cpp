@@ -0,0 +1,140 @@
+// Unit tests of the latency histogram: bucket layout, recording and snapshots.
+
+#include "check.h"
+
+#include "metrics.h"
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using metrics::Histogram;
+
+// ------------------------------
+// BUCKETS
+// ------------------------------
+
+TEST(small_values_have_exact_buckets) {
+    for (uint64_t ns = 0; ns < Histogram::SUB_BUCKETS; ++ns) {
+        size_t bucket = Histogram::bucket_of(ns);
+        CHECK_EQ(bucket, static_cast<size_t>(ns));
+        CHECK_EQ(Histogram::bucket_lower(bucket), ns);
+        CHECK_EQ(Histogram::bucket_upper(bucket), ns);
+    }
+}
+
+TEST(buckets_tile_the_value_range) {
+    CHECK_EQ(Histogram::bucket_lower(0), uint64_t{0});
+    for (size_t bucket = 0; bucket + 1 < Histogram::BUCKET_COUNT; ++bucket) {
+        uint64_t lower = Histogram::bucket_lower(bucket);
+        uint64_t upper = Histogram::bucket_upper(bucket);
+        CHECK(lower <= upper);
+        //next bucket starts right after this one ends, no gaps or overlaps
+        CHECK_EQ(Histogram::bucket_lower(bucket + 1), upper + 1);
+        CHECK_EQ(Histogram::bucket_of(lower), bucket);
+        CHECK_EQ(Histogram::bucket_of(upper), bucket);
+    }
+    CHECK_EQ(Histogram::bucket_of(UINT64_MAX), Histogram::BUCKET_COUNT - 1);
+    CHECK_EQ(Histogram::bucket_upper(Histogram::BUCKET_COUNT - 1), UINT64_MAX);
+}
+
+TEST(bucket_width_is_within_relative_error) {
+    for (size_t bucket = Histogram::SUB_BUCKETS; bucket < Histogram::BUCKET_COUNT; ++bucket) {
+        uint64_t lower = Histogram::bucket_lower(bucket);
+        uint64_t width = Histogram::bucket_upper(bucket) - lower + 1;
+        //width at most lower / 16, every value is reported within 6.25%
+        CHECK(width * Histogram::SUB_BUCKETS <= lower);
+    }
+}
+
+TEST(bucket_of_is_monotonic) {
+    size_t previous = 0;
+    for (uint64_t ns = 1; ns < (uint64_t{1} << 62); ns += ns / 7 + 1) {
+        size_t bucket = Histogram::bucket_of(ns);
+        CHECK(bucket >= previous);
+        CHECK(Histogram::bucket_lower(bucket) <= ns && ns <= Histogram::bucket_upper(bucket));
+        previous = bucket;
+    }
+}
+
+// ------------------------------
+// SNAPSHOT
+// ------------------------------
+
+TEST(snapshot_of_empty_histogram) {
+    auto histogram = std::make_unique<Histogram>();
+    Histogram::Snapshot snap = histogram->snapshot();
+    CHECK_EQ(snap.counts.size(), Histogram::BUCKET_COUNT);
+    CHECK_EQ(snap.count, uint64_t{0});
+    CHECK_EQ(snap.sum, uint64_t{0});
+    CHECK_EQ(snap.max, uint64_t{0});
+    CHECK_EQ(snap.percentile(0.99), uint64_t{0});
+    CHECK_EQ(snap.count_at_most(UINT64_MAX), uint64_t{0});
+}
+
+TEST(snapshot_counts_sum_and_max) {
+    auto histogram = std::make_unique<Histogram>();
+    //1..1000 microseconds
+    uint64_t sum = 0;
+    for (uint64_t us = 1; us <= 1000; ++us) {
+        histogram->record(us * 1000);
+        sum += us * 1000;
+    }
+    Histogram::Snapshot snap = histogram->snapshot();
+    CHECK_EQ(snap.count, uint64_t{1000});
+    CHECK_EQ(snap.sum, sum);
+    CHECK_EQ(snap.max, uint64_t{1000000});
+
+    uint64_t buckets = 0;
+    for (uint64_t c : snap.counts) buckets += c;
+    CHECK_EQ(buckets, uint64_t{1000});
+}
+
+TEST(percentiles_are_bucket_upper_bounds) {
+    auto histogram = std::make_unique<Histogram>();
+    for (uint64_t us = 1; us <= 1000; ++us) histogram->record(us * 1000);
+    Histogram::Snapshot snap = histogram->snapshot();
+
+    for (double q : {0.5, 0.9, 0.99}) {
+        uint64_t exact = static_cast<uint64_t>(q * 1000) * 1000;
+        uint64_t reported = snap.percentile(q);
+        CHECK(reported >= exact);
+        CHECK(reported - exact <= exact / Histogram::SUB_BUCKETS);
+    }
+    //never above the largest recorded value
+    CHECK_EQ(snap.percentile(1.0), snap.max);
+    CHECK_EQ(snap.percentile(0.0), Histogram::bucket_upper(Histogram::bucket_of(1000)));
+}
+
+TEST(count_at_most_uses_bucket_resolution) {
+    auto histogram = std::make_unique<Histogram>();
+    for (uint64_t ns : {5, 100, 100, 1000, 1000000}) histogram->record(ns);
+    Histogram::Snapshot snap = histogram->snapshot();
+    CHECK_EQ(snap.count_at_most(4), uint64_t{0});
+    CHECK_EQ(snap.count_at_most(5), uint64_t{1});
+    CHECK_EQ(snap.count_at_most(100), uint64_t{3});
+    CHECK_EQ(snap.count_at_most(500000), uint64_t{4});
+    CHECK_EQ(snap.count_at_most(UINT64_MAX), uint64_t{5});
+}
+
+TEST(records_from_many_threads_are_merged) {
+    auto histogram = std::make_unique<Histogram>();
+    std::vector<std::thread> threads;
+    for (uint64_t t = 1; t <= 8; ++t) {
+        threads.emplace_back([&histogram, t] {
+            for (int i = 0; i < 10000; ++i) histogram->record(t);
+        });
+    }
+    for (std::thread &thread : threads) thread.join();
+
+    Histogram::Snapshot snap = histogram->snapshot();
+    CHECK_EQ(snap.count, uint64_t{80000});
+    CHECK_EQ(snap.sum, uint64_t{10000 * 36});
+    CHECK_EQ(snap.max, uint64_t{8});
+    for (uint64_t t = 1; t <= 8; ++t) CHECK_EQ(snap.counts[t], uint64_t{10000});
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
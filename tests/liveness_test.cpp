@@ -0,0 +1,125 @@
+// Behaviour tests of connection liveness against an embedded broker: a
+// logged in connection that stays silent gets a heartbeat after
+// HEARTBEAT_INTERVAL and is closed after CLIENT_READ_TIMEOUT, a client that
+// answers heartbeats stays connected.
+//
+// The intervals are the broker's own, so this test runs in real time for
+// about CLIENT_READ_TIMEOUT seconds; the connections are watched in parallel.
+
+#include "check.h"
+
+#include "broker_fixture.h"
+#include "protocol_handler.h"
+
+#include <chrono>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Frame received on a raw connection and when, counted from the start of the watch.
+struct Arrival {
+    std::string code;
+    std::chrono::steady_clock::duration at;
+};
+
+// What a raw connection received until the broker closed it.
+struct Watch {
+    std::vector<Arrival> frames;
+    bool closed = false;
+    std::chrono::steady_clock::duration closed_at{};
+
+    bool got(const std::string &code) const {
+        for (const Arrival &frame : frames) {
+            if (frame.code == code) return true;
+        }
+        return false;
+    }
+};
+
+// Reads legacy frames from sock until it is closed or timeout passed.
+static void watch(int sock, std::chrono::steady_clock::time_point start, std::chrono::seconds timeout, Watch &result) {
+    std::string buffer;
+    while (std::chrono::steady_clock::now() - start < timeout) {
+        pollfd pfd{sock, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        char chunk[4096];
+        ssize_t n = recv(sock, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            result.closed = true;
+            result.closed_at = std::chrono::steady_clock::now() - start;
+            return;
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+        wire::frame_header header;
+        while (wire::decode_header(buffer.data(), buffer.size(), false, header) == wire::decode_status::COMPLETE &&
+               buffer.size() >= header.size + header.payload_size) {
+            result.frames.push_back({std::string(header.code, wire::TYPE_SIZE), std::chrono::steady_clock::now() - start});
+            buffer.erase(0, header.size + header.payload_size);
+        }
+    }
+}
+
+static bool send_all(int sock, const std::string &data) {
+    return send(sock, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size());
+}
+
+TEST(silent_connections_get_heartbeats_then_time_out) {
+    EmbeddedBroker broker;
+    uint64_t heartbeats = metrics::broker().heartbeats_sent.value();
+    uint64_t timeouts = metrics::broker().idle_timeouts.value();
+
+    //logged in and never answering
+    int silent = broker.connect();
+    //never logging in, only the timeout applies
+    int anonymous = broker.connect();
+    CHECK(silent != -1 && anonymous != -1);
+    auto start = std::chrono::steady_clock::now();
+    CHECK(send_all(silent, prepare_message(message_type::LOGIN, "liveness-silent")));
+
+    //answers heartbeats like every client does
+    MessageQueueClient answering("liveness-answering");
+    broker.attach(answering);
+
+    //the wheel counts whole seconds of its own tick, so limits may pass up to a second early
+    auto heartbeat_after = std::chrono::seconds(HEARTBEAT_INTERVAL - 1);
+    auto timeout_after = std::chrono::seconds(CLIENT_READ_TIMEOUT - 1);
+    Watch silent_watch;
+    Watch anonymous_watch;
+    auto timeout = std::chrono::seconds(CLIENT_READ_TIMEOUT + 5);
+    std::thread silent_reader(watch, silent, start, timeout, std::ref(silent_watch));
+    std::thread anonymous_reader(watch, anonymous, start, timeout, std::ref(anonymous_watch));
+    silent_reader.join();
+    anonymous_reader.join();
+
+    CHECK(silent_watch.got("LO"));
+    CHECK(silent_watch.got("HB"));
+    for (const Arrival &frame : silent_watch.frames) {
+        if (frame.code == "HB") CHECK(frame.at >= heartbeat_after);
+    }
+    CHECK(silent_watch.closed);
+    CHECK(silent_watch.closed_at >= timeout_after);
+
+    CHECK(!anonymous_watch.got("HB"));
+    CHECK(anonymous_watch.closed);
+    CHECK(anonymous_watch.closed_at >= timeout_after);
+
+    //heartbeat answers count as traffic
+    CHECK(answering.is_connected());
+    CHECK(answering.create_queue_async("liveness_alive").wait().ok);
+
+    CHECK(metrics::broker().heartbeats_sent.value() >= heartbeats + 2);
+    CHECK(metrics::broker().idle_timeouts.value() >= timeouts + 2);
+
+    answering.disconnect();
+    close(silent);
+    close(anonymous);
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
@@ -0,0 +1,88 @@
+// Behaviour tests of MessageQueuePool against an embedded broker over TCP:
+// every queue is served by the connection connection_for() names, and
+// messages of one queue keep their order while the events of all
+// connections are merged into one stream.
+
+#include "check.h"
+
+#include "broker_fixture.h"
+#include "MessageQueuePool.h"
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static std::vector<std::string> queue_names(size_t count) {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < count; ++i) names.push_back("pool_queue" + std::to_string(i));
+    return names;
+}
+
+TEST(requests_for_a_queue_use_its_connection) {
+    std::string port = free_tcp_port();
+    EmbeddedBroker broker(port, queue_names(12));
+
+    MessageQueuePool pool("pool-test", 3);
+    CHECK(pool.connect_to_server("127.0.0.1", port));
+    CHECK_EQ(pool.size(), size_t{3});
+
+    std::set<size_t> used;
+    for (const std::string &name : queue_names(12)) {
+        size_t connection = pool.connection_for(name);
+        CHECK(connection < pool.size());
+        CHECK_EQ(pool.connection_for(name), connection);
+        used.insert(connection);
+
+        //the broker sees the subscriber logged in on that connection, it is added right after SS:OK
+        CHECK(pool.subscribe_async(name).wait().ok);
+        std::vector<std::string> expected{"pool-test#" + std::to_string(connection)};
+        CHECK(eventually([&] { return broker.subscribers(name) == expected; }));
+    }
+    //twelve queues spread over more than one connection
+    CHECK(used.size() > 1);
+    pool.disconnect();
+}
+
+TEST(messages_of_each_queue_keep_their_order) {
+    std::string port = free_tcp_port();
+    std::vector<std::string> queues = queue_names(4);
+    EmbeddedBroker broker(port, queues);
+
+    MessageQueuePool pool("pool-order", 3);
+    CHECK(pool.connect_to_server("127.0.0.1", port));
+    for (const std::string &name : queues) {
+        CHECK(pool.subscribe_async(name).wait().ok);
+        //every publish below is then an MS, not part of a backlog
+        CHECK(eventually([&] { return broker.subscribers(name).size() == 1; }));
+    }
+
+    //interleaved publishes, each queue on its own connection
+    const int per_queue = 200;
+    for (int i = 0; i < per_queue; ++i) {
+        for (const std::string &name : queues) CHECK(pool.publish(name, std::to_string(i), 60));
+    }
+
+    std::map<std::string, int> next;
+    size_t received = 0;
+    bool ordered = true;
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    Event ev;
+    while (received < queues.size() * per_queue && std::chrono::steady_clock::now() < deadline) {
+        if (!pool.poll_event(ev) || ev.type() != Event::Type::Message) continue;
+        ordered = ordered && ev.text() == std::to_string(next[ev.source()]);
+        ++next[ev.source()];
+        ++received;
+    }
+    CHECK(ordered);
+    CHECK_EQ(received, queues.size() * per_queue);
+    for (const std::string &name : queues) CHECK_EQ(next[name], per_queue);
+    pool.disconnect();
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
@@ -0,0 +1,111 @@
+// Behaviour tests of queue list prefix filters against an embedded broker:
+// a filtered client only gets lists of matching queues and only when one
+// of them changed, a client that opted out gets no lists at all.
+
+#include "check.h"
+
+#include "broker_fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static std::vector<std::string> sorted_items(const Event &ev) {
+    std::vector<std::string> items = ev.items();
+    std::sort(items.begin(), items.end());
+    return items;
+}
+
+// Waits for a list equal to expected, every queue named in the lists on the way is added to seen.
+static bool list_becomes(MessageQueueClient &client, const std::vector<std::string> &expected, std::vector<std::string> &seen) {
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+    Event ev;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!client.poll_event(ev) || ev.type() != Event::Type::QueueList) continue;
+        std::vector<std::string> queues = sorted_items(ev);
+        seen.insert(seen.end(), queues.begin(), queues.end());
+        if (queues == expected) return true;
+    }
+    return false;
+}
+
+// Whether any list reached client within timeout.
+static bool queue_list_arrives(MessageQueueClient &client, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    Event ev;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (client.poll_event(ev) && ev.type() == Event::Type::QueueList) return true;
+    }
+    return false;
+}
+
+TEST(filtered_client_gets_only_matching_queues) {
+    EmbeddedBroker broker("", {"orders_eu", "payments"});
+
+    MessageQueueClient filtered("filter-orders");
+    filtered.set_queue_list_filter({"orders_"});
+    broker.attach(filtered);
+    std::vector<std::string> seen;
+    CHECK(list_becomes(filtered, {"orders_eu"}, seen));
+
+    MessageQueueClient admin("filter-admin");
+    broker.attach(admin);
+    CHECK(admin.create_queue_async("orders_us").wait().ok);
+    CHECK(admin.create_queue_async("payments_x").wait().ok);
+    //the two creates may come in one list or two
+    CHECK(list_becomes(filtered, {"orders_eu", "orders_us"}, seen));
+    for (const std::string &name : seen) CHECK(name.rfind("orders_", 0) == 0);
+
+    //a change no prefix matches is not sent, the admin sees it
+    CHECK(admin.create_queue_async("refunds").wait().ok);
+    CHECK(eventually([&] {
+        std::vector<std::string> all = admin.get_available_queues();
+        return std::find(all.begin(), all.end(), "refunds") != all.end();
+    }));
+    CHECK(!queue_list_arrives(filtered, 500ms));
+    std::vector<std::string> cached = filtered.get_available_queues();
+    std::sort(cached.begin(), cached.end());
+    CHECK(cached == (std::vector<std::string>{"orders_eu", "orders_us"}));
+
+    admin.disconnect();
+    filtered.disconnect();
+}
+
+TEST(opted_out_client_gets_no_lists) {
+    EmbeddedBroker broker("", {"orders_eu"});
+
+    MessageQueueClient producer("filter-producer");
+    producer.set_queue_list_filter({});
+    broker.attach(producer);
+
+    MessageQueueClient admin("filter-admin");
+    broker.attach(admin);
+    CHECK(admin.create_queue_async("orders_us").wait().ok);
+    CHECK(admin.delete_queue_async("orders_eu").wait().ok);
+
+    //still publishes, just without lists
+    CHECK(producer.publish_async("orders_us", "order", 60).wait().ok);
+    CHECK(!queue_list_arrives(producer, 500ms));
+    CHECK(producer.get_available_queues().empty());
+
+    admin.disconnect();
+    producer.disconnect();
+}
+
+TEST(empty_prefix_matches_every_queue) {
+    EmbeddedBroker broker("", {"orders_eu", "payments"});
+
+    MessageQueueClient everything("filter-everything");
+    everything.set_queue_list_filter({""});
+    broker.attach(everything);
+    std::vector<std::string> seen;
+    CHECK(list_becomes(everything, {"orders_eu", "payments"}, seen));
+    everything.disconnect();
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
@@ -0,0 +1,288 @@
+// Unit tests of queue list versions: net changes on the broker, QD frames
+// built from them and their application by the client.
+//
+// The client side runs a MessageQueueClient attached to a socketpair whose
+// far end plays the server, so the frames the broker builds are applied by
+// the real client code and checked through its QueueList events.
+
+#include "check.h"
+
+#include "MessageQueueClient.h"
+
+#include "common.h"
+#include "message_operations.h"
+#include "protocol_handler.h"
+#include "queue_list.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// ------------------------------
+// FIXTURES
+// ------------------------------
+
+// Client logged in over a socketpair, the test writes server frames to the far end.
+class AttachedClient {
+ public:
+    MessageQueueClient client{"queue-list-test"};
+
+    AttachedClient() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            std::perror("socketpair");
+            std::exit(1);
+        }
+        _far = fds[1];
+        //login reply is waiting before the client asks
+        write(prepare_message(message_type::LOGIN, "OK:LOGGED"));
+        if (!client.attach_socket(fds[0])) {
+            std::cerr << "Can not attach client\n";
+            std::exit(1);
+        }
+    }
+
+    ~AttachedClient() {
+        client.disconnect();
+        close(_far);
+    }
+
+    AttachedClient(const AttachedClient &) = delete;
+    AttachedClient &operator=(const AttachedClient &) = delete;
+
+    void write(const std::string &frame) {
+        size_t sent = 0;
+        while (sent < frame.size()) {
+            ssize_t n = send(_far, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) std::exit(1);
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    // Next QueueList event with its queues sorted, false if none came in time.
+    bool next_queue_list(std::vector<std::string> &queues) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        Event ev;
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (client.poll_event(ev) && ev.type() == Event::Type::QueueList) {
+                queues = ev.items();
+                std::sort(queues.begin(), queues.end());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether the client sent a frame of the given type, reads everything it sent so far.
+    bool sent_frame(const char (&code)[3]) {
+        while (true) {
+            pollfd pfd{_far, POLLIN, 0};
+            if (poll(&pfd, 1, 500) <= 0) break;
+            char buf[4096];
+            ssize_t n = recv(_far, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            _received.append(buf, static_cast<size_t>(n));
+        }
+        //client frames use the legacy header, no compact framing was negotiated
+        size_t offset = 0;
+        wire::frame_header header;
+        while (wire::decode_header(_received.data() + offset, _received.size() - offset, false, header) == wire::decode_status::COMPLETE) {
+            if (header.code[0] == code[0] && header.code[1] == code[1]) return true;
+            offset += header.size + header.payload_size;
+        }
+        return false;
+    }
+
+ private:
+    int _far = -1;
+    std::string _received;
+};
+
+// Creates or deletes a queue the way create_queue and delete_queue record it.
+static void change_queue(BrokerState &state, const std::string &name, bool added) {
+    MeteredLock lock(state.queues_mutex);
+    if (added) {
+        Queue &queue = state.existing_queues[name];
+        queue.name = name;
+        assign_queue_handle(state, queue);
+    } else {
+        auto it = state.existing_queues.find(name);
+        release_queue_handle(state, it->second.handle);
+        state.existing_queues.erase(it);
+    }
+    queue_list_changed(state.queue_list, name, added);
+}
+
+static QueueListBatch take_batch(BrokerState &state) {
+    QueueListBatch batch;
+    MeteredLock lock(state.queues_mutex);
+    queue_list_take(state.queue_list, batch);
+    return batch;
+}
+
+static std::vector<std::pair<std::string, bool>> sorted(std::vector<std::pair<std::string, bool>> changes) {
+    std::sort(changes.begin(), changes.end());
+    return changes;
+}
+
+// ------------------------------
+// BROKER
+// ------------------------------
+
+TEST(every_change_is_a_new_version) {
+    QueueListLog log;
+    queue_list_changed(log, "a", true);
+    queue_list_changed(log, "b", true);
+    queue_list_changed(log, "a", false);
+    CHECK_EQ(log.version, 3u);
+    CHECK_EQ(log.announced, 0u);
+}
+
+TEST(take_returns_net_changes) {
+    QueueListLog log;
+    QueueListBatch batch;
+    CHECK(!queue_list_take(log, batch));
+
+    queue_list_changed(log, "kept", true);
+    queue_list_changed(log, "temporary", true);
+    queue_list_changed(log, "temporary", false);
+    CHECK(queue_list_take(log, batch));
+    CHECK_EQ(batch.from, 0u);
+    CHECK_EQ(batch.to, 3u);
+    CHECK(sorted(batch.changes) == (std::vector<std::pair<std::string, bool>>{{"kept", true}}));
+
+    //recreated within a batch: existed before and after, no change
+    queue_list_changed(log, "kept", false);
+    queue_list_changed(log, "kept", true);
+    queue_list_changed(log, "gone", false);
+    CHECK(queue_list_take(log, batch));
+    CHECK_EQ(batch.from, 3u);
+    CHECK_EQ(batch.to, 6u);
+    CHECK(sorted(batch.changes) == (std::vector<std::pair<std::string, bool>>{{"gone", false}}));
+
+    CHECK(!queue_list_take(log, batch));
+    CHECK_EQ(log.announced, 6u);
+}
+
+TEST(delta_frame_layout) {
+    QueueListBatch batch;
+    batch.from = 4;
+    batch.to = 9;
+    batch.changes = {{"ab", true}, {"c", false}};
+    std::string frame = construct_queue_delta(batch);
+
+    wire::frame_header header;
+    CHECK(wire::decode_header(frame.data(), frame.size(), false, header) == wire::decode_status::COMPLETE);
+    CHECK(header.type() == wire::frame_type::QUEUE_LIST_DELTA);
+    CHECK_EQ(header.size + header.payload_size, frame.size());
+
+    const char *payload = frame.data() + header.size;
+    CHECK_EQ(wire::read_u32(payload), 4u);
+    CHECK_EQ(wire::read_u32(payload + 4), 9u);
+    CHECK_EQ(wire::read_u32(payload + 8), 2u);
+    CHECK_EQ(payload[12], wire::QUEUE_ADDED);
+    CHECK_EQ(wire::read_u32(payload + 13), 2u);
+    CHECK_EQ(std::string(payload + 17, 2), std::string("ab"));
+    CHECK_EQ(payload[19], wire::QUEUE_REMOVED);
+    CHECK_EQ(wire::read_u32(payload + 20), 1u);
+    CHECK_EQ(std::string(payload + 24, 1), std::string("c"));
+    CHECK_EQ(header.payload_size, 25u);
+}
+
+// ------------------------------
+// CLIENT
+// ------------------------------
+
+TEST(client_applies_delta_to_snapshot) {
+    BrokerState state;
+    change_queue(state, "orders", true);
+    change_queue(state, "payments", true);
+    take_batch(state);
+
+    AttachedClient fixture;
+    uint32_t version = 0;
+    fixture.write(construct_queue_snapshot(state, false, version));
+    CHECK_EQ(version, 2u);
+    std::vector<std::string> queues;
+    CHECK(fixture.next_queue_list(queues));
+    CHECK(queues == (std::vector<std::string>{"orders", "payments"}));
+
+    change_queue(state, "orders", false);
+    change_queue(state, "refunds", true);
+    change_queue(state, "temporary", true);
+    change_queue(state, "temporary", false);
+    fixture.write(construct_queue_delta(take_batch(state)));
+    CHECK(fixture.next_queue_list(queues));
+    CHECK(queues == (std::vector<std::string>{"payments", "refunds"}));
+    CHECK(fixture.client.get_available_queues().size() == 2);
+}
+
+TEST(client_ignores_delta_it_already_has) {
+    BrokerState state;
+    change_queue(state, "orders", true);
+    QueueListBatch first = take_batch(state);
+
+    AttachedClient fixture;
+    uint32_t version = 0;
+    fixture.write(construct_queue_snapshot(state, false, version));
+    std::vector<std::string> queues;
+    CHECK(fixture.next_queue_list(queues));
+
+    //changes up to the snapshot version are already in the list
+    fixture.write(construct_queue_delta(first));
+    change_queue(state, "payments", true);
+    fixture.write(construct_queue_delta(take_batch(state)));
+    //the next event is the newer delta, the stale one made none
+    CHECK(fixture.next_queue_list(queues));
+    CHECK(queues == (std::vector<std::string>{"orders", "payments"}));
+}
+
+TEST(client_ignores_delta_before_snapshot) {
+    BrokerState state;
+    change_queue(state, "orders", true);
+
+    AttachedClient fixture;
+    fixture.write(construct_queue_delta(take_batch(state)));
+    uint32_t version = 0;
+    fixture.write(construct_queue_snapshot(state, false, version));
+    std::vector<std::string> queues;
+    CHECK(fixture.next_queue_list(queues));
+    CHECK(queues == (std::vector<std::string>{"orders"}));
+    CHECK(!fixture.sent_frame("QL"));
+}
+
+TEST(client_asks_for_snapshot_after_gap) {
+    BrokerState state;
+    change_queue(state, "orders", true);
+    take_batch(state);
+
+    AttachedClient fixture;
+    uint32_t version = 0;
+    fixture.write(construct_queue_snapshot(state, false, version));
+    std::vector<std::string> queues;
+    CHECK(fixture.next_queue_list(queues));
+    CHECK(!fixture.sent_frame("QL"));
+
+    //version 2 is lost, the delta from 2 to 3 can not be applied
+    change_queue(state, "lost", true);
+    take_batch(state);
+    change_queue(state, "payments", true);
+    fixture.write(construct_queue_delta(take_batch(state)));
+    CHECK(fixture.sent_frame("QL"));
+
+    //the answer to QL is a snapshot, the first event after the gap
+    fixture.write(construct_queue_snapshot(state, false, version));
+    CHECK(fixture.next_queue_list(queues));
+    CHECK(queues == (std::vector<std::string>{"lost", "orders", "payments"}));
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
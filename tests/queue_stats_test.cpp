@@ -0,0 +1,100 @@
+// Behaviour tests of QS per-queue statistics against an embedded broker:
+// the values a client reads with queue_stats() follow publishes,
+// subscriptions, deliveries and message expiry.
+
+#include "check.h"
+
+#include "broker_fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Statistics of one queue, a default entry with empty name if the request failed.
+static QueueStats stats_of(MessageQueueClient &client, const std::string &queue) {
+    std::vector<QueueStats> stats;
+    if (!client.queue_stats(queue, stats) || stats.size() != 1) return QueueStats();
+    return stats.front();
+}
+
+TEST(stats_follow_publishes_subscribers_and_deliveries) {
+    EmbeddedBroker broker;
+    MessageQueueClient client("stats-test");
+    MessageQueueClient subscriber("stats-subscriber");
+    broker.attach(client);
+    broker.attach(subscriber);
+
+    CHECK(client.create_queue_async("stats_orders").wait().ok);
+    QueueStats empty = stats_of(client, "stats_orders");
+    CHECK_EQ(empty.name, std::string("stats_orders"));
+    CHECK_EQ(empty.depth, 0u);
+    CHECK_EQ(empty.retained_bytes, 0u);
+    CHECK_EQ(empty.subscribers, 0u);
+    CHECK_EQ(empty.oldest_age_ms, 0u);
+
+    CHECK(subscriber.subscribe_async("stats_orders").wait().ok);
+    CHECK(eventually([&] { return broker.subscribers("stats_orders").size() == 1; }));
+    CHECK(client.publish_async("stats_orders", "aaa", 60).wait().ok);
+    CHECK(client.publish_async("stats_orders", "bbbb", 60).wait().ok);
+    CHECK(client.publish_async("stats_orders", "cc", 60).wait().ok);
+
+    //delivered is counted once the subscriber was sent the message
+    CHECK(eventually([&] { return stats_of(client, "stats_orders").delivered == 3; }));
+    std::this_thread::sleep_for(50ms);
+    QueueStats stats = stats_of(client, "stats_orders");
+    CHECK_EQ(stats.depth, 3u);
+    CHECK_EQ(stats.retained_bytes, 9u);
+    CHECK_EQ(stats.subscribers, 1u);
+    CHECK_EQ(stats.published, 3u);
+    CHECK(stats.oldest_age_ms >= 50);
+    CHECK(stats.publish_rate > 0);
+
+    client.disconnect();
+    subscriber.disconnect();
+}
+
+TEST(expired_messages_leave_depth_and_bytes) {
+    EmbeddedBroker broker;
+    MessageQueueClient client("stats-expiry");
+    broker.attach(client);
+
+    CHECK(client.create_queue_async("stats_expiring").wait().ok);
+    CHECK(client.publish_async("stats_expiring", "short", 1).wait().ok);
+    CHECK(client.publish_async("stats_expiring", "long", 60).wait().ok);
+    QueueStats stats = stats_of(client, "stats_expiring");
+    CHECK_EQ(stats.depth, 2u);
+    CHECK_EQ(stats.retained_bytes, 9u);
+
+    //gone from QS as soon as it expires, before the cleanup sweep removes it
+    CHECK(eventually([&] { return stats_of(client, "stats_expiring").depth == 1; }, 3s));
+    stats = stats_of(client, "stats_expiring");
+    CHECK_EQ(stats.retained_bytes, 4u);
+    CHECK_EQ(stats.published, 2u);
+    client.disconnect();
+}
+
+TEST(all_queues_or_error_for_unknown_queue) {
+    EmbeddedBroker broker;
+    MessageQueueClient client("stats-all");
+    broker.attach(client);
+
+    CHECK(client.create_queue_async("stats_a").wait().ok);
+    CHECK(client.create_queue_async("stats_b").wait().ok);
+    std::vector<QueueStats> stats;
+    CHECK(client.queue_stats("", stats));
+    std::vector<std::string> names;
+    for (const QueueStats &queue : stats) names.push_back(queue.name);
+    std::sort(names.begin(), names.end());
+    CHECK(names == (std::vector<std::string>{"stats_a", "stats_b"}));
+
+    CHECK(!client.queue_stats("stats_missing", stats));
+    client.disconnect();
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
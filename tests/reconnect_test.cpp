@@ -0,0 +1,91 @@
+// Behaviour tests of the client reconnect policy against an embedded broker
+// over TCP: subscriptions are restored after a broker restart, publishes
+// issued during the outage are sent once the connection is back, and a
+// session the broker kept is resumed without subscribing again.
+
+#include "check.h"
+
+#include "broker_fixture.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+static ReconnectPolicy fast_reconnect() {
+    ReconnectPolicy policy;
+    policy.enabled = true;
+    policy.initial_backoff = 20ms;
+    policy.max_backoff = 100ms;
+    return policy;
+}
+
+// Waits for the "Reconnected" status and the message content on queue, in any order.
+static bool reconnected_and_received(MessageQueueClient &client, const std::string &queue, const std::string &content) {
+    bool reconnected = false;
+    bool received = false;
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+    Event ev;
+    while (!(reconnected && received) && std::chrono::steady_clock::now() < deadline) {
+        if (!client.poll_event(ev)) continue;
+        if (ev.type() == Event::Type::StatusUpdate && ev.text() == "Reconnected") reconnected = true;
+        if (ev.type() == Event::Type::Message && ev.source() == queue && ev.text() == content) received = true;
+    }
+    return reconnected && received;
+}
+
+TEST(subscriptions_and_buffered_publishes_survive_broker_restart) {
+    std::string port = free_tcp_port();
+    auto first = std::make_unique<EmbeddedBroker>(port);
+
+    MessageQueueClient client("reconnect-test");
+    client.set_reconnect_policy(fast_reconnect());
+    CHECK(client.connect_to_server("127.0.0.1", port));
+    CHECK(client.create_queue_async("orders").wait().ok);
+    CHECK(client.subscribe_async("orders").wait().ok);
+
+    first.reset();
+    CHECK(eventually([&] { return client.is_reconnecting(); }));
+    //buffered until the connection is back, then sent after the subscription is restored
+    CHECK(client.publish("orders", "while away", 60));
+
+    //a restarted broker knows the queue, but not the subscriber
+    EmbeddedBroker second(port, {"orders"});
+    CHECK(reconnected_and_received(client, "orders", "while away"));
+    CHECK(second.subscribers("orders") == std::vector<std::string>{"reconnect-test"});
+    CHECK(client.is_connected());
+    CHECK(!client.is_reconnecting());
+    client.disconnect();
+}
+
+TEST(kept_session_is_resumed_without_subscribing_again) {
+    std::string port = free_tcp_port();
+    EmbeddedBroker broker(port, {"orders"});
+
+    MessageQueueClient client("resume-test");
+    client.set_reconnect_policy(fast_reconnect());
+    CHECK(client.connect_to_server("127.0.0.1", port));
+    CHECK(client.subscribe_async("orders").wait().ok);
+
+    //connection drops, the broker keeps the session for SECONDS_TO_CLEAR_CLIENT
+    {
+        BrokerState &state = broker.state();
+        MeteredLock lock(state.clients_mutex);
+        state.clients.at("resume-test").connection->shutdown();
+    }
+    CHECK(eventually([&] { return client.is_reconnecting(); }));
+    CHECK(eventually([&] { return client.is_connected() && !client.is_reconnecting(); }));
+
+    MessageQueueClient producer("resume-producer");
+    broker.attach(producer);
+    CHECK(producer.publish_async("orders", "after resume", 60).wait().ok);
+    CHECK(reconnected_and_received(client, "orders", "after resume"));
+    CHECK(broker.subscribers("orders") == std::vector<std::string>{"resume-test"});
+    producer.disconnect();
+    client.disconnect();
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}
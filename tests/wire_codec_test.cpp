@@ -0,0 +1,230 @@
+// Unit tests of the wire codec: varints, frame headers and the login hello.
+
+#include "check.h"
+
+#include "wire_codec.h"
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+
+using namespace wire;
+
+// ------------------------------
+// VARINT
+// ------------------------------
+
+TEST(varint_round_trips_at_length_boundaries) {
+    const uint32_t values[] = {0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456, UINT32_MAX};
+    const size_t sizes[] = {1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5};
+    for (size_t i = 0; i < std::size(values); ++i) {
+        char buf[MAX_VARINT_SIZE] = {};
+        size_t written = write_varint(buf, values[i]);
+        CHECK_EQ(written, sizes[i]);
+        CHECK_EQ(varint_size(values[i]), sizes[i]);
+
+        size_t offset = 0;
+        uint32_t decoded = 0;
+        CHECK(read_varint(buf, written, offset, decoded) == decode_status::COMPLETE);
+        CHECK_EQ(offset, written);
+        CHECK_EQ(decoded, values[i]);
+    }
+}
+
+TEST(varint_is_little_endian_base_128) {
+    char buf[MAX_VARINT_SIZE] = {};
+    CHECK_EQ(write_varint(buf, 300), size_t{2});
+    CHECK_EQ(static_cast<uint8_t>(buf[0]), 0xAC);
+    CHECK_EQ(static_cast<uint8_t>(buf[1]), 0x02);
+}
+
+TEST(varint_reads_at_offset_and_from_string) {
+    std::string data = "xy";
+    char buf[MAX_VARINT_SIZE];
+    data.append(buf, write_varint(buf, 1000));
+    data += "z";
+
+    size_t offset = 2;
+    uint32_t value = 0;
+    CHECK(read_varint(data, offset, value) == decode_status::COMPLETE);
+    CHECK_EQ(value, 1000u);
+    CHECK_EQ(offset, data.size() - 1);
+}
+
+TEST(truncated_varint_needs_more_without_moving_offset) {
+    char buf[MAX_VARINT_SIZE];
+    size_t written = write_varint(buf, 1u << 20);
+    for (size_t size = 0; size < written; ++size) {
+        size_t offset = 0;
+        uint32_t value = 7;
+        CHECK(read_varint(buf, size, offset, value) == decode_status::NEED_MORE);
+        CHECK_EQ(offset, size_t{0});
+        CHECK_EQ(value, 7u);
+    }
+}
+
+TEST(overlong_varint_is_malformed) {
+    //six bytes, the first five all with the continuation bit
+    const char data[] = {'\x80', '\x80', '\x80', '\x80', '\x80', '\x01'};
+    size_t offset = 0;
+    uint32_t value = 0;
+    CHECK(read_varint(data, sizeof(data), offset, value) == decode_status::MALFORMED);
+    CHECK_EQ(offset, size_t{0});
+}
+
+TEST(varint_fifth_byte_above_0x0f_is_malformed) {
+    //0x0F in the 5th byte is the largest uint32, 0x10 would be bit 32
+    const char largest[] = {'\xFF', '\xFF', '\xFF', '\xFF', '\x0F'};
+    size_t offset = 0;
+    uint32_t value = 0;
+    CHECK(read_varint(largest, sizeof(largest), offset, value) == decode_status::COMPLETE);
+    CHECK_EQ(value, UINT32_MAX);
+
+    const char overflow[] = {'\xFF', '\xFF', '\xFF', '\xFF', '\x10'};
+    offset = 0;
+    value = 7;
+    CHECK(read_varint(overflow, sizeof(overflow), offset, value) == decode_status::MALFORMED);
+    CHECK_EQ(offset, size_t{0});
+    CHECK_EQ(value, 7u);
+
+    //same as a compact frame length
+    const char frame[] = {'P', 'B', '\x80', '\x80', '\x80', '\x80', '\x10'};
+    frame_header header;
+    CHECK(decode_header(frame, sizeof(frame), true, header) == decode_status::MALFORMED);
+}
+
+TEST(varint_needs_more_until_malformed_byte_arrives) {
+    //four continuation bytes may still end well, the overflowing 5th byte decides
+    const char data[] = {'\x80', '\x80', '\x80', '\x80', '\x20'};
+    for (size_t size = 0; size < sizeof(data); ++size) {
+        size_t offset = 0;
+        uint32_t value = 0;
+        CHECK(read_varint(data, size, offset, value) == decode_status::NEED_MORE);
+    }
+    size_t offset = 0;
+    uint32_t value = 0;
+    CHECK(read_varint(data, sizeof(data), offset, value) == decode_status::MALFORMED);
+}
+
+// ------------------------------
+// FRAME HEADER
+// ------------------------------
+
+TEST(legacy_header_round_trips) {
+    char buf[MAX_HEADER_SIZE];
+    size_t written = encode_header(buf, frame_type::PUBLISH, 0x01020304, false);
+    CHECK_EQ(written, FIXED_HEADER_SIZE);
+    CHECK_EQ(header_size(0x01020304, false), FIXED_HEADER_SIZE);
+    CHECK_EQ(std::string(buf, 2), std::string("PB"));
+    //length in network byte order
+    CHECK_EQ(static_cast<uint8_t>(buf[2]), 0x01);
+    CHECK_EQ(static_cast<uint8_t>(buf[5]), 0x04);
+
+    frame_header header;
+    CHECK(decode_header(buf, written, false, header) == decode_status::COMPLETE);
+    CHECK(header.type() == frame_type::PUBLISH);
+    CHECK_EQ(header.payload_size, 0x01020304u);
+    CHECK_EQ(header.size, FIXED_HEADER_SIZE);
+}
+
+TEST(compact_header_round_trips) {
+    for (uint32_t size : {0u, 127u, 128u, 65536u, UINT32_MAX}) {
+        char buf[MAX_HEADER_SIZE];
+        size_t written = encode_header(buf, frame_type::CHUNK, size, true);
+        CHECK_EQ(written, TYPE_SIZE + varint_size(size));
+        CHECK_EQ(header_size(size, true), written);
+
+        frame_header header;
+        CHECK(decode_header(buf, written, true, header) == decode_status::COMPLETE);
+        CHECK(header.type() == frame_type::CHUNK);
+        CHECK_EQ(header.payload_size, size);
+        CHECK_EQ(header.size, written);
+    }
+}
+
+TEST(header_with_unknown_type_decodes_as_error_type) {
+    char buf[MAX_HEADER_SIZE];
+    size_t written = encode_header(buf, 'Z', 'Z', 5, true);
+    frame_header header;
+    CHECK(decode_header(buf, written, true, header) == decode_status::COMPLETE);
+    CHECK(header.type() == frame_type::ERROR);
+    CHECK(!is_known_type('Z', 'Z'));
+    CHECK(is_known_type('E', 'R'));
+    CHECK(is_known_type('Q', 'D'));
+}
+
+TEST(partial_header_needs_more) {
+    char buf[MAX_HEADER_SIZE];
+    frame_header header;
+
+    size_t legacy = encode_header(buf, frame_type::HEARTBEAT, 10, false);
+    for (size_t size = 0; size < legacy; ++size) {
+        CHECK(decode_header(buf, size, false, header) == decode_status::NEED_MORE);
+    }
+
+    size_t compact = encode_header(buf, frame_type::HEARTBEAT, 1u << 30, true);
+    CHECK_EQ(compact, MAX_HEADER_SIZE);
+    for (size_t size = 0; size < compact; ++size) {
+        CHECK(decode_header(buf, size, true, header) == decode_status::NEED_MORE);
+    }
+}
+
+TEST(compact_header_without_varint_end_is_malformed) {
+    const char data[] = {'P', 'B', '\xFF', '\xFF', '\xFF', '\xFF', '\xFF', '\x01'};
+    frame_header header;
+    //until MAX_VARINT_SIZE length bytes arrived it can still be a short read
+    CHECK(decode_header(data, TYPE_SIZE + MAX_VARINT_SIZE - 1, true, header) == decode_status::NEED_MORE);
+    CHECK(decode_header(data, TYPE_SIZE + MAX_VARINT_SIZE, true, header) == decode_status::MALFORMED);
+    CHECK(decode_header(data, sizeof(data), true, header) == decode_status::MALFORMED);
+    //the same bytes are a valid legacy header
+    CHECK(decode_header(data, sizeof(data), false, header) == decode_status::COMPLETE);
+}
+
+TEST(frames_decode_back_to_back) {
+    std::string stream;
+    char buf[MAX_HEADER_SIZE];
+    stream.append(buf, encode_header(buf, frame_type::QUEUE_LIST, 3, true));
+    stream += "abc";
+    stream.append(buf, encode_header(buf, frame_type::HEARTBEAT, 0, true));
+
+    frame_header header;
+    CHECK(decode_header(stream.data(), stream.size(), true, header) == decode_status::COMPLETE);
+    CHECK(header.type() == frame_type::QUEUE_LIST);
+    size_t next = header.size + header.payload_size;
+    CHECK_EQ(stream.substr(header.size, header.payload_size), std::string("abc"));
+    CHECK(decode_header(stream.data() + next, stream.size() - next, true, header) == decode_status::COMPLETE);
+    CHECK(header.type() == frame_type::HEARTBEAT);
+    CHECK_EQ(header.payload_size, 0u);
+}
+
+// ------------------------------
+// LOGIN NEGOTIATION
+// ------------------------------
+
+TEST(hello_round_trips) {
+    hello sent;
+    sent.version = PROTOCOL_VERSION;
+    sent.capabilities = CAP_COMPACT_FRAMING | CAP_CHUNKING | CAP_QUEUE_LIST_DELTA;
+    sent.max_frame = 1u << 24;
+
+    char buf[HELLO_SIZE];
+    CHECK_EQ(encode_hello(buf, sent), HELLO_SIZE);
+
+    hello received;
+    CHECK(decode_hello(buf, HELLO_SIZE, received));
+    CHECK_EQ(received.version, sent.version);
+    CHECK_EQ(received.capabilities, sent.capabilities);
+    CHECK_EQ(received.max_frame, sent.max_frame);
+    CHECK(!decode_hello(buf, HELLO_SIZE - 1, received));
+}
+
+TEST(frame_limit_zero_is_unlimited) {
+    CHECK_EQ(min_frame_limit(0, 0), 0u);
+    CHECK_EQ(min_frame_limit(0, 100), 100u);
+    CHECK_EQ(min_frame_limit(100, 0), 100u);
+    CHECK_EQ(min_frame_limit(50, 100), 50u);
+}
+
+int main(int argc, char **argv) {
+    return check::run_tests(argc, argv);
+}